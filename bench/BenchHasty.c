@@ -0,0 +1,13 @@
+// Compile a second copy of the benchmark scenes that step using cpHastySpace.
+// The symbols are renamed so both sets can be linked into the same executable.
+
+extern unsigned long ChipmunkBenchThreads;
+
+#define ENABLE_HASTY 1
+#define BENCH_HASTY_THREADS ChipmunkBenchThreads
+
+#define bench_list bench_list_hasty
+#define bench_count bench_count_hasty
+#define BouncyHexagons BouncyHexagons_hasty
+
+#include "Bench.c"
@@ -0,0 +1,532 @@
+/*
+	Headless benchmark runner.
+
+	Runs the scenes from demo/Bench.c without the demo application (no sokol, OpenGL or windowing)
+	and writes the results as JSON to stdout so they can be tracked by automated builds.
+	Chipmunk is compiled with CP_ENABLE_STEP_STATS so the time inside each step is broken down by phase.
+
+	Usage: chipmunk_bench [-steps N] [-hasty] [-threads N] [-spin N] [-affinity] [-islands] [-simd none|neon|sse2|avx2] [-unpacked] [-rotations N] [-qbvh static|dynamic|both] [-hgrid static|dynamic|both] [-spacehash dim count] [-reuse threshold] [-filter substring]
+	Usage: chipmunk_bench -hashset
+	Usage: chipmunk_bench -queries
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+#else
+	#include <time.h>
+#endif
+
+#include "chipmunk/chipmunk_private.h"
+#include "chipmunk/cpHastySpace.h"
+#include "ChipmunkDemo.h"
+
+//MARK: Allocation Counting
+
+ChipmunkBenchAllocCounts ChipmunkBenchAllocs;
+
+void *
+ChipmunkBenchCalloc(size_t count, size_t size)
+{
+	ChipmunkBenchAllocs.calloc++;
+	ChipmunkBenchAllocs.bytes += count*size;
+	return calloc(count, size);
+}
+
+void *
+ChipmunkBenchRealloc(void *ptr, size_t size)
+{
+	ChipmunkBenchAllocs.realloc++;
+	ChipmunkBenchAllocs.bytes += size;
+	return realloc(ptr, size);
+}
+
+void
+ChipmunkBenchFree(void *ptr)
+{
+	if(ptr) ChipmunkBenchAllocs.free++;
+	free(ptr);
+}
+
+static ChipmunkBenchAllocCounts
+AllocCountsSince(ChipmunkBenchAllocCounts start)
+{
+	ChipmunkBenchAllocCounts counts = {
+		ChipmunkBenchAllocs.calloc - start.calloc,
+		ChipmunkBenchAllocs.realloc - start.realloc,
+		ChipmunkBenchAllocs.free - start.free,
+		ChipmunkBenchAllocs.bytes - start.bytes,
+	};
+
+	return counts;
+}
+
+//MARK: Demo Support Functions
+
+// The benchmark scenes reference a few functions from ChipmunkDemo.c that can't be linked without the graphics code.
+
+void ChipmunkDemoDefaultDrawImpl(cpSpace *space){}
+
+static void ShapeFreeWrap(cpSpace *space, cpShape *shape, void *unused){
+	cpSpaceRemoveShape(space, shape);
+	cpShapeFree(shape);
+}
+
+static void PostShapeFree(cpShape *shape, cpSpace *space){
+	cpSpaceAddPostStepCallback(space, (cpPostStepFunc)ShapeFreeWrap, shape, NULL);
+}
+
+static void ConstraintFreeWrap(cpSpace *space, cpConstraint *constraint, void *unused){
+	cpSpaceRemoveConstraint(space, constraint);
+	cpConstraintFree(constraint);
+}
+
+static void PostConstraintFree(cpConstraint *constraint, cpSpace *space){
+	cpSpaceAddPostStepCallback(space, (cpPostStepFunc)ConstraintFreeWrap, constraint, NULL);
+}
+
+static void BodyFreeWrap(cpSpace *space, cpBody *body, void *unused){
+	cpSpaceRemoveBody(space, body);
+	cpBodyFree(body);
+}
+
+static void PostBodyFree(cpBody *body, cpSpace *space){
+	cpSpaceAddPostStepCallback(space, (cpPostStepFunc)BodyFreeWrap, body, NULL);
+}
+
+void
+ChipmunkDemoFreeSpaceChildren(cpSpace *space)
+{
+	// Must remove these BEFORE freeing the body or you will access dangling pointers.
+	cpSpaceEachShape(space, (cpSpaceShapeIteratorFunc)PostShapeFree, space);
+	cpSpaceEachConstraint(space, (cpSpaceConstraintIteratorFunc)PostConstraintFree, space);
+
+	cpSpaceEachBody(space, (cpSpaceBodyIteratorFunc)PostBodyFree, space);
+}
+
+//MARK: Timing
+
+static uint64_t
+TimeNanoseconds(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	if(!freq.QuadPart) QueryPerformanceFrequency(&freq);
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return (uint64_t)((double)now.QuadPart*1e9/(double)freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+uint64_t ChipmunkBenchTimeNanoseconds(void){return TimeNanoseconds();}
+
+//MARK: Benchmark Runner
+
+extern ChipmunkDemo bench_list[];
+extern int bench_count;
+
+extern ChipmunkDemo bench_list_hasty[];
+extern int bench_count_hasty;
+
+// cpHashSet microbenchmark. (HashSetBench.c)
+void ChipmunkBenchHashSet(void);
+
+// Spatial index query microbenchmark. (QueryBench.c)
+void ChipmunkBenchQueries(void);
+
+unsigned long ChipmunkBenchThreads = 1;
+
+// cpHastySpace scheduler options. A negative spin budget keeps the default.
+static long ChipmunkBenchSpinBudget = -1;
+static cpBool ChipmunkBenchAffinity = cpFalse;
+static cpBool ChipmunkBenchIslands = cpFalse;
+
+// Contact solver instruction set. A negative value keeps the default.
+static int ChipmunkBenchSIMD = -1;
+static const char *ChipmunkBenchSIMDNames[] = {"none", "neon", "sse2", "avx2"};
+
+// Run cpSpaceStep() without the packed solver bodies.
+static cpBool ChipmunkBenchUnpacked = cpFalse;
+
+// cpBBTreeSetRotationBudget() for the dynamic shapes' tree.
+static int ChipmunkBenchRotations = 0;
+
+// Use cpSpaceUseQBVH() for the static and/or dynamic shapes.
+static cpBool ChipmunkBenchStaticQBVH = cpFalse;
+static cpBool ChipmunkBenchDynamicQBVH = cpFalse;
+
+// Use cpSpaceUseHGrid() for the static and/or dynamic shapes.
+static cpBool ChipmunkBenchStaticHGrid = cpFalse;
+static cpBool ChipmunkBenchDynamicHGrid = cpFalse;
+
+// Use cpSpaceUseSpatialHash() with these starting parameters and auto tune the dynamic shapes' hash.
+static cpFloat ChipmunkBenchHashDim = 0.0f;
+static int ChipmunkBenchHashCount = 0;
+
+// cpSpaceSetContactReuseThreshold() for every scene.
+static cpFloat ChipmunkBenchReuseThreshold = 0.0f;
+
+static void CountObject(void *obj, int *count){(*count)++;}
+
+// Parse the static|dynamic|both argument of -qbvh and -hgrid. Returns false if it isn't one of them.
+static cpBool
+ParseIndexTargets(const char *which, cpBool *useStatic, cpBool *useDynamic)
+{
+	cpBool both = (strcmp(which, "both") == 0);
+	*useStatic = (both || strcmp(which, "static") == 0);
+	*useDynamic = (both || strcmp(which, "dynamic") == 0);
+	return (*useStatic || *useDynamic);
+}
+
+static const char *
+IndexClassName(cpSpatialIndex *index)
+{
+	if(cpSpatialIndexIsBBTree(index)) return "cpBBTree";
+	if(cpSpatialIndexIsQBVH(index)) return "cpQBVH";
+	if(cpSpatialIndexIsHGrid(index)) return "cpHGrid";
+	if(cpSpatialIndexIsUniformGrid(index)) return "cpUniformGrid";
+	if(cpSpatialIndexIsSpaceHash(index)) return "cpSpaceHash";
+	if(cpSpatialIndexIsSweep1D(index)) return "cpSweep1D";
+	return "unknown";
+}
+
+static void
+HashBytes(uint64_t *hash, const void *bytes, size_t count)
+{
+	// FNV-1a
+	for(size_t i=0; i<count; i++){
+		*hash = (*hash ^ ((const unsigned char *)bytes)[i])*1099511628211ull;
+	}
+}
+
+static void
+HashBodyState(cpBody *body, uint64_t *hash)
+{
+	cpVect p = cpBodyGetPosition(body), v = cpBodyGetVelocity(body);
+	cpFloat a = cpBodyGetAngle(body), w = cpBodyGetAngularVelocity(body);
+	
+	HashBytes(hash, &p, sizeof(p));
+	HashBytes(hash, &v, sizeof(v));
+	HashBytes(hash, &a, sizeof(a));
+	HashBytes(hash, &w, sizeof(w));
+}
+
+static const char *PhaseNames[CP_SPACE_STEP_PHASE_COUNT] = {
+	"integrate_positions",
+	"update_bbs",
+	"collide",
+	"components",
+	"arbiter_filter",
+	"prestep",
+	"solve",
+	"post_solve",
+};
+
+static const char *ShapeTypeNames[CP_SPACE_STEP_STATS_SHAPE_TYPES] = {"circle", "segment", "poly"};
+
+// Step statistics summed over every step of a benchmark run.
+typedef struct StepStatsTotals {
+	uint64_t phaseNanoseconds[CP_SPACE_STEP_PHASE_COUNT];
+	unsigned long long pairsTested;
+	unsigned long long pairsReused;
+	unsigned long long narrowphaseCalls[CP_SPACE_STEP_STATS_SHAPE_TYPES][CP_SPACE_STEP_STATS_SHAPE_TYPES];
+	unsigned long long gjkIterations[CP_SPACE_STEP_STATS_ITERATION_BINS];
+	unsigned long long epaIterations[CP_SPACE_STEP_STATS_ITERATION_BINS];
+	unsigned long long arbitersCreated;
+	unsigned long long arbitersPooled;
+	unsigned long long contactBuffersAllocated;
+	unsigned int sleepingComponents;
+} StepStatsTotals;
+
+static void
+AccumulateStepStats(StepStatsTotals *totals, cpSpaceStepStats stats)
+{
+	for(int i=0; i<CP_SPACE_STEP_PHASE_COUNT; i++) totals->phaseNanoseconds[i] += stats.phaseNanoseconds[i];
+	
+	totals->pairsTested += stats.pairsTested;
+	totals->pairsReused += stats.pairsReused;
+	for(int i=0; i<CP_SPACE_STEP_STATS_SHAPE_TYPES; i++){
+		for(int j=0; j<CP_SPACE_STEP_STATS_SHAPE_TYPES; j++) totals->narrowphaseCalls[i][j] += stats.narrowphaseCalls[i][j];
+	}
+	
+	for(int i=0; i<CP_SPACE_STEP_STATS_ITERATION_BINS; i++){
+		totals->gjkIterations[i] += stats.gjkIterations[i];
+		totals->epaIterations[i] += stats.epaIterations[i];
+	}
+	
+	totals->arbitersCreated += stats.arbitersCreated;
+	totals->arbitersPooled += stats.arbitersPooled;
+	totals->contactBuffersAllocated += stats.contactBuffersAllocated;
+	totals->sleepingComponents = stats.sleepingComponents;
+}
+
+static void
+PrintIterationHistogram(const char *name, unsigned long long *bins)
+{
+	printf("\t\t\t\t\"%s\": [", name);
+	for(int i=0; i<CP_SPACE_STEP_STATS_ITERATION_BINS; i++){
+		printf("%llu%s", bins[i], (i + 1 < CP_SPACE_STEP_STATS_ITERATION_BINS ? ", " : ""));
+	}
+	printf("],\n");
+}
+
+static void
+PrintStepStats(StepStatsTotals *totals)
+{
+	printf("\t\t\t\"step_phases_ms\": {");
+	for(int i=0; i<CP_SPACE_STEP_PHASE_COUNT; i++){
+		printf("\"%s\": %.3f%s", PhaseNames[i], totals->phaseNanoseconds[i]*1e-6, (i + 1 < CP_SPACE_STEP_PHASE_COUNT ? ", " : ""));
+	}
+	printf("},\n");
+	
+	printf("\t\t\t\"counters\": {\n");
+	printf("\t\t\t\t\"pairs_tested\": %llu,\n", totals->pairsTested);
+	printf("\t\t\t\t\"pairs_reused\": %llu,\n", totals->pairsReused);
+	printf("\t\t\t\t\"narrowphase_calls\": {");
+	const char *separator = "";
+	for(int i=0; i<CP_SPACE_STEP_STATS_SHAPE_TYPES; i++){
+		for(int j=i; j<CP_SPACE_STEP_STATS_SHAPE_TYPES; j++){
+			printf("%s\"%s_%s\": %llu", separator, ShapeTypeNames[i], ShapeTypeNames[j], totals->narrowphaseCalls[i][j]);
+			separator = ", ";
+		}
+	}
+	printf("},\n");
+	PrintIterationHistogram("gjk_iterations", totals->gjkIterations);
+	PrintIterationHistogram("epa_iterations", totals->epaIterations);
+	printf("\t\t\t\t\"arbiters_created\": %llu,\n", totals->arbitersCreated);
+	printf("\t\t\t\t\"arbiters_pooled\": %llu,\n", totals->arbitersPooled);
+	printf("\t\t\t\t\"contact_buffers_allocated\": %llu,\n", totals->contactBuffersAllocated);
+	printf("\t\t\t\t\"sleeping_components\": %u\n", totals->sleepingComponents);
+	printf("\t\t\t},\n");
+}
+
+static void
+PrintAllocCounts(const char *name, ChipmunkBenchAllocCounts counts, const char *separator)
+{
+	printf("\t\t\t\t\"%s\": {\"calloc\": %lu, \"realloc\": %lu, \"free\": %lu, \"bytes\": %llu}%s\n",
+		name, counts.calloc, counts.realloc, counts.free, counts.bytes, separator
+	);
+}
+
+static void
+RunBench(ChipmunkDemo *bench, const char *solver, cpBool hasty, int steps, const char *separator)
+{
+	// Use the same random scene layout every run.
+	srand(5);
+
+	ChipmunkBenchAllocCounts allocs_start = ChipmunkBenchAllocs;
+	uint64_t init_start = TimeNanoseconds();
+	cpSpace *space = bench->initFunc();
+	uint64_t init_time = TimeNanoseconds() - init_start;
+	ChipmunkBenchAllocCounts init_allocs = AllocCountsSince(allocs_start);
+
+	if(ChipmunkBenchUnpacked) cpSpaceSetPackedSolver(space, cpFalse);
+	if(ChipmunkBenchStaticQBVH || ChipmunkBenchDynamicQBVH) cpSpaceUseQBVH(space, ChipmunkBenchStaticQBVH, ChipmunkBenchDynamicQBVH);
+	if(ChipmunkBenchStaticHGrid || ChipmunkBenchDynamicHGrid) cpSpaceUseHGrid(space, ChipmunkBenchStaticHGrid, ChipmunkBenchDynamicHGrid);
+	if(ChipmunkBenchHashCount > 0){
+		cpSpaceUseSpatialHash(space, ChipmunkBenchHashDim, ChipmunkBenchHashCount);
+		cpSpaceHashSetAutoTune((cpSpaceHash *)space->dynamicShapes, cpTrue);
+	}
+	
+	if(ChipmunkBenchReuseThreshold > 0.0f) cpSpaceSetContactReuseThreshold(space, ChipmunkBenchReuseThreshold);
+	
+	// Some scenes install their own index, so check the one in use instead of the options.
+	cpBool tree = cpSpatialIndexIsBBTree(space->dynamicShapes);
+	if(tree) cpBBTreeSetRotationBudget(space->dynamicShapes, ChipmunkBenchRotations);
+	
+	if(hasty){
+		if(ChipmunkBenchSpinBudget >= 0) cpHastySpaceSetSpinBudget(space, (unsigned long)ChipmunkBenchSpinBudget);
+		if(ChipmunkBenchAffinity) cpHastySpaceSetThreadAffinity(space, cpTrue);
+		if(ChipmunkBenchIslands) cpHastySpaceSetSolverMode(space, CP_HASTY_SOLVER_ISLANDS);
+		if(ChipmunkBenchSIMD >= 0) cpHastySpaceSetSIMD(space, (cpHastySpaceSIMD)ChipmunkBenchSIMD);
+	}
+	
+	// Scenes can install their own indexes, so report the ones actually in use.
+	const char *static_index = IndexClassName(space->staticShapes);
+	const char *dynamic_index = IndexClassName(space->dynamicShapes);
+	
+	int body_count = 0, shape_count = 0;
+	cpSpaceEachBody(space, (cpSpaceBodyIteratorFunc)CountObject, &body_count);
+	cpSpaceEachShape(space, (cpSpaceShapeIteratorFunc)CountObject, &shape_count);
+
+	cpFloat tree_cost_start = (tree ? cpBBTreeGetCost(space->dynamicShapes) : 0.0f);
+	
+	double dt = bench->timestep;
+	uint64_t step_max = 0;
+	StepStatsTotals totals = {{0}};
+
+	allocs_start = ChipmunkBenchAllocs;
+	uint64_t step_start = TimeNanoseconds();
+	for(int i=0; i<steps; i++){
+		uint64_t start = TimeNanoseconds();
+		bench->updateFunc(space, dt);
+		uint64_t elapsed = TimeNanoseconds() - start;
+
+		if(elapsed > step_max) step_max = elapsed;
+		AccumulateStepStats(&totals, cpSpaceGetStepStats(space));
+	}
+	uint64_t step_time = TimeNanoseconds() - step_start;
+	ChipmunkBenchAllocCounts step_allocs = AllocCountsSince(allocs_start);
+
+	cpFloat tree_cost_end = (tree ? cpBBTreeGetCost(space->dynamicShapes) : 0.0f);
+	cpSpaceHashStats hash_stats = {0};
+	if(ChipmunkBenchHashCount > 0) hash_stats = cpSpaceHashGetStats((cpSpaceHash *)space->dynamicShapes);
+	
+	// Hash of the final body state to check that runs are deterministic. (ex: with different thread counts)
+	uint64_t state_hash = 14695981039346656037ull;
+	cpSpaceEachBody(space, (cpSpaceBodyIteratorFunc)HashBodyState, &state_hash);
+	
+	cpHastySpaceSIMD simd = (hasty ? cpHastySpaceGetSIMD(space) : CP_HASTY_SIMD_NONE);
+	
+	allocs_start = ChipmunkBenchAllocs;
+	uint64_t destroy_start = TimeNanoseconds();
+	bench->destroyFunc(space);
+	uint64_t destroy_time = TimeNanoseconds() - destroy_start;
+	ChipmunkBenchAllocCounts destroy_allocs = AllocCountsSince(allocs_start);
+
+	printf("\t\t{\n");
+	printf("\t\t\t\"name\": \"%s\",\n", bench->name);
+	printf("\t\t\t\"solver\": \"%s\",\n", solver);
+	if(hasty) printf("\t\t\t\"simd\": \"%s\",\n", ChipmunkBenchSIMDNames[simd]);
+	printf("\t\t\t\"static_index\": \"%s\",\n", static_index);
+	printf("\t\t\t\"dynamic_index\": \"%s\",\n", dynamic_index);
+	printf("\t\t\t\"steps\": %d,\n", steps);
+	printf("\t\t\t\"bodies\": %d,\n", body_count);
+	printf("\t\t\t\"shapes\": %d,\n", shape_count);
+	printf("\t\t\t\"steps_per_sec\": %.2f,\n", steps/(step_time*1e-9));
+	printf("\t\t\t\"step_mean_us\": %.3f,\n", step_time*1e-3/steps);
+	printf("\t\t\t\"step_max_us\": %.3f,\n", step_max*1e-3);
+	printf("\t\t\t\"state_hash\": \"%016llx\",\n", (unsigned long long)state_hash);
+	printf("\t\t\t\"phases_ms\": {\"init\": %.3f, \"step\": %.3f, \"destroy\": %.3f},\n", init_time*1e-6, step_time*1e-6, destroy_time*1e-6);
+	if(tree) printf("\t\t\t\"tree_cost\": {\"start\": %.3f, \"end\": %.3f},\n", tree_cost_start, tree_cost_end);
+	if(ChipmunkBenchHashCount > 0){
+		printf("\t\t\t\"space_hash\": {\"celldim\": %.3f, \"numcells\": %d, \"objects\": %d, \"entries\": %d, \"average_extent\": %.3f, \"average_chain\": %.3f, \"retunes\": %d},\n",
+			hash_stats.celldim, hash_stats.numcells, hash_stats.objects, hash_stats.entries, hash_stats.averageExtent, hash_stats.averageChain, hash_stats.retunes
+		);
+	}
+	PrintStepStats(&totals);
+	printf("\t\t\t\"allocations\": {\n");
+	PrintAllocCounts("init", init_allocs, ",");
+	PrintAllocCounts("step", step_allocs, ",");
+	PrintAllocCounts("destroy", destroy_allocs, "");
+	printf("\t\t\t}\n");
+	printf("\t\t}%s\n", separator);
+	fflush(stdout);
+}
+
+// Print the command line options. Returns the exit status for bad arguments.
+static int
+PrintUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-steps N] [-hasty] [-threads N] [-spin N] [-affinity] [-islands] [-simd none|neon|sse2|avx2] [-unpacked] [-rotations N] [-qbvh static|dynamic|both] [-hgrid static|dynamic|both] [-spacehash dim count] [-reuse threshold] [-filter substring]\n", name);
+	fprintf(stderr, "       %s -hashset\n", name);
+	fprintf(stderr, "       %s -queries\n", name);
+	return 1;
+}
+
+int
+main(int argc, const char **argv)
+{
+	int steps = 1000;
+	cpBool hasty = cpFalse;
+	const char *filter = NULL;
+
+	if(argc == 2 && strcmp(argv[1], "-hashset") == 0){
+		ChipmunkBenchHashSet();
+		return 0;
+	}
+	
+	if(argc == 2 && strcmp(argv[1], "-queries") == 0){
+		ChipmunkBenchQueries();
+		return 0;
+	}
+	
+	for(int i=1; i<argc; i++){
+		if(strcmp(argv[i], "-steps") == 0 && i + 1 < argc){
+			steps = atoi(argv[++i]);
+		} else if(strcmp(argv[i], "-hasty") == 0){
+			hasty = cpTrue;
+		} else if(strcmp(argv[i], "-threads") == 0 && i + 1 < argc){
+			ChipmunkBenchThreads = strtoul(argv[++i], NULL, 10);
+		} else if(strcmp(argv[i], "-spin") == 0 && i + 1 < argc){
+			ChipmunkBenchSpinBudget = strtol(argv[++i], NULL, 10);
+		} else if(strcmp(argv[i], "-affinity") == 0){
+			ChipmunkBenchAffinity = cpTrue;
+		} else if(strcmp(argv[i], "-islands") == 0){
+			ChipmunkBenchIslands = cpTrue;
+		} else if(strcmp(argv[i], "-simd") == 0 && i + 1 < argc){
+			const char *name = argv[++i];
+			int simd = -1;
+			for(int j=0; j<4; j++){
+				if(strcmp(name, ChipmunkBenchSIMDNames[j]) == 0) simd = j;
+			}
+			
+			if(simd < 0) return PrintUsage(argv[0]);
+			ChipmunkBenchSIMD = simd;
+		} else if(strcmp(argv[i], "-unpacked") == 0){
+			ChipmunkBenchUnpacked = cpTrue;
+		} else if(strcmp(argv[i], "-rotations") == 0 && i + 1 < argc){
+			ChipmunkBenchRotations = atoi(argv[++i]);
+		} else if(strcmp(argv[i], "-qbvh") == 0 && i + 1 < argc){
+			if(!ParseIndexTargets(argv[++i], &ChipmunkBenchStaticQBVH, &ChipmunkBenchDynamicQBVH)) return PrintUsage(argv[0]);
+		} else if(strcmp(argv[i], "-hgrid") == 0 && i + 1 < argc){
+			if(!ParseIndexTargets(argv[++i], &ChipmunkBenchStaticHGrid, &ChipmunkBenchDynamicHGrid)) return PrintUsage(argv[0]);
+		} else if(strcmp(argv[i], "-spacehash") == 0 && i + 2 < argc){
+			ChipmunkBenchHashDim = atof(argv[++i]);
+			ChipmunkBenchHashCount = atoi(argv[++i]);
+		} else if(strcmp(argv[i], "-reuse") == 0 && i + 1 < argc){
+			ChipmunkBenchReuseThreshold = atof(argv[++i]);
+		} else if(strcmp(argv[i], "-filter") == 0 && i + 1 < argc){
+			filter = argv[++i];
+		} else {
+			return PrintUsage(argv[0]);
+		}
+	}
+
+	if(steps <= 0){
+		fprintf(stderr, "Step count must be positive.\n");
+		return 1;
+	}
+
+	ChipmunkDemo *list = (hasty ? bench_list_hasty : bench_list);
+	int count = (hasty ? bench_count_hasty : bench_count);
+	const char *solver = (hasty ? "cpHastySpaceStep" : "cpSpaceStep");
+
+	// Collect the benchmarks to run first so the JSON separators can be written correctly.
+	ChipmunkDemo **selected = (ChipmunkDemo **)calloc(count, sizeof(ChipmunkDemo *));
+	int selected_count = 0;
+	for(int i=0; i<count; i++){
+		if(!filter || strstr(list[i].name, filter)) selected[selected_count++] = list + i;
+	}
+
+	printf("{\n");
+	printf("\t\"version\": \"%s\",\n", cpVersionString);
+	printf("\t\"float_bits\": %d,\n", (int)(8*sizeof(cpFloat)));
+	printf("\t\"threads\": %lu,\n", (hasty ? ChipmunkBenchThreads : 1ul));
+	if(!hasty) printf("\t\"packed_solver\": %s,\n", (ChipmunkBenchUnpacked ? "false" : "true"));
+	if(hasty){
+		if(ChipmunkBenchSpinBudget >= 0) printf("\t\"spin_budget\": %ld,\n", ChipmunkBenchSpinBudget);
+		printf("\t\"affinity\": %s,\n", (ChipmunkBenchAffinity ? "true" : "false"));
+		printf("\t\"solver_mode\": \"%s\",\n", (ChipmunkBenchIslands ? "islands" : "colored"));
+	}
+	printf("\t\"benchmarks\": [\n");
+	for(int i=0; i<selected_count; i++){
+		RunBench(selected[i], solver, hasty, steps, (i + 1 < selected_count ? "," : ""));
+	}
+	printf("\t]\n");
+	printf("}\n");
+
+	free(selected);
+	return 0;
+}
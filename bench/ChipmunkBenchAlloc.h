@@ -0,0 +1,24 @@
+// Force included into every translation unit of chipmunk_bench (including the Chipmunk sources)
+// so that all of Chipmunk's allocations are routed through counting wrappers.
+
+#ifndef CHIPMUNK_BENCH_ALLOC_H
+#define CHIPMUNK_BENCH_ALLOC_H
+
+#include <stddef.h>
+
+#define cpcalloc ChipmunkBenchCalloc
+#define cprealloc ChipmunkBenchRealloc
+#define cpfree ChipmunkBenchFree
+
+typedef struct ChipmunkBenchAllocCounts {
+	unsigned long calloc, realloc, free;
+	unsigned long long bytes;
+} ChipmunkBenchAllocCounts;
+
+extern ChipmunkBenchAllocCounts ChipmunkBenchAllocs;
+
+void *ChipmunkBenchCalloc(size_t count, size_t size);
+void *ChipmunkBenchRealloc(void *ptr, size_t size);
+void ChipmunkBenchFree(void *ptr);
+
+#endif
@@ -0,0 +1,141 @@
+// cpHashSet microbenchmark. (chipmunk_bench -hashset)
+// Times the operations cpSpace does on cachedArbiters every step, with the same pair keys and hash.
+
+#include <stdio.h>
+
+#include "chipmunk/chipmunk_private.h"
+
+// Returns a monotonic time in nanoseconds. (Defined in ChipmunkBench.c)
+uint64_t ChipmunkBenchTimeNanoseconds(void);
+
+typedef struct HashSetBenchPair {
+	void *a, *b;
+	cpBool keep;
+} HashSetBenchPair;
+
+static cpBool
+HashSetBenchEql(void **key, HashSetBenchPair *pair)
+{
+	return ((key[0] == pair->a && key[1] == pair->b) || (key[1] == pair->a && key[0] == pair->b));
+}
+
+static void *
+HashSetBenchTrans(void **key, HashSetBenchPair *pair)
+{
+	return pair;
+}
+
+static cpBool HashSetBenchFilter(HashSetBenchPair *pair, int *visited){(*visited)++; return pair->keep;}
+static void HashSetBenchEach(HashSetBenchPair *pair, int *visited){(*visited)++;}
+
+static inline cpHashValue
+HashSetBenchHash(HashSetBenchPair *pair)
+{
+	return CP_HASH_PAIR((cpHashValue)pair->a, (cpHashValue)pair->b);
+}
+
+static double
+NanosecondsPerOp(uint64_t start, int count)
+{
+	return (double)(ChipmunkBenchTimeNanoseconds() - start)/(double)count;
+}
+
+static void
+HashSetBenchRun(int count, const char *separator)
+{
+	// Shapes are only used as keys, so any unique addresses will do. Give each shape a few neighbors like a pile of objects.
+	const int neighbors = 4;
+	int shape_count = count/neighbors + 1;
+	char *shapes = (char *)cpcalloc(shape_count, 64);
+	
+	HashSetBenchPair *pairs = (HashSetBenchPair *)cpcalloc(count, sizeof(HashSetBenchPair));
+	HashSetBenchPair *misses = (HashSetBenchPair *)cpcalloc(count, sizeof(HashSetBenchPair));
+	for(int i=0; i<count; i++){
+		int a = i/neighbors, b = (a + 1 + i%neighbors)%shape_count;
+		pairs[i].a = shapes + 64*a;
+		pairs[i].b = shapes + 64*b;
+		// Every 10th pair separates and is filtered out.
+		pairs[i].keep = (i%10 != 0);
+		
+		misses[i].a = shapes + 64*a;
+		misses[i].b = shapes + 64*((a + 1 + neighbors + i%neighbors)%shape_count);
+	}
+	
+	cpHashSet *set = cpHashSetNew(0, (cpHashSetEqlFunc)HashSetBenchEql);
+	
+	uint64_t start = ChipmunkBenchTimeNanoseconds();
+	for(int i=0; i<count; i++){
+		void *key[] = {pairs[i].a, pairs[i].b};
+		cpHashSetInsert(set, HashSetBenchHash(pairs + i), key, (cpHashSetTransFunc)HashSetBenchTrans, pairs + i);
+	}
+	double insert = NanosecondsPerOp(start, count);
+	
+	// cpSpaceCollideShapes() calls cpHashSetInsert() for every colliding pair, which almost always finds the existing arbiter.
+	start = ChipmunkBenchTimeNanoseconds();
+	for(int i=0; i<count; i++){
+		void *key[] = {pairs[i].a, pairs[i].b};
+		cpHashSetInsert(set, HashSetBenchHash(pairs + i), key, (cpHashSetTransFunc)HashSetBenchTrans, pairs + i);
+	}
+	double insert_existing = NanosecondsPerOp(start, count);
+	
+	start = ChipmunkBenchTimeNanoseconds();
+	for(int i=0; i<count; i++){
+		void *key[] = {misses[i].a, misses[i].b};
+		cpHashSetFind(set, HashSetBenchHash(misses + i), key);
+	}
+	double find_miss = NanosecondsPerOp(start, count);
+	
+	int visited = 0;
+	start = ChipmunkBenchTimeNanoseconds();
+	cpHashSetEach(set, (cpHashSetIteratorFunc)HashSetBenchEach, &visited);
+	double each = NanosecondsPerOp(start, count);
+	
+	start = ChipmunkBenchTimeNanoseconds();
+	cpHashSetFilter(set, (cpHashSetFilterFunc)HashSetBenchFilter, &visited);
+	double filter = NanosecondsPerOp(start, count);
+	
+	cpAssertHard(visited == 2*count, "Internal Error: cpHashSet iterated over the wrong number of elements.");
+	cpAssertHard(cpHashSetCount(set) == count - (count + 9)/10, "Internal Error: cpHashSet filtered the wrong number of elements.");
+	
+	int remaining = cpHashSetCount(set);
+	start = ChipmunkBenchTimeNanoseconds();
+	for(int i=0; i<count; i++){
+		void *key[] = {pairs[i].a, pairs[i].b};
+		cpHashSetRemove(set, HashSetBenchHash(pairs + i), key);
+	}
+	double remove = NanosecondsPerOp(start, count);
+	
+	cpAssertHard(cpHashSetCount(set) == 0, "Internal Error: cpHashSet didn't remove every element.");
+	cpHashSetFree(set);
+	
+	printf("\t\t{\n");
+	printf("\t\t\t\"elements\": %d,\n", count);
+	printf("\t\t\t\"filtered\": %d,\n", count - remaining);
+	printf("\t\t\t\"ns_per_op\": {\n");
+	printf("\t\t\t\t\"insert\": %.1f,\n", insert);
+	printf("\t\t\t\t\"insert_existing\": %.1f,\n", insert_existing);
+	printf("\t\t\t\t\"find_miss\": %.1f,\n", find_miss);
+	printf("\t\t\t\t\"each\": %.1f,\n", each);
+	printf("\t\t\t\t\"filter\": %.1f,\n", filter);
+	printf("\t\t\t\t\"remove\": %.1f\n", remove);
+	printf("\t\t\t}\n");
+	printf("\t\t}%s\n", separator);
+	
+	cpfree(misses);
+	cpfree(pairs);
+	cpfree(shapes);
+}
+
+void
+ChipmunkBenchHashSet(void)
+{
+	static const int counts[] = {10000, 30000, 100000};
+	int count = sizeof(counts)/sizeof(*counts);
+	
+	printf("{\n");
+	printf("\t\"version\": \"%s\",\n", cpVersionString);
+	printf("\t\"hashset\": [\n");
+	for(int i=0; i<count; i++) HashSetBenchRun(counts[i], (i + 1 < count ? "," : ""));
+	printf("\t]\n");
+	printf("}\n");
+}
@@ -0,0 +1,114 @@
+// Spatial index query microbenchmark. (chipmunk_bench -queries)
+// Times cpSpaceBBQuery() and cpSpaceSegmentQueryFirst() against a large number of static shapes,
+// with the static shapes indexed by an optimized cpBBTree and by a cpQBVH.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "chipmunk/chipmunk_private.h"
+
+// Returns a monotonic time in nanoseconds. (Defined in ChipmunkBench.c)
+uint64_t ChipmunkBenchTimeNanoseconds(void);
+
+// Size of the world the shapes and queries are scattered over.
+#define WORLD_WIDTH 10000.0f
+#define WORLD_HEIGHT 2000.0f
+
+static cpFloat
+RandomRange(cpFloat min, cpFloat max)
+{
+	return min + (max - min)*((cpFloat)rand()/(cpFloat)RAND_MAX);
+}
+
+static void CountBBQuery(cpShape *shape, int *hits){(*hits)++;}
+
+static void
+ShapeFreeWrap(cpSpace *space, cpShape *shape, void *unused)
+{
+	cpSpaceRemoveShape(space, shape);
+	cpShapeFree(shape);
+}
+
+// The space is locked while iterating, so the shapes are removed by post-step callbacks.
+static void PostShapeFree(cpShape *shape, cpSpace *space){cpSpaceAddPostStepCallback(space, (cpPostStepFunc)ShapeFreeWrap, shape, NULL);}
+
+static cpSpace *
+QueryBenchSpace(int count, cpBool qbvh)
+{
+	// Both spaces get the same shapes.
+	srand(5);
+	
+	cpSpace *space = cpSpaceNew();
+	if(qbvh) cpSpaceUseQBVH(space, cpTrue, cpFalse);
+	
+	cpBody *body = cpSpaceGetStaticBody(space);
+	for(int i=0; i<count; i++){
+		cpFloat x = RandomRange(0.0f, WORLD_WIDTH), y = RandomRange(0.0f, WORLD_HEIGHT);
+		cpFloat w = RandomRange(1.0f, 30.0f), h = RandomRange(1.0f, 30.0f);
+		cpSpaceAddShape(space, cpBoxShapeNew2(body, cpBBNew(x, y, x + w, y + h), 0.0f));
+	}
+	
+	if(!qbvh) cpBBTreeOptimize(space->staticShapes);
+	
+	return space;
+}
+
+static void
+QueryBenchRun(int count, int queries, cpBool qbvh, const char *separator)
+{
+	cpSpace *space = QueryBenchSpace(count, qbvh);
+	
+	// Build the index before timing the queries. (The QBVH is built lazily)
+	int hits = 0;
+	cpSpaceBBQuery(space, cpBBNew(0.0f, 0.0f, 1.0f, 1.0f), CP_SHAPE_FILTER_ALL, (cpSpaceBBQueryFunc)CountBBQuery, &hits);
+	
+	srand(7);
+	hits = 0;
+	uint64_t start = ChipmunkBenchTimeNanoseconds();
+	for(int i=0; i<queries; i++){
+		cpFloat x = RandomRange(0.0f, WORLD_WIDTH), y = RandomRange(0.0f, WORLD_HEIGHT);
+		cpSpaceBBQuery(space, cpBBNew(x, y, x + 20.0f, y + 20.0f), CP_SHAPE_FILTER_ALL, (cpSpaceBBQueryFunc)CountBBQuery, &hits);
+	}
+	double bb_query = (double)(ChipmunkBenchTimeNanoseconds() - start)/queries;
+	
+	// Rays with a random length and direction, like line of sight checks.
+	srand(11);
+	int segment_hits = 0;
+	start = ChipmunkBenchTimeNanoseconds();
+	for(int i=0; i<queries; i++){
+		cpVect a = cpv(RandomRange(0.0f, WORLD_WIDTH), RandomRange(0.0f, WORLD_HEIGHT));
+		cpVect b = cpvadd(a, cpvmult(cpvforangle(RandomRange(0.0f, 2.0f*CP_PI)), RandomRange(10.0f, 500.0f)));
+		if(cpSpaceSegmentQueryFirst(space, a, b, 0.0f, CP_SHAPE_FILTER_ALL, NULL)) segment_hits++;
+	}
+	double segment_query = (double)(ChipmunkBenchTimeNanoseconds() - start)/queries;
+	
+	cpSpaceEachShape(space, (cpSpaceShapeIteratorFunc)PostShapeFree, space);
+	cpSpaceFree(space);
+	
+	printf("\t\t{\n");
+	printf("\t\t\t\"index\": \"%s\",\n", (qbvh ? "cpQBVH" : "cpBBTree"));
+	printf("\t\t\t\"shapes\": %d,\n", count);
+	printf("\t\t\t\"queries\": %d,\n", queries);
+	printf("\t\t\t\"bb_hits\": %d,\n", hits);
+	printf("\t\t\t\"segment_hits\": %d,\n", segment_hits);
+	printf("\t\t\t\"ns_per_query\": {\"bb\": %.1f, \"segment_first\": %.1f}\n", bb_query, segment_query);
+	printf("\t\t}%s\n", separator);
+}
+
+void
+ChipmunkBenchQueries(void)
+{
+	static const int counts[] = {1000, 10000, 100000};
+	int count = sizeof(counts)/sizeof(*counts);
+	
+	printf("{\n");
+	printf("\t\"version\": \"%s\",\n", cpVersionString);
+	printf("\t\"float_bits\": %d,\n", (int)(8*sizeof(cpFloat)));
+	printf("\t\"queries\": [\n");
+	for(int i=0; i<count; i++){
+		QueryBenchRun(counts[i], 100000, cpFalse, ",");
+		QueryBenchRun(counts[i], 100000, cpTrue, (i + 1 < count ? "," : ""));
+	}
+	printf("\t]\n");
+	printf("}\n");
+}
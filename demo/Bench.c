@@ -2,13 +2,20 @@
 #include "chipmunk/chipmunk_unsafe.h"
 #include "ChipmunkDemo.h"
 
-#define ENABLE_HASTY 0
+#ifndef ENABLE_HASTY
+	#define ENABLE_HASTY 0
+#endif
+
 #if ENABLE_HASTY
 	#include "chipmunk/cpHastySpace.h"
 	
+	#ifndef BENCH_HASTY_THREADS
+		#define BENCH_HASTY_THREADS 0
+	#endif
+	
 	static cpSpace *MakeHastySpace(){
 		cpSpace *space = cpHastySpaceNew();
-		cpHastySpaceSetThreads(space, 0);
+		cpHastySpaceSetThreads(space, BENCH_HASTY_THREADS);
 		return space;
 	}
 	
@@ -21,7 +28,7 @@
 	#define BENCH_SPACE_STEP cpSpaceStep
 #endif
 
-const cpFloat bevel = 1.0;
+static const cpFloat bevel = 1.0;
 
 static cpVect simple_terrain_verts[] = {
 	{350.00, 425.07}, {336.00, 436.55}, {272.00, 435.39}, {258.00, 427.63}, {225.28, 420.00}, {202.82, 396.00},
@@ -77,6 +84,38 @@ static void add_hexagon(cpSpace *space, int index, cpFloat radius){
 	cpShapeSetElasticity(shape, 0.0); cpShapeSetFriction(shape, 0.9);
 }
 
+// Hexagons without a bevel radius overlap when resting on each other, so every contact needs EPA.
+static void add_sharp_hexagon(cpSpace *space, int index, cpFloat radius){
+	cpVect hexagon[6];
+	for(int i=0; i<6; i++){
+		cpFloat angle = -CP_PI*2.0f*i/6.0f;
+		hexagon[i] = cpvmult(cpv(cos(angle), sin(angle)), radius);
+	}
+	
+	cpFloat mass = radius*radius;
+	cpBody *body = cpSpaceAddBody(space, cpBodyNew(mass, cpMomentForPoly(mass, 6, hexagon, cpvzero, 0.0f)));
+	cpBodySetPosition(body, cpvmult(frand_unit_circle(), 180.0f));
+	
+	cpShape *shape = cpSpaceAddShape(space, cpPolyShapeNew(body, 6, hexagon, cpTransformIdentity, 0.0f));
+	cpShapeSetElasticity(shape, 0.0); cpShapeSetFriction(shape, 0.9);
+}
+
+// Round 32 sided polys, large enough that their support points are found by hill climbing.
+static void add_big_poly(cpSpace *space, int index, cpFloat radius){
+	cpVect verts[32];
+	for(int i=0; i<32; i++){
+		cpFloat angle = -CP_PI*2.0f*i/32.0f;
+		verts[i] = cpvmult(cpv(cos(angle), sin(angle)), radius - bevel);
+	}
+	
+	cpFloat mass = radius*radius;
+	cpBody *body = cpSpaceAddBody(space, cpBodyNew(mass, cpMomentForPoly(mass, 32, verts, cpvzero, 0.0f)));
+	cpBodySetPosition(body, cpvmult(frand_unit_circle(), 180.0f));
+	
+	cpShape *shape = cpSpaceAddShape(space, cpPolyShapeNew(body, 32, verts, cpTransformIdentity, bevel));
+	cpShapeSetElasticity(shape, 0.0); cpShapeSetFriction(shape, 0.9);
+}
+
 
 static cpSpace *
 SetupSpace_simpleTerrain(){
@@ -159,6 +198,20 @@ static cpSpace *init_SimpleTerrainHexagons_100(void){
 	return space;
 }
 
+static cpSpace *init_SimpleTerrainSharpHexagons_500(void){
+	cpSpace *space = SetupSpace_simpleTerrain();
+	for(int i=0; i<500; i++) add_sharp_hexagon(space, i, 5.0f);
+	
+	return space;
+}
+
+static cpSpace *init_SimpleTerrainBigPolys_200(void){
+	cpSpace *space = SetupSpace_simpleTerrain();
+	for(int i=0; i<200; i++) add_big_poly(space, i, 8.0f);
+	
+	return space;
+}
+
 
 // SimpleTerrain variable sized objects
 static cpFloat rand_size(){
@@ -432,6 +485,235 @@ static cpSpace *init_NoCollide(void){
 }
 
 
+// Particles
+// Lots of small circles bouncing around a box, with the dynamic shapes in each kind of spatial index.
+
+static cpSpace *
+SetupSpace_particles(int count)
+{
+	cpSpace *space = BENCH_SPACE_NEW();
+	cpSpaceSetIterations(space, 5);
+	
+	cpFloat radius = 2.0f, size = 500.0f;
+	cpBody *staticBody = cpSpaceGetStaticBody(space);
+	cpShapeSetElasticity(cpSpaceAddShape(space, cpSegmentShapeNew(staticBody, cpv(-size, -size), cpv( size, -size), 0.0f)), 1.0f);
+	cpShapeSetElasticity(cpSpaceAddShape(space, cpSegmentShapeNew(staticBody, cpv( size, -size), cpv( size,  size), 0.0f)), 1.0f);
+	cpShapeSetElasticity(cpSpaceAddShape(space, cpSegmentShapeNew(staticBody, cpv( size,  size), cpv(-size,  size), 0.0f)), 1.0f);
+	cpShapeSetElasticity(cpSpaceAddShape(space, cpSegmentShapeNew(staticBody, cpv(-size,  size), cpv(-size, -size), 0.0f)), 1.0f);
+	
+	for(int i=0; i<count; i++){
+		cpFloat mass = 1.0f;
+		cpBody *body = cpSpaceAddBody(space, cpBodyNew(mass, cpMomentForCircle(mass, 0.0f, radius, cpvzero)));
+		cpBodySetPosition(body, cpv((2.0f*frand() - 1.0f)*(size - radius), (2.0f*frand() - 1.0f)*(size - radius)));
+		cpBodySetVelocity(body, cpvmult(frand_unit_circle(), 50.0f));
+		
+		cpShape *shape = cpSpaceAddShape(space, cpCircleShapeNew(body, radius, cpvzero));
+		cpShapeSetElasticity(shape, 1.0f);
+	}
+	
+	return space;
+}
+
+static cpSpace *init_Particles_BBTree(void){
+	return SetupSpace_particles(10000);
+}
+
+static cpSpace *init_Particles_SpaceHash(void){
+	cpSpace *space = SetupSpace_particles(10000);
+	cpSpaceUseSpatialHash(space, 4.0f, 40000);
+	
+	return space;
+}
+
+static cpSpace *init_Particles_UniformGrid(void){
+	cpSpace *space = SetupSpace_particles(10000);
+	cpSpaceUseUniformGrid(space, 0.0f);
+	
+	return space;
+}
+
+
+// Bullets
+// Bullets bouncing around a box with some targets. The collision filters keep the bullets from hitting each other.
+
+#define BULLET_CATEGORY_WALL   1
+#define BULLET_CATEGORY_TARGET 2
+#define BULLET_CATEGORY_BULLET 4
+
+static cpSpace *
+SetupSpace_bullets(int bulletCount, int targetCount)
+{
+	cpSpace *space = BENCH_SPACE_NEW();
+	cpSpaceSetIterations(space, 5);
+	
+	cpFloat radius = 3.0f, size = 500.0f;
+	cpShapeFilter wallFilter = cpShapeFilterNew(CP_NO_GROUP, BULLET_CATEGORY_WALL, CP_ALL_CATEGORIES);
+	cpShapeFilter targetFilter = cpShapeFilterNew(CP_NO_GROUP, BULLET_CATEGORY_TARGET, CP_ALL_CATEGORIES);
+	cpShapeFilter bulletFilter = cpShapeFilterNew(CP_NO_GROUP, BULLET_CATEGORY_BULLET, BULLET_CATEGORY_WALL | BULLET_CATEGORY_TARGET);
+	
+	cpBody *staticBody = cpSpaceGetStaticBody(space);
+	cpVect corners[] = {cpv(-size, -size), cpv( size, -size), cpv( size,  size), cpv(-size,  size)};
+	for(int i=0; i<4; i++){
+		cpShape *shape = cpSegmentShapeNew(staticBody, corners[i], corners[(i + 1)%4], 0.0f);
+		cpShapeSetElasticity(shape, 1.0f);
+		cpShapeSetFilter(shape, wallFilter);
+		cpSpaceAddShape(space, shape);
+	}
+	
+	for(int i=0; i<bulletCount + targetCount; i++){
+		cpBool bullet = (i < bulletCount);
+		cpFloat r = (bullet ? radius : 4.0f*radius);
+		cpFloat mass = (bullet ? 1.0f : 10.0f);
+		
+		cpBody *body = cpSpaceAddBody(space, cpBodyNew(mass, cpMomentForCircle(mass, 0.0f, r, cpvzero)));
+		cpBodySetPosition(body, cpv((2.0f*frand() - 1.0f)*(size - r), (2.0f*frand() - 1.0f)*(size - r)));
+		cpBodySetVelocity(body, cpvmult(frand_unit_circle(), (bullet ? 200.0f : 20.0f)));
+		
+		// Set the filter before adding the shape so the spatial index stores it right away.
+		cpShape *shape = cpCircleShapeNew(body, r, cpvzero);
+		cpShapeSetElasticity(shape, 1.0f);
+		cpShapeSetFilter(shape, (bullet ? bulletFilter : targetFilter));
+		cpSpaceAddShape(space, shape);
+	}
+	
+	return space;
+}
+
+static cpSpace *init_Bullets_BBTree(void){
+	return SetupSpace_bullets(10000, 500);
+}
+
+static cpSpace *init_Bullets_UniformGrid(void){
+	cpSpace *space = SetupSpace_bullets(10000, 500);
+	cpSpaceUseUniformGrid(space, 0.0f);
+	
+	return space;
+}
+
+
+// Jointed Rigs
+// Rigs of bodies held together by joints that don't collide with each other, piled up on the ground.
+// Every pair of bodies from touching rigs has to be checked against the bodies' constraints.
+
+static void
+add_rig(cpSpace *space, cpVect pos)
+{
+	int limbs = 8;
+	cpFloat hubRadius = 12.0f, limbRadius = 6.0f;
+	
+	cpBody *hub = cpSpaceAddBody(space, cpBodyNew(5.0f, cpMomentForCircle(5.0f, 0.0f, hubRadius, cpvzero)));
+	cpBodySetPosition(hub, pos);
+	cpShapeSetFriction(cpSpaceAddShape(space, cpCircleShapeNew(hub, hubRadius, cpvzero)), 0.7f);
+	
+	cpBody *prev = NULL;
+	for(int i=0; i<limbs; i++){
+		cpVect dir = cpvforangle(2.0f*CP_PI*i/limbs);
+		cpBody *limb = cpSpaceAddBody(space, cpBodyNew(1.0f, cpMomentForCircle(1.0f, 0.0f, limbRadius, cpvzero)));
+		cpBodySetPosition(limb, cpvadd(pos, cpvmult(dir, hubRadius + limbRadius)));
+		cpShapeSetFriction(cpSpaceAddShape(space, cpCircleShapeNew(limb, limbRadius, cpvzero)), 0.7f);
+		
+		cpConstraint *joints[] = {
+			cpPivotJointNew(hub, limb, cpvadd(pos, cpvmult(dir, hubRadius))),
+			cpRotaryLimitJointNew(hub, limb, -0.5f, 0.5f),
+			(prev ? cpSlideJointNew(prev, limb, cpvzero, cpvzero, 0.0f, 2.0f*limbRadius + 8.0f) : NULL),
+		};
+		
+		for(int j=0; j<3; j++){
+			if(!joints[j]) continue;
+			cpConstraintSetCollideBodies(joints[j], cpFalse);
+			cpSpaceAddConstraint(space, joints[j]);
+		}
+		
+		prev = limb;
+	}
+}
+
+static cpSpace *init_JointedRigs_300(void){
+	cpSpace *space = BENCH_SPACE_NEW();
+	cpSpaceSetIterations(space, 10);
+	cpSpaceSetGravity(space, cpv(0, -100));
+	cpSpaceSetCollisionSlop(space, 0.5f);
+	
+	cpBody *staticBody = cpSpaceGetStaticBody(space);
+	cpShapeSetFriction(cpSpaceAddShape(space, cpSegmentShapeNew(staticBody, cpv(-320, -240), cpv(320, -240), 0.0f)), 1.0f);
+	cpShapeSetFriction(cpSpaceAddShape(space, cpSegmentShapeNew(staticBody, cpv(-320, -240), cpv(-320, 2000), 0.0f)), 1.0f);
+	cpShapeSetFriction(cpSpaceAddShape(space, cpSegmentShapeNew(staticBody, cpv( 320, -240), cpv( 320, 2000), 0.0f)), 1.0f);
+	
+	for(int i=0; i<300; i++) add_rig(space, cpv(-280.0f + 560.0f*frand(), -200.0f + 2000.0f*frand()));
+	
+	return space;
+}
+
+// The box stacks from the PyramidStack and PyramidTopple demos.
+// Sleeping is left disabled so every step collides the whole resting stack.
+static cpSpace *init_PyramidStack(void){
+	cpSpace *space = BENCH_SPACE_NEW();
+	cpSpaceSetIterations(space, 30);
+	cpSpaceSetGravity(space, cpv(0, -100));
+	cpSpaceSetCollisionSlop(space, 0.5f);
+	
+	cpBody *staticBody = cpSpaceGetStaticBody(space);
+	cpShapeSetFriction(cpSpaceAddShape(space, cpSegmentShapeNew(staticBody, cpv(-320, -240), cpv(-320, 240), 0.0f)), 1.0f);
+	cpShapeSetFriction(cpSpaceAddShape(space, cpSegmentShapeNew(staticBody, cpv( 320, -240), cpv( 320, 240), 0.0f)), 1.0f);
+	cpShapeSetFriction(cpSpaceAddShape(space, cpSegmentShapeNew(staticBody, cpv(-320, -240), cpv( 320, -240), 0.0f)), 1.0f);
+	
+	for(int i=0; i<14; i++){
+		for(int j=0; j<=i; j++){
+			cpBody *body = cpSpaceAddBody(space, cpBodyNew(1.0f, cpMomentForBox(1.0f, 30.0f, 30.0f)));
+			cpBodySetPosition(body, cpv(j*32 - i*16, 300 - i*32));
+			cpShapeSetFriction(cpSpaceAddShape(space, cpBoxShapeNew(body, 30.0f, 30.0f, 0.5f)), 0.8f);
+		}
+	}
+	
+	cpFloat radius = 15.0f;
+	cpBody *ball = cpSpaceAddBody(space, cpBodyNew(10.0f, cpMomentForCircle(10.0f, 0.0f, radius, cpvzero)));
+	cpBodySetPosition(ball, cpv(0, -240 + radius + 5));
+	cpShapeSetFriction(cpSpaceAddShape(space, cpCircleShapeNew(ball, radius, cpvzero)), 0.9f);
+	
+	return space;
+}
+
+static void add_domino(cpSpace *space, cpVect pos, cpBool flipped){
+	const cpFloat width = 4.0f, height = 30.0f, radius = 0.5f;
+	cpBody *body = cpSpaceAddBody(space, cpBodyNew(1.0f, cpMomentForBox(1.0f, width, height)));
+	cpBodySetPosition(body, pos);
+	
+	cpShape *shape = (flipped ? cpBoxShapeNew(body, height, width, 0.0f) : cpBoxShapeNew(body, width - radius*2.0f, height, radius));
+	cpShapeSetFriction(cpSpaceAddShape(space, shape), 0.6f);
+}
+
+static cpSpace *init_PyramidTopple(void){
+	cpSpace *space = BENCH_SPACE_NEW();
+	cpSpaceSetIterations(space, 30);
+	cpSpaceSetGravity(space, cpv(0, -300));
+	cpSpaceSetCollisionSlop(space, 0.5f);
+	
+	cpShapeSetFriction(cpSpaceAddShape(space, cpSegmentShapeNew(cpSpaceGetStaticBody(space), cpv(-600, -240), cpv(600, -240), 0.0f)), 1.0f);
+	
+	const cpFloat width = 4.0f, height = 30.0f;
+	int n = 12;
+	for(int i=0; i<n; i++){
+		for(int j=0; j<(n - i); j++){
+			cpVect offset = cpv((j - (n - 1 - i)*0.5f)*1.5f*height, (i + 0.5f)*(height + 2*width) - width - 240);
+			add_domino(space, offset, cpFalse);
+			add_domino(space, cpvadd(offset, cpv(0, (height + width)/2.0f)), cpTrue);
+			
+			if(j == 0){
+				add_domino(space, cpvadd(offset, cpv(0.5f*(width - height), height + width)), cpFalse);
+			}
+			
+			if(j != n - i - 1){
+				add_domino(space, cpvadd(offset, cpv(height*0.75f, (height + 3*width)/2.0f)), cpTrue);
+			} else {
+				add_domino(space, cpvadd(offset, cpv(0.5f*(height - width), height + width)), cpFalse);
+			}
+		}
+	}
+	
+	return space;
+}
+
+
 // TODO ideas:
 // addition/removal
 // Memory usage? (too small to matter?)
@@ -469,6 +751,8 @@ ChipmunkDemo bench_list[] = {
 	BENCH(SimpleTerrainHexagons_1000),
 	BENCH(SimpleTerrainHexagons_500),
 	BENCH(SimpleTerrainHexagons_100),
+	BENCH(SimpleTerrainSharpHexagons_500),
+	BENCH(SimpleTerrainBigPolys_200),
 	BENCH(SimpleTerrainVCircles_200),
 	BENCH(SimpleTerrainVBoxes_200),
 	BENCH(SimpleTerrainVHexagons_200),
@@ -477,6 +761,14 @@ ChipmunkDemo bench_list[] = {
 	BENCH(BouncyTerrainCircles_500),
 	BENCH(BouncyTerrainHexagons_500),
 	BENCH(NoCollide),
+	BENCH(Particles_BBTree),
+	BENCH(Particles_SpaceHash),
+	BENCH(Particles_UniformGrid),
+	BENCH(Bullets_BBTree),
+	BENCH(Bullets_UniformGrid),
+	BENCH(JointedRigs_300),
+	BENCH(PyramidStack),
+	{"benchmark - PyramidTopple", 1.0/180.0, init_PyramidTopple, update, ChipmunkDemoDefaultDrawImpl, destroy},
 };
 
 int bench_count = sizeof(bench_list)/sizeof(ChipmunkDemo);
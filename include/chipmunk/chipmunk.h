@@ -67,6 +67,12 @@ CP_EXPORT void cpMessage(const char *condition, const char *file, int line, int
 	#define CP_BUFFER_BYTES (32*1024)
 #endif
 
+/// Collect per-phase timings and counters for each call to cpSpaceStep(). See cpSpaceGetStepStats().
+/// When disabled the instrumentation is compiled out entirely.
+#ifndef CP_ENABLE_STEP_STATS
+	#define CP_ENABLE_STEP_STATS 0
+#endif
+
 #ifndef cpcalloc
 	/// Chipmunk calloc() alias.
 	#define cpcalloc calloc
@@ -82,6 +82,56 @@ void cpBodyRemoveConstraint(cpBody *body, cpConstraint *constraint);
 //MARK: Spatial Index Functions
 
 cpSpatialIndex *cpSpatialIndexInit(cpSpatialIndex *index, cpSpatialIndexClass *klass, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
+// Memory for the sorted objects of cpSpatialIndexCollideStaticBuffered().
+// Indexes keep one so it only grows instead of being allocated every step. Zero it to start, and cpfree() 'objects' when done.
+typedef struct cpCollideStaticBuffer {
+	void *objects;
+	int capacity;
+} cpCollideStaticBuffer;
+// Same as cpSpatialIndexCollideStatic(), but reuses the memory in 'buffer'.
+void cpSpatialIndexCollideStaticBuffered(cpSpatialIndex *dynamicIndex, cpSpatialIndex *staticIndex, cpSpatialIndexQueryFunc func, void *data, cpCollideStaticBuffer *buffer);
+
+// Object being sorted into a bounding volume hierarchy.
+// The bounds are copied so partitioning the items only touches the scratch memory.
+typedef struct cpBuildItem {
+	cpBB bb;
+	cpVect centroid;
+	// Cached filter for indexes that prune by it.
+	cpSpatialIndexFilter filter;
+	// The index's own leaf for the object.
+	void *leaf;
+} cpBuildItem;
+// Reorder the items with a binned surface area heuristic so the first 'n' go in the first half, and return 'n'.
+int cpSpatialIndexPartitionSAH(cpBuildItem *items, int count);
+
+// Returns true if the index is of the named class.
+cpBool cpSpatialIndexIsBBTree(cpSpatialIndex *index);
+cpBool cpSpatialIndexIsQBVH(cpSpatialIndex *index);
+cpBool cpSpatialIndexIsHGrid(cpSpatialIndex *index);
+cpBool cpSpatialIndexIsUniformGrid(cpSpatialIndex *index);
+cpBool cpSpatialIndexIsSpaceHash(cpSpatialIndex *index);
+cpBool cpSpatialIndexIsSweep1D(cpSpatialIndex *index);
+// Collides two cpBBTrees by descending both at once. Returns false without colliding anything if either index isn't a cpBBTree.
+cpBool cpBBTreeCollideTrees(cpSpatialIndex *dynamicIndex, cpSpatialIndex *staticIndex, cpSpatialIndexQueryFunc func, void *data);
+
+// Returns the filter of an object, or one that matches everything if the index has no filter function.
+static inline cpSpatialIndexFilter
+cpSpatialIndexGetFilter(cpSpatialIndex *index, void *obj)
+{
+	if(index->filterfunc){
+		return index->filterfunc(obj);
+	} else {
+		cpSpatialIndexFilter filter = {CP_ALL_CATEGORIES, CP_ALL_CATEGORIES};
+		return filter;
+	}
+}
+
+// Returns true if two objects can't collide according to their filters. Mirrors the category checks of cpShapeFilterReject().
+static inline cpBool
+cpSpatialIndexFilterReject(cpSpatialIndexFilter a, cpSpatialIndexFilter b)
+{
+	return ((a.categories & b.mask) == 0 || (b.categories & a.mask) == 0);
+}
 
 
 //MARK: Arbiters
@@ -97,9 +147,12 @@ cpArbiterThreadForBody(cpArbiter *arb, cpBody *body)
 void cpArbiterUnthread(cpArbiter *arb);
 
 void cpArbiterUpdate(cpArbiter *arb, struct cpCollisionInfo *info, cpSpace *space);
+// Fill in info with the arbiter's contacts moved along with its bodies if they haven't drifted further than threshold.
+cpBool cpArbiterReuseContacts(cpArbiter *arb, cpFloat threshold, struct cpCollisionInfo *info);
 void cpArbiterPreStep(cpArbiter *arb, cpFloat dt, cpFloat bias, cpFloat slop);
 void cpArbiterApplyCachedImpulse(cpArbiter *arb, cpFloat dt_coef);
 void cpArbiterApplyImpulse(cpArbiter *arb);
+void cpArbiterApplyPackedImpulse(cpArbiter *arb, struct cpSolverBody *bodies);
 
 
 //MARK: Shapes/Collisions
@@ -114,8 +167,33 @@ cpShapeActive(cpShape *shape)
 	return (shape->prev || (shape->body && shape->body->shapeList == shape));
 }
 
+// Set up a collision between two shapes, sorted by type the way the collision functions expect them.
+static inline struct cpCollisionInfo
+cpCollisionInfoInit(const cpShape *a, const cpShape *b, cpCollisionID id, struct cpContact *contacts)
+{
+	struct cpCollisionInfo info = {a, b, id, 0, cpvzero, 0, contacts};
+	
+	if(a->klass->type > b->klass->type){
+		info.a = b;
+		info.b = a;
+	}
+	
+	return info;
+}
+
+// Index of the collision function for two shapes sorted by type.
+static inline int
+cpCollisionFuncIndex(const cpShape *a, const cpShape *b)
+{
+	return a->klass->type + b->klass->type*CP_NUM_SHAPES;
+}
+
 // Note: This function returns contact points with r1/r2 in absolute coordinates, not body relative.
-struct cpCollisionInfo cpCollide(const cpShape *a, const cpShape *b, cpCollisionID id, struct cpContact *contacts);
+struct cpCollisionInfo cpCollide(const cpShape *a, const cpShape *b, cpCollisionID id, cpCollisionID hint, struct cpContact *contacts);
+
+// Collide a batch of collisions set up with cpCollisionInfoInit() that all have the same cpCollisionFuncIndex().
+// Circle/circle and circle/poly batches are tested in data parallel loops instead of one pair at a time.
+void cpCollideBatch(struct cpCollisionInfo **infos, int count);
 
 static inline void
 CircleSegmentQuery(cpShape *shape, cpVect center, cpFloat r1, cpVect a, cpVect b, cpFloat r2, cpSegmentQueryInfo *info)
@@ -182,8 +260,17 @@ normal_relative_velocity(cpBody *a, cpBody *b, cpVect r1, cpVect r2, cpVect n){
 	return cpvdot(relative_velocity(a, b, r1, r2), n);
 }
 
+// Static and kinematic bodies have infinite mass, so impulses never change their velocity.
+// Skipping the writes lets solvers running on several threads share them without a data race.
+static inline cpBool
+cpBodyTakesImpulses(const cpBody *body)
+{
+	return (body->m != INFINITY);
+}
+
 static inline void
 apply_impulse(cpBody *body, cpVect j, cpVect r){
+	if(!cpBodyTakesImpulses(body)) return;
 	body->v = cpvadd(body->v, cpvmult(j, body->m_inv));
 	body->w += body->i_inv*cpvcross(r, j);
 }
@@ -198,10 +285,17 @@ apply_impulses(cpBody *a , cpBody *b, cpVect r1, cpVect r2, cpVect j)
 static inline void
 apply_bias_impulse(cpBody *body, cpVect j, cpVect r)
 {
+	if(!cpBodyTakesImpulses(body)) return;
 	body->v_bias = cpvadd(body->v_bias, cpvmult(j, body->m_inv));
 	body->w_bias += body->i_inv*cpvcross(r, j);
 }
 
+static inline void
+apply_angular_impulse(cpBody *body, cpFloat j){
+	if(!cpBodyTakesImpulses(body)) return;
+	body->w += body->i_inv*j;
+}
+
 static inline void
 apply_bias_impulses(cpBody *a , cpBody *b, cpVect r1, cpVect r2, cpVect j)
 {
@@ -281,6 +375,10 @@ void cpSpaceSetStaticBody(cpSpace *space, cpBody *body);
 extern cpCollisionHandler cpCollisionHandlerDoNothing;
 
 void cpSpaceProcessComponents(cpSpace *space, cpFloat dt);
+// Flood fill the awake dynamic bodies into connected components of the contact graph and push their roots onto 'roots'.
+// cpSpaceClearComponents() must be called before the next step since only sleeping bodies may keep their component pointers.
+void cpSpaceGatherComponents(cpSpace *space, cpArray *roots);
+void cpSpaceClearComponents(cpArray *roots);
 
 void cpSpacePushFreshContactBuffer(cpSpace *space);
 struct cpContact *cpContactBufferGetArray(cpSpace *space);
@@ -289,6 +387,10 @@ void cpSpacePushContacts(cpSpace *space, int count);
 cpPostStepCallback *cpSpaceGetPostStepCallback(cpSpace *space, void *key);
 
 cpBool cpSpaceArbiterSetFilter(cpArbiter *arb, cpSpace *space);
+
+// Count a constraint with collideBodies == cpFalse between two bodies in the space's set of no-collide pairs, or stop counting one.
+void cpSpaceAddNoCollidePair(cpSpace *space, cpBody *a, cpBody *b);
+void cpSpaceRemoveNoCollidePair(cpSpace *space, cpBody *a, cpBody *b);
 void cpSpaceFilterArbiters(cpSpace *space, cpBody *body, cpShape *filter);
 
 void cpSpaceActivateBody(cpSpace *space, cpBody *body);
@@ -313,6 +415,80 @@ cpSpaceArrayForBodyType(cpSpace *space, cpBodyType type)
 
 void cpShapeUpdateFunc(cpShape *shape, void *unused);
 cpCollisionID cpSpaceCollideShapes(cpShape *a, cpShape *b, cpCollisionID id, cpSpace *space);
+// Update the spatial index of a shape whose filter changed. Deferred until the space unlocks if it is locked.
+void cpSpaceShapeFilterChanged(cpSpace *space, cpShape *shape);
+// Find the cached arbiter of a pair set up with cpCollisionInfoInit().
+// Returns NULL if there isn't one, or for pairs that are cheaper to collide again than to look up.
+cpArbiter *cpSpaceCachedArbiter(cpSpace *space, const struct cpCollisionInfo *info);
+// Fill in info from the cached arbiter of a pair that touched last step instead of running the narrowphase.
+// Returns false if the space doesn't reuse contacts or they need to be regenerated.
+cpBool cpSpaceReuseContacts(cpSpace *space, cpArbiter *arb, struct cpCollisionInfo *info);
+// Find or create the arbiter for a narrowphase result and call its begin and preSolve callbacks.
+// arb is the pair's cached arbiter if the caller already looked it up, or NULL.
+// The contacts in info must have been pushed onto the space's contact buffer already.
+void cpSpaceProcessCollision(cpSpace *space, struct cpCollisionInfo *info, cpArbiter *arb);
+
+
+//MARK: Step Statistics
+
+#if CP_ENABLE_STEP_STATS
+	uint64_t cpSpaceStepStatsTime(void);
+	
+	static inline void
+	cpSpaceStepStatsBegin(cpSpace *space)
+	{
+		cpSpaceStepStats zero = {{0}};
+		space->stepStats = zero;
+		space->stepStatsMark = cpSpaceStepStatsTime();
+	}
+	
+	// Attribute the time since the last mark to the given phase.
+	static inline void
+	cpSpaceStepStatsPhase(cpSpace *space, cpSpaceStepPhase phase)
+	{
+		uint64_t now = cpSpaceStepStatsTime();
+		space->stepStats.phaseNanoseconds[phase] += now - space->stepStatsMark;
+		space->stepStatsMark = now;
+	}
+	
+	static inline void
+	cpSpaceStepStatsNarrowphase(cpSpace *space, const cpShape *a, const cpShape *b)
+	{
+		cpShapeType type_a = a->klass->type, type_b = b->klass->type;
+		if(type_a <= type_b){
+			space->stepStats.narrowphaseCalls[type_a][type_b]++;
+		} else {
+			space->stepStats.narrowphaseCalls[type_b][type_a]++;
+		}
+	}
+	
+	static inline void
+	cpSpaceStepStatsIterationBin(unsigned int *bins, int iterations)
+	{
+		if(iterations > 0) bins[(iterations < CP_SPACE_STEP_STATS_ITERATION_BINS ? iterations : CP_SPACE_STEP_STATS_ITERATION_BINS) - 1]++;
+	}
+	
+	static inline void
+	cpSpaceStepStatsIterations(cpSpace *space, const struct cpCollisionInfo *info)
+	{
+		cpSpaceStepStatsIterationBin(space->stepStats.gjkIterations, info->gjkIterations);
+		cpSpaceStepStatsIterationBin(space->stepStats.epaIterations, info->epaIterations);
+	}
+	
+	#define CP_STEP_STATS_BEGIN(space) cpSpaceStepStatsBegin(space)
+	#define CP_STEP_STATS_PHASE(space, phase) cpSpaceStepStatsPhase(space, phase)
+	#define CP_STEP_STATS_COUNT(space, counter) ((space)->stepStats.counter++)
+	#define CP_STEP_STATS_NARROWPHASE(space, a, b) cpSpaceStepStatsNarrowphase(space, a, b)
+	#define CP_STEP_STATS_ITERATIONS(space, info) cpSpaceStepStatsIterations(space, info)
+	#define CP_STEP_STATS_END(space) ((space)->stepStats.sleepingComponents = (space)->sleepingComponents->num)
+#else
+	#define CP_STEP_STATS_BEGIN(space)
+	#define CP_STEP_STATS_PHASE(space, phase)
+	#define CP_STEP_STATS_COUNT(space, counter)
+	#define CP_STEP_STATS_NARROWPHASE(space, a, b)
+	#define CP_STEP_STATS_ITERATIONS(space, info)
+	#define CP_STEP_STATS_END(space)
+#endif
 
 
 //MARK: Foreach loops
@@ -341,4 +517,32 @@ cpArbiterNext(cpArbiter *node, cpBody *body)
 #define CP_BODY_FOREACH_COMPONENT(root, var)\
 	for(cpBody *var = root; var; var = var->sleeping.next)
 
+
+//MARK: Broadphase Pair Rejection
+
+static inline cpBool
+cpSpaceShapeQueryRejectConstraint(cpSpace *space, cpBody *a, cpBody *b)
+{
+	// Only bodies that both have constraints can be in the set, which skips the hash lookup for most pairs.
+	if(!a->constraintList || !b->constraintList) return cpFalse;
+	
+	const cpBody *bodies[] = {a, b};
+	return (cpHashSetFind(space->noCollidePairs, CP_HASH_PAIR((cpHashValue)a, (cpHashValue)b), bodies) != NULL);
+}
+
+static inline cpBool
+cpSpaceShapeQueryReject(cpShape *a, cpShape *b)
+{
+	return (
+		// BBoxes must overlap
+		!cpBBIntersects(a->bb, b->bb)
+		// Don't collide shapes attached to the same body.
+		|| a->body == b->body
+		// Don't collide shapes that are filtered.
+		|| cpShapeFilterReject(a->filter, b->filter)
+		// Don't collide bodies if they have a constraint with collideBodies == cpFalse.
+		|| cpSpaceShapeQueryRejectConstraint(a->space, a->body, b->body)
+	);
+}
+
 #endif
@@ -78,6 +78,21 @@ struct cpBody {
 		cpBody *next;
 		cpFloat idleTime;
 	} sleeping;
+	
+	// Bit mask of the solver colors that already contain this body. (Used by cpHastySpace)
+	uint64_t colorMask;
+	// Index of the island a component root belongs to. (Used by cpHastySpace)
+	int island;
+	// Index of the body's packed velocity state in cpSpace.solverBodies for the current step.
+	int solverSlot;
+};
+
+// Copy of the body state read and written by the contact solver.
+// Packed densely by solver slot so the solver iterations don't have to touch the rest of the cpBody.
+struct cpSolverBody {
+	cpVect v, v_bias;
+	cpFloat w, w_bias;
+	cpFloat m_inv, i_inv;
 };
 
 enum cpArbiterState {
@@ -113,12 +128,22 @@ struct cpContact {
 struct cpCollisionInfo {
 	const cpShape *a, *b;
 	cpCollisionID id;
+	// More features for the narrowphase to start from, cached with the pair's arbiter instead of the spatial index.
+	cpCollisionID hint;
 	
 	cpVect n;
 	
 	int count;
 	// TODO Should this be a unique struct type?
 	struct cpContact *arr;
+	
+	// Number of GJK and EPA iterations the narrowphase used, or 0 if it didn't run them.
+	int gjkIterations, epaIterations;
+	
+	// True if the contacts were moved along from the last step instead of running the narrowphase.
+	cpBool reused;
+	// Distance the contacts have drifted since the narrowphase last generated them.
+	cpFloat drift;
 };
 
 struct cpArbiter {
@@ -136,6 +161,16 @@ struct cpArbiter {
 	struct cpContact *contacts;
 	cpVect n;
 	
+	// Rotations of both bodies and the offset between them when the contacts were last updated.
+	cpVect rot_a, rot_b, delta;
+	cpFloat drift;
+	
+	// Collision hint the narrowphase returned for the shapes. (See cpCollisionInfo)
+	cpCollisionID hint;
+	
+	// Solver slots of body_a and body_b for the current step.
+	int slot_a, slot_b;
+	
 	// Regular, wildcard A and wildcard B collision handlers.
 	cpCollisionHandler *handler, *handlerA, *handlerB;
 	cpBool swapped;
@@ -405,6 +440,7 @@ struct cpSpace {
 	cpFloat collisionSlop;
 	cpFloat collisionBias;
 	cpTimestamp collisionPersistence;
+	cpFloat contactReuseThreshold;
 	
 	cpDataPointer userData;
 	
@@ -419,8 +455,12 @@ struct cpSpace {
 	cpHashValue shapeIDCounter;
 	cpSpatialIndex *staticShapes;
 	cpSpatialIndex *dynamicShapes;
+	// Static shapes whose filter changed while the space was locked. (See cpSpaceShapeFilterChanged())
+	cpArray *filterChangedShapes;
 	
 	cpArray *constraints;
+	// Pairs of bodies joined by a constraint with collideBodies == cpFalse. (See cpSpaceShapeQueryRejectConstraint())
+	cpHashSet *noCollidePairs;
 	
 	cpArray *arbiters;
 	cpContactBufferHeader *contactBuffersHead;
@@ -439,6 +479,17 @@ struct cpSpace {
 	
 	cpBody *staticBody;
 	cpBody _staticBody;
+	
+	cpSpaceStepStats stepStats;
+	uint64_t stepStatsMark;
+	
+	// Packed solver body state. (See cpSpaceSetPackedSolver())
+	cpBool packedSolver;
+	struct cpSolverBody *solverBodies;
+	cpBody **solverBodySources;
+	int solverBodyCount, solverBodyCapacity;
+	// Packed bodies that constraints also act on and must be synced around constraint iterations.
+	cpArray *solverSyncBodies;
 };
 
 typedef struct cpPostStepCallback {
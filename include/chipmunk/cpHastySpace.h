@@ -10,18 +10,80 @@ typedef struct cpHastySpace cpHastySpace;
 
 /// Create a new hasty space.
 /// On ARM platforms that support NEON, this will enable the vectorized solver.
-/// cpHastySpace also supports multiple threads, but runs single threaded by default for determinism.
+/// cpHastySpace also supports multiple threads, but runs single threaded by default.
 CP_EXPORT cpSpace *cpHastySpaceNew(void);
 CP_EXPORT void cpHastySpaceFree(cpSpace *space);
 
-/// Set the number of threads to use for the solver.
-/// Currently Chipmunk is limited to 2 threads as using more generally provides very minimal performance gains.
-/// Passing 0 as the thread count on iOS or OS X will cause Chipmunk to automatically detect the number of threads it should use.
-/// On other platforms passing 0 for the thread count will set 1 thread.
+/// Set the number of threads to use for the solver and collision detection.
+/// The worker threads are persistent and run a work stealing job scheduler.
+/// Integrating the bodies, updating the shape bounding boxes, the narrowphase collisions, the contact prestep and the solver are split into jobs.
+/// Body velocity and position update functions may be called concurrently from the worker threads,
+/// but the collision and constraint callbacks are always called from the thread that calls cpHastySpaceStep().
+/// The solver splits the contacts and joints into graph colored batches that share no dynamic bodies,
+/// so the simulation is deterministic and gives the same results regardless of the number of threads.
+/// Passing 0 as the thread count will cause Chipmunk to automatically detect the number of threads it should use.
+/// Chipmunk is limited to 32 threads.
 CP_EXPORT void cpHastySpaceSetThreads(cpSpace *space, unsigned long threads);
 
 /// Returns the number of threads the solver is using to run.
 CP_EXPORT unsigned long cpHastySpaceGetThreads(cpSpace *space);
 
+/// Set how many times an idle worker thread checks for new jobs before going to sleep.
+/// Spinning avoids the latency of waking the threads for each job, but burns CPU time while waiting.
+/// Use 0 to put the workers to sleep immediately. This is best when there are more threads than free CPU cores.
+/// The default is 4096.
+CP_EXPORT void cpHastySpaceSetSpinBudget(cpSpace *space, unsigned long spins);
+
+/// Returns the spin budget of the worker threads.
+CP_EXPORT unsigned long cpHastySpaceGetSpinBudget(cpSpace *space);
+
+/// Pin each worker thread to its own CPU core, leaving the first core for the thread that calls cpHastySpaceStep().
+/// This is ignored on platforms that don't support thread affinity. (ex: macOS and iOS)
+CP_EXPORT void cpHastySpaceSetThreadAffinity(cpSpace *space, cpBool affinity);
+
+/// Returns true if the worker threads are pinned to CPU cores.
+CP_EXPORT cpBool cpHastySpaceGetThreadAffinity(cpSpace *space);
+
+/// Ways cpHastySpace can split the solver between threads.
+typedef enum cpHastySpaceSolverMode {
+	/// Split the contacts and joints into graph colored batches. (default)
+	/// Scales well even when everything is part of one big pile, but the results are different from cpSpaceStep().
+	CP_HASTY_SOLVER_COLORED,
+	/// Solve each island of touching or jointed bodies on a single thread, with small islands batched together.
+	/// Scales well with many small independent piles, and gives the same results as cpSpaceStep().
+	CP_HASTY_SOLVER_ISLANDS,
+} cpHastySpaceSolverMode;
+
+/// Set how the solver is split between the threads.
+CP_EXPORT void cpHastySpaceSetSolverMode(cpSpace *space, cpHastySpaceSolverMode mode);
+
+/// Returns how the solver is split between the threads.
+CP_EXPORT cpHastySpaceSolverMode cpHastySpaceGetSolverMode(cpSpace *space);
+
+/// Instruction sets the contact solver can use.
+typedef enum cpHastySpaceSIMD {
+	/// Plain C.
+	CP_HASTY_SIMD_NONE,
+	/// ARM NEON, one contact at a time.
+	CP_HASTY_SIMD_NEON,
+	/// x86-64 SSE2, 4 contacts at a time. (2 with CP_USE_DOUBLES)
+	CP_HASTY_SIMD_SSE2,
+	/// x86-64 AVX2, 8 contacts at a time. (4 with CP_USE_DOUBLES)
+	CP_HASTY_SIMD_AVX2,
+} cpHastySpaceSIMD;
+
+/// Set the instruction set used to solve the contacts.
+/// The best one the CPU supports is picked when the space is created, and unsupported values also select it.
+/// The SSE2 and AVX2 solvers work on several contacts from a graph colored batch at once, so they are only used by CP_HASTY_SOLVER_COLORED.
+/// They do the same math in the same order as the plain C solver, so the results match exactly unless the compiler is allowed to reorder floating point math. (-ffast-math)
+CP_EXPORT void cpHastySpaceSetSIMD(cpSpace *space, cpHastySpaceSIMD simd);
+
+/// Returns the instruction set used to solve the contacts.
+CP_EXPORT cpHastySpaceSIMD cpHastySpaceGetSIMD(cpSpace *space);
+
+/// Rebuild the static shapes' bounding box tree like cpBBTreeOptimize(), using the worker threads.
+/// Call this after adding a large number of static shapes, such as when loading a level.
+CP_EXPORT void cpHastySpaceOptimizeStaticIndex(cpSpace *space);
+
 /// When stepping a hasty space, you must use this function.
 CP_EXPORT void cpHastySpaceStep(cpSpace *space, cpFloat dt);
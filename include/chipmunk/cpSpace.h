@@ -83,6 +83,12 @@ CP_EXPORT void cpSpaceFree(cpSpace *space);
 CP_EXPORT int cpSpaceGetIterations(const cpSpace *space);
 CP_EXPORT void cpSpaceSetIterations(cpSpace *space, int iterations);
 
+/// Copy the velocities of the bodies touched by contacts into a dense array while running the impulse solver.
+/// This makes the solver iterations much friendlier to the cache and gives the same results as the unpacked solver.
+/// The default value is cpTrue.
+CP_EXPORT cpBool cpSpaceGetPackedSolver(const cpSpace *space);
+CP_EXPORT void cpSpaceSetPackedSolver(cpSpace *space, cpBool packedSolver);
+
 /// Gravity to pass to rigid bodies when integrating velocity.
 CP_EXPORT cpVect cpSpaceGetGravity(const cpSpace *space);
 CP_EXPORT void cpSpaceSetGravity(cpSpace *space, cpVect gravity);
@@ -123,6 +129,16 @@ CP_EXPORT void cpSpaceSetCollisionBias(cpSpace *space, cpFloat collisionBias);
 CP_EXPORT cpTimestamp cpSpaceGetCollisionPersistence(const cpSpace *space);
 CP_EXPORT void cpSpaceSetCollisionPersistence(cpSpace *space, cpTimestamp collisionPersistence);
 
+/// Distance the contacts between two shapes are allowed to drift before they are regenerated.
+/// While a pair of touching shapes moves less than this relative to each other,
+/// cpSpaceStep() skips their narrowphase test and moves last step's contacts along with the bodies instead.
+/// This saves a lot of time in settled piles and stacks of polygons at the cost of slightly less accurate contacts.
+/// Pairs with a circle always run the narrowphase since it is cheaper than reusing the contacts.
+/// Shapes changed with the unsafe API keep their old contacts until they move.
+/// Defaults to 0, which disables reusing contacts.
+CP_EXPORT cpFloat cpSpaceGetContactReuseThreshold(const cpSpace *space);
+CP_EXPORT void cpSpaceSetContactReuseThreshold(cpSpace *space, cpFloat contactReuseThreshold);
+
 /// User definable data pointer.
 /// Generally this points to your game's controller or game state
 /// class so you can access it when given a cpSpace reference in a callback.
@@ -247,6 +263,15 @@ CP_EXPORT void cpSpaceReindexShapesForBody(cpSpace *space, cpBody *body);
 
 /// Switch the space to use a spatial has as it's spatial index.
 CP_EXPORT void cpSpaceUseSpatialHash(cpSpace *space, cpFloat dim, int count);
+/// Switch the space's static shapes, dynamic shapes or both to use a 4-wide bounding volume hierarchy (cpQBVH) as their spatial index.
+/// The other index is a bounding box tree, which is the default for both.
+CP_EXPORT void cpSpaceUseQBVH(cpSpace *space, cpBool staticShapes, cpBool dynamicShapes);
+/// Switch the space's dynamic shapes to use a uniform grid (cpUniformGrid) as their spatial index.
+/// The cells are at least @c celldim wide, pass 0 to size them to the largest shape.
+CP_EXPORT void cpSpaceUseUniformGrid(cpSpace *space, cpFloat celldim);
+/// Switch the space's static shapes, dynamic shapes or both to use a hierarchical grid (cpHGrid) as their spatial index.
+/// The other index is a bounding box tree, which is the default for both.
+CP_EXPORT void cpSpaceUseHGrid(cpSpace *space, cpBool staticShapes, cpBool dynamicShapes);
 
 
 //MARK: Time Stepping
@@ -255,6 +280,65 @@ CP_EXPORT void cpSpaceUseSpatialHash(cpSpace *space, cpFloat dim, int count);
 CP_EXPORT void cpSpaceStep(cpSpace *space, cpFloat dt);
 
 
+//MARK: Step Statistics
+
+/// The phases of a time step that are timed by cpSpaceStepStats.
+typedef enum cpSpaceStepPhase {
+	/// Integrating the positions of the awake bodies.
+	CP_SPACE_STEP_PHASE_INTEGRATE_POSITIONS,
+	/// Updating the bounding boxes of the dynamic shapes.
+	CP_SPACE_STEP_PHASE_UPDATE_BBS,
+	/// Reindexing the dynamic shapes and finding colliding pairs (broadphase and narrowphase).
+	CP_SPACE_STEP_PHASE_COLLIDE,
+	/// Rebuilding the contact graph and updating sleeping components.
+	CP_SPACE_STEP_PHASE_COMPONENTS,
+	/// Filtering the cached arbiters and calling separate callbacks.
+	CP_SPACE_STEP_PHASE_ARBITER_FILTER,
+	/// Prestepping arbiters and constraints, integrating velocities and applying cached impulses.
+	CP_SPACE_STEP_PHASE_PRESTEP,
+	/// Running the impulse solver iterations.
+	CP_SPACE_STEP_PHASE_SOLVE,
+	/// Calling the constraint and collision post-solve callbacks.
+	CP_SPACE_STEP_PHASE_POST_SOLVE,
+	CP_SPACE_STEP_PHASE_COUNT,
+} cpSpaceStepPhase;
+
+/// Number of shape types in cpSpaceStepStats.narrowphaseCalls. (circle, segment, poly)
+#define CP_SPACE_STEP_STATS_SHAPE_TYPES 3
+/// Number of bins in the cpSpaceStepStats GJK and EPA iteration histograms.
+/// Bin i counts the tests that took i + 1 iterations, and the last bin also counts every test that took longer.
+#define CP_SPACE_STEP_STATS_ITERATION_BINS 8
+
+/// Timings and counters for the most recent time step.
+typedef struct cpSpaceStepStats {
+	/// Wall clock time spent in each phase in nanoseconds, indexed by cpSpaceStepPhase.
+	uint64_t phaseNanoseconds[CP_SPACE_STEP_PHASE_COUNT];
+	/// Number of candidate pairs reported by the broadphase.
+	unsigned int pairsTested;
+	/// Number of touching pairs that reused last step's contacts instead of running the narrowphase.
+	unsigned int pairsReused;
+	/// Number of narrowphase collision tests indexed by the types of both shapes. (circle, segment, poly)
+	/// The smaller type is always the first index.
+	unsigned int narrowphaseCalls[CP_SPACE_STEP_STATS_SHAPE_TYPES][CP_SPACE_STEP_STATS_SHAPE_TYPES];
+	/// Histogram of the GJK iterations used by each narrowphase test that ran GJK.
+	unsigned int gjkIterations[CP_SPACE_STEP_STATS_ITERATION_BINS];
+	/// Histogram of the EPA iterations used by each narrowphase test where GJK found the shapes overlapping.
+	unsigned int epaIterations[CP_SPACE_STEP_STATS_ITERATION_BINS];
+	/// Number of new arbiters taken from the arbiter pool.
+	unsigned int arbitersCreated;
+	/// Number of expired arbiters returned to the arbiter pool.
+	unsigned int arbitersPooled;
+	/// Number of contact buffers that had to be allocated.
+	unsigned int contactBuffersAllocated;
+	/// Number of sleeping components at the end of the step.
+	unsigned int sleepingComponents;
+} cpSpaceStepStats;
+
+/// Get the timings and counters for the most recent call to cpSpaceStep().
+/// Chipmunk must be compiled with CP_ENABLE_STEP_STATS for the statistics to be collected, otherwise they are always zero.
+CP_EXPORT cpSpaceStepStats cpSpaceGetStepStats(const cpSpace *space);
+
+
 //MARK: Debug API
 
 #ifndef CP_SPACE_DISABLE_DEBUG_API
@@ -50,6 +50,19 @@ typedef cpCollisionID (*cpSpatialIndexQueryFunc)(void *obj1, void *obj2, cpColli
 /// Spatial segment query callback function type.
 typedef cpFloat (*cpSpatialIndexSegmentQueryFunc)(void *obj1, void *obj2, void *data);
 
+/// Collision categories and mask of an object, with the same meaning as in a cpShapeFilter.
+typedef struct cpSpatialIndexFilter {
+	cpBitmask categories;
+	cpBitmask mask;
+} cpSpatialIndexFilter;
+/// Spatial index collision filter callback function type.
+/// Indexes that support it skip pairs of objects whose categories and masks don't match while they search for pairs.
+typedef cpSpatialIndexFilter (*cpSpatialIndexFilterFunc)(void *obj);
+
+/// Function that runs the jobs of a parallel spatial index operation, such as cpBBTreeOptimizeParallel() or a cpUniformGrid pair search.
+/// It must call job(jobData, i) once for every i in [0, count), from any number of threads, and return once they have all finished.
+typedef void (*cpSpatialIndexJobRunner)(void (*job)(void *jobData, int i), void *jobData, int count, void *data);
+
 
 typedef struct cpSpatialIndexClass cpSpatialIndexClass;
 typedef struct cpSpatialIndex cpSpatialIndex;
@@ -59,6 +72,7 @@ struct cpSpatialIndex {
 	cpSpatialIndexClass *klass;
 	
 	cpSpatialIndexBBFunc bbfunc;
+	cpSpatialIndexFilterFunc filterfunc;
 	
 	cpSpatialIndex *staticIndex, *dynamicIndex;
 };
@@ -81,6 +95,34 @@ CP_EXPORT cpSpatialIndex* cpSpaceHashNew(cpFloat celldim, int cells, cpSpatialIn
 /// Some trial and error is required to find the optimum numbers for efficiency.
 CP_EXPORT void cpSpaceHashResize(cpSpaceHash *hash, cpFloat celldim, int numcells);
 
+/// Statistics gathered by a spatial hash each time cpSpatialIndexReindexQuery() is called on it.
+typedef struct cpSpaceHashStats {
+	/// The current cell dimensions.
+	cpFloat celldim;
+	/// The current table size.
+	int numcells;
+	/// The number of objects that were hashed.
+	int objects;
+	/// The number of cells the objects were hashed into.
+	int entries;
+	/// The average of the width and height of the objects' bounding boxes.
+	cpFloat averageExtent;
+	/// The average length of the chains of bins that were looked up.
+	cpFloat averageChain;
+	/// The number of times auto tuning changed the cell dimensions or table size.
+	int retunes;
+} cpSpaceHashStats;
+
+/// Enable automatic tuning of the cell dimensions and table size. Defaults to cpFalse.
+/// The hash tracks the average object size, the table occupancy and the chain lengths each time it's reindexed,
+/// and resizes itself before the next reindex when they drift too far from the ideal.
+/// Only cpSpatialIndexReindexQuery() gathers statistics, so this has no effect on a space's static index.
+CP_EXPORT void cpSpaceHashSetAutoTune(cpSpaceHash *hash, cpBool autoTune);
+/// Get whether automatic tuning is enabled.
+CP_EXPORT cpBool cpSpaceHashGetAutoTune(cpSpaceHash *hash);
+/// Get the statistics and the current parameters of the spatial hash.
+CP_EXPORT cpSpaceHashStats cpSpaceHashGetStats(cpSpaceHash *hash);
+
 //MARK: AABB Tree
 
 typedef struct cpBBTree cpBBTree;
@@ -95,12 +137,28 @@ CP_EXPORT cpSpatialIndex* cpBBTreeNew(cpSpatialIndexBBFunc bbfunc, cpSpatialInde
 /// Perform a static top down optimization of the tree.
 CP_EXPORT void cpBBTreeOptimize(cpSpatialIndex *index);
 
+/// Older name of cpSpatialIndexJobRunner, kept for compatibility.
+typedef cpSpatialIndexJobRunner cpBBTreeJobRunner;
+/// Same as cpBBTreeOptimize(), but the independent subtrees are built as jobs run by @c runner.
+/// cpHastySpaceOptimizeStaticIndex() uses this to rebuild the static shapes' tree on its worker threads.
+CP_EXPORT void cpBBTreeOptimizeParallel(cpSpatialIndex *index, cpSpatialIndexJobRunner runner, void *data);
+
 /// Bounding box tree velocity callback function.
 /// This function should return an estimate for the object's velocity.
 typedef cpVect (*cpBBTreeVelocityFunc)(void *obj);
 /// Set the velocity function for the bounding box tree to enable temporal coherence.
 CP_EXPORT void cpBBTreeSetVelocityFunc(cpSpatialIndex *index, cpBBTreeVelocityFunc func);
 
+/// Set how many internal nodes the tree may try to rotate each time it's reindexed.
+/// Rotations keep the quality of a tree with moving objects from drifting without the cost of cpBBTreeOptimize().
+/// A budget of a few percent of the object count is usually enough. Defaults to 0. (disabled)
+CP_EXPORT void cpBBTreeSetRotationBudget(cpSpatialIndex *index, int budget);
+/// Get the rotation budget of the tree.
+CP_EXPORT int cpBBTreeGetRotationBudget(cpSpatialIndex *index);
+/// Get the surface area heuristic cost of the tree.
+/// This is the sum of the perimeters of the internal nodes divided by the perimeter of the root. Lower costs make for faster queries.
+CP_EXPORT cpFloat cpBBTreeGetCost(cpSpatialIndex *index);
+
 //MARK: Single Axis Sweep
 
 typedef struct cpSweep1D cpSweep1D;
@@ -112,6 +170,52 @@ CP_EXPORT cpSpatialIndex* cpSweep1DInit(cpSweep1D *sweep, cpSpatialIndexBBFunc b
 /// Allocate and initialize a 1D sort and sweep broadphase.
 CP_EXPORT cpSpatialIndex* cpSweep1DNew(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
 
+//MARK: 4-wide Bounding Volume Hierarchy
+
+typedef struct cpQBVH cpQBVH;
+
+/// Allocate a 4-wide bounding volume hierarchy.
+/// Each node stores the bounds of its four children side by side, so queries test all of them with a single SIMD comparison.
+/// Queries are faster than with a cpBBTree, but moving objects refits the whole hierarchy,
+/// and adding or removing objects rebuilds it the next time it's queried or reindexed.
+/// It works best for static shapes, or for spaces that are queried much more often than they are stepped.
+CP_EXPORT cpQBVH* cpQBVHAlloc(void);
+/// Initialize a 4-wide bounding volume hierarchy.
+CP_EXPORT cpSpatialIndex* cpQBVHInit(cpQBVH *bvh, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
+/// Allocate and initialize a 4-wide bounding volume hierarchy.
+CP_EXPORT cpSpatialIndex* cpQBVHNew(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
+
+//MARK: Uniform Grid
+
+typedef struct cpUniformGrid cpUniformGrid;
+
+/// Allocate a uniform grid.
+/// The grid is rebuilt from scratch with a counting sort each time it's reindexed, and pairs are found by checking neighboring cells.
+/// The cells are never smaller than the largest object, so it works best for large numbers of similarly sized objects like particles.
+CP_EXPORT cpUniformGrid* cpUniformGridAlloc(void);
+/// Initialize a uniform grid. The cells are at least @c celldim wide, pass 0 to size them to the largest object.
+CP_EXPORT cpSpatialIndex* cpUniformGridInit(cpUniformGrid *grid, cpFloat celldim, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
+/// Allocate and initialize a uniform grid.
+CP_EXPORT cpSpatialIndex* cpUniformGridNew(cpFloat celldim, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
+/// Find the pairs of bands of rows of cells as jobs run by @c runner when the grid is reindexed.
+/// The pairs are still reported on the calling thread, and in the same order as without a runner. Pass NULL to disable.
+/// cpHastySpace sets this to its worker threads when its dynamic shapes use a grid.
+CP_EXPORT void cpUniformGridSetJobRunner(cpSpatialIndex *index, cpSpatialIndexJobRunner runner, void *data);
+
+//MARK: Hierarchical Grid
+
+typedef struct cpHGrid cpHGrid;
+
+/// Allocate a hierarchical grid.
+/// The grid has several levels, and each level's cells are twice as large as the level below it.
+/// Objects are stored once, in the level with cells that match their size, so it handles small and huge objects mixed together.
+/// Like cpUniformGrid, it's rebuilt from scratch each time it's reindexed.
+CP_EXPORT cpHGrid* cpHGridAlloc(void);
+/// Initialize a hierarchical grid. @c celldim is the cell size of the lowest level, pass 0 to size it to the smallest object.
+CP_EXPORT cpSpatialIndex* cpHGridInit(cpHGrid *grid, cpFloat celldim, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
+/// Allocate and initialize a hierarchical grid.
+CP_EXPORT cpSpatialIndex* cpHGridNew(cpFloat celldim, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex);
+
 //MARK: Spatial Index Implementation
 
 typedef void (*cpSpatialIndexDestroyImpl)(cpSpatialIndex *index);
@@ -150,6 +254,10 @@ struct cpSpatialIndexClass {
 
 /// Destroy and free a spatial index.
 CP_EXPORT void cpSpatialIndexFree(cpSpatialIndex *index);
+/// Set the collision filter callback used to skip pairs while searching for them.
+/// The cpBBTree and cpUniformGrid indexes use it. Set it before adding objects.
+/// A cpBBTree reads the filters again when objects are reindexed.
+CP_EXPORT void cpSpatialIndexSetFilterFunc(cpSpatialIndex *index, cpSpatialIndexFilterFunc func);
 /// Collide the objects in @c dynamicIndex against the objects in @c staticIndex using the query callback function.
 CP_EXPORT void cpSpatialIndexCollideStatic(cpSpatialIndex *dynamicIndex, cpSpatialIndex *staticIndex, cpSpatialIndexQueryFunc func, void *data);
 
@@ -329,6 +329,11 @@ cpArbiterInit(cpArbiter *arb, cpShape *a, cpShape *b)
 	arb->count = 0;
 	arb->contacts = NULL;
 	
+	arb->rot_a = arb->rot_b = cpv(1.0f, 0.0f);
+	arb->delta = cpvzero;
+	arb->drift = 0.0f;
+	arb->hint = 0;
+	
 	arb->a = a; arb->body_a = a->body;
 	arb->b = b; arb->body_b = b->body;
 	
@@ -390,6 +395,13 @@ cpArbiterUpdate(cpArbiter *arb, struct cpCollisionInfo *info, cpSpace *space)
 	arb->count = info->count;
 	arb->n = info->n;
 	
+	cpBody *body_a = a->body, *body_b = b->body;
+	arb->rot_a = cpv(body_a->transform.a, body_a->transform.b);
+	arb->rot_b = cpv(body_b->transform.a, body_b->transform.b);
+	arb->delta = cpvsub(body_b->p, body_a->p);
+	arb->drift = info->drift;
+	arb->hint = info->hint;
+	
 	arb->e = a->e * b->e;
 	arb->u = a->u * b->u;
 	
@@ -413,6 +425,59 @@ cpArbiterUpdate(cpArbiter *arb, struct cpCollisionInfo *info, cpSpace *space)
 	if(arb->state == CP_ARBITER_STATE_CACHED) arb->state = CP_ARBITER_STATE_FIRST_COLLISION;
 }
 
+cpBool
+cpArbiterReuseContacts(cpArbiter *arb, cpFloat threshold, struct cpCollisionInfo *info)
+{
+	if(arb->count == 0) return cpFalse;
+	
+	cpBody *a = arb->body_a, *b = arb->body_b;
+	cpVect rot_a = cpv(a->transform.a, a->transform.b);
+	cpVect rot_b = cpv(b->transform.a, b->transform.b);
+	cpVect delta = cpvsub(b->p, a->p);
+	
+	// How far each body has turned since the contacts were updated.
+	cpVect turn_a = cpvunrotate(rot_a, arb->rot_a);
+	cpVect turn_b = cpvunrotate(rot_b, arb->rot_b);
+	
+	// Rolling shapes barely drift at the contact, but the contact still moves around them as they turn.
+	// The chord between the relative rotations is close to the angle for small turns and avoids the trig.
+	cpFloat roll = cpvdist(cpvunrotate(turn_b, turn_a), cpv(1.0f, 0.0f));
+	// The contact moves around the body that did the turning, so only its lever counts.
+	// (The other body could be static terrain with its center of gravity far away from the contact)
+	cpBool a_turned = (turn_a.x < turn_b.x);
+	
+	// Contact points on b are measured in a's frame so that moving both bodies together doesn't count as drift.
+	cpFloat drift = 0.0f;
+	for(int i=0; i<arb->count; i++){
+		struct cpContact *con = &arb->contacts[i];
+		cpVect old_p = cpvunrotate(cpvadd(arb->delta, con->r2), arb->rot_a);
+		cpVect new_p = cpvunrotate(cpvadd(delta, cpvrotate(con->r2, turn_b)), rot_a);
+		cpFloat lever = cpvlength(a_turned ? con->r1 : con->r2);
+		drift = cpfmax(drift, cpvdist(old_p, new_p) + roll*lever);
+	}
+	
+	drift += arb->drift;
+	if(drift > threshold) return cpFalse;
+	
+	info->a = arb->a;
+	info->b = arb->b;
+	info->n = cpvrotate(arb->n, turn_a);
+	info->count = arb->count;
+	info->reused = cpTrue;
+	info->drift = drift;
+	
+	for(int i=0; i<arb->count; i++){
+		struct cpContact con = arb->contacts[i];
+		
+		// cpArbiterUpdate() expects absolute offsets like the narrowphase returns.
+		con.r1 = cpvadd(a->p, cpvrotate(con.r1, turn_a));
+		con.r2 = cpvadd(b->p, cpvrotate(con.r2, turn_b));
+		info->arr[i] = con;
+	}
+	
+	return cpTrue;
+}
+
 void
 cpArbiterPreStep(cpArbiter *arb, cpFloat dt, cpFloat slop, cpFloat bias)
 {
@@ -496,3 +561,72 @@ cpArbiterApplyImpulse(cpArbiter *arb)
 		apply_impulses(a, b, r1, r2, cpvrotate(n, cpv(con->jnAcc - jnOld, con->jtAcc - jtOld)));
 	}
 }
+
+static inline cpVect
+packed_relative_velocity(struct cpSolverBody *a, struct cpSolverBody *b, cpVect r1, cpVect r2){
+	cpVect v1_sum = cpvadd(a->v, cpvmult(cpvperp(r1), a->w));
+	cpVect v2_sum = cpvadd(b->v, cpvmult(cpvperp(r2), b->w));
+	
+	return cpvsub(v2_sum, v1_sum);
+}
+
+static inline void
+packed_apply_impulse(struct cpSolverBody *body, cpVect j, cpVect r){
+	body->v = cpvadd(body->v, cpvmult(j, body->m_inv));
+	body->w += body->i_inv*cpvcross(r, j);
+}
+
+static inline void
+packed_apply_bias_impulse(struct cpSolverBody *body, cpVect j, cpVect r)
+{
+	body->v_bias = cpvadd(body->v_bias, cpvmult(j, body->m_inv));
+	body->w_bias += body->i_inv*cpvcross(r, j);
+}
+
+// Same as cpArbiterApplyImpulse(), but reads and writes the packed body state at arb->slot_a and arb->slot_b.
+// The math must stay in the same order as cpArbiterApplyImpulse() so both give bit identical results.
+void
+cpArbiterApplyPackedImpulse(cpArbiter *arb, struct cpSolverBody *bodies)
+{
+	struct cpSolverBody *a = bodies + arb->slot_a;
+	struct cpSolverBody *b = bodies + arb->slot_b;
+	cpVect n = arb->n;
+	cpVect surface_vr = arb->surface_vr;
+	cpFloat friction = arb->u;
+
+	for(int i=0; i<arb->count; i++){
+		struct cpContact *con = &arb->contacts[i];
+		cpFloat nMass = con->nMass;
+		cpVect r1 = con->r1;
+		cpVect r2 = con->r2;
+		
+		cpVect vb1 = cpvadd(a->v_bias, cpvmult(cpvperp(r1), a->w_bias));
+		cpVect vb2 = cpvadd(b->v_bias, cpvmult(cpvperp(r2), b->w_bias));
+		cpVect vr = cpvadd(packed_relative_velocity(a, b, r1, r2), surface_vr);
+		
+		cpFloat vbn = cpvdot(cpvsub(vb2, vb1), n);
+		cpFloat vrn = cpvdot(vr, n);
+		cpFloat vrt = cpvdot(vr, cpvperp(n));
+		
+		cpFloat jbn = (con->bias - vbn)*nMass;
+		cpFloat jbnOld = con->jBias;
+		con->jBias = cpfmax(jbnOld + jbn, 0.0f);
+		
+		cpFloat jn = -(con->bounce + vrn)*nMass;
+		cpFloat jnOld = con->jnAcc;
+		con->jnAcc = cpfmax(jnOld + jn, 0.0f);
+		
+		cpFloat jtMax = friction*con->jnAcc;
+		cpFloat jt = -vrt*con->tMass;
+		cpFloat jtOld = con->jtAcc;
+		con->jtAcc = cpfclamp(jtOld + jt, -jtMax, jtMax);
+		
+		cpVect jb = cpvmult(n, con->jBias - jbnOld);
+		packed_apply_bias_impulse(a, cpvneg(jb), r1);
+		packed_apply_bias_impulse(b, jb, r2);
+		
+		cpVect j = cpvrotate(n, cpv(con->jnAcc - jnOld, con->jtAcc - jtOld));
+		packed_apply_impulse(a, cpvneg(j), r1);
+		packed_apply_impulse(b, j, r2);
+	}
+}
@@ -27,48 +27,77 @@
 static inline cpSpatialIndexClass *Klass(void);
 
 typedef struct Node Node;
+typedef struct Leaf Leaf;
 typedef struct Pair Pair;
 
+// Nodes are referred to by their index in cpBBTree.nodes.
+#define NODE_NULL (-1)
+
 struct cpBBTree {
 	cpSpatialIndex spatialIndex;
 	cpBBTreeVelocityFunc velocityFunc;
 	
 	cpHashSet *leaves;
-	Node *root;
 	
-	Node *pooledNodes;
+	// All of the nodes are stored in a single array that grows as needed.
+	// Unused nodes are linked through their parent index starting at pooledNodes.
+	Node *nodes;
+	int nodeCount, nodeCapacity;
+	int root, pooledNodes;
+	
+	Leaf *pooledLeaves;
 	Pair *pooledPairs;
 	cpArray *allocatedBuffers;
 	
 	cpTimestamp stamp;
+	
+	// Incremental optimization state. See cpBBTreeSetRotationBudget().
+	int rotationBudget;
+	unsigned int opath;
+	
+	// Used when the static index isn't a cpBBTree.
+	cpCollideStaticBuffer staticBuffer;
 };
 
+// Only the data needed to traverse the tree is stored in the nodes.
+// The rest of a leaf's data is stored in a separate Leaf struct so it doesn't take up cache space during queries.
 struct Node {
-	void *obj;
 	cpBB bb;
-	Node *parent;
+	int parent;
+	cpBool isLeaf;
+	// Set by MarkSubtree() when the subtree contains a leaf that moved this step.
+	cpBool moved;
+	
+	// The filter of a leaf, or the union of the categories and masks of the leaves under an internal node.
+	// Two subtrees can't have a pair of leaves that passes the filters if their unions already reject each other.
+	cpSpatialIndexFilter filter;
 	
 	union {
 		// Internal nodes
-		struct { Node *a, *b; } children;
+		struct { int a, b; } children;
 		
 		// Leaves
-		struct {
-			cpTimestamp stamp;
-			Pair *pairs;
-		} leaf;
+		Leaf *leaf;
 	} node;
 };
 
 // Can't use anonymous unions and still get good x-compiler compatability
 #define A node.children.a
 #define B node.children.b
-#define STAMP node.leaf.stamp
-#define PAIRS node.leaf.pairs
+#define LEAF node.leaf
+
+// Leaves are pooled like pairs so pointers to them stay valid as the node array grows.
+struct Leaf {
+	void *obj;
+	int node;
+	
+	cpTimestamp stamp;
+	Pair *pairs;
+};
 
 typedef struct Thread {
 	Pair *prev;
-	Node *leaf;
+	Leaf *leaf;
 	Pair *next;
 } Thread;
 
@@ -103,9 +132,10 @@ GetTree(cpSpatialIndex *index)
 	return (index && index->klass == Klass() ? (cpBBTree *)index : NULL);
 }
 
-static inline Node *
-GetRootIfTree(cpSpatialIndex *index){
-	return (index && index->klass == Klass() ? ((cpBBTree *)index)->root : NULL);
+static inline cpBBTree *
+GetTreeIfRoot(cpSpatialIndex *index){
+	cpBBTree *tree = GetTree(index);
+	return (tree && tree->root != NODE_NULL ? tree : NULL);
 }
 
 static inline cpBBTree *
@@ -178,15 +208,15 @@ ThreadUnlink(Thread thread)
 	if(prev){
 		if(prev->a.leaf == thread.leaf) prev->a.next = next; else prev->b.next = next;
 	} else {
-		thread.leaf->PAIRS = next;
+		thread.leaf->pairs = next;
 	}
 }
 
 static void
-PairsClear(Node *leaf, cpBBTree *tree)
+PairsClear(Leaf *leaf, cpBBTree *tree)
 {
-	Pair *pair = leaf->PAIRS;
-	leaf->PAIRS = NULL;
+	Pair *pair = leaf->pairs;
+	leaf->pairs = NULL;
 	
 	while(pair){
 		if(pair->a.leaf == leaf){
@@ -204,13 +234,13 @@ PairsClear(Node *leaf, cpBBTree *tree)
 }
 
 static void
-PairInsert(Node *a, Node *b, cpBBTree *tree)
+PairInsert(Leaf *a, Leaf *b, cpBBTree *tree)
 {
-	Pair *nextA = a->PAIRS, *nextB = b->PAIRS;
+	Pair *nextA = a->pairs, *nextB = b->pairs;
 	Pair *pair = PairFromPool(tree);
 	Pair temp = {{NULL, a, nextA},{NULL, b, nextB}, 0};
 	
-	a->PAIRS = b->PAIRS = pair;
+	a->pairs = b->pairs = pair;
 	*pair = temp;
 	
 	if(nextA){
@@ -226,92 +256,105 @@ PairInsert(Node *a, Node *b, cpBBTree *tree)
 //MARK: Node Functions
 
 static void
-NodeRecycle(cpBBTree *tree, Node *node)
+NodeRecycle(cpBBTree *tree, int node)
 {
-	node->parent = tree->pooledNodes;
+	tree->nodes[node].parent = tree->pooledNodes;
 	tree->pooledNodes = node;
 }
 
-static Node *
+// Growing the node array moves it, so pointers into it must not be held across calls to NodeFromPool().
+static int
 NodeFromPool(cpBBTree *tree)
 {
-	Node *node = tree->pooledNodes;
+	int node = tree->pooledNodes;
 	
-	if(node){
-		tree->pooledNodes = node->parent;
+	if(node != NODE_NULL){
+		tree->pooledNodes = tree->nodes[node].parent;
 		return node;
 	} else {
-		// Pool is exhausted, make more
-		int count = CP_BUFFER_BYTES/sizeof(Node);
-		cpAssertHard(count, "Internal Error: Buffer size is too small.");
-		
-		Node *buffer = (Node *)cpcalloc(1, CP_BUFFER_BYTES);
-		cpArrayPush(tree->allocatedBuffers, buffer);
+		if(tree->nodeCount == tree->nodeCapacity){
+			// Pool is exhausted, make more
+			int count = CP_BUFFER_BYTES/sizeof(Node);
+			cpAssertHard(count, "Internal Error: Buffer size is too small.");
+			
+			tree->nodeCapacity = (tree->nodeCapacity ? 2*tree->nodeCapacity : count);
+			tree->nodes = (Node *)cprealloc(tree->nodes, tree->nodeCapacity*sizeof(Node));
+		}
 		
-		// push all but the first one, return the first instead
-		for(int i=1; i<count; i++) NodeRecycle(tree, buffer + i);
-		return buffer;
+		return tree->nodeCount++;
 	}
 }
 
 static inline void
-NodeSetA(Node *node, Node *value)
+NodeSetA(Node *nodes, int node, int value)
 {
-	node->A = value;
-	value->parent = node;
+	nodes[node].A = value;
+	nodes[value].parent = node;
 }
 
 static inline void
-NodeSetB(Node *node, Node *value)
+NodeSetB(Node *nodes, int node, int value)
 {
-	node->B = value;
-	value->parent = node;
+	nodes[node].B = value;
+	nodes[value].parent = node;
 }
 
-static Node *
-NodeNew(cpBBTree *tree, Node *a, Node *b)
+// Recalculate the bounds and filter of an internal node from its children.
+static inline void
+NodeRefit(Node *nodes, int node)
 {
-	Node *node = NodeFromPool(tree);
-	
-	node->obj = NULL;
-	node->bb = cpBBMerge(a->bb, b->bb);
-	node->parent = NULL;
-	
-	NodeSetA(node, a);
-	NodeSetB(node, b);
+	Node *a = nodes + nodes[node].A, *b = nodes + nodes[node].B;
+	nodes[node].bb = cpBBMerge(a->bb, b->bb);
+	nodes[node].filter.categories = a->filter.categories | b->filter.categories;
+	nodes[node].filter.mask = a->filter.mask | b->filter.mask;
+}
+
+static inline void
+NodeInit(Node *nodes, int node, int a, int b)
+{
+	nodes[node].parent = NODE_NULL;
+	nodes[node].isLeaf = cpFalse;
 	
-	return node;
+	NodeSetA(nodes, node, a);
+	NodeSetB(nodes, node, b);
+	NodeRefit(nodes, node);
 }
 
 static inline cpBool
 NodeIsLeaf(Node *node)
 {
-	return (node->obj != NULL);
+	return node->isLeaf;
 }
 
-static inline Node *
-NodeOther(Node *node, Node *child)
+// Returns true if the filters of some pair of leaves under the two nodes might match.
+static inline cpBool
+NodeFiltersMatch(Node *a, Node *b)
 {
-	return (node->A == child ? node->B : node->A);
+	return !cpSpatialIndexFilterReject(a->filter, b->filter);
+}
+
+static inline int
+NodeOther(Node *nodes, int node, int child)
+{
+	return (nodes[node].A == child ? nodes[node].B : nodes[node].A);
 }
 
 static inline void
-NodeReplaceChild(Node *parent, Node *child, Node *value, cpBBTree *tree)
+NodeReplaceChild(cpBBTree *tree, int parent, int child, int value)
 {
-	cpAssertSoft(!NodeIsLeaf(parent), "Internal Error: Cannot replace child of a leaf.");
-	cpAssertSoft(child == parent->A || child == parent->B, "Internal Error: Node is not a child of parent.");
+	Node *nodes = tree->nodes;
+	cpAssertSoft(!NodeIsLeaf(nodes + parent), "Internal Error: Cannot replace child of a leaf.");
+	cpAssertSoft(child == nodes[parent].A || child == nodes[parent].B, "Internal Error: Node is not a child of parent.");
 	
-	if(parent->A == child){
-		NodeRecycle(tree, parent->A);
-		NodeSetA(parent, value);
+	if(nodes[parent].A == child){
+		NodeRecycle(tree, child);
+		NodeSetA(nodes, parent, value);
 	} else {
-		NodeRecycle(tree, parent->B);
-		NodeSetB(parent, value);
+		NodeRecycle(tree, child);
+		NodeSetB(nodes, parent, value);
 	}
 	
-	for(Node *node=parent; node; node = node->parent){
-		node->bb = cpBBMerge(node->A->bb, node->B->bb);
-	}
+	for(int node=parent; node != NODE_NULL; node = nodes[node].parent) NodeRefit(nodes, node);
 }
 
 //MARK: Subtree Functions
@@ -322,92 +365,126 @@ cpBBProximity(cpBB a, cpBB b)
 	return cpfabs(a.l + a.r - b.l - b.r) + cpfabs(a.b + a.t - b.b - b.t);
 }
 
-static Node *
-SubtreeInsert(Node *subtree, Node *leaf, cpBBTree *tree)
+// Insert 'leaf' into 'subtree' and return the new root of the subtree.
+static int
+SubtreeInsert(cpBBTree *tree, int subtree, int leaf)
 {
-	if(subtree == NULL){
-		return leaf;
-	} else if(NodeIsLeaf(subtree)){
-		return NodeNew(tree, leaf, subtree);
-	} else {
-		cpFloat cost_a = cpBBArea(subtree->B->bb) + cpBBMergedArea(subtree->A->bb, leaf->bb);
-		cpFloat cost_b = cpBBArea(subtree->A->bb) + cpBBMergedArea(subtree->B->bb, leaf->bb);
+	if(subtree == NODE_NULL) return leaf;
+	
+	// Get the new parent node before walking the tree since the node array may move.
+	int parent = NodeFromPool(tree);
+	Node *nodes = tree->nodes;
+	cpBB bb = nodes[leaf].bb;
+	cpSpatialIndexFilter filter = nodes[leaf].filter;
+	
+	int node = subtree;
+	while(!NodeIsLeaf(nodes + node)){
+		Node *n = nodes + node;
+		cpBB bb_a = nodes[n->A].bb, bb_b = nodes[n->B].bb;
 		
-		if(cost_a == cost_b){
-			cost_a = cpBBProximity(subtree->A->bb, leaf->bb);
-			cost_b = cpBBProximity(subtree->B->bb, leaf->bb);
-		}
+		cpFloat cost_a = cpBBArea(bb_b) + cpBBMergedArea(bb_a, bb);
+		cpFloat cost_b = cpBBArea(bb_a) + cpBBMergedArea(bb_b, bb);
 		
-		if(cost_b < cost_a){
-			NodeSetB(subtree, SubtreeInsert(subtree->B, leaf, tree));
-		} else {
-			NodeSetA(subtree, SubtreeInsert(subtree->A, leaf, tree));
+		if(cost_a == cost_b){
+			cost_a = cpBBProximity(bb_a, bb);
+			cost_b = cpBBProximity(bb_b, bb);
 		}
 		
-		subtree->bb = cpBBMerge(subtree->bb, leaf->bb);
+		n->bb = cpBBMerge(n->bb, bb);
+		n->filter.categories |= filter.categories;
+		n->filter.mask |= filter.mask;
+		node = (cost_b < cost_a ? n->B : n->A);
+	}
+	
+	// Pair the leaf with the leaf it landed on.
+	int grandparent = nodes[node].parent;
+	NodeInit(nodes, parent, leaf, node);
+	
+	if(grandparent == NODE_NULL){
+		return parent;
+	} else {
+		if(nodes[grandparent].A == node) NodeSetA(nodes, grandparent, parent); else NodeSetB(nodes, grandparent, parent);
 		return subtree;
 	}
 }
 
 static void
-SubtreeQuery(Node *subtree, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data)
+SubtreeQuery(Node *nodes, int subtree, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data)
 {
-	if(cpBBIntersects(subtree->bb, bb)){
-		if(NodeIsLeaf(subtree)){
-			func(obj, subtree->obj, 0, data);
+	Node *node = nodes + subtree;
+	if(cpBBIntersects(node->bb, bb)){
+		if(NodeIsLeaf(node)){
+			func(obj, node->LEAF->obj, 0, data);
 		} else {
-			SubtreeQuery(subtree->A, obj, bb, func, data);
-			SubtreeQuery(subtree->B, obj, bb, func, data);
+			SubtreeQuery(nodes, node->A, obj, bb, func, data);
+			SubtreeQuery(nodes, node->B, obj, bb, func, data);
 		}
 	}
 }
 
+// Find the overlapping leaves of two subtrees, which can belong to different trees, by descending both at once.
+static void
+SubtreeCollide(Node *nodes, int subtree, Node *otherNodes, int otherSubtree, cpSpatialIndexQueryFunc func, void *data)
+{
+	Node *node = nodes + subtree, *other = otherNodes + otherSubtree;
+	if(!cpBBIntersects(node->bb, other->bb) || !NodeFiltersMatch(node, other)) return;
+	
+	if(NodeIsLeaf(node)){
+		if(NodeIsLeaf(other)){
+			func(node->LEAF->obj, other->LEAF->obj, 0, data);
+		} else {
+			SubtreeCollide(nodes, subtree, otherNodes, other->A, func, data);
+			SubtreeCollide(nodes, subtree, otherNodes, other->B, func, data);
+		}
+	} else if(NodeIsLeaf(other) || cpBBArea(node->bb) > cpBBArea(other->bb)){
+		// Split the larger of the two nodes.
+		SubtreeCollide(nodes, node->A, otherNodes, otherSubtree, func, data);
+		SubtreeCollide(nodes, node->B, otherNodes, otherSubtree, func, data);
+	} else {
+		SubtreeCollide(nodes, subtree, otherNodes, other->A, func, data);
+		SubtreeCollide(nodes, subtree, otherNodes, other->B, func, data);
+	}
+}
 
 static cpFloat
-SubtreeSegmentQuery(Node *subtree, void *obj, cpVect a, cpVect b, cpFloat t_exit, cpSpatialIndexSegmentQueryFunc func, void *data)
+SubtreeSegmentQuery(Node *nodes, int subtree, void *obj, cpVect a, cpVect b, cpFloat t_exit, cpSpatialIndexSegmentQueryFunc func, void *data)
 {
-	if(NodeIsLeaf(subtree)){
-		return func(obj, subtree->obj, data);
+	Node *node = nodes + subtree;
+	if(NodeIsLeaf(node)){
+		return func(obj, node->LEAF->obj, data);
 	} else {
-		cpFloat t_a = cpBBSegmentQuery(subtree->A->bb, a, b);
-		cpFloat t_b = cpBBSegmentQuery(subtree->B->bb, a, b);
+		int child_a = node->A, child_b = node->B;
+		cpFloat t_a = cpBBSegmentQuery(nodes[child_a].bb, a, b);
+		cpFloat t_b = cpBBSegmentQuery(nodes[child_b].bb, a, b);
 		
 		if(t_a < t_b){
-			if(t_a < t_exit) t_exit = cpfmin(t_exit, SubtreeSegmentQuery(subtree->A, obj, a, b, t_exit, func, data));
-			if(t_b < t_exit) t_exit = cpfmin(t_exit, SubtreeSegmentQuery(subtree->B, obj, a, b, t_exit, func, data));
+			if(t_a < t_exit) t_exit = cpfmin(t_exit, SubtreeSegmentQuery(nodes, child_a, obj, a, b, t_exit, func, data));
+			if(t_b < t_exit) t_exit = cpfmin(t_exit, SubtreeSegmentQuery(nodes, child_b, obj, a, b, t_exit, func, data));
 		} else {
-			if(t_b < t_exit) t_exit = cpfmin(t_exit, SubtreeSegmentQuery(subtree->B, obj, a, b, t_exit, func, data));
-			if(t_a < t_exit) t_exit = cpfmin(t_exit, SubtreeSegmentQuery(subtree->A, obj, a, b, t_exit, func, data));
+			if(t_b < t_exit) t_exit = cpfmin(t_exit, SubtreeSegmentQuery(nodes, child_b, obj, a, b, t_exit, func, data));
+			if(t_a < t_exit) t_exit = cpfmin(t_exit, SubtreeSegmentQuery(nodes, child_a, obj, a, b, t_exit, func, data));
 		}
 		
 		return t_exit;
 	}
 }
 
-static void
-SubtreeRecycle(cpBBTree *tree, Node *node)
-{
-	if(!NodeIsLeaf(node)){
-		SubtreeRecycle(tree, node->A);
-		SubtreeRecycle(tree, node->B);
-		NodeRecycle(tree, node);
-	}
-}
-
-static inline Node *
-SubtreeRemove(Node *subtree, Node *leaf, cpBBTree *tree)
+// Remove 'leaf' from 'subtree' and return the new root of the subtree.
+static inline int
+SubtreeRemove(cpBBTree *tree, int subtree, int leaf)
 {
 	if(leaf == subtree){
-		return NULL;
+		return NODE_NULL;
 	} else {
-		Node *parent = leaf->parent;
+		Node *nodes = tree->nodes;
+		int parent = nodes[leaf].parent;
 		if(parent == subtree){
-			Node *other = NodeOther(subtree, leaf);
-			other->parent = subtree->parent;
+			int other = NodeOther(nodes, subtree, leaf);
+			nodes[other].parent = nodes[subtree].parent;
 			NodeRecycle(tree, subtree);
 			return other;
 		} else {
-			NodeReplaceChild(parent->parent, parent, NodeOther(parent, leaf), tree);
+			NodeReplaceChild(tree, nodes[parent].parent, parent, NodeOther(nodes, parent, leaf));
 			return subtree;
 		}
 	}
@@ -417,46 +494,55 @@ SubtreeRemove(Node *subtree, Node *leaf, cpBBTree *tree)
 
 typedef struct MarkContext {
 	cpBBTree *tree;
-	Node *staticRoot;
+	cpBBTree *staticTree;
 	cpSpatialIndexQueryFunc func;
 	void *data;
 } MarkContext;
 
+// Find the leaves of 'subtree' that overlap the leaf of 'leafNode' and pass its filter.
+// The subtree can belong to a different tree than the leaf, so its nodes are passed in.
 static void
-MarkLeafQuery(Node *subtree, Node *leaf, cpBool left, MarkContext *context)
+MarkLeafQuery(Node *nodes, int subtree, Node *leafNode, cpBool left, MarkContext *context)
 {
-	if(cpBBIntersects(leaf->bb, subtree->bb)){
-		if(NodeIsLeaf(subtree)){
+	Node *node = nodes + subtree;
+	if(cpBBIntersects(leafNode->bb, node->bb) && NodeFiltersMatch(leafNode, node)){
+		if(NodeIsLeaf(node)){
+			Leaf *leaf = leafNode->LEAF, *other = node->LEAF;
 			if(left){
-				PairInsert(leaf, subtree, context->tree);
+				PairInsert(leaf, other, context->tree);
 			} else {
-				if(subtree->STAMP < leaf->STAMP) PairInsert(subtree, leaf, context->tree);
-				context->func(leaf->obj, subtree->obj, 0, context->data);
+				if(other->stamp < leaf->stamp) PairInsert(other, leaf, context->tree);
+				context->func(leaf->obj, other->obj, 0, context->data);
 			}
 		} else {
-			MarkLeafQuery(subtree->A, leaf, left, context);
-			MarkLeafQuery(subtree->B, leaf, left, context);
+			MarkLeafQuery(nodes, node->A, leafNode, left, context);
+			MarkLeafQuery(nodes, node->B, leafNode, left, context);
 		}
 	}
 }
 
-static void
-MarkLeaf(Node *leaf, MarkContext *context)
+// Returns true if the leaf moved this step.
+static cpBool
+MarkLeaf(Leaf *leaf, MarkContext *context)
 {
 	cpBBTree *tree = context->tree;
-	if(leaf->STAMP == GetMasterTree(tree)->stamp){
-		Node *staticRoot = context->staticRoot;
-		if(staticRoot) MarkLeafQuery(staticRoot, leaf, cpFalse, context);
+	if(leaf->stamp == GetMasterTree(tree)->stamp){
+		Node *nodes = tree->nodes;
+		Node *leafNode = nodes + leaf->node;
+		
+		cpBBTree *staticTree = context->staticTree;
+		if(staticTree) MarkLeafQuery(staticTree->nodes, staticTree->root, leafNode, cpFalse, context);
 		
-		for(Node *node = leaf; node->parent; node = node->parent){
-			if(node == node->parent->A){
-				MarkLeafQuery(node->parent->B, leaf, cpTrue, context);
+		for(int node = leaf->node; nodes[node].parent != NODE_NULL; node = nodes[node].parent){
+			Node *parent = nodes + nodes[node].parent;
+			if(node == parent->A){
+				MarkLeafQuery(nodes, parent->B, leafNode, cpTrue, context);
 			} else {
-				MarkLeafQuery(node->parent->A, leaf, cpFalse, context);
+				MarkLeafQuery(nodes, parent->A, leafNode, cpFalse, context);
 			}
 		}
 	} else {
-		Pair *pair = leaf->PAIRS;
+		Pair *pair = leaf->pairs;
 		while(pair){
 			if(leaf == pair->b.leaf){
 				pair->id = context->func(pair->a.leaf->obj, leaf->obj, pair->id, context->data);
@@ -465,50 +551,122 @@ MarkLeaf(Node *leaf, MarkContext *context)
 				pair = pair->a.next;
 			}
 		}
+		
+		return cpFalse;
+	}
+	
+	return cpTrue;
+}
+
+static cpBool
+MarkSubtree(Node *nodes, int subtree, MarkContext *context)
+{
+	Node *node = nodes + subtree;
+	if(NodeIsLeaf(node)){
+		node->moved = MarkLeaf(node->LEAF, context);
+	} else {
+		// Both children must be marked, so don't short circuit.
+		cpBool moved = MarkSubtree(nodes, node->A, context);
+		node->moved = MarkSubtree(nodes, node->B, context) | moved;
 	}
+	
+	return node->moved;
 }
 
+// Find the overlapping leaves of a dynamic subtree and a static subtree by descending both at once.
+// Dynamic subtrees without a moved leaf are pruned since their static pairs are still cached.
 static void
-MarkSubtree(Node *subtree, MarkContext *context)
+MarkStaticSubtree(Node *nodes, int subtree, Node *staticNodes, int staticSubtree, MarkContext *context)
 {
-	if(NodeIsLeaf(subtree)){
-		MarkLeaf(subtree, context);
+	Node *node = nodes + subtree, *staticNode = staticNodes + staticSubtree;
+	if(!node->moved || !cpBBIntersects(node->bb, staticNode->bb) || !NodeFiltersMatch(node, staticNode)) return;
+	
+	if(NodeIsLeaf(node)){
+		if(NodeIsLeaf(staticNode)){
+			Leaf *leaf = node->LEAF, *other = staticNode->LEAF;
+			if(other->stamp < leaf->stamp) PairInsert(other, leaf, context->tree);
+			context->func(leaf->obj, other->obj, 0, context->data);
+		} else {
+			MarkStaticSubtree(nodes, subtree, staticNodes, staticNode->A, context);
+			MarkStaticSubtree(nodes, subtree, staticNodes, staticNode->B, context);
+		}
+	} else if(NodeIsLeaf(staticNode) || cpBBArea(node->bb) > cpBBArea(staticNode->bb)){
+		// Split the larger of the two nodes.
+		MarkStaticSubtree(nodes, node->A, staticNodes, staticSubtree, context);
+		MarkStaticSubtree(nodes, node->B, staticNodes, staticSubtree, context);
 	} else {
-		MarkSubtree(subtree->A, context);
-		MarkSubtree(subtree->B, context); // TODO: Force TCO here?
+		MarkStaticSubtree(nodes, subtree, staticNodes, staticNode->A, context);
+		MarkStaticSubtree(nodes, subtree, staticNodes, staticNode->B, context);
 	}
 }
 
 //MARK: Leaf Functions
 
-static Node *
+static void
+LeafRecycle(cpBBTree *tree, Leaf *leaf)
+{
+	leaf->obj = tree->pooledLeaves;
+	tree->pooledLeaves = leaf;
+}
+
+static Leaf *
+LeafFromPool(cpBBTree *tree)
+{
+	Leaf *leaf = tree->pooledLeaves;
+	
+	if(leaf){
+		tree->pooledLeaves = (Leaf *)leaf->obj;
+		return leaf;
+	} else {
+		// Pool is exhausted, make more
+		int count = CP_BUFFER_BYTES/sizeof(Leaf);
+		cpAssertHard(count, "Internal Error: Buffer size is too small.");
+		
+		Leaf *buffer = (Leaf *)cpcalloc(1, CP_BUFFER_BYTES);
+		cpArrayPush(tree->allocatedBuffers, buffer);
+		
+		// push all but the first one, return the first instead
+		for(int i=1; i<count; i++) LeafRecycle(tree, buffer + i);
+		return buffer;
+	}
+}
+
+static Leaf *
 LeafNew(cpBBTree *tree, void *obj, cpBB bb)
 {
-	Node *node = NodeFromPool(tree);
-	node->obj = obj;
-	node->bb = GetBB(tree, obj);
+	Leaf *leaf = LeafFromPool(tree);
+	leaf->obj = obj;
+	leaf->node = NodeFromPool(tree);
+	leaf->stamp = 0;
+	leaf->pairs = NULL;
 	
-	node->parent = NULL;
-	node->STAMP = 0;
-	node->PAIRS = NULL;
+	Node *node = tree->nodes + leaf->node;
+	node->bb = GetBB(tree, obj);
+	node->filter = cpSpatialIndexGetFilter((cpSpatialIndex *)tree, obj);
+	node->parent = NODE_NULL;
+	node->isLeaf = cpTrue;
+	node->LEAF = leaf;
 	
-	return node;
+	return leaf;
 }
 
 static cpBool
-LeafUpdate(Node *leaf, cpBBTree *tree)
+LeafUpdate(Leaf *leaf, cpBBTree *tree)
 {
-	Node *root = tree->root;
+	Node *node = tree->nodes + leaf->node;
 	cpBB bb = tree->spatialIndex.bbfunc(leaf->obj);
+	cpSpatialIndexFilter filter = cpSpatialIndexGetFilter((cpSpatialIndex *)tree, leaf->obj);
 	
-	if(!cpBBContainsBB(leaf->bb, bb)){
-		leaf->bb = GetBB(tree, leaf->obj);
+	// A leaf with a new filter is reinserted like a moved one so its cached pairs and the unions above it are updated.
+	if(!cpBBContainsBB(node->bb, bb) || filter.categories != node->filter.categories || filter.mask != node->filter.mask){
+		node->bb = GetBB(tree, leaf->obj);
+		node->filter = filter;
 		
-		root = SubtreeRemove(root, leaf, tree);
-		tree->root = SubtreeInsert(root, leaf, tree);
+		int root = SubtreeRemove(tree, tree->root, leaf->node);
+		tree->root = SubtreeInsert(tree, root, leaf->node);
 		
 		PairsClear(leaf, tree);
-		leaf->STAMP = GetMasterTree(tree)->stamp;
+		leaf->stamp = GetMasterTree(tree)->stamp;
 		
 		return cpTrue;
 	} else {
@@ -519,19 +677,18 @@ LeafUpdate(Node *leaf, cpBBTree *tree)
 static cpCollisionID VoidQueryFunc(void *obj1, void *obj2, cpCollisionID id, void *data){return id;}
 
 static void
-LeafAddPairs(Node *leaf, cpBBTree *tree)
+LeafAddPairs(Leaf *leaf, cpBBTree *tree)
 {
 	cpSpatialIndex *dynamicIndex = tree->spatialIndex.dynamicIndex;
 	if(dynamicIndex){
-		Node *dynamicRoot = GetRootIfTree(dynamicIndex);
-		if(dynamicRoot){
-			cpBBTree *dynamicTree = GetTree(dynamicIndex);
+		cpBBTree *dynamicTree = GetTreeIfRoot(dynamicIndex);
+		if(dynamicTree){
 			MarkContext context = {dynamicTree, NULL, NULL, NULL};
-			MarkLeafQuery(dynamicRoot, leaf, cpTrue, &context);
+			MarkLeafQuery(dynamicTree->nodes, dynamicTree->root, tree->nodes + leaf->node, cpTrue, &context);
 		}
 	} else {
-		Node *staticRoot = GetRootIfTree(tree->spatialIndex.staticIndex);
-		MarkContext context = {tree, staticRoot, VoidQueryFunc, NULL};
+		cpBBTree *staticTree = GetTreeIfRoot(tree->spatialIndex.staticIndex);
+		MarkContext context = {tree, staticTree, VoidQueryFunc, NULL};
 		MarkLeaf(leaf, &context);
 	}
 }
@@ -545,9 +702,9 @@ cpBBTreeAlloc(void)
 }
 
 static int
-leafSetEql(void *obj, Node *node)
+leafSetEql(void *obj, Leaf *leaf)
 {
-	return (obj == node->obj);
+	return (obj == leaf->obj);
 }
 
 static void *
@@ -564,13 +721,24 @@ cpBBTreeInit(cpBBTree *tree, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *static
 	tree->velocityFunc = NULL;
 	
 	tree->leaves = cpHashSetNew(0, (cpHashSetEqlFunc)leafSetEql);
-	tree->root = NULL;
 	
-	tree->pooledNodes = NULL;
+	tree->nodes = NULL;
+	tree->nodeCount = tree->nodeCapacity = 0;
+	tree->root = NODE_NULL;
+	tree->pooledNodes = NODE_NULL;
+	
+	tree->pooledLeaves = NULL;
+	tree->pooledPairs = NULL;
 	tree->allocatedBuffers = cpArrayNew(0);
 	
 	tree->stamp = 0;
 	
+	tree->rotationBudget = 0;
+	tree->opath = 0;
+	
+	tree->staticBuffer.objects = NULL;
+	tree->staticBuffer.capacity = 0;
+	
 	return (cpSpatialIndex *)tree;
 }
 
@@ -595,9 +763,11 @@ static void
 cpBBTreeDestroy(cpBBTree *tree)
 {
 	cpHashSetFree(tree->leaves);
+	cpfree(tree->nodes);
 	
 	if(tree->allocatedBuffers) cpArrayFreeEach(tree->allocatedBuffers, cpfree);
 	cpArrayFree(tree->allocatedBuffers);
+	cpfree(tree->staticBuffer.objects);
 }
 
 //MARK: Insert/Remove
@@ -605,12 +775,11 @@ cpBBTreeDestroy(cpBBTree *tree)
 static void
 cpBBTreeInsert(cpBBTree *tree, void *obj, cpHashValue hashid)
 {
-	Node *leaf = (Node *)cpHashSetInsert(tree->leaves, hashid, obj, (cpHashSetTransFunc)leafSetTrans, tree);
+	Leaf *leaf = (Leaf *)cpHashSetInsert(tree->leaves, hashid, obj, (cpHashSetTransFunc)leafSetTrans, tree);
 	
-	Node *root = tree->root;
-	tree->root = SubtreeInsert(root, leaf, tree);
+	tree->root = SubtreeInsert(tree, tree->root, leaf->node);
 	
-	leaf->STAMP = GetMasterTree(tree)->stamp;
+	leaf->stamp = GetMasterTree(tree)->stamp;
 	LeafAddPairs(leaf, tree);
 	IncrementStamp(tree);
 }
@@ -618,11 +787,12 @@ cpBBTreeInsert(cpBBTree *tree, void *obj, cpHashValue hashid)
 static void
 cpBBTreeRemove(cpBBTree *tree, void *obj, cpHashValue hashid)
 {
-	Node *leaf = (Node *)cpHashSetRemove(tree->leaves, hashid, obj);
+	Leaf *leaf = (Leaf *)cpHashSetRemove(tree->leaves, hashid, obj);
 	
-	tree->root = SubtreeRemove(tree->root, leaf, tree);
+	tree->root = SubtreeRemove(tree, tree->root, leaf->node);
 	PairsClear(leaf, tree);
-	NodeRecycle(tree, leaf);
+	NodeRecycle(tree, leaf->node);
+	LeafRecycle(tree, leaf);
 }
 
 static cpBool
@@ -633,22 +803,29 @@ cpBBTreeContains(cpBBTree *tree, void *obj, cpHashValue hashid)
 
 //MARK: Reindex
 
-static void LeafUpdateWrap(Node *leaf, cpBBTree *tree) {LeafUpdate(leaf, tree);}
+static void LeafUpdateWrap(Leaf *leaf, cpBBTree *tree) {LeafUpdate(leaf, tree);}
+static void cpBBTreeOptimizeIncremental(cpBBTree *tree, int budget);
 
 static void
 cpBBTreeReindexQuery(cpBBTree *tree, cpSpatialIndexQueryFunc func, void *data)
 {
-	if(!tree->root) return;
+	if(tree->root == NODE_NULL) return;
 	
 	// LeafUpdate() may modify tree->root. Don't cache it.
 	cpHashSetEach(tree->leaves, (cpHashSetIteratorFunc)LeafUpdateWrap, tree);
+	if(tree->rotationBudget > 0) cpBBTreeOptimizeIncremental(tree, tree->rotationBudget);
 	
 	cpSpatialIndex *staticIndex = tree->spatialIndex.staticIndex;
-	Node *staticRoot = (staticIndex && staticIndex->klass == Klass() ? ((cpBBTree *)staticIndex)->root : NULL);
+	cpBBTree *staticTree = GetTreeIfRoot(staticIndex);
 	
-	MarkContext context = {tree, staticRoot, func, data};
-	MarkSubtree(tree->root, &context);
-	if(staticIndex && !staticRoot) cpSpatialIndexCollideStatic((cpSpatialIndex *)tree, staticIndex, func, data);
+	// Moved leaves find their static pairs in a separate pass over both trees instead of one query each.
+	MarkContext context = {tree, NULL, func, data};
+	MarkSubtree(tree->nodes, tree->root, &context);
+	if(staticTree){
+		MarkStaticSubtree(tree->nodes, tree->root, staticTree->nodes, staticTree->root, &context);
+	} else if(staticIndex){
+		cpSpatialIndexCollideStaticBuffered((cpSpatialIndex *)tree, staticIndex, func, data, &tree->staticBuffer);
+	}
 	
 	IncrementStamp(tree);
 }
@@ -662,7 +839,7 @@ cpBBTreeReindex(cpBBTree *tree)
 static void
 cpBBTreeReindexObject(cpBBTree *tree, void *obj, cpHashValue hashid)
 {
-	Node *leaf = (Node *)cpHashSetFind(tree->leaves, hashid, obj);
+	Leaf *leaf = (Leaf *)cpHashSetFind(tree->leaves, hashid, obj);
 	if(leaf){
 		if(LeafUpdate(leaf, tree)) LeafAddPairs(leaf, tree);
 		IncrementStamp(tree);
@@ -674,14 +851,26 @@ cpBBTreeReindexObject(cpBBTree *tree, void *obj, cpHashValue hashid)
 static void
 cpBBTreeSegmentQuery(cpBBTree *tree, void *obj, cpVect a, cpVect b, cpFloat t_exit, cpSpatialIndexSegmentQueryFunc func, void *data)
 {
-	Node *root = tree->root;
-	if(root) SubtreeSegmentQuery(root, obj, a, b, t_exit, func, data);
+	if(tree->root != NODE_NULL) SubtreeSegmentQuery(tree->nodes, tree->root, obj, a, b, t_exit, func, data);
 }
 
 static void
 cpBBTreeQuery(cpBBTree *tree, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data)
 {
-	if(tree->root) SubtreeQuery(tree->root, obj, bb, func, data);
+	if(tree->root != NODE_NULL) SubtreeQuery(tree->nodes, tree->root, obj, bb, func, data);
+}
+
+cpBool
+cpBBTreeCollideTrees(cpSpatialIndex *dynamicIndex, cpSpatialIndex *staticIndex, cpSpatialIndexQueryFunc func, void *data)
+{
+	cpBBTree *dynamicTree = GetTree(dynamicIndex), *staticTree = GetTree(staticIndex);
+	if(!dynamicTree || !staticTree) return cpFalse;
+	
+	if(dynamicTree->root != NODE_NULL && staticTree->root != NODE_NULL){
+		SubtreeCollide(dynamicTree->nodes, dynamicTree->root, staticTree->nodes, staticTree->root, func, data);
+	}
+	
+	return cpTrue;
 }
 
 //MARK: Misc
@@ -697,7 +886,7 @@ typedef struct eachContext {
 	void *data;
 } eachContext;
 
-static void each_helper(Node *node, eachContext *context){context->func(node->obj, context->data);}
+static void each_helper(Leaf *leaf, eachContext *context){context->func(leaf->obj, context->data);}
 
 static void
 cpBBTreeEach(cpBBTree *tree, cpSpatialIndexIteratorFunc func, void *data)
@@ -729,122 +918,279 @@ static inline cpSpatialIndexClass *Klass(){return &klass;}
 
 //MARK: Tree Optimization
 
-static int
-cpfcompare(const cpFloat *a, const cpFloat *b){
-	return (*a < *b ? -1 : (*b < *a ? 1 : 0));
+// The tree is rebuilt top down with a binned surface area heuristic. (See cpSpatialIndexPartitionSAH())
+// The nodes are written to a new array in depth first order, so traversing the rebuilt tree walks forward through memory.
+
+// Ranges of at most this many leaves are built as a single job by cpBBTreeOptimizeParallel().
+#define BUILD_JOB_LEAVES 1024
+
+// Range of leaves to build a subtree from.
+// The subtree's 2*count - 1 nodes are stored starting at index 'node', with the root of the subtree first.
+typedef struct BuildRange {
+	int start, end, node;
+	// Where the range was split. Only used for the top of the tree built by cpBBTreeOptimizeParallel().
+	int split;
+} BuildRange;
+
+// All the scratch memory used by a rebuild is allocated in a single block.
+typedef struct BuildContext {
+	cpBuildItem *items;
+	int item_count;
+	
+	// The node array being built.
+	Node *nodes;
+	
+	// Subtrees built as jobs, and the ranges above them in post order.
+	BuildRange *jobs, *top;
+	int job_count, top_count;
+} BuildContext;
+
+static inline cpFloat
+BBPerimeter(cpBB bb)
+{
+	return (bb.r - bb.l) + (bb.t - bb.b);
+}
+
+static void
+fillBuildItems(Leaf *leaf, BuildContext *context){
+	Node *node = context->nodes + leaf->node;
+	cpBB bb = node->bb;
+	cpBuildItem item = {bb, cpv((bb.l + bb.r)*0.5f, (bb.b + bb.t)*0.5f), node->filter, leaf};
+	context->items[context->item_count++] = item;
 }
 
 static void
-fillNodeArray(Node *node, Node ***cursor){
-	(**cursor) = node;
-	(*cursor)++;
+BuildSubtree(BuildContext *context, int start, int end, int node)
+{
+	if(end - start == 1){
+		cpBuildItem *item = context->items + start;
+		Node *leaf = context->nodes + node;
+		leaf->bb = item->bb;
+		leaf->filter = item->filter;
+		leaf->parent = NODE_NULL;
+		leaf->isLeaf = cpTrue;
+		leaf->LEAF = (Leaf *)item->leaf;
+		leaf->LEAF->node = node;
+	} else {
+		int split = start + cpSpatialIndexPartitionSAH(context->items + start, end - start);
+		int a = node + 1, b = node + 2*(split - start);
+		BuildSubtree(context, start, split, a);
+		BuildSubtree(context, split, end, b);
+		NodeInit(context->nodes, node, a, b);
+	}
 }
 
-static Node *
-partitionNodes(cpBBTree *tree, Node **nodes, int count)
+static void
+BuildJob(BuildContext *context, int i)
 {
-	if(count == 1){
-		return nodes[0];
-	} else if(count == 2) {
-		return NodeNew(tree, nodes[0], nodes[1]);
+	BuildRange *range = context->jobs + i;
+	BuildSubtree(context, range->start, range->end, range->node);
+}
+
+// Split the top of the tree into ranges small enough to be built as jobs.
+static void
+SplitBuildJobs(BuildContext *context, int start, int end, int node, int job_leaves)
+{
+	if(end - start <= job_leaves){
+		BuildRange range = {start, end, node, 0};
+		context->jobs[context->job_count++] = range;
+	} else {
+		int split = start + cpSpatialIndexPartitionSAH(context->items + start, end - start);
+		SplitBuildJobs(context, start, split, node + 1, job_leaves);
+		SplitBuildJobs(context, split, end, node + 2*(split - start), job_leaves);
+		
+		BuildRange range = {start, end, node, split};
+		context->top[context->top_count++] = range;
+	}
+}
+
+void
+cpBBTreeOptimizeParallel(cpSpatialIndex *index, cpSpatialIndexJobRunner runner, void *data)
+{
+	if(index->klass != &klass){
+		cpAssertWarn(cpFalse, "Ignoring cpBBTreeOptimizeParallel() call to non-tree spatial index.");
+		return;
 	}
 	
-	// Find the AABB for these nodes
-	cpBB bb = nodes[0]->bb;
-	for(int i=1; i<count; i++) bb = cpBBMerge(bb, nodes[i]->bb);
+	cpBBTree *tree = (cpBBTree *)index;
+	if(tree->root == NODE_NULL) return;
+	
+	int count = cpBBTreeCount(tree);
 	
-	// Split it on it's longest axis
-	cpBool splitWidth = (bb.r - bb.l > bb.t - bb.b);
+	// Leaves, then the job and top ranges.
+	void *scratch = cpcalloc(1, count*(sizeof(cpBuildItem) + 2*sizeof(BuildRange)));
+	BuildContext context = {(cpBuildItem *)scratch, 0, tree->nodes, NULL, NULL, 0, 0};
+	context.jobs = (BuildRange *)(context.items + count);
+	context.top = context.jobs + count;
 	
-	// Sort the bounds and use the median as the splitting point
-	cpFloat *bounds = (cpFloat *)cpcalloc(count*2, sizeof(cpFloat));
-	if(splitWidth){
-		for(int i=0; i<count; i++){
-			bounds[2*i + 0] = nodes[i]->bb.l;
-			bounds[2*i + 1] = nodes[i]->bb.r;
+	cpHashSetEach(tree->leaves, (cpHashSetIteratorFunc)fillBuildItems, &context);
+	
+	// The whole tree is written to a new array, so the jobs don't share a pool of nodes.
+	int node_count = 2*count - 1;
+	int capacity = (tree->nodeCapacity > node_count ? tree->nodeCapacity : node_count);
+	context.nodes = (Node *)cpcalloc(capacity, sizeof(Node));
+	
+	if(runner){
+		// Aim for several jobs per thread so they balance out.
+		int job_leaves = (count/64 > BUILD_JOB_LEAVES ? count/64 : BUILD_JOB_LEAVES);
+		SplitBuildJobs(&context, 0, count, 0, job_leaves);
+		runner((void (*)(void *, int))BuildJob, &context, context.job_count, data);
+		
+		// Join the subtrees built by the jobs. The ranges above them are in post order, so their children are always ready.
+		for(int i=0; i<context.top_count; i++){
+			BuildRange *range = context.top + i;
+			NodeInit(context.nodes, range->node, range->node + 1, range->node + 2*(range->split - range->start));
 		}
 	} else {
-		for(int i=0; i<count; i++){
-			bounds[2*i + 0] = nodes[i]->bb.b;
-			bounds[2*i + 1] = nodes[i]->bb.t;
-		}
+		BuildSubtree(&context, 0, count, 0);
 	}
 	
-	qsort(bounds, count*2, sizeof(cpFloat), (int (*)(const void *, const void *))cpfcompare);
-	cpFloat split = (bounds[count - 1] + bounds[count])*0.5f; // use the medain as the split
-	cpfree(bounds);
+	cpfree(tree->nodes);
+	tree->nodes = context.nodes;
+	tree->nodeCount = node_count;
+	tree->nodeCapacity = capacity;
+	tree->root = 0;
+	tree->pooledNodes = NODE_NULL;
+	
+	cpfree(scratch);
+}
+
+void
+cpBBTreeOptimize(cpSpatialIndex *index)
+{
+	cpBBTreeOptimizeParallel(index, NULL, NULL);
+}
+
+//MARK: Incremental Optimization
+
+// Leaves are reinserted greedily as they move, so the tree slowly loses quality compared to a rebuilt one.
+// Each reindex, a budget of internal nodes are visited and their children are rotated like Box2D's dynamic tree:
+// a child can be swapped with one of its sibling's children when that shrinks the perimeter of the sibling.
+// The leaves under the visited node don't change, so its bounds and the bounds of its ancestors stay the same.
+// Leaves keep their pairs, and the marking functions only need the parent indexes to be consistent.
+
+// Swap the child 'a' of 'node' with 'c', a child of its other child 'b', and refit 'b'.
+static void
+NodeRotate(Node *nodes, int node, int a, int b, int c)
+{
+	if(nodes[node].A == a) NodeSetA(nodes, node, c); else NodeSetB(nodes, node, c);
+	if(nodes[b].A == c) NodeSetA(nodes, b, a); else NodeSetB(nodes, b, a);
+	NodeRefit(nodes, b);
+}
 
-	// Generate the child BBs
-	cpBB a = bb, b = bb;
-	if(splitWidth) a.r = b.l = split; else a.t = b.b = split;
+// Apply the rotation of 'node' that reduces the perimeter of its children the most. Returns true if one was applied.
+static cpBool
+NodeRotateBest(Node *nodes, int node)
+{
+	int a = nodes[node].A, b = nodes[node].B;
+	int best_a = NODE_NULL, best_b = NODE_NULL, best_c = NODE_NULL;
+	cpFloat best_gain = 0.0f;
 	
-	// Partition the nodes
-	int right = count;
-	for(int left=0; left < right;){
-		Node *node = nodes[left];
-		if(cpBBMergedArea(node->bb, b) < cpBBMergedArea(node->bb, a)){
-//		if(cpBBProximity(node->bb, b) < cpBBProximity(node->bb, a)){
-			right--;
-			nodes[left] = nodes[right];
-			nodes[right] = node;
-		} else {
-			left++;
-		}
+	if(!NodeIsLeaf(nodes + b)){
+		cpFloat perimeter = BBPerimeter(nodes[b].bb);
+		
+		// Swap 'a' with b->A, leaving b = (a, b->B).
+		cpFloat gain = perimeter - BBPerimeter(cpBBMerge(nodes[a].bb, nodes[nodes[b].B].bb));
+		if(gain > best_gain){best_gain = gain; best_a = a; best_b = b; best_c = nodes[b].A;}
+		
+		// Swap 'a' with b->B, leaving b = (b->A, a).
+		gain = perimeter - BBPerimeter(cpBBMerge(nodes[nodes[b].A].bb, nodes[a].bb));
+		if(gain > best_gain){best_gain = gain; best_a = a; best_b = b; best_c = nodes[b].B;}
 	}
 	
-	if(right == count){
-		Node *node = NULL;
-		for(int i=0; i<count; i++) node = SubtreeInsert(node, nodes[i], tree);
-		return node;
+	if(!NodeIsLeaf(nodes + a)){
+		cpFloat perimeter = BBPerimeter(nodes[a].bb);
+		
+		cpFloat gain = perimeter - BBPerimeter(cpBBMerge(nodes[b].bb, nodes[nodes[a].B].bb));
+		if(gain > best_gain){best_gain = gain; best_a = b; best_b = a; best_c = nodes[a].A;}
+		
+		gain = perimeter - BBPerimeter(cpBBMerge(nodes[nodes[a].A].bb, nodes[b].bb));
+		if(gain > best_gain){best_gain = gain; best_a = b; best_b = a; best_c = nodes[a].B;}
+	}
+	
+	if(best_c != NODE_NULL){
+		NodeRotate(nodes, node, best_a, best_b, best_c);
+		return cpTrue;
+	} else {
+		return cpFalse;
 	}
+}
+
+// Visit 'budget' internal nodes, trying to rotate each one.
+// Each pass walks up from a leaf chosen by the bits of tree->opath, least significant bit first.
+// Counting opath up alternates between the subtrees at the top of the tree the fastest, so passes spread evenly over the tree.
+static void
+cpBBTreeOptimizeIncremental(cpBBTree *tree, int budget)
+{
+	Node *nodes = tree->nodes;
+	int root = tree->root;
+	if(root == NODE_NULL || NodeIsLeaf(nodes + root)) return;
 	
-	// Recurse and build the node!
-	return NodeNew(tree,
-		partitionNodes(tree, nodes, right),
-		partitionNodes(tree, nodes + right, count - right)
-	);
-}
-
-//static void
-//cpBBTreeOptimizeIncremental(cpBBTree *tree, int passes)
-//{
-//	for(int i=0; i<passes; i++){
-//		Node *root = tree->root;
-//		Node *node = root;
-//		int bit = 0;
-//		unsigned int path = tree->opath;
-//		
-//		while(!NodeIsLeaf(node)){
-//			node = (path&(1<<bit) ? node->a : node->b);
-//			bit = (bit + 1)&(sizeof(unsigned int)*8 - 1);
-//		}
-//		
-//		root = subtreeRemove(root, node, tree);
-//		tree->root = subtreeInsert(root, node, tree);
-//	}
-//}
+	while(budget > 0){
+		unsigned int path = tree->opath++;
+		
+		int node = root;
+		for(int bit = 0; !NodeIsLeaf(nodes + node); bit = (bit + 1)&(sizeof(unsigned int)*8 - 1)){
+			node = (path&(1u<<bit) ? nodes[node].A : nodes[node].B);
+		}
+		
+		for(node = nodes[node].parent; node != NODE_NULL && budget > 0; node = nodes[node].parent, budget--) NodeRotateBest(nodes, node);
+	}
+}
+
+cpBool
+cpSpatialIndexIsBBTree(cpSpatialIndex *index)
+{
+	return (index && index->klass == Klass());
+}
 
 void
-cpBBTreeOptimize(cpSpatialIndex *index)
+cpBBTreeSetRotationBudget(cpSpatialIndex *index, int budget)
 {
-	if(index->klass != &klass){
-		cpAssertWarn(cpFalse, "Ignoring cpBBTreeOptimize() call to non-tree spatial index.");
+	if(index->klass != Klass()){
+		cpAssertWarn(cpFalse, "Ignoring cpBBTreeSetRotationBudget() call to non-tree spatial index.");
 		return;
 	}
 	
-	cpBBTree *tree = (cpBBTree *)index;
-	Node *root = tree->root;
-	if(!root) return;
+	((cpBBTree *)index)->rotationBudget = (budget > 0 ? budget : 0);
+}
+
+int
+cpBBTreeGetRotationBudget(cpSpatialIndex *index)
+{
+	if(index->klass != Klass()){
+		cpAssertWarn(cpFalse, "Ignoring cpBBTreeGetRotationBudget() call to non-tree spatial index.");
+		return 0;
+	}
 	
-	int count = cpBBTreeCount(tree);
-	Node **nodes = (Node **)cpcalloc(count, sizeof(Node *));
-	Node **cursor = nodes;
+	return ((cpBBTree *)index)->rotationBudget;
+}
+
+static cpFloat
+SubtreeCost(Node *nodes, int node)
+{
+	if(NodeIsLeaf(nodes + node)){
+		return 0.0f;
+	} else {
+		return BBPerimeter(nodes[node].bb) + SubtreeCost(nodes, nodes[node].A) + SubtreeCost(nodes, nodes[node].B);
+	}
+}
+
+cpFloat
+cpBBTreeGetCost(cpSpatialIndex *index)
+{
+	if(index->klass != Klass()){
+		cpAssertWarn(cpFalse, "Ignoring cpBBTreeGetCost() call to non-tree spatial index.");
+		return 0.0f;
+	}
 	
-	cpHashSetEach(tree->leaves, (cpHashSetIteratorFunc)fillNodeArray, &cursor);
+	cpBBTree *tree = (cpBBTree *)index;
+	Node *nodes = tree->nodes;
+	int root = tree->root;
+	if(root == NODE_NULL || NodeIsLeaf(nodes + root)) return 0.0f;
 	
-	SubtreeRecycle(tree, root);
-	tree->root = partitionNodes(tree, nodes, count);
-	cpfree(nodes);
+	cpFloat perimeter = BBPerimeter(nodes[root].bb);
+	return (perimeter > 0.0f ? SubtreeCost(nodes, root)/perimeter : 0.0f);
 }
 
 //MARK: Debug Draw
@@ -856,14 +1202,14 @@ cpBBTreeOptimize(cpSpatialIndex *index)
 #include <GLUT/glut.h>
 
 static void
-NodeRender(Node *node, int depth)
+NodeRender(Node *nodes, int node, int depth)
 {
-	if(!NodeIsLeaf(node) && depth <= 10){
-		NodeRender(node->a, depth + 1);
-		NodeRender(node->b, depth + 1);
+	if(!NodeIsLeaf(nodes + node) && depth <= 10){
+		NodeRender(nodes, nodes[node].A, depth + 1);
+		NodeRender(nodes, nodes[node].B, depth + 1);
 	}
 	
-	cpBB bb = node->bb;
+	cpBB bb = nodes[node].bb;
 	
 //	GLfloat v = depth/2.0f;	
 //	glColor3f(1.0f - v, v, 0.0f);
@@ -891,6 +1237,6 @@ cpBBTreeRenderDebug(cpSpatialIndex *index){
 	}
 	
 	cpBBTree *tree = (cpBBTree *)index;
-	if(tree->root) NodeRender(tree->root, 0);
+	if(tree->root != NODE_NULL) NodeRender(tree->nodes, tree->root, 0);
 }
 #endif
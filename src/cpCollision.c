@@ -41,6 +41,14 @@
 #define WARN_GJK_ITERATIONS 20
 #define WARN_EPA_ITERATIONS 20
 
+// Set in a collision hint when bits 0-15 store a third minkowski point that makes a triangle around the origin with the cached edge.
+#define TRIANGLE_HINT_FLAG ((cpCollisionID)1<<16)
+// Bits of a collision hint that store the axis found by the separating axis test.
+// Bit 31 marks the axis as valid, bit 30 selects a face of the second poly, and bits 24-29 are the index of the face.
+#define SAT_HINT_MASK ((cpCollisionID)0xFF<<24)
+#define SAT_HINT_FLAG ((cpCollisionID)1<<31)
+#define SAT_HINT_POLY2 ((cpCollisionID)1<<30)
+
 static inline void
 cpCollisionInfoPushContact(struct cpCollisionInfo *info, cpVect p1, cpVect p2, cpHashValue hash)
 {
@@ -77,6 +85,51 @@ PolySupportPointIndex(const int count, const struct cpSplittingPlane *planes, co
 	return index;
 }
 
+// Polys with more vertices than this find their support points by hill climbing instead of checking every vertex.
+#define POLY_HILL_CLIMB_COUNT 8
+
+// The dot products around a convex poly only rise once and fall once, so walking uphill from any vertex finds the support point.
+// Starting from the support point of a nearby axis usually only takes a step or two.
+static inline int
+PolyClimbSupportPointIndex(const int count, const struct cpSplittingPlane *planes, const cpVect n, const int start)
+{
+	int index = (start < count ? start : 0);
+	cpFloat max = cpvdot(planes[index].v0, n);
+	
+	int next = (index + 1 == count ? 0 : index + 1);
+	cpFloat d = cpvdot(planes[next].v0, n);
+	if(d > max){
+		do {
+			index = next;
+			max = d;
+			next = (index + 1 == count ? 0 : index + 1);
+			d = cpvdot(planes[next].v0, n);
+		} while(d > max);
+	} else {
+		int prev = (index == 0 ? count - 1 : index - 1);
+		d = cpvdot(planes[prev].v0, n);
+		while(d > max){
+			index = prev;
+			max = d;
+			prev = (index == 0 ? count - 1 : index - 1);
+			d = cpvdot(planes[prev].v0, n);
+		}
+	}
+	
+	return index;
+}
+
+// Find the support point index of a poly, starting the search from a hint for large polys.
+static inline int
+PolySupportPointIndexHint(const int count, const struct cpSplittingPlane *planes, const cpVect n, const int hint)
+{
+	if(count > POLY_HILL_CLIMB_COUNT){
+		return PolyClimbSupportPointIndex(count, planes, n, hint);
+	} else {
+		return PolySupportPointIndex(count, planes, n);
+	}
+}
+
 struct SupportPoint {
 	cpVect p;
 	// Save an index of the point so it can be cheaply looked up as a starting point for the next frame.
@@ -90,16 +143,17 @@ SupportPointNew(cpVect p, cpCollisionID index)
 	return point;
 }
 
-typedef struct SupportPoint (*SupportPointFunc)(const cpShape *shape, const cpVect n);
+// The hint is the index of a nearby support point to start searching from.
+typedef struct SupportPoint (*SupportPointFunc)(const cpShape *shape, const cpVect n, const int hint);
 
 static inline struct SupportPoint
-CircleSupportPoint(const cpCircleShape *circle, const cpVect n)
+CircleSupportPoint(const cpCircleShape *circle, const cpVect n, const int hint)
 {
 	return SupportPointNew(circle->tc, 0);
 }
 
 static inline struct SupportPoint
-SegmentSupportPoint(const cpSegmentShape *seg, const cpVect n)
+SegmentSupportPoint(const cpSegmentShape *seg, const cpVect n, const int hint)
 {
 	if(cpvdot(seg->ta, n) > cpvdot(seg->tb, n)){
 		return SupportPointNew(seg->ta, 0);
@@ -109,10 +163,10 @@ SegmentSupportPoint(const cpSegmentShape *seg, const cpVect n)
 }
 
 static inline struct SupportPoint
-PolySupportPoint(const cpPolyShape *poly, const cpVect n)
+PolySupportPoint(const cpPolyShape *poly, const cpVect n, const int hint)
 {
 	const struct cpSplittingPlane *planes = poly->planes;
-	int i = PolySupportPointIndex(poly->count, planes, n);
+	int i = PolySupportPointIndexHint(poly->count, planes, n, hint);
 	return SupportPointNew(planes[i].v0, i);
 }
 
@@ -139,11 +193,12 @@ struct SupportContext {
 };
 
 // Calculate the maximal point on the minkowski difference of two shapes along a particular axis.
+// The support point indexes in the hint's id are where the search starts.
 static inline struct MinkowskiPoint
-Support(const struct SupportContext *ctx, const cpVect n)
+Support(const struct SupportContext *ctx, const cpVect n, const cpCollisionID hint)
 {
-	struct SupportPoint a = ctx->func1(ctx->shape1, cpvneg(n));
-	struct SupportPoint b = ctx->func2(ctx->shape2, n);
+	struct SupportPoint a = ctx->func1(ctx->shape1, cpvneg(n), (hint>>8)&0xFF);
+	struct SupportPoint b = ctx->func2(ctx->shape2, n, hint&0xFF);
 	return MinkowskiPointNew(a, b);
 }
 
@@ -161,10 +216,10 @@ struct Edge {
 };
 
 static struct Edge
-SupportEdgeForPoly(const cpPolyShape *poly, const cpVect n)
+SupportEdgeForPoly(const cpPolyShape *poly, const cpVect n, const int hint)
 {
 	int count = poly->count;
-	int i1 = PolySupportPointIndex(poly->count, poly->planes, n);
+	int i1 = PolySupportPointIndexHint(poly->count, poly->planes, n, hint);
 	
 	// TODO: get rid of mod eventually, very expensive on ARM
 	int i0 = (i1 - 1 + count)%count;
@@ -221,6 +276,10 @@ struct ClosestPoints {
 	cpFloat d;
 	// Concatenation of the id's of the minkoski points.
 	cpCollisionID id;
+	// Features EPA found that are worth caching along with the id. (See TRIANGLE_HINT_FLAG)
+	cpCollisionID hint;
+	// Number of GJK and EPA iterations it took to find the points.
+	int gjkIterations, epaIterations;
 };
 
 // Calculate the closest points on two shapes given the closest edge on their minkowski difference to (0, 0)
@@ -288,7 +347,7 @@ EPARecurse(const struct SupportContext *ctx, const int count, const struct Minko
 	cpAssertSoft(!cpveql(v0.ab, v1.ab), "Internal Error: EPA vertexes are the same (%d and %d)", mini, (mini + 1)%count);
 	
 	// Check if there is a point on the minkowski difference beyond this edge.
-	struct MinkowskiPoint p = Support(ctx, cpvperp(cpvsub(v1.ab, v0.ab)));
+	struct MinkowskiPoint p = Support(ctx, cpvperp(cpvsub(v1.ab, v0.ab)), v0.id);
 	
 #if DRAW_EPA
 	cpVect verts[count];
@@ -327,7 +386,18 @@ EPARecurse(const struct SupportContext *ctx, const int count, const struct Minko
 	} else {
 		// Could not find a new point to insert, so we have found the closest edge of the minkowski difference.
 		cpAssertWarn(iteration < WARN_EPA_ITERATIONS, "High EPA iterations: %d", iteration);
-		return ClosestPointsNew(v0, v1);
+		struct ClosestPoints points = ClosestPointsNew(v0, v1);
+		points.epaIterations = iteration;
+		
+		// Cache the hull point farthest behind the edge too. It usually still makes a triangle around the origin next frame.
+		cpVect n = cpvperp(cpvsub(v1.ab, v0.ab));
+		int far = (mini + 2)%count;
+		for(int i=0; i<count; i++){
+			if(cpvdot(hull[i].ab, n) < cpvdot(hull[far].ab, n)) far = i;
+		}
+		
+		points.hint = TRIANGLE_HINT_FLAG | (hull[far].id & 0xFFFF);
+		return points;
 	}
 }
 
@@ -350,7 +420,9 @@ GJKRecurse(const struct SupportContext *ctx, const struct MinkowskiPoint v0, con
 {
 	if(iteration > MAX_GJK_ITERATIONS){
 		cpAssertWarn(iteration < WARN_GJK_ITERATIONS, "High GJK iterations: %d", iteration);
-		return ClosestPointsNew(v0, v1);
+		struct ClosestPoints points = ClosestPointsNew(v0, v1);
+		points.gjkIterations = iteration;
+		return points;
 	}
 	
 	if(cpCheckPointGreater(v1.ab, v0.ab, cpvzero)){
@@ -359,7 +431,7 @@ GJKRecurse(const struct SupportContext *ctx, const struct MinkowskiPoint v0, con
 	} else {
 		cpFloat t = ClosestT(v0.ab, v1.ab);
 		cpVect n = (-1.0f < t && t < 1.0f ? cpvperp(cpvsub(v1.ab, v0.ab)) : cpvneg(LerpT(v0.ab, v1.ab, t)));
-		struct MinkowskiPoint p = Support(ctx, n);
+		struct MinkowskiPoint p = Support(ctx, n, v0.id);
 		
 #if DRAW_GJK
 		ChipmunkDebugDrawSegment(v0.ab, v1.ab, RGBAColor(1, 1, 1, 1));
@@ -372,12 +444,16 @@ GJKRecurse(const struct SupportContext *ctx, const struct MinkowskiPoint v0, con
 		if(cpCheckPointGreater(p.ab, v0.ab, cpvzero) && cpCheckPointGreater(v1.ab, p.ab, cpvzero)){
 			// The triangle v0, p, v1 contains the origin. Use EPA to find the MSA.
 			cpAssertWarn(iteration < WARN_GJK_ITERATIONS, "High GJK->EPA iterations: %d", iteration);
-			return EPA(ctx, v0, p, v1);
+			struct ClosestPoints points = EPA(ctx, v0, p, v1);
+			points.gjkIterations = iteration;
+			return points;
 		} else {
 			if(cpCheckAxis(v0.ab, v1.ab, p.ab, n)){
 				// The edge v0, v1 that we already have is the closest to (0, 0) since p was not closer.
 				cpAssertWarn(iteration < WARN_GJK_ITERATIONS, "High GJK iterations: %d", iteration);
-				return ClosestPointsNew(v0, v1);
+				struct ClosestPoints points = ClosestPointsNew(v0, v1);
+				points.gjkIterations = iteration;
+				return points;
 			} else {
 				// p was closer to the origin than our existing edge.
 				// Need to figure out which existing point to drop.
@@ -413,8 +489,9 @@ ShapePoint(const cpShape *shape, const int i)
 }
 
 // Find the closest points between two shapes using the GJK algorithm.
+// The collision id and hint in info are used as the starting point, and are updated along with the iteration counts.
 static struct ClosestPoints
-GJK(const struct SupportContext *ctx, cpCollisionID *id)
+GJK(const struct SupportContext *ctx, struct cpCollisionInfo *info)
 {
 #if DRAW_GJK || DRAW_EPA
 	int count1 = 1;
@@ -454,20 +531,42 @@ GJK(const struct SupportContext *ctx, cpCollisionID *id)
 	ChipmunkDebugDrawPolygon(hullCount, hullVerts, 0.0, RGBAColor(1, 0, 0, 1), RGBAColor(1, 0, 0, 0.25));
 #endif
 	
+	cpCollisionID id = info->id, hint = info->hint;
 	struct MinkowskiPoint v0, v1;
-	if(*id){
+	if(id){
 		// Use the minkowski points from the last frame as a starting point using the cached indexes.
-		v0 = MinkowskiPointNew(ShapePoint(ctx->shape1, (*id>>24)&0xFF), ShapePoint(ctx->shape2, (*id>>16)&0xFF));
-		v1 = MinkowskiPointNew(ShapePoint(ctx->shape1, (*id>> 8)&0xFF), ShapePoint(ctx->shape2, (*id    )&0xFF));
+		v0 = MinkowskiPointNew(ShapePoint(ctx->shape1, (id>>24)&0xFF), ShapePoint(ctx->shape2, (id>>16)&0xFF));
+		v1 = MinkowskiPointNew(ShapePoint(ctx->shape1, (id>> 8)&0xFF), ShapePoint(ctx->shape2, (id    )&0xFF));
+		
+		if(hint & TRIANGLE_HINT_FLAG){
+			// The shapes overlapped last frame. If the cached triangle still contains the origin they still do,
+			// and EPA can start from it without running GJK again to rediscover that.
+			struct MinkowskiPoint p = MinkowskiPointNew(ShapePoint(ctx->shape1, (hint>>8)&0xFF), ShapePoint(ctx->shape2, hint&0xFF));
+			if(
+				cpCheckPointGreater(v1.ab, v0.ab, cpvzero) &&
+				cpCheckPointGreater(p.ab, v1.ab, cpvzero) &&
+				cpCheckPointGreater(v0.ab, p.ab, cpvzero)
+			){
+				struct ClosestPoints points = EPA(ctx, v1, p, v0);
+				info->id = points.id;
+				info->hint = points.hint;
+				info->gjkIterations = 0;
+				info->epaIterations = points.epaIterations;
+				return points;
+			}
+		}
 	} else {
 		// No cached indexes, use the shapes' bounding box centers as a guess for a starting axis.
 		cpVect axis = cpvperp(cpvsub(cpBBCenter(ctx->shape1->bb), cpBBCenter(ctx->shape2->bb)));
-		v0 = Support(ctx, axis);
-		v1 = Support(ctx, cpvneg(axis));
+		v0 = Support(ctx, axis, 0);
+		v1 = Support(ctx, cpvneg(axis), 0);
 	}
 	
 	struct ClosestPoints points = GJKRecurse(ctx, v0, v1, 1);
-	*id = points.id;
+	info->id = points.id;
+	info->hint = points.hint;
+	info->gjkIterations = points.gjkIterations;
+	info->epaIterations = points.epaIterations;
 	return points;
 }
 
@@ -517,10 +616,134 @@ ContactPoints(const struct Edge e1, const struct Edge e2, const struct ClosestPo
 	}
 }
 
+//MARK: Separating Axis Test
+
+// Distance from a face of poly1 to the vertex of poly2 that is the farthest behind it.
+static inline cpFloat
+PolyFaceSeparation(const cpPolyShape *poly1, const cpPolyShape *poly2, const int face, int *vertex)
+{
+	struct cpSplittingPlane plane = poly1->planes[face];
+	int i = PolySupportPointIndex(poly2->count, poly2->planes, cpvneg(plane.n));
+	
+	*vertex = i;
+	return cpvdot(plane.n, cpvsub(poly2->planes[i].v0, plane.v0));
+}
+
+// Find the face of poly1 that poly2 is the farthest in front of.
+// Stops early if it finds one with a separation greater than max.
+static cpFloat
+PolyMaxSeparation(const cpPolyShape *poly1, const cpPolyShape *poly2, const cpFloat max, int *face, int *vertex)
+{
+	cpFloat separation = -INFINITY;
+	
+	for(int i=0; i<poly1->count; i++){
+		int v;
+		cpFloat s = PolyFaceSeparation(poly1, poly2, i, &v);
+		if(s > separation){
+			separation = s;
+			*face = i;
+			*vertex = v;
+			
+			if(s > max) break;
+		}
+	}
+	
+	return separation;
+}
+
+// Check if the vertex of poly2 is closest to the inside of the face of poly1 instead of one of its endpoints.
+static inline cpBool
+PolyFaceContainsVertex(const cpPolyShape *poly1, const int face, const cpPolyShape *poly2, const int vertex)
+{
+	cpVect a = poly1->planes[(face - 1 + poly1->count)%poly1->count].v0;
+	cpVect b = poly1->planes[face].v0;
+	cpVect delta = cpvsub(b, a);
+	cpFloat t = cpvdot(cpvsub(poly2->planes[vertex].v0, a), delta);
+	return (0.0f <= t && t <= cpvlengthsq(delta));
+}
+
+// Collision hint that caches a face of poly1 or poly2 as the separating axis for the next frame.
+static inline cpCollisionID
+SATCollisionHint(const cpCollisionID hint, const cpBool second, const int face)
+{
+	return (hint & ~SAT_HINT_MASK) | SAT_HINT_FLAG | (second ? SAT_HINT_POLY2 : 0) | (cpCollisionID)face<<24;
+}
+
+// Collide two small polys using the separating axis test instead of GJK and EPA.
+// The separating axis from the last frame is cached in the collision hint and checked first.
+// Returns false if the closest features might be two vertexes, which needs GJK to find the distance.
+static cpBool
+PolyToPolySAT(const cpPolyShape *poly1, const cpPolyShape *poly2, struct cpCollisionInfo *info)
+{
+	cpFloat rsum = poly1->r + poly2->r;
+	cpCollisionID hint = info->hint;
+	
+	// Shapes that weren't touching are usually still separated by the same axis.
+	if(hint & SAT_HINT_FLAG){
+		int face = (int)((hint>>24)&0x3F), vertex;
+		cpBool second = ((hint & SAT_HINT_POLY2) != 0);
+		const cpPolyShape *ref = (second ? poly2 : poly1);
+		if(face < ref->count && PolyFaceSeparation(ref, (second ? poly1 : poly2), face, &vertex) > rsum) return cpTrue;
+	}
+	
+	int face1 = 0, vertex1 = 0;
+	cpFloat s1 = PolyMaxSeparation(poly1, poly2, rsum, &face1, &vertex1);
+	if(s1 > rsum){
+		info->hint = SATCollisionHint(hint, cpFalse, face1);
+		return cpTrue;
+	}
+	
+	int face2 = 0, vertex2 = 0;
+	cpFloat s2 = PolyMaxSeparation(poly2, poly1, rsum, &face2, &vertex2);
+	if(s2 > rsum){
+		info->hint = SATCollisionHint(hint, cpTrue, face2);
+		return cpTrue;
+	}
+	
+	cpBool second = (s2 > s1);
+	if(cpfmax(s1, s2) > 0.0f){
+		// The cores are separated. A face with the closest vertex in front of it has the exact distance as its separation.
+		// If neither best face does, the closest features are two vertexes and GJK needs to find the distance.
+		cpBool contains1 = (s1 > 0.0f && PolyFaceContainsVertex(poly1, face1, poly2, vertex1));
+		cpBool contains2 = (s2 > 0.0f && PolyFaceContainsVertex(poly2, face2, poly1, vertex2));
+		if(!contains1 && !contains2) return cpFalse;
+		if(second ? !contains2 : !contains1) second = !second;
+	}
+	
+	info->hint = SATCollisionHint(hint, second, (second ? face2 : face1));
+	
+	// The MSA is the normal of the face, pointing from poly1 towards poly2.
+	struct ClosestPoints points;
+	if(second){
+		cpVect n = cpvneg(poly2->planes[face2].n);
+		cpVect pa = poly1->planes[vertex2].v0;
+		struct ClosestPoints sat = {pa, cpvadd(pa, cpvmult(n, s2)), n, s2, 0};
+		points = sat;
+	} else {
+		cpVect n = poly1->planes[face1].n;
+		cpVect pb = poly2->planes[vertex1].v0;
+		struct ClosestPoints sat = {cpvsub(pb, cpvmult(n, s1)), pb, n, s1, 0};
+		points = sat;
+	}
+	
+	int hint1 = (second ? vertex2 : face1), hint2 = (second ? face2 : vertex1);
+	ContactPoints(SupportEdgeForPoly(poly1, points.n, hint1), SupportEdgeForPoly(poly2, cpvneg(points.n), hint2), points, info);
+	return cpTrue;
+}
+
 //MARK: Collision Functions
 
 typedef void (*CollisionFunc)(const cpShape *a, const cpShape *b, struct cpCollisionInfo *info);
 
+// Push the contact for two overlapping circles.
+static inline void
+CircleToCircleContact(const cpCircleShape *c1, const cpCircleShape *c2, cpVect delta, cpFloat distsq, struct cpCollisionInfo *info)
+{
+	cpFloat dist = cpfsqrt(distsq);
+	cpVect n = info->n = (dist ? cpvmult(delta, 1.0f/dist) : cpv(1.0f, 0.0f));
+	cpCollisionInfoPushContact(info, cpvadd(c1->tc, cpvmult(n, c1->r)), cpvadd(c2->tc, cpvmult(n, -c2->r)), 0);
+}
+
 // Collide circle shapes.
 static void
 CircleToCircle(const cpCircleShape *c1, const cpCircleShape *c2, struct cpCollisionInfo *info)
@@ -529,11 +752,7 @@ CircleToCircle(const cpCircleShape *c1, const cpCircleShape *c2, struct cpCollis
 	cpVect delta = cpvsub(c2->tc, c1->tc);
 	cpFloat distsq = cpvlengthsq(delta);
 	
-	if(distsq < mindist*mindist){
-		cpFloat dist = cpfsqrt(distsq);
-		cpVect n = info->n = (dist ? cpvmult(delta, 1.0f/dist) : cpv(1.0f, 0.0f));
-		cpCollisionInfoPushContact(info, cpvadd(c1->tc, cpvmult(n, c1->r)), cpvadd(c2->tc, cpvmult(n, -c2->r)), 0);
-	}
+	if(distsq < mindist*mindist) CircleToCircleContact(c1, c2, delta, distsq, info);
 }
 
 static void
@@ -572,7 +791,7 @@ static void
 SegmentToSegment(const cpSegmentShape *seg1, const cpSegmentShape *seg2, struct cpCollisionInfo *info)
 {
 	struct SupportContext context = {(cpShape *)seg1, (cpShape *)seg2, (SupportPointFunc)SegmentSupportPoint, (SupportPointFunc)SegmentSupportPoint};
-	struct ClosestPoints points = GJK(&context, &info->id);
+	struct ClosestPoints points = GJK(&context, info);
 	
 #if DRAW_CLOSEST
 #if PRINT_LOG
@@ -606,8 +825,14 @@ SegmentToSegment(const cpSegmentShape *seg1, const cpSegmentShape *seg2, struct
 static void
 PolyToPoly(const cpPolyShape *poly1, const cpPolyShape *poly2, struct cpCollisionInfo *info)
 {
+	// Small polys like boxes are faster to collide with the separating axis test.
+	if(
+		poly1->count <= CP_POLY_SHAPE_INLINE_ALLOC && poly2->count <= CP_POLY_SHAPE_INLINE_ALLOC &&
+		PolyToPolySAT(poly1, poly2, info)
+	) return;
+	
 	struct SupportContext context = {(cpShape *)poly1, (cpShape *)poly2, (SupportPointFunc)PolySupportPoint, (SupportPointFunc)PolySupportPoint};
-	struct ClosestPoints points = GJK(&context, &info->id);
+	struct ClosestPoints points = GJK(&context, info);
 	
 #if DRAW_CLOSEST
 #if PRINT_LOG
@@ -622,7 +847,9 @@ PolyToPoly(const cpPolyShape *poly1, const cpPolyShape *poly2, struct cpCollisio
 	
 	// If the closest points are nearer than the sum of the radii...
 	if(points.d - poly1->r - poly2->r <= 0.0){
-		ContactPoints(SupportEdgeForPoly(poly1, points.n), SupportEdgeForPoly(poly2, cpvneg(points.n)), points, info);
+		// The closest points' id has the support point indexes of the closest features to start from.
+		int hint1 = (points.id>>24)&0xFF, hint2 = (points.id>>16)&0xFF;
+		ContactPoints(SupportEdgeForPoly(poly1, points.n, hint1), SupportEdgeForPoly(poly2, cpvneg(points.n), hint2), points, info);
 	}
 }
 
@@ -630,7 +857,7 @@ static void
 SegmentToPoly(const cpSegmentShape *seg, const cpPolyShape *poly, struct cpCollisionInfo *info)
 {
 	struct SupportContext context = {(cpShape *)seg, (cpShape *)poly, (SupportPointFunc)SegmentSupportPoint, (SupportPointFunc)PolySupportPoint};
-	struct ClosestPoints points = GJK(&context, &info->id);
+	struct ClosestPoints points = GJK(&context, info);
 	
 #if DRAW_CLOSEST
 #if PRINT_LOG
@@ -654,7 +881,7 @@ SegmentToPoly(const cpSegmentShape *seg, const cpPolyShape *poly, struct cpColli
 			(!cpveql(points.a, seg->tb) || cpvdot(n, cpvrotate(seg->b_tangent, rot)) <= 0.0)
 		)
 	){
-		ContactPoints(SupportEdgeForSegment(seg, n), SupportEdgeForPoly(poly, cpvneg(n)), points, info);
+		ContactPoints(SupportEdgeForSegment(seg, n), SupportEdgeForPoly(poly, cpvneg(n), (points.id>>16)&0xFF), points, info);
 	}
 }
 
@@ -662,7 +889,7 @@ static void
 CircleToPoly(const cpCircleShape *circle, const cpPolyShape *poly, struct cpCollisionInfo *info)
 {
 	struct SupportContext context = {(cpShape *)circle, (cpShape *)poly, (SupportPointFunc)CircleSupportPoint, (SupportPointFunc)PolySupportPoint};
-	struct ClosestPoints points = GJK(&context, &info->id);
+	struct ClosestPoints points = GJK(&context, info);
 	
 #if DRAW_CLOSEST
 	ChipmunkDebugDrawDot(3.0, points.a, RGBAColor(1, 1, 1, 1));
@@ -699,17 +926,11 @@ static const CollisionFunc BuiltinCollisionFuncs[9] = {
 static const CollisionFunc *CollisionFuncs = BuiltinCollisionFuncs;
 
 struct cpCollisionInfo
-cpCollide(const cpShape *a, const cpShape *b, cpCollisionID id, struct cpContact *contacts)
+cpCollide(const cpShape *a, const cpShape *b, cpCollisionID id, cpCollisionID hint, struct cpContact *contacts)
 {
-	struct cpCollisionInfo info = {a, b, id, cpvzero, 0, contacts};
-	
-	// Make sure the shape types are in order.
-	if(a->klass->type > b->klass->type){
-		info.a = b;
-		info.b = a;
-	}
-	
-	CollisionFuncs[info.a->klass->type + info.b->klass->type*CP_NUM_SHAPES](info.a, info.b, &info);
+	struct cpCollisionInfo info = cpCollisionInfoInit(a, b, id, contacts);
+	info.hint = hint;
+	CollisionFuncs[cpCollisionFuncIndex(info.a, info.b)](info.a, info.b, &info);
 	
 //	if(0){
 //		for(int i=0; i<info.count; i++){
@@ -724,3 +945,90 @@ cpCollide(const cpShape *a, const cpShape *b, cpCollisionID id, struct cpContact
 	
 	return info;
 }
+
+//MARK: Batched Collision Functions
+
+// Pairs are tested in blocks of this size so their values can be gathered into arrays on the stack.
+#define BATCH_SIZE 64
+
+// Collide circle shapes.
+// The distance test is done for a whole block at once, and only the overlapping pairs make contacts.
+static void
+CircleToCircleBatch(struct cpCollisionInfo **infos, int count)
+{
+	cpFloat dx[BATCH_SIZE], dy[BATCH_SIZE], mindist[BATCH_SIZE];
+	cpBool overlap[BATCH_SIZE];
+	
+	for(int start=0; start<count; start+=BATCH_SIZE){
+		struct cpCollisionInfo **batch = infos + start;
+		int n = (count - start < BATCH_SIZE ? count - start : BATCH_SIZE);
+		
+		for(int i=0; i<n; i++){
+			const cpCircleShape *c1 = (cpCircleShape *)batch[i]->a, *c2 = (cpCircleShape *)batch[i]->b;
+			dx[i] = c2->tc.x - c1->tc.x;
+			dy[i] = c2->tc.y - c1->tc.y;
+			mindist[i] = c1->r + c2->r;
+		}
+		
+		for(int i=0; i<n; i++){
+			overlap[i] = (dx[i]*dx[i] + dy[i]*dy[i] < mindist[i]*mindist[i]);
+		}
+		
+		for(int i=0; i<n; i++){
+			if(!overlap[i]) continue;
+			
+			cpVect delta = cpv(dx[i], dy[i]);
+			CircleToCircleContact((cpCircleShape *)batch[i]->a, (cpCircleShape *)batch[i]->b, delta, cpvlengthsq(delta), batch[i]);
+		}
+	}
+}
+
+// Collide circles with polygons.
+// The circle is outside of the rounded polygon if its center is farther than the radii from the plane of any edge.
+// That rejects most of the pairs without running GJK, and the rest are collided normally by CircleToPoly().
+static void
+CircleToPolyBatch(struct cpCollisionInfo **infos, int count)
+{
+	cpFloat separation[BATCH_SIZE], rsum[BATCH_SIZE];
+	
+	for(int start=0; start<count; start+=BATCH_SIZE){
+		struct cpCollisionInfo **batch = infos + start;
+		int n = (count - start < BATCH_SIZE ? count - start : BATCH_SIZE);
+		
+		for(int i=0; i<n; i++){
+			const cpCircleShape *circle = (cpCircleShape *)batch[i]->a;
+			const cpPolyShape *poly = (cpPolyShape *)batch[i]->b;
+			const struct cpSplittingPlane *planes = poly->planes;
+			cpVect c = circle->tc;
+			
+			cpFloat max = -INFINITY;
+			for(int j=0; j<poly->count; j++){
+				cpFloat d = (c.x - planes[j].v0.x)*planes[j].n.x + (c.y - planes[j].v0.y)*planes[j].n.y;
+				max = cpfmax(max, d);
+			}
+			
+			separation[i] = max;
+			rsum[i] = circle->r + poly->r;
+		}
+		
+		for(int i=0; i<n; i++){
+			if(separation[i] <= rsum[i]) CircleToPoly((cpCircleShape *)batch[i]->a, (cpPolyShape *)batch[i]->b, batch[i]);
+		}
+	}
+}
+
+void
+cpCollideBatch(struct cpCollisionInfo **infos, int count)
+{
+	if(count == 0) return;
+	
+	int type = cpCollisionFuncIndex(infos[0]->a, infos[0]->b);
+	if(type == CP_CIRCLE_SHAPE + CP_CIRCLE_SHAPE*CP_NUM_SHAPES){
+		CircleToCircleBatch(infos, count);
+	} else if(type == CP_CIRCLE_SHAPE + CP_POLY_SHAPE*CP_NUM_SHAPES){
+		CircleToPolyBatch(infos, count);
+	} else {
+		CollisionFunc func = CollisionFuncs[type];
+		for(int i=0; i<count; i++) func(infos[i]->a, infos[i]->b, infos[i]);
+	}
+}
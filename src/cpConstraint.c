@@ -126,6 +126,17 @@ void
 cpConstraintSetCollideBodies(cpConstraint *constraint, cpBool collideBodies)
 {
 	cpConstraintActivateBodies(constraint);
+	
+	// Keep the space's set of no-collide pairs in sync.
+	cpSpace *space = constraint->space;
+	if(space && !collideBodies != !constraint->collideBodies){
+		if(collideBodies){
+			cpSpaceRemoveNoCollidePair(space, constraint->a, constraint->b);
+		} else {
+			cpSpaceAddNoCollidePair(space, constraint->a, constraint->b);
+		}
+	}
+	
 	constraint->collideBodies = collideBodies;
 }
 
@@ -0,0 +1,519 @@
+/* Copyright (c) 2013 Scott Lembcke and Howling Moon Software
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include "chipmunk/chipmunk_private.h"
+
+static inline cpSpatialIndexClass *Klass(void);
+
+//MARK: Basic Structures
+
+// Each level's cells are twice the size of the level below it.
+// An object goes in the lowest level with cells at least as large as the object, in the cell that contains its center.
+// So overlapping objects on the same level are always in the same or adjacent cells.
+#define HGRID_MAX_LEVELS 16
+
+// Cell coordinates are clamped to this range so far away or non-finite bounding boxes can't overflow an int.
+#define HGRID_MAX_CELL (1 << 29)
+
+typedef struct Entry {
+	void *obj;
+	cpBB bb;
+	int x, y, level;
+} Entry;
+
+struct cpHGrid {
+	cpSpatialIndex spatialIndex;
+	
+	// The objects themselves are the elements of the set.
+	cpHashSet *objects;
+	
+	// The cell size of the lowest level. 0 picks it from the smallest object.
+	cpFloat celldim;
+	
+	// The grid built by the last update.
+	cpFloat cellSize[HGRID_MAX_LEVELS];
+	int levelCount[HGRID_MAX_LEVELS];
+	
+	// Each level is hashed into its own range of buckets, from levelBucket[level] to levelBucket[level + 1] - 1.
+	// The size of each range is a power of two.
+	int levelBucket[HGRID_MAX_LEVELS + 1];
+	
+	// The entries in bucket i are entries[bucketStart[i]] to entries[bucketStart[i + 1] - 1].
+	int *bucketStart;
+	int bucketCapacity;
+	
+	Entry *entries;
+	int count, capacity;
+	
+	// Entries in the order they were gathered, and the buckets they belong to.
+	Entry *gatherEntries;
+	int *gatherBuckets;
+	
+	// Objects were added, removed or reindexed since the grid was built.
+	cpBool dirty;
+	
+	cpCollideStaticBuffer staticBuffer;
+};
+
+// Much faster than (int)floor(f)
+static inline int
+floor_int(cpFloat f)
+{
+	// Also catches NaN.
+	if(!(f > -HGRID_MAX_CELL)) return -HGRID_MAX_CELL;
+	if(f > HGRID_MAX_CELL) return HGRID_MAX_CELL;
+	
+	int i = (int)f;
+	return (f < 0.0f && f != i ? i - 1 : i);
+}
+
+static inline int
+HGridBucket(cpHGrid *grid, int x, int y, int level)
+{
+	int start = grid->levelBucket[level];
+	unsigned int mask = (unsigned int)(grid->levelBucket[level + 1] - start - 1);
+	return start + (int)(((unsigned int)x*73856093u ^ (unsigned int)y*19349663u) & mask);
+}
+
+//MARK: Building
+
+static void
+GatherObject(void *obj, cpHGrid *grid)
+{
+	Entry *entry = grid->gatherEntries + grid->count++;
+	entry->obj = obj;
+	entry->bb = grid->spatialIndex.bbfunc(obj);
+}
+
+static void
+ReserveEntries(cpHGrid *grid, int count)
+{
+	if(count <= grid->capacity) return;
+	
+	int capacity = (count > 2*grid->capacity ? count : 2*grid->capacity);
+	grid->capacity = capacity;
+	grid->entries = (Entry *)cprealloc(grid->entries, capacity*sizeof(Entry));
+	grid->gatherEntries = (Entry *)cprealloc(grid->gatherEntries, capacity*sizeof(Entry));
+	grid->gatherBuckets = (int *)cprealloc(grid->gatherBuckets, capacity*sizeof(int));
+}
+
+static inline cpFloat
+BBExtent(cpBB bb)
+{
+	return cpfmax(bb.r - bb.l, bb.t - bb.b);
+}
+
+// Picks the cell sizes and assigns each gathered entry to a level.
+static void
+AssignLevels(cpHGrid *grid)
+{
+	int count = grid->count;
+	Entry *entries = grid->gatherEntries;
+	
+	cpFloat minExtent = INFINITY, maxExtent = 0.0f;
+	for(int i=0; i<count; i++){
+		cpFloat extent = BBExtent(entries[i].bb);
+		if(extent > 0.0f) minExtent = cpfmin(minExtent, extent);
+		maxExtent = cpfmax(maxExtent, extent);
+	}
+	
+	// Make sure the largest object fits in the top level.
+	cpFloat base = (grid->celldim > 0.0f ? grid->celldim : (minExtent < INFINITY ? minExtent : 1.0f));
+	base = cpfmax(base, maxExtent/(cpFloat)(1 << (HGRID_MAX_LEVELS - 1)));
+	
+	for(int level=0; level<HGRID_MAX_LEVELS; level++){
+		grid->cellSize[level] = base*(cpFloat)(1 << level);
+		grid->levelCount[level] = 0;
+	}
+	
+	for(int i=0; i<count; i++){
+		Entry *entry = entries + i;
+		cpFloat extent = BBExtent(entry->bb);
+		
+		int level = 0;
+		while(level < HGRID_MAX_LEVELS - 1 && grid->cellSize[level] < extent) level++;
+		
+		cpFloat size = grid->cellSize[level];
+		entry->level = level;
+		entry->x = floor_int(0.5f*(entry->bb.l + entry->bb.r)/size);
+		entry->y = floor_int(0.5f*(entry->bb.b + entry->bb.t)/size);
+		grid->levelCount[level]++;
+	}
+}
+
+// Rebuilds the grid from scratch with a counting sort of the entries by bucket.
+static void
+HGridBuild(cpHGrid *grid)
+{
+	ReserveEntries(grid, cpHashSetCount(grid->objects));
+	
+	grid->count = 0;
+	cpHashSetEach(grid->objects, (cpHashSetIteratorFunc)GatherObject, grid);
+	grid->dirty = cpFalse;
+	
+	int count = grid->count;
+	AssignLevels(grid);
+	
+	// Give each level a power of two number of buckets, at least twice the number of entries.
+	int buckets = 0;
+	for(int level=0; level<HGRID_MAX_LEVELS; level++){
+		grid->levelBucket[level] = buckets;
+		
+		int n = grid->levelCount[level];
+		if(n > 0){
+			int size = 1;
+			while(size < 2*n) size *= 2;
+			buckets += size;
+		}
+	}
+	grid->levelBucket[HGRID_MAX_LEVELS] = buckets;
+	
+	if(buckets + 1 > grid->bucketCapacity){
+		grid->bucketCapacity = (buckets + 1 > 2*grid->bucketCapacity ? buckets + 1 : 2*grid->bucketCapacity);
+		grid->bucketStart = (int *)cprealloc(grid->bucketStart, grid->bucketCapacity*sizeof(int));
+	}
+	
+	int *bucketStart = grid->bucketStart;
+	memset(bucketStart, 0, (buckets + 1)*sizeof(int));
+	
+	// First pass, count the entries in each bucket.
+	for(int i=0; i<count; i++){
+		Entry *entry = grid->gatherEntries + i;
+		int bucket = HGridBucket(grid, entry->x, entry->y, entry->level);
+		grid->gatherBuckets[i] = bucket;
+		bucketStart[bucket]++;
+	}
+	
+	// Turn the counts into the end of each bucket's range.
+	for(int i=1; i<=buckets; i++) bucketStart[i] += bucketStart[i - 1];
+	
+	// Second pass, place the entries. Going backwards leaves bucketStart at the start of each range and keeps the gathered order within a bucket.
+	for(int i=count-1; i>=0; i--){
+		grid->entries[--bucketStart[grid->gatherBuckets[i]]] = grid->gatherEntries[i];
+	}
+}
+
+static inline void
+HGridUpdate(cpHGrid *grid)
+{
+	if(grid->dirty) HGridBuild(grid);
+}
+
+//MARK: Memory Management Functions
+
+static int objectSetEql(void *obj, void *elt){return (obj == elt);}
+static void *objectSetTrans(void *obj, void *unused){return obj;}
+
+cpHGrid *
+cpHGridAlloc(void)
+{
+	return (cpHGrid *)cpcalloc(1, sizeof(cpHGrid));
+}
+
+cpSpatialIndex *
+cpHGridInit(cpHGrid *grid, cpFloat celldim, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex)
+{
+	cpSpatialIndexInit((cpSpatialIndex *)grid, Klass(), bbfunc, staticIndex);
+	
+	grid->objects = cpHashSetNew(0, (cpHashSetEqlFunc)objectSetEql);
+	grid->celldim = celldim;
+	
+	for(int level=0; level<HGRID_MAX_LEVELS; level++){
+		grid->cellSize[level] = 0.0f;
+		grid->levelCount[level] = 0;
+	}
+	memset(grid->levelBucket, 0, sizeof(grid->levelBucket));
+	
+	grid->bucketStart = NULL;
+	grid->bucketCapacity = 0;
+	
+	grid->entries = grid->gatherEntries = NULL;
+	grid->gatherBuckets = NULL;
+	grid->count = grid->capacity = 0;
+	
+	grid->dirty = cpFalse;
+	grid->staticBuffer.objects = NULL;
+	grid->staticBuffer.capacity = 0;
+	
+	return (cpSpatialIndex *)grid;
+}
+
+cpSpatialIndex *
+cpHGridNew(cpFloat celldim, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex)
+{
+	return cpHGridInit(cpHGridAlloc(), celldim, bbfunc, staticIndex);
+}
+
+static void
+cpHGridDestroy(cpHGrid *grid)
+{
+	cpHashSetFree(grid->objects);
+	
+	cpfree(grid->bucketStart);
+	cpfree(grid->entries);
+	cpfree(grid->gatherEntries);
+	cpfree(grid->gatherBuckets);
+	cpfree(grid->staticBuffer.objects);
+}
+
+//MARK: Misc
+
+static int
+cpHGridCount(cpHGrid *grid)
+{
+	return cpHashSetCount(grid->objects);
+}
+
+typedef struct eachContext {
+	cpSpatialIndexIteratorFunc func;
+	void *data;
+} eachContext;
+
+static void each_helper(void *obj, eachContext *context){context->func(obj, context->data);}
+
+static void
+cpHGridEach(cpHGrid *grid, cpSpatialIndexIteratorFunc func, void *data)
+{
+	eachContext context = {func, data};
+	cpHashSetEach(grid->objects, (cpHashSetIteratorFunc)each_helper, &context);
+}
+
+static cpBool
+cpHGridContains(cpHGrid *grid, void *obj, cpHashValue hashid)
+{
+	return (cpHashSetFind(grid->objects, hashid, obj) != NULL);
+}
+
+//MARK: Insert/Remove
+
+static void
+cpHGridInsert(cpHGrid *grid, void *obj, cpHashValue hashid)
+{
+	cpHashSetInsert(grid->objects, hashid, obj, (cpHashSetTransFunc)objectSetTrans, NULL);
+	grid->dirty = cpTrue;
+}
+
+static void
+cpHGridRemove(cpHGrid *grid, void *obj, cpHashValue hashid)
+{
+	if(cpHashSetRemove(grid->objects, hashid, obj)) grid->dirty = cpTrue;
+}
+
+//MARK: Query
+
+typedef struct CellRange {
+	int x0, y0, x1, y1;
+} CellRange;
+
+// The cells of a level that can contain an object overlapping 'bb'.
+// An object's center is never more than half a cell outside of it.
+static inline CellRange
+HGridCellRange(cpHGrid *grid, int level, cpBB bb)
+{
+	cpFloat size = grid->cellSize[level], half = 0.5f*size;
+	CellRange range = {
+		floor_int((bb.l - half)/size), floor_int((bb.b - half)/size),
+		floor_int((bb.r + half)/size), floor_int((bb.t + half)/size),
+	};
+	
+	return range;
+}
+
+// Returns true if it's cheaper to check every entry on the level than to look up the cells overlapping 'bb'.
+// Also keeps huge or infinite bounding boxes from being converted to cell coordinates.
+static inline cpBool
+HGridScanLevel(cpHGrid *grid, int level, cpBB bb)
+{
+	cpFloat size = grid->cellSize[level];
+	cpFloat cells = ((bb.r - bb.l)/size + 2.0f)*((bb.t - bb.b)/size + 2.0f);
+	return !(cells <= (cpFloat)grid->levelCount[level]);
+}
+
+static void
+cpHGridQuery(cpHGrid *grid, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data)
+{
+	HGridUpdate(grid);
+	
+	Entry *entries = grid->entries;
+	int *bucketStart = grid->bucketStart;
+	
+	// Walk the levels from the coarsest to the finest.
+	for(int level=HGRID_MAX_LEVELS-1; level>=0; level--){
+		if(grid->levelCount[level] == 0) continue;
+		
+		if(HGridScanLevel(grid, level, bb)){
+			for(int i=bucketStart[grid->levelBucket[level]], end=bucketStart[grid->levelBucket[level + 1]]; i<end; i++){
+				if(obj != entries[i].obj && cpBBIntersects(bb, entries[i].bb)) func(obj, entries[i].obj, 0, data);
+			}
+			
+			continue;
+		}
+		
+		CellRange range = HGridCellRange(grid, level, bb);
+		for(int y=range.y0; y<=range.y1; y++){
+			for(int x=range.x0; x<=range.x1; x++){
+				int bucket = HGridBucket(grid, x, y, level);
+				for(int i=bucketStart[bucket], end=bucketStart[bucket + 1]; i<end; i++){
+					Entry *entry = entries + i;
+					// Other cells can hash to the same bucket.
+					if(entry->x != x || entry->y != y) continue;
+					if(obj != entry->obj && cpBBIntersects(bb, entry->bb)) func(obj, entry->obj, 0, data);
+				}
+			}
+		}
+	}
+}
+
+static void
+cpHGridSegmentQuery(cpHGrid *grid, void *obj, cpVect a, cpVect b, cpFloat t_exit, cpSpatialIndexSegmentQueryFunc func, void *data)
+{
+	HGridUpdate(grid);
+	
+	Entry *entries = grid->entries;
+	int *bucketStart = grid->bucketStart;
+	
+	for(int level=HGRID_MAX_LEVELS-1; level>=0; level--){
+		if(grid->levelCount[level] == 0) continue;
+		
+		// The cells aren't visited in order along the segment, but t_exit still skips objects past the closest hit so far.
+		cpBB bb = cpBBExpand(cpBBNew(a.x, a.y, a.x, a.y), cpvlerp(a, b, cpfmin(t_exit, 1.0f)));
+		if(HGridScanLevel(grid, level, bb)){
+			for(int i=bucketStart[grid->levelBucket[level]], end=bucketStart[grid->levelBucket[level + 1]]; i<end; i++){
+				if(cpBBSegmentQuery(entries[i].bb, a, b) < t_exit) t_exit = cpfmin(t_exit, func(obj, entries[i].obj, data));
+			}
+			
+			continue;
+		}
+		
+		CellRange range = HGridCellRange(grid, level, bb);
+		for(int y=range.y0; y<=range.y1; y++){
+			for(int x=range.x0; x<=range.x1; x++){
+				int bucket = HGridBucket(grid, x, y, level);
+				for(int i=bucketStart[bucket], end=bucketStart[bucket + 1]; i<end; i++){
+					Entry *entry = entries + i;
+					if(entry->x != x || entry->y != y) continue;
+					if(cpBBSegmentQuery(entry->bb, a, b) < t_exit) t_exit = cpfmin(t_exit, func(obj, entry->obj, data));
+				}
+			}
+		}
+	}
+}
+
+//MARK: Reindex
+
+static void
+cpHGridReindex(cpHGrid *grid)
+{
+	HGridBuild(grid);
+}
+
+static void
+cpHGridReindexObject(cpHGrid *grid, void *obj, cpHashValue hashid)
+{
+	grid->dirty = cpTrue;
+}
+
+// Reports the entries in a cell that overlap entry 'i'.
+// Only entries after 'i' are reported when 'after' is true so that pairs on the same level are only reported once.
+static inline void
+CollideCell(cpHGrid *grid, int i, int x, int y, int level, cpBool after, cpSpatialIndexQueryFunc func, void *data)
+{
+	Entry *entries = grid->entries;
+	Entry *entry = entries + i;
+	
+	int bucket = HGridBucket(grid, x, y, level);
+	int start = grid->bucketStart[bucket], end = grid->bucketStart[bucket + 1];
+	if(after && start <= i) start = i + 1;
+	
+	for(int j=start; j<end; j++){
+		Entry *other = entries + j;
+		if(other->x != x || other->y != y) continue;
+		if(cpBBIntersects(entry->bb, other->bb)) func(entry->obj, other->obj, 0, data);
+	}
+}
+
+static void
+cpHGridReindexQuery(cpHGrid *grid, cpSpatialIndexQueryFunc func, void *data)
+{
+	HGridBuild(grid);
+	
+	for(int i=0, count=grid->count; i<count; i++){
+		Entry *entry = grid->entries + i;
+		int level = entry->level;
+		
+		// Objects on the same level can only overlap in the neighboring cells.
+		for(int y=entry->y-1; y<=entry->y+1; y++){
+			for(int x=entry->x-1; x<=entry->x+1; x++){
+				CollideCell(grid, i, x, y, level, cpTrue, func, data);
+			}
+		}
+		
+		// Then check the coarser levels. Objects on finer levels check this one when they get to it.
+		for(int coarse=level+1; coarse<HGRID_MAX_LEVELS; coarse++){
+			if(grid->levelCount[coarse] == 0) continue;
+			
+			if(HGridScanLevel(grid, coarse, entry->bb)){
+				for(int j=grid->bucketStart[grid->levelBucket[coarse]], end=grid->bucketStart[grid->levelBucket[coarse + 1]]; j<end; j++){
+					Entry *other = grid->entries + j;
+					if(cpBBIntersects(entry->bb, other->bb)) func(entry->obj, other->obj, 0, data);
+				}
+				
+				continue;
+			}
+			
+			CellRange range = HGridCellRange(grid, coarse, entry->bb);
+			for(int y=range.y0; y<=range.y1; y++){
+				for(int x=range.x0; x<=range.x1; x++) CollideCell(grid, i, x, y, coarse, cpFalse, func, data);
+			}
+		}
+	}
+	
+	cpSpatialIndexCollideStaticBuffered((cpSpatialIndex *)grid, grid->spatialIndex.staticIndex, func, data, &grid->staticBuffer);
+}
+
+static cpSpatialIndexClass klass = {
+	(cpSpatialIndexDestroyImpl)cpHGridDestroy,
+	
+	(cpSpatialIndexCountImpl)cpHGridCount,
+	(cpSpatialIndexEachImpl)cpHGridEach,
+	(cpSpatialIndexContainsImpl)cpHGridContains,
+	
+	(cpSpatialIndexInsertImpl)cpHGridInsert,
+	(cpSpatialIndexRemoveImpl)cpHGridRemove,
+	
+	(cpSpatialIndexReindexImpl)cpHGridReindex,
+	(cpSpatialIndexReindexObjectImpl)cpHGridReindexObject,
+	(cpSpatialIndexReindexQueryImpl)cpHGridReindexQuery,
+	
+	(cpSpatialIndexQueryImpl)cpHGridQuery,
+	(cpSpatialIndexSegmentQueryImpl)cpHGridSegmentQuery,
+};
+
+static inline cpSpatialIndexClass *Klass(){return &klass;}
+
+cpBool
+cpSpatialIndexIsHGrid(cpSpatialIndex *index)
+{
+	return (index && index->klass == Klass());
+}
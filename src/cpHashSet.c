@@ -20,12 +20,17 @@
  */
 
 #include "chipmunk/chipmunk_private.h"
-#include "prime.h"
+
+// Open addressing hash set using Robin Hood hashing.
+// The elements and their hashes are stored inline in a power of two sized table.
+// Elements are kept at or after their home bin, in order of their home bin, so lookups only scan a short run of bins.
+// When inserting, an element takes the bin of any element that is closer to its own home bin.
+// That keeps the runs short even when the table is mostly full, and lets a lookup stop as soon as it passes where the element would be.
 
 typedef struct cpHashSetBin {
-	void *elt;
 	cpHashValue hash;
-	struct cpHashSetBin *next;
+	// NULL if the bin is empty.
+	void *elt;
 } cpHashSetBin;
 
 struct cpHashSet {
@@ -34,21 +39,35 @@ struct cpHashSet {
 	cpHashSetEqlFunc eql;
 	void *default_value;
 	
-	cpHashSetBin **table;
-	cpHashSetBin *pooledBins;
-	
-	cpArray *allocatedBuffers;
+	cpHashSetBin *table;
 };
 
+// The table is grown when it would be more than 3/4 full.
+static inline cpBool
+setIsFull(unsigned int entries, unsigned int size)
+{
+	return (entries > size - size/4);
+}
+
+static inline unsigned int
+homeBin(cpHashValue hash, unsigned int size)
+{
+	// Hashes of pointers have zeros in their low bits, so mix the hash before masking it. (Fibonacci hashing)
+	return (unsigned int)(((uint64_t)hash*0x9E3779B97F4A7C15ull) >> 32) & (size - 1);
+}
+
+// How far the element in bin 'idx' is from its home bin.
+static inline unsigned int
+binDistance(cpHashSetBin *bin, unsigned int idx, unsigned int size)
+{
+	return (idx - homeBin(bin->hash, size)) & (size - 1);
+}
+
 void
 cpHashSetFree(cpHashSet *set)
 {
 	if(set){
 		cpfree(set->table);
-		
-		cpArrayFreeEach(set->allocatedBuffers, cpfree);
-		cpArrayFree(set->allocatedBuffers);
-		
 		cpfree(set);
 	}
 }
@@ -58,16 +77,14 @@ cpHashSetNew(int size, cpHashSetEqlFunc eqlFunc)
 {
 	cpHashSet *set = (cpHashSet *)cpcalloc(1, sizeof(cpHashSet));
 	
-	set->size = next_prime(size);
+	set->size = 8;
+	while(setIsFull(size, set->size)) set->size *= 2;
 	set->entries = 0;
 	
 	set->eql = eqlFunc;
 	set->default_value = NULL;
 	
-	set->table = (cpHashSetBin **)cpcalloc(set->size, sizeof(cpHashSetBin *));
-	set->pooledBins = NULL;
-	
-	set->allocatedBuffers = cpArrayNew(0);
+	set->table = (cpHashSetBin *)cpcalloc(set->size, sizeof(cpHashSetBin));
 	
 	return set;
 }
@@ -78,33 +95,42 @@ cpHashSetSetDefaultValue(cpHashSet *set, void *default_value)
 	set->default_value = default_value;
 }
 
-static int
-setIsFull(cpHashSet *set)
+// Insert an element that isn't in the table yet.
+static void
+insertBin(cpHashSetBin *table, unsigned int size, cpHashValue hash, void *elt)
 {
-	return (set->entries >= set->size);
+	cpHashSetBin bin = {hash, elt};
+	unsigned int idx = homeBin(hash, size);
+	
+	for(unsigned int dist = 0;; dist++){
+		cpHashSetBin *slot = table + idx;
+		if(!slot->elt){
+			(*slot) = bin;
+			return;
+		}
+		
+		// Take the bin from an element closer to its home, then keep looking for a bin for that element instead.
+		unsigned int slot_dist = binDistance(slot, idx, size);
+		if(slot_dist < dist){
+			cpHashSetBin tmp = *slot;
+			(*slot) = bin;
+			bin = tmp;
+			dist = slot_dist;
+		}
+		
+		idx = (idx + 1) & (size - 1);
+	}
 }
 
 static void
 cpHashSetResize(cpHashSet *set)
 {
-	// Get the next approximate doubled prime.
-	unsigned int newSize = next_prime(set->size + 1);
-	// Allocate a new table.
-	cpHashSetBin **newTable = (cpHashSetBin **)cpcalloc(newSize, sizeof(cpHashSetBin *));
+	unsigned int newSize = 2*set->size;
+	cpHashSetBin *newTable = (cpHashSetBin *)cpcalloc(newSize, sizeof(cpHashSetBin));
 	
-	// Iterate over the chains.
 	for(unsigned int i=0; i<set->size; i++){
-		// Rehash the bins into the new table.
-		cpHashSetBin *bin = set->table[i];
-		while(bin){
-			cpHashSetBin *next = bin->next;
-			
-			cpHashValue idx = bin->hash%newSize;
-			bin->next = newTable[idx];
-			newTable[idx] = bin;
-			
-			bin = next;
-		}
+		cpHashSetBin *bin = set->table + i;
+		if(bin->elt) insertBin(newTable, newSize, bin->hash, bin->elt);
 	}
 	
 	cpfree(set->table);
@@ -113,34 +139,41 @@ cpHashSetResize(cpHashSet *set)
 	set->size = newSize;
 }
 
-static inline void
-recycleBin(cpHashSet *set, cpHashSetBin *bin)
+// Returns the index of the bin with the matching element, or -1.
+static inline int
+findBin(cpHashSet *set, cpHashValue hash, const void *ptr)
 {
-	bin->next = set->pooledBins;
-	set->pooledBins = bin;
-	bin->elt = NULL;
+	unsigned int size = set->size;
+	unsigned int idx = homeBin(hash, size);
+	
+	for(unsigned int dist = 0;; dist++){
+		cpHashSetBin *bin = set->table + idx;
+		
+		// Stop at an empty bin, or where the element would have taken the bin if it was in the table.
+		if(!bin->elt || binDistance(bin, idx, size) < dist) return -1;
+		if(bin->hash == hash && set->eql(ptr, bin->elt)) return (int)idx;
+		
+		idx = (idx + 1) & (size - 1);
+	}
 }
 
-static cpHashSetBin *
-getUnusedBin(cpHashSet *set)
+// Empty a bin and shift the rest of its run back to fill the gap.
+static void
+removeBin(cpHashSet *set, unsigned int idx)
 {
-	cpHashSetBin *bin = set->pooledBins;
-	
-	if(bin){
-		set->pooledBins = bin->next;
-		return bin;
-	} else {
-		// Pool is exhausted, make more
-		int count = CP_BUFFER_BYTES/sizeof(cpHashSetBin);
-		cpAssertHard(count, "Internal Error: Buffer size is too small.");
-		
-		cpHashSetBin *buffer = (cpHashSetBin *)cpcalloc(1, CP_BUFFER_BYTES);
-		cpArrayPush(set->allocatedBuffers, buffer);
+	unsigned int size = set->size;
+	cpHashSetBin *table = set->table;
+	
+	for(;;){
+		unsigned int next = (idx + 1) & (size - 1);
+		if(!table[next].elt || binDistance(table + next, next, size) == 0) break;
 		
-		// push all but the first one, return it instead
-		for(int i=1; i<count; i++) recycleBin(set, buffer + i);
-		return buffer;
+		table[idx] = table[next];
+		idx = next;
 	}
+	
+	table[idx].elt = NULL;
+	set->entries--;
 }
 
 int
@@ -152,51 +185,29 @@ cpHashSetCount(cpHashSet *set)
 const void *
 cpHashSetInsert(cpHashSet *set, cpHashValue hash, const void *ptr, cpHashSetTransFunc trans, void *data)
 {
-	cpHashValue idx = hash%set->size;
-	
-	// Find the bin with the matching element.
-	cpHashSetBin *bin = set->table[idx];
-	while(bin && !set->eql(ptr, bin->elt))
-		bin = bin->next;
+	int idx = findBin(set, hash, ptr);
+	if(idx >= 0) return set->table[idx].elt;
 	
 	// Create it if necessary.
-	if(!bin){
-		bin = getUnusedBin(set);
-		bin->hash = hash;
-		bin->elt = (trans ? trans(ptr, data) : data);
-		
-		bin->next = set->table[idx];
-		set->table[idx] = bin;
-		
-		set->entries++;
-		if(setIsFull(set)) cpHashSetResize(set);
-	}
+	void *elt = (trans ? trans(ptr, data) : data);
+	cpAssertHard(elt, "Internal Error: cpHashSet elements cannot be NULL.");
 	
-	return bin->elt;
+	if(setIsFull(set->entries + 1, set->size)) cpHashSetResize(set);
+	insertBin(set->table, set->size, hash, elt);
+	set->entries++;
+	
+	return elt;
 }
 
 const void *
 cpHashSetRemove(cpHashSet *set, cpHashValue hash, const void *ptr)
 {
-	cpHashValue idx = hash%set->size;
-	
-	cpHashSetBin **prev_ptr = &set->table[idx];
-	cpHashSetBin *bin = set->table[idx];
-	
-	// Find the bin
-	while(bin && !set->eql(ptr, bin->elt)){
-		prev_ptr = &bin->next;
-		bin = bin->next;
-	}
+	int idx = findBin(set, hash, ptr);
 	
 	// Remove it if it exists.
-	if(bin){
-		// Update the previous linked list pointer
-		(*prev_ptr) = bin->next;
-		set->entries--;
-		
-		const void *elt = bin->elt;
-		recycleBin(set, bin);
+	if(idx >= 0){
+		const void *elt = set->table[idx].elt;
+		removeBin(set, idx);
 		
 		return elt;
 	}
@@ -207,47 +218,40 @@ cpHashSetRemove(cpHashSet *set, cpHashValue hash, const void *ptr)
 const void *
 cpHashSetFind(cpHashSet *set, cpHashValue hash, const void *ptr)
 {	
-	cpHashValue idx = hash%set->size;
-	cpHashSetBin *bin = set->table[idx];
-	while(bin && !set->eql(ptr, bin->elt))
-		bin = bin->next;
-		
-	return (bin ? bin->elt : set->default_value);
+	int idx = findBin(set, hash, ptr);
+	return (idx >= 0 ? set->table[idx].elt : set->default_value);
 }
 
+// Note: The set must not be modified by the iterator function.
 void
 cpHashSetEach(cpHashSet *set, cpHashSetIteratorFunc func, void *data)
 {
 	for(unsigned int i=0; i<set->size; i++){
-		cpHashSetBin *bin = set->table[i];
-		while(bin){
-			cpHashSetBin *next = bin->next;
-			func(bin->elt, data);
-			bin = next;
-		}
+		void *elt = set->table[i].elt;
+		if(elt) func(elt, data);
 	}
 }
 
 void
 cpHashSetFilter(cpHashSet *set, cpHashSetFilterFunc func, void *data)
 {
-	for(unsigned int i=0; i<set->size; i++){
-		// The rest works similarly to cpHashSetRemove() above.
-		cpHashSetBin **prev_ptr = &set->table[i];
-		cpHashSetBin *bin = set->table[i];
-		while(bin){
-			cpHashSetBin *next = bin->next;
-			
-			if(func(bin->elt, data)){
-				prev_ptr = &bin->next;
-			} else {
-				(*prev_ptr) = next;
-
-				set->entries--;
-				recycleBin(set, bin);
-			}
-			
-			bin = next;
+	unsigned int size = set->size;
+	cpHashSetBin *table = set->table;
+	
+	// Start after an empty bin so that no run of bins wraps around past the start.
+	// Removing a bin only shifts the bins after it in the same run, which haven't been visited yet.
+	unsigned int start = 0;
+	while(table[start].elt) start++;
+	
+	for(unsigned int i=1; i<=size;){
+		unsigned int idx = (start + i) & (size - 1);
+		void *elt = table[idx].elt;
+		
+		if(elt && !func(elt, data)){
+			// Check the same bin again since the next element was shifted into it.
+			removeBin(set, idx);
+		} else {
+			i++;
 		}
 	}
 }
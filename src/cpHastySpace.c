@@ -1,8 +1,14 @@
 // Copyright 2013 Howling Moon Software. All rights reserved.
 // See http://chipmunk2d.net/legal.php for more information.
 
+// Needed for pthread_setaffinity_np()
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 //TODO: Move all the thread stuff to another file
 
@@ -13,8 +19,11 @@
 #endif
 
 #ifndef _WIN32
+#include <unistd.h>
+#include <sched.h>
 #include <pthread.h>
 #elif defined(__MINGW32__)
+#include <windows.h>
 #include <pthread.h>
 #else
 #ifndef WIN32_LEAN_AND_MEAN
@@ -362,15 +371,19 @@ cpArbiterApplyImpulse_NEON(cpArbiter *arb)
 		v_b = vadd(v_b, vmul_n(j, b->m_inv));
 		
 		// TODO would moving these earlier help pipeline them better?
-		vst((cpFloat_t *)&a->v_bias, vBias_a);
-		vst((cpFloat_t *)&b->v_bias, vBias_b);
-		vst_lane((cpFloat_t *)&a->w_bias, wBias, 0);
-		vst_lane((cpFloat_t *)&b->w_bias, wBias, 1);
+		if(cpBodyTakesImpulses(a)){
+			vst((cpFloat_t *)&a->v_bias, vBias_a);
+			vst_lane((cpFloat_t *)&a->w_bias, wBias, 0);
+			vst((cpFloat_t *)&a->v, v_a);
+			vst_lane((cpFloat_t *)&a->w, w, 0);
+		}
 		
-		vst((cpFloat_t *)&a->v, v_a);
-		vst((cpFloat_t *)&b->v, v_b);
-		vst_lane((cpFloat_t *)&a->w, w, 0);
-		vst_lane((cpFloat_t *)&b->w, w, 1);
+		if(cpBodyTakesImpulses(b)){
+			vst((cpFloat_t *)&b->v_bias, vBias_b);
+			vst_lane((cpFloat_t *)&b->w_bias, wBias, 1);
+			vst((cpFloat_t *)&b->v, v_b);
+			vst_lane((cpFloat_t *)&b->w, w, 1);
+		}
 		
 		vst_lane((cpFloat_t *)&con->jBias, jbn_jn, 0);
 		vst_lane((cpFloat_t *)&con->jnAcc, jbn_jn, 1);
@@ -380,11 +393,370 @@ cpArbiterApplyImpulse_NEON(cpArbiter *arb)
 
 #endif
 
-//MARK: PThreads
+//MARK: x86 Wide Solver
+
+// x86-64 always has SSE2. AVX2 is detected when the space is created.
+#if defined(__x86_64__) || defined(_M_X64)
+#define CP_HASTY_WIDE_SOLVER 1
+
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+// Widest vector used by the wide solvers. (8 floats or 4 doubles with AVX2)
+#define WIDE_MAX_LANES 8
+
+// The wide solvers work on groups of arbiters from the same colored batch, one arbiter per vector lane.
+// Each group's arbiter and contact values are transposed once per step into consecutive vectors of the fields below.
+// Lanes without an arbiter, or without a contact, are filled with zeros.
+enum {
+	WIDE_NX, WIDE_NY, WIDE_SURFACE_VX, WIDE_SURFACE_VY, WIDE_FRICTION, WIDE_CONTACTS,
+	WIDE_A_M_INV, WIDE_A_I_INV, WIDE_B_M_INV, WIDE_B_I_INV,
+	WIDE_ARBITER_FIELDS,
+};
+
+enum {
+	WIDE_R1X, WIDE_R1Y, WIDE_R2X, WIDE_R2Y, WIDE_N_MASS, WIDE_T_MASS, WIDE_BIAS, WIDE_BOUNCE,
+	WIDE_J_BIAS, WIDE_JN_ACC, WIDE_JT_ACC,
+	WIDE_CONTACT_FIELDS,
+};
+
+#define WIDE_GROUP_FIELDS (WIDE_ARBITER_FIELDS + CP_MAX_CONTACTS_PER_ARBITER*WIDE_CONTACT_FIELDS)
+
+// Index of contact 'k's field in a group.
+#define WIDE_CONTACT_FIELD(k, field) (WIDE_ARBITER_FIELDS + (k)*WIDE_CONTACT_FIELDS + (field))
+
+// The body velocities are gathered into vectors for each iteration, and stored back through these fields.
+enum {WIDE_VX, WIDE_VY, WIDE_W, WIDE_VBX, WIDE_VBY, WIDE_WB, WIDE_BODY_FIELDS};
+
+// Transpose up to 'lanes' arbiters into a group.
+static void
+WidePrepareGroup(cpFloat *group, cpArbiter **group_arbs, void **items, int count, int lanes)
+{
+	for(int lane=0; lane<lanes; lane++){
+		cpArbiter *arb = group_arbs[lane] = (lane < count ? (cpArbiter *)items[lane] : NULL);
+		int contacts = (arb ? arb->count : 0);
+		
+		for(int field=0; field<WIDE_GROUP_FIELDS; field++) group[field*lanes + lane] = 0.0f;
+		if(!arb) continue;
+		
+		group[WIDE_NX*lanes + lane] = arb->n.x;
+		group[WIDE_NY*lanes + lane] = arb->n.y;
+		group[WIDE_SURFACE_VX*lanes + lane] = arb->surface_vr.x;
+		group[WIDE_SURFACE_VY*lanes + lane] = arb->surface_vr.y;
+		group[WIDE_FRICTION*lanes + lane] = arb->u;
+		group[WIDE_CONTACTS*lanes + lane] = (cpFloat)contacts;
+		group[WIDE_A_M_INV*lanes + lane] = arb->body_a->m_inv;
+		group[WIDE_A_I_INV*lanes + lane] = arb->body_a->i_inv;
+		group[WIDE_B_M_INV*lanes + lane] = arb->body_b->m_inv;
+		group[WIDE_B_I_INV*lanes + lane] = arb->body_b->i_inv;
+		
+		for(int k=0; k<contacts; k++){
+			struct cpContact *con = arb->contacts + k;
+			cpFloat *fields = group + WIDE_CONTACT_FIELD(k, 0)*lanes + lane;
+			fields[WIDE_R1X*lanes] = con->r1.x;
+			fields[WIDE_R1Y*lanes] = con->r1.y;
+			fields[WIDE_R2X*lanes] = con->r2.x;
+			fields[WIDE_R2Y*lanes] = con->r2.y;
+			fields[WIDE_N_MASS*lanes] = con->nMass;
+			fields[WIDE_T_MASS*lanes] = con->tMass;
+			fields[WIDE_BIAS*lanes] = con->bias;
+			fields[WIDE_BOUNCE*lanes] = con->bounce;
+			fields[WIDE_J_BIAS*lanes] = con->jBias;
+			fields[WIDE_JN_ACC*lanes] = con->jnAcc;
+			fields[WIDE_JT_ACC*lanes] = con->jtAcc;
+		}
+	}
+}
+
+// Copy the accumulated impulses of a group back to the contacts.
+static void
+WideStoreImpulses(cpFloat *group, cpArbiter **group_arbs, int lanes)
+{
+	for(int lane=0; lane<lanes && group_arbs[lane]; lane++){
+		cpArbiter *arb = group_arbs[lane];
+		
+		for(int k=0; k<arb->count; k++){
+			struct cpContact *con = arb->contacts + k;
+			cpFloat *fields = group + WIDE_CONTACT_FIELD(k, 0)*lanes + lane;
+			con->jBias = fields[WIDE_J_BIAS*lanes];
+			con->jnAcc = fields[WIDE_JN_ACC*lanes];
+			con->jtAcc = fields[WIDE_JT_ACC*lanes];
+		}
+	}
+}
+
+// Read by the lanes of a group that have no arbiter.
+static cpBody WideZeroBody;
+
+static inline void
+WideGatherBodies(cpBody **a, cpBody **b, cpArbiter **group_arbs, int lanes)
+{
+	for(int lane=0; lane<lanes; lane++){
+		cpArbiter *arb = group_arbs[lane];
+		a[lane] = (arb ? arb->body_a : &WideZeroBody);
+		b[lane] = (arb ? arb->body_b : &WideZeroBody);
+	}
+}
+
+static inline void
+WideScatterBody(cpFloat (*bodies)[WIDE_MAX_LANES], int lane, cpBody *body)
+{
+	// Static and kinematic bodies can be shared between the lanes and threads, so only dynamic bodies are written.
+	if(!cpBodyTakesImpulses(body)) return;
+	
+	body->v = cpv(bodies[WIDE_VX][lane], bodies[WIDE_VY][lane]);
+	body->w = bodies[WIDE_W][lane];
+	body->v_bias = cpv(bodies[WIDE_VBX][lane], bodies[WIDE_VBY][lane]);
+	body->w_bias = bodies[WIDE_WB][lane];
+}
+
+static inline void
+WideScatterBodies(cpFloat (*a)[WIDE_MAX_LANES], cpFloat (*b)[WIDE_MAX_LANES], cpArbiter **group_arbs, int lanes)
+{
+	for(int lane=0; lane<lanes && group_arbs[lane]; lane++){
+		WideScatterBody(a, lane, group_arbs[lane]->body_a);
+		WideScatterBody(b, lane, group_arbs[lane]->body_b);
+	}
+}
+
+static cpBool
+CPUSupportsAVX2(void)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+	__cpuid(info, 0);
+	if(info[0] < 7) return cpFalse;
+	
+	// The OS has to save the AVX registers too. (OSXSAVE and AVX bits, then the XCR0 register)
+	__cpuid(info, 1);
+	int osxsave_avx = (1 << 27) | (1 << 28);
+	if((info[2] & osxsave_avx) != osxsave_avx || (_xgetbv(0) & 0x6) != 0x6) return cpFalse;
+	
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+// SSE2
+#define WIDE_FUNC SolveWideSSE2
+#if CP_USE_DOUBLES
+	#define WIDE_LANES 2
+	#define wvec __m128d
+	#define wload _mm_loadu_pd
+	#define wstore _mm_storeu_pd
+	#define wset1 _mm_set1_pd
+	#define wadd _mm_add_pd
+	#define wsub _mm_sub_pd
+	#define wmul _mm_mul_pd
+	#define wmax _mm_max_pd
+	#define wmin _mm_min_pd
+	#define wneg(__a) _mm_xor_pd(__a, _mm_set1_pd(-0.0))
+	#define wlt _mm_cmplt_pd
+	#define wany _mm_movemask_pd
+	#define wblend(__mask, __a, __b) _mm_or_pd(_mm_and_pd(__mask, __a), _mm_andnot_pd(__mask, __b))
+	#define wgather(__b, __m) _mm_set_pd(__b[1]->__m, __b[0]->__m)
+#else
+	#define WIDE_LANES 4
+	#define wvec __m128
+	#define wload _mm_loadu_ps
+	#define wstore _mm_storeu_ps
+	#define wset1 _mm_set1_ps
+	#define wadd _mm_add_ps
+	#define wsub _mm_sub_ps
+	#define wmul _mm_mul_ps
+	#define wmax _mm_max_ps
+	#define wmin _mm_min_ps
+	#define wneg(__a) _mm_xor_ps(__a, _mm_set1_ps(-0.0f))
+	#define wlt _mm_cmplt_ps
+	#define wany _mm_movemask_ps
+	#define wblend(__mask, __a, __b) _mm_or_ps(_mm_and_ps(__mask, __a), _mm_andnot_ps(__mask, __b))
+	#define wgather(__b, __m) _mm_set_ps(__b[3]->__m, __b[2]->__m, __b[1]->__m, __b[0]->__m)
+#endif
+
+#include "cpHastySpaceWide.h"
+
+#undef WIDE_FUNC
+#undef WIDE_LANES
+#undef wvec
+#undef wload
+#undef wstore
+#undef wset1
+#undef wadd
+#undef wsub
+#undef wmul
+#undef wmax
+#undef wmin
+#undef wneg
+#undef wlt
+#undef wany
+#undef wblend
+#undef wgather
+
+// AVX2
+// Only this function is compiled for AVX2 so the rest of the library still runs on any x86-64 CPU.
+#if defined(__clang__)
+	#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#elif defined(__GNUC__)
+	#pragma GCC push_options
+	#pragma GCC target("avx2")
+#endif
+
+#define WIDE_FUNC SolveWideAVX2
+#if CP_USE_DOUBLES
+	#define WIDE_LANES 4
+	#define wvec __m256d
+	#define wload _mm256_loadu_pd
+	#define wstore _mm256_storeu_pd
+	#define wset1 _mm256_set1_pd
+	#define wadd _mm256_add_pd
+	#define wsub _mm256_sub_pd
+	#define wmul _mm256_mul_pd
+	#define wmax _mm256_max_pd
+	#define wmin _mm256_min_pd
+	#define wneg(__a) _mm256_xor_pd(__a, _mm256_set1_pd(-0.0))
+	#define wlt(__a, __b) _mm256_cmp_pd(__a, __b, _CMP_LT_OQ)
+	#define wany _mm256_movemask_pd
+	#define wblend(__mask, __a, __b) _mm256_blendv_pd(__b, __a, __mask)
+	#define wgather(__b, __m) _mm256_set_pd(__b[3]->__m, __b[2]->__m, __b[1]->__m, __b[0]->__m)
+#else
+	#define WIDE_LANES 8
+	#define wvec __m256
+	#define wload _mm256_loadu_ps
+	#define wstore _mm256_storeu_ps
+	#define wset1 _mm256_set1_ps
+	#define wadd _mm256_add_ps
+	#define wsub _mm256_sub_ps
+	#define wmul _mm256_mul_ps
+	#define wmax _mm256_max_ps
+	#define wmin _mm256_min_ps
+	#define wneg(__a) _mm256_xor_ps(__a, _mm256_set1_ps(-0.0f))
+	#define wlt(__a, __b) _mm256_cmp_ps(__a, __b, _CMP_LT_OQ)
+	#define wany _mm256_movemask_ps
+	#define wblend(__mask, __a, __b) _mm256_blendv_ps(__b, __a, __mask)
+	#define wgather(__b, __m) _mm256_set_ps( \
+		__b[7]->__m, __b[6]->__m, __b[5]->__m, __b[4]->__m, \
+		__b[3]->__m, __b[2]->__m, __b[1]->__m, __b[0]->__m \
+	)
+#endif
+
+#include "cpHastySpaceWide.h"
+
+#undef WIDE_FUNC
+#undef WIDE_LANES
+#undef wvec
+#undef wload
+#undef wstore
+#undef wset1
+#undef wadd
+#undef wsub
+#undef wmul
+#undef wmax
+#undef wmin
+#undef wneg
+#undef wlt
+#undef wany
+#undef wblend
+#undef wgather
+
+#if defined(__clang__)
+	#pragma clang attribute pop
+#elif defined(__GNUC__)
+	#pragma GCC pop_options
+#endif
+
+#endif
+
+//MARK: Atomics
+
+#if defined(_MSC_VER) && !defined(__clang__)
+	#include <intrin.h>
+	
+	static inline uint64_t AtomicLoad(volatile uint64_t *ptr){return (uint64_t)InterlockedCompareExchange64((volatile LONG64 *)ptr, 0, 0);}
+	static inline void AtomicStore(volatile uint64_t *ptr, uint64_t value){InterlockedExchange64((volatile LONG64 *)ptr, (LONG64)value);}
+	static inline uint64_t AtomicAdd(volatile uint64_t *ptr, uint64_t value){return (uint64_t)InterlockedExchangeAdd64((volatile LONG64 *)ptr, (LONG64)value) + value;}
+	
+	static inline cpBool
+	AtomicCompareAndSwap(volatile uint64_t *ptr, uint64_t expected, uint64_t value)
+	{
+		return ((uint64_t)InterlockedCompareExchange64((volatile LONG64 *)ptr, (LONG64)value, (LONG64)expected) == expected);
+	}
+#else
+	static inline uint64_t AtomicLoad(volatile uint64_t *ptr){return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);}
+	static inline void AtomicStore(volatile uint64_t *ptr, uint64_t value){__atomic_store_n(ptr, value, __ATOMIC_SEQ_CST);}
+	static inline uint64_t AtomicAdd(volatile uint64_t *ptr, uint64_t value){return __atomic_add_fetch(ptr, value, __ATOMIC_SEQ_CST);}
+	
+	static inline cpBool
+	AtomicCompareAndSwap(volatile uint64_t *ptr, uint64_t expected, uint64_t value)
+	{
+		return __atomic_compare_exchange_n(ptr, &expected, value, cpFalse, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	}
+#endif
+
+// Hint to the CPU that the thread is spinning.
+static inline void
+CPURelax(void)
+{
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+	_mm_pause();
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+	__builtin_ia32_pause();
+#elif defined(__GNUC__) && (defined(__arm__) || defined(__aarch64__))
+	__asm__ __volatile__("yield");
+#endif
+}
+
+static inline void
+ThreadYield(void)
+{
+#ifdef _WIN32
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
 
-// Right now using more than 2 threads probably wont help your performance any.
-// If you are using a ridiculous number of iterations it could help though.
-#define MAX_THREADS 2
+//MARK: Job Scheduler
+
+// Worker threads are persistent and wait for jobs by spinning for a while before going to sleep on a condition variable.
+// Each step is made of parallel for loops. (integrate, update BBs, narrowphase, prestep, solver batches)
+// A loop is split into chunks that are dealt out evenly to the workers' queues, and workers steal from each other once their own queue is empty.
+// Every item in a loop is independent, so the results don't depend on which thread runs which chunk.
+#define MAX_THREADS 32
+
+// Maximum number of colors used to batch the solver.
+// Arbiters or constraints that can't be colored are put into an extra batch that is solved on a single thread.
+#define MAX_COLORS 64
+
+// Default number of times an idle worker polls for new jobs before going to sleep.
+#define DEFAULT_SPIN_BUDGET 4096
+
+// Number of items per chunk for the different loops.
+// Smaller chunks balance the work better, but each one has some overhead.
+#define BODY_CHUNK_SIZE 256
+#define SHAPE_CHUNK_SIZE 128
+#define PAIR_CHUNK_SIZE 64
+#define ARBITER_CHUNK_SIZE 64
+#define SOLVER_CHUNK_SIZE 32
+
+// A worker's queue is a range of chunk indexes packed into a single word along with the low bits of the job generation.
+// The owner pops chunks from the front and other workers steal from the back, both using compare and swap on the whole word.
+// The generation tag keeps a late worker from claiming chunks of a newer job than the one it started.
+#define QUEUE_TAG_SHIFT 48
+#define QUEUE_HEAD_SHIFT 24
+#define QUEUE_INDEX_MASK ((1ull << 24) - 1)
+#define QUEUE_TAG_MASK ((1ull << 16) - 1)
+
+typedef struct WorkerQueue {
+	volatile uint64_t range;
+	
+	// Keep each queue on its own cache line.
+	char padding[64 - sizeof(uint64_t)];
+} WorkerQueue;
 
 struct ThreadContext {
 	pthread_t thread;
@@ -392,7 +764,43 @@ struct ThreadContext {
 	unsigned long thread_num;
 };
 
-typedef	void (*cpHastySpaceWorkFunction)(cpSpace *space, unsigned long worker, unsigned long worker_count);
+typedef void (*cpHastySpaceJobFunction)(cpHastySpace *hasty, void *data, int start, int end);
+
+// A range of arbiters or constraints that can be solved concurrently.
+typedef struct SolverBatch {
+	int start, end;
+	
+	// The batch contains constraints instead of arbiters.
+	cpBool constraints;
+	// The batch contains items that share bodies and must be solved by a single thread.
+	cpBool serial;
+	
+	// Range of the wide solver groups of the batch's arbiters.
+	int group_start, group_end;
+} SolverBatch;
+
+// Ranges of the arbiters and constraints of an island of the contact graph.
+// Arbiters are in [start, constraints) and constraints are in [constraints, end).
+typedef struct Island {
+	int start, constraints, end;
+} Island;
+
+// A pair of shapes with overlapping bounding boxes found by the spatial index.
+typedef struct CollisionPair {
+	cpShape *a, *b;
+	
+	// Collision id and hint cached from the previous step.
+	cpCollisionID id, hint;
+	
+	// Collision function index of the shapes. (See cpCollisionFuncIndex())
+	int type;
+	
+	// The pair was rejected before running the narrowphase. (filtered, same body, etc)
+	cpBool rejected;
+	
+	// Narrowphase result. The contacts are stored in hasty->contacts until they are merged.
+	struct cpCollisionInfo info;
+} CollisionPair;
 
 struct cpHastySpace {
 	cpSpace space;
@@ -400,114 +808,885 @@ struct cpHastySpace {
 	// Number of worker threads (including the main thread)
 	unsigned long num_threads;
 	
-	// Number of worker threads currently executing. (also including the main thread)
-	unsigned long num_working;
+	// Number of times an idle worker polls for jobs before sleeping.
+	unsigned long spin_budget;
 	
-	// Number of constraints (plus contacts) that must exist per step to start the worker threads.
-	unsigned long constraint_count_threshold;
+	// Pin the worker threads to separate CPUs.
+	cpBool affinity;
 	
+	// Used by idle workers to sleep until a job is submitted.
 	pthread_mutex_t mutex;
-	pthread_cond_t cond_work, cond_resume;
+	pthread_cond_t cond_work;
+	
+	// Incremented for each job submitted, number of sleeping workers, and non-zero when the workers should exit.
+	volatile uint64_t generation, sleeping, quit;
 	
-	// Work function to invoke.
-	cpHastySpaceWorkFunction work;
+	// Number of chunks of the current job that have not finished.
+	volatile uint64_t remaining;
 	
+	// Current job. Only written by the main thread while no chunks are running.
+	cpHastySpaceJobFunction job_func;
+	void *job_data;
+	int job_count, job_chunk_size;
+	
+	WorkerQueue queues[MAX_THREADS];
 	struct ThreadContext workers[MAX_THREADS - 1];
+	
+	// Arbiters followed by constraints, sorted into batches by color.
+	void **solver_items;
+	int *solver_colors;
+	int solver_capacity;
+	
+	SolverBatch batches[2*(MAX_COLORS + 1)];
+	int batch_count;
+	
+	cpHastySpaceSolverMode solver_mode;
+	
+	// Instruction set used to solve the arbiters.
+	cpHastySpaceSIMD simd;
+	
+	// Arbiters of the colored batches transposed into groups for the wide solvers.
+	// Each group holds 'wide_lanes' arbiters and WIDE_GROUP_FIELDS vectors of values.
+	int wide_lanes;
+	cpFloat *wide_groups;
+	cpArbiter **wide_arbiters;
+	int wide_group_count, wide_group_capacity;
+	
+	// Roots of the awake components of the contact graph used to build the islands.
+	cpArray *island_roots;
+	
+	Island *islands;
+	int island_count, island_capacity;
+	
+	// Islands are grouped into jobs. Job i solves islands [island_jobs[i], island_jobs[i + 1]).
+	int *island_jobs;
+	int island_job_count;
+	
+	// Shapes to update the bounding boxes of.
+	cpArray *collide_shapes;
+	
+	// Collision pairs from the current and previous step.
+	CollisionPair *pairs, *prev_pairs;
+	int pair_count, prev_pair_count;
+	int pair_capacity, prev_pair_capacity;
+	
+	// Indexes of the pairs sorted by type, so each type of collision is queued together for cpCollideBatch().
+	int *pair_queue;
+	int pair_queue_capacity;
+	int pair_type_counts[CP_NUM_SHAPES*CP_NUM_SHAPES];
+	
+	// Narrowphase contacts with CP_MAX_CONTACTS_PER_ARBITER slots for each pair.
+	struct cpContact *contacts;
+	int contact_capacity;
 };
 
-static void *
-WorkerThreadLoop(struct ThreadContext *context)
+static inline uint64_t
+QueueRange(uint64_t tag, uint64_t head, uint64_t tail)
+{
+	return (tag & QUEUE_TAG_MASK) << QUEUE_TAG_SHIFT | head << QUEUE_HEAD_SHIFT | tail;
+}
+
+static cpBool
+QueuePop(WorkerQueue *queue, uint64_t tag, int *chunk)
+{
+	for(;;){
+		uint64_t range = AtomicLoad(&queue->range);
+		uint64_t head = (range >> QUEUE_HEAD_SHIFT) & QUEUE_INDEX_MASK, tail = range & QUEUE_INDEX_MASK;
+		if(range >> QUEUE_TAG_SHIFT != (tag & QUEUE_TAG_MASK) || head == tail) return cpFalse;
+		
+		if(AtomicCompareAndSwap(&queue->range, range, QueueRange(tag, head + 1, tail))){
+			(*chunk) = (int)head;
+			return cpTrue;
+		}
+	}
+}
+
+static cpBool
+QueueSteal(WorkerQueue *queue, uint64_t tag, int *chunk)
+{
+	for(;;){
+		uint64_t range = AtomicLoad(&queue->range);
+		uint64_t head = (range >> QUEUE_HEAD_SHIFT) & QUEUE_INDEX_MASK, tail = range & QUEUE_INDEX_MASK;
+		if(range >> QUEUE_TAG_SHIFT != (tag & QUEUE_TAG_MASK) || head == tail) return cpFalse;
+		
+		if(AtomicCompareAndSwap(&queue->range, range, QueueRange(tag, head, tail - 1))){
+			(*chunk) = (int)(tail - 1);
+			return cpTrue;
+		}
+	}
+}
+
+// Run chunks of the job with the given generation until there are none left to pop or steal.
+static void
+RunChunks(cpHastySpace *hasty, unsigned long worker, uint64_t generation)
 {
-	cpHastySpace *hasty = context->space;
-	
-	unsigned long thread = context->thread_num;
 	unsigned long num_threads = hasty->num_threads;
 	
 	for(;;){
-		pthread_mutex_lock(&hasty->mutex); {
-			if(--hasty->num_working == 0){
-				pthread_cond_signal(&hasty->cond_resume);
+		int chunk;
+		if(!QueuePop(hasty->queues + worker, generation, &chunk)){
+			cpBool stolen = cpFalse;
+			for(unsigned long i=1; i<num_threads && !stolen; i++){
+				stolen = QueueSteal(hasty->queues + (worker + i)%num_threads, generation, &chunk);
 			}
 			
-			pthread_cond_wait(&hasty->cond_work, &hasty->mutex);
-		} pthread_mutex_unlock(&hasty->mutex);
+			if(!stolen) return;
+		}
 		
-		cpHastySpaceWorkFunction func = hasty->work;
-		if(func){
-			hasty->work(&hasty->space, thread, num_threads);
-		} else {
-			break;
+		// Claiming a chunk guarantees the job can't be replaced until it's finished.
+		int start = chunk*hasty->job_chunk_size;
+		int end = start + hasty->job_chunk_size;
+		hasty->job_func(hasty, hasty->job_data, start, (end < hasty->job_count ? end : hasty->job_count));
+		
+		AtomicAdd(&hasty->remaining, (uint64_t)-1);
+	}
+}
+
+// Spin until a job newer than 'seen' is submitted, then go to sleep.
+static uint64_t
+WaitForJob(cpHastySpace *hasty, uint64_t seen)
+{
+	uint64_t generation;
+	for(unsigned long i=0; i<hasty->spin_budget; i++){
+		generation = AtomicLoad(&hasty->generation);
+		if(generation != seen || AtomicLoad(&hasty->quit)) return generation;
+		
+		CPURelax();
+	}
+	
+	pthread_mutex_lock(&hasty->mutex); {
+		// The sleeping count must be visible before checking the generation again so RunJob() can't miss the wake up.
+		AtomicAdd(&hasty->sleeping, 1);
+		while((generation = AtomicLoad(&hasty->generation)) == seen && !AtomicLoad(&hasty->quit)){
+			pthread_cond_wait(&hasty->cond_work, &hasty->mutex);
 		}
+		AtomicAdd(&hasty->sleeping, (uint64_t)-1);
+	} pthread_mutex_unlock(&hasty->mutex);
+	
+	return generation;
+}
+
+static void
+PinThread(unsigned long cpu)
+{
+#if defined(_WIN32)
+	SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << (cpu%(8*sizeof(DWORD_PTR))));
+#elif defined(__linux__) && defined(__GLIBC__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu%CPU_SETSIZE, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+	// Thread affinity is not supported.
+	(void)cpu;
+#endif
+}
+
+static unsigned long ProcessorCount(void);
+
+static void *
+WorkerThreadLoop(struct ThreadContext *context)
+{
+	cpHastySpace *hasty = context->space;
+	unsigned long thread = context->thread_num;
+	
+	// Leave the first CPU for the main thread.
+	if(hasty->affinity) PinThread(thread%ProcessorCount());
+	
+	uint64_t seen = AtomicLoad(&hasty->generation);
+	for(;;){
+		seen = WaitForJob(hasty, seen);
+		if(AtomicLoad(&hasty->quit)) break;
+		
+		RunChunks(hasty, thread, seen);
 	}
 	
 	return NULL;
 }
 
+// Call func() for all items in [0, count) split into chunks of chunk_size items, and wait for it to finish.
+// Small jobs are run directly on the calling thread.
 static void
-RunWorkers(cpHastySpace *hasty, cpHastySpaceWorkFunction func)
+RunJob(cpHastySpace *hasty, cpHastySpaceJobFunction func, void *data, int count, int chunk_size)
 {
-	hasty->num_working = hasty->num_threads - 1;
-	hasty->work = func;
+	unsigned long num_threads = hasty->num_threads;
+	int chunks = (count + chunk_size - 1)/chunk_size;
+	
+	if(num_threads == 1 || chunks <= 1){
+		if(count > 0) func(hasty, data, 0, count);
+		return;
+	}
+	
+	// Keep the chunk indexes in range of the queue encoding.
+	if((uint64_t)chunks > QUEUE_INDEX_MASK){
+		chunk_size = (int)(count/QUEUE_INDEX_MASK) + 1;
+		chunks = (count + chunk_size - 1)/chunk_size;
+	}
+	
+	hasty->job_func = func;
+	hasty->job_data = data;
+	hasty->job_count = count;
+	hasty->job_chunk_size = chunk_size;
 	
-	if(hasty->num_working > 0){
+	uint64_t generation = hasty->generation + 1;
+	for(unsigned long i=0; i<num_threads; i++){
+		uint64_t head = chunks*i/num_threads, tail = chunks*(i + 1)/num_threads;
+		AtomicStore(&hasty->queues[i].range, QueueRange(generation, head, tail));
+	}
+	
+	AtomicStore(&hasty->remaining, chunks);
+	AtomicStore(&hasty->generation, generation);
+	
+	if(AtomicLoad(&hasty->sleeping)){
 		pthread_mutex_lock(&hasty->mutex); {
 			pthread_cond_broadcast(&hasty->cond_work);
 		} pthread_mutex_unlock(&hasty->mutex);
+	}
+	
+	RunChunks(hasty, 0, generation);
+	
+	// Wait for the chunks that other workers are still running.
+	for(unsigned long i=0; AtomicLoad(&hasty->remaining); i++){
+		if(i < hasty->spin_budget){
+			CPURelax();
+		} else {
+			ThreadYield();
+		}
+	}
+}
+
+//MARK: Graph Colored Solver
+
+// The solvers never write to static and kinematic bodies (see cpBodyTakesImpulses()), so any number of items in a color can share them.
+static inline uint64_t
+BodyColorMask(cpBody *body)
+{
+	return (cpBodyGetType(body) == CP_BODY_TYPE_DYNAMIC ? body->colorMask : 0);
+}
+
+static inline void
+BodyAddColor(cpBody *body, int color)
+{
+	if(cpBodyGetType(body) == CP_BODY_TYPE_DYNAMIC) body->colorMask |= (uint64_t)1 << color;
+}
+
+static inline void
+SolverItemBodies(void *item, cpBool constraints, cpBody **a, cpBody **b)
+{
+	if(constraints){
+		cpConstraint *constraint = (cpConstraint *)item;
+		(*a) = constraint->a, (*b) = constraint->b;
+	} else {
+		cpArbiter *arb = (cpArbiter *)item;
+		(*a) = arb->body_a, (*b) = arb->body_b;
+	}
+}
+
+// Greedily color the items so that no two items with the same color share a dynamic body.
+// The items are then sorted by color into hasty->solver_items starting at 'offset'.
+// The coloring only depends on the order of the items, so the batches are the same for any number of threads.
+static int
+ColorSolverItems(cpHastySpace *hasty, void **items, int count, cpBool constraints, int offset)
+{
+	int *colors = hasty->solver_colors + offset;
+	int color_counts[MAX_COLORS + 1] = {0};
+	
+	for(int i=0; i<count; i++){
+		cpBody *a, *b; SolverItemBodies(items[i], constraints, &a, &b);
+		a->colorMask = b->colorMask = 0;
+	}
+	
+	for(int i=0; i<count; i++){
+		cpBody *a, *b; SolverItemBodies(items[i], constraints, &a, &b);
+		uint64_t used = BodyColorMask(a) | BodyColorMask(b);
 		
-		func((cpSpace *)hasty, 0, hasty->num_threads);
-			
-		pthread_mutex_lock(&hasty->mutex); {
-			if(hasty->num_working > 0){
-				pthread_cond_wait(&hasty->cond_resume, &hasty->mutex);
+		int color = 0;
+		while(color < MAX_COLORS && (used & ((uint64_t)1 << color))) color++;
+		
+		// Items that can't be colored end up in the serial batch. (color == MAX_COLORS)
+		if(color < MAX_COLORS){
+			BodyAddColor(a, color);
+			BodyAddColor(b, color);
+		}
+		
+		colors[i] = color;
+		color_counts[color]++;
+	}
+	
+	// Convert the counts into batches and then scatter the items into place.
+	int color_starts[MAX_COLORS + 1];
+	for(int color=0, start=offset; color<=MAX_COLORS; color++){
+		color_starts[color] = start;
+		
+		int end = start + color_counts[color];
+		if(end > start){
+			SolverBatch batch = {start, end, constraints, color == MAX_COLORS};
+			hasty->batches[hasty->batch_count++] = batch;
+		}
+		
+		start = end;
+	}
+	
+	for(int i=0; i<count; i++) hasty->solver_items[color_starts[colors[i]]++] = items[i];
+	
+	return offset + count;
+}
+
+static void
+SolverItemsReserve(cpHastySpace *hasty, int count)
+{
+	if(count > hasty->solver_capacity){
+		hasty->solver_capacity = (count > 2*hasty->solver_capacity ? count : 2*hasty->solver_capacity);
+		hasty->solver_items = (void **)cprealloc(hasty->solver_items, hasty->solver_capacity*sizeof(void *));
+		hasty->solver_colors = (int *)cprealloc(hasty->solver_colors, hasty->solver_capacity*sizeof(int));
+	}
+}
+
+static void
+BuildSolverBatches(cpHastySpace *hasty)
+{
+	cpArray *arbiters = hasty->space.arbiters;
+	cpArray *constraints = hasty->space.constraints;
+	SolverItemsReserve(hasty, arbiters->num + constraints->num);
+	
+	hasty->batch_count = 0;
+	int offset = ColorSolverItems(hasty, arbiters->arr, arbiters->num, cpFalse, 0);
+	ColorSolverItems(hasty, constraints->arr, constraints->num, cpTrue, offset);
+}
+
+static inline void
+SolveArbiters(void **items, int start, int end, cpHastySpaceSIMD simd)
+{
+	for(int i=start; i<end; i++){
+		cpArbiter *arb = (cpArbiter *)items[i];
+		#ifdef __ARM_NEON__
+			if(simd == CP_HASTY_SIMD_NEON){
+				cpArbiterApplyImpulse_NEON(arb);
+				continue;
 			}
-		} pthread_mutex_unlock(&hasty->mutex);
+		#endif
+		
+		cpArbiterApplyImpulse(arb);
+	}
+}
+
+static inline void
+SolveConstraints(void **items, int start, int end, cpFloat dt)
+{
+	for(int i=start; i<end; i++){
+		cpConstraint *constraint = (cpConstraint *)items[i];
+		constraint->klass->applyImpulse(constraint, dt);
+	}
+}
+
+#if CP_HASTY_WIDE_SOLVER
+
+static inline int
+WideLaneCount(cpHastySpaceSIMD simd)
+{
+	switch(simd){
+		case CP_HASTY_SIMD_SSE2: return (int)(sizeof(__m128)/sizeof(cpFloat));
+		case CP_HASTY_SIMD_AVX2: return (int)(sizeof(__m256)/sizeof(cpFloat));
+		default: return 0;
+	}
+}
+
+// Transpose the arbiters of the parallel batches into groups for the wide solver.
+static void
+BuildWideGroups(cpHastySpace *hasty)
+{
+	int lanes = hasty->wide_lanes = WideLaneCount(hasty->simd);
+	if(!lanes) return;
+	
+	int count = 0;
+	for(int i=0; i<hasty->batch_count; i++){
+		SolverBatch *batch = hasty->batches + i;
+		if(!batch->constraints && !batch->serial) count += (batch->end - batch->start + lanes - 1)/lanes;
+	}
+	
+	if(count > hasty->wide_group_capacity){
+		hasty->wide_group_capacity = (count > 2*hasty->wide_group_capacity ? count : 2*hasty->wide_group_capacity);
+		hasty->wide_groups = (cpFloat *)cprealloc(hasty->wide_groups, hasty->wide_group_capacity*WIDE_GROUP_FIELDS*WIDE_MAX_LANES*sizeof(cpFloat));
+		hasty->wide_arbiters = (cpArbiter **)cprealloc(hasty->wide_arbiters, hasty->wide_group_capacity*WIDE_MAX_LANES*sizeof(cpArbiter *));
+	}
+	
+	int group = 0;
+	for(int i=0; i<hasty->batch_count; i++){
+		SolverBatch *batch = hasty->batches + i;
+		if(batch->constraints || batch->serial) continue;
+		
+		batch->group_start = group;
+		for(int j=batch->start; j<batch->end; j+=lanes, group++){
+			int remaining = batch->end - j;
+			cpFloat *fields = hasty->wide_groups + group*WIDE_GROUP_FIELDS*lanes;
+			WidePrepareGroup(fields, hasty->wide_arbiters + group*lanes, hasty->solver_items + j, (remaining < lanes ? remaining : lanes), lanes);
+		}
+		batch->group_end = group;
+	}
+	
+	hasty->wide_group_count = group;
+}
+
+static void
+StoreWideImpulses(cpHastySpace *hasty)
+{
+	int lanes = hasty->wide_lanes;
+	for(int i=0; i<hasty->wide_group_count; i++){
+		WideStoreImpulses(hasty->wide_groups + i*WIDE_GROUP_FIELDS*lanes, hasty->wide_arbiters + i*lanes, lanes);
+	}
+}
+
+static inline void
+SolveWide(cpHastySpace *hasty, int start, int end)
+{
+	if(hasty->simd == CP_HASTY_SIMD_AVX2){
+		SolveWideAVX2(hasty->wide_groups, hasty->wide_arbiters, start, end);
 	} else {
-		func((cpSpace *)hasty, 0, hasty->num_threads);
+		SolveWideSSE2(hasty->wide_groups, hasty->wide_arbiters, start, end);
 	}
+}
+
+#else
+
+// There are no wide solvers for this CPU, so hasty->wide_lanes is always 0.
+static inline void BuildWideGroups(cpHastySpace *hasty){}
+static inline void StoreWideImpulses(cpHastySpace *hasty){}
+static inline void SolveWide(cpHastySpace *hasty, int start, int end){}
+
+#endif
+
+// Solve the items in [start, end) relative to the start of the batch.
+static void
+SolveBatch(cpHastySpace *hasty, SolverBatch *batch, int start, int end)
+{
+	void **items = hasty->solver_items + batch->start;
 	
-	hasty->work = NULL;
+	if(batch->constraints){
+		SolveConstraints(items, start, end, hasty->space.curr_dt);
+	} else if(hasty->wide_lanes && !batch->serial){
+		// Chunks start at multiples of SOLVER_CHUNK_SIZE, which is a multiple of the lane count.
+		int lanes = hasty->wide_lanes;
+		SolveWide(hasty, batch->group_start + start/lanes, batch->group_start + (end + lanes - 1)/lanes);
+	} else {
+		SolveArbiters(items, start, end, hasty->simd);
+	}
 }
 
 static void
-Solver(cpSpace *space, unsigned long worker, unsigned long worker_count)
+Solver(cpHastySpace *hasty)
 {
-	cpArray *constraints = space->constraints;
+	BuildWideGroups(hasty);
+	
+	for(int i=0; i<hasty->space.iterations; i++){
+		for(int j=0; j<hasty->batch_count; j++){
+			SolverBatch *batch = hasty->batches + j;
+			
+			if(batch->serial){
+				SolveBatch(hasty, batch, 0, batch->end - batch->start);
+			} else {
+				// Items in a batch don't share any dynamic bodies, so they can be split between the threads arbitrarily.
+				RunJob(hasty, (cpHastySpaceJobFunction)SolveBatch, batch, batch->end - batch->start, SOLVER_CHUNK_SIZE);
+			}
+		}
+	}
+	
+	StoreWideImpulses(hasty);
+}
+
+//MARK: Island Solver
+
+// Islands are solved in jobs of at least this many arbiters and constraints.
+#define ISLAND_JOB_SIZE 64
+
+static inline int
+SolverItemIsland(cpBody *a, cpBody *b, int leftover)
+{
+	cpBody *body = (cpBodyGetType(a) == CP_BODY_TYPE_DYNAMIC ? a : b);
+	cpBody *root = (cpBodyGetType(body) == CP_BODY_TYPE_DYNAMIC ? body->sleeping.root : NULL);
+	return (root ? root->island : leftover);
+}
+
+// Sort the arbiters and constraints into contiguous lists for each island of the contact graph.
+// Each island holds its arbiters followed by its constraints, in the same order as the space's arrays.
+// Items that don't touch a dynamic body go into an extra island at the end.
+static void
+BuildIslands(cpHastySpace *hasty)
+{
+	cpSpace *space = (cpSpace *)hasty;
 	cpArray *arbiters = space->arbiters;
+	cpArray *constraints = space->constraints;
+	SolverItemsReserve(hasty, arbiters->num + constraints->num);
 	
-	cpFloat dt = space->curr_dt;
-	unsigned long iterations = (space->iterations + worker_count - 1)/worker_count;
+	cpArray *roots = hasty->island_roots;
+	roots->num = 0;
+	cpSpaceGatherComponents(space, roots);
 	
-	for(unsigned long i=0; i<iterations; i++){
-		for(int j=0; j<arbiters->num; j++){
-			cpArbiter *arb = (cpArbiter *)arbiters->arr[j];
-			#ifdef __ARM_NEON__
-				cpArbiterApplyImpulse_NEON(arb);
-			#else
-				cpArbiterApplyImpulse(arb);
-			#endif
+	int leftover = roots->num;
+	int island_count = roots->num + 1;
+	for(int i=0; i<roots->num; i++) ((cpBody *)roots->arr[i])->island = i;
+	
+	if(island_count > hasty->island_capacity){
+		hasty->island_capacity = (island_count > 2*hasty->island_capacity ? island_count : 2*hasty->island_capacity);
+		hasty->islands = (Island *)cprealloc(hasty->islands, hasty->island_capacity*sizeof(Island));
+		hasty->island_jobs = (int *)cprealloc(hasty->island_jobs, (hasty->island_capacity + 1)*sizeof(int));
+	}
+	
+	Island *islands = hasty->islands;
+	memset(islands, 0, island_count*sizeof(Island));
+	
+	// Count the items in each island and remember which island they go into.
+	// Until they are converted into ranges, 'constraints' and 'end' hold the arbiter and constraint counts.
+	int *item_islands = hasty->solver_colors;
+	for(int i=0; i<arbiters->num; i++){
+		cpArbiter *arb = (cpArbiter *)arbiters->arr[i];
+		int island = item_islands[i] = SolverItemIsland(arb->body_a, arb->body_b, leftover);
+		islands[island].constraints++;
+	}
+	
+	for(int i=0; i<constraints->num; i++){
+		cpConstraint *constraint = (cpConstraint *)constraints->arr[i];
+		int island = item_islands[arbiters->num + i] = SolverItemIsland(constraint->a, constraint->b, leftover);
+		islands[island].end++;
+	}
+	
+	// The component pointers were only needed to find the islands.
+	cpSpaceClearComponents(roots);
+	
+	// Convert the counts into ranges. Arbiters are scattered to [start, constraints) and constraints to [constraints, end).
+	int *arbiter_cursors = hasty->island_jobs;
+	for(int i=0, start=0; i<island_count; i++){
+		Island *island = islands + i;
+		int arbiter_count = island->constraints, constraint_count = island->end;
+		
+		island->start = start;
+		island->constraints = start + arbiter_count;
+		island->end = island->constraints + constraint_count;
+		
+		arbiter_cursors[i] = island->start;
+		start = island->end;
+	}
+	
+	for(int i=0; i<arbiters->num; i++){
+		hasty->solver_items[arbiter_cursors[item_islands[i]]++] = arbiters->arr[i];
+	}
+	
+	// Every island's arbiter cursor now points at the start of its constraints.
+	for(int i=0; i<constraints->num; i++){
+		hasty->solver_items[arbiter_cursors[item_islands[arbiters->num + i]]++] = constraints->arr[i];
+	}
+	
+	// Batch small islands together into jobs.
+	int *jobs = hasty->island_jobs;
+	int job_count = 0, job_items = 0;
+	jobs[0] = 0;
+	for(int i=0; i<island_count; i++){
+		job_items += islands[i].end - islands[i].start;
+		
+		if(job_items >= ISLAND_JOB_SIZE || i == island_count - 1){
+			jobs[++job_count] = i + 1;
+			job_items = 0;
 		}
+	}
+	
+	hasty->island_count = island_count;
+	hasty->island_job_count = job_count;
+}
+
+// Islands don't share any dynamic bodies, so each one can be solved by a single thread without synchronization.
+// The impulses are applied to each body in the same order as cpSpaceStep().
+static void
+SolveIslands(cpHastySpace *hasty, void *unused, int start, int end)
+{
+	void **items = hasty->solver_items;
+	cpFloat dt = hasty->space.curr_dt;
+	int iterations = hasty->space.iterations;
+	
+	for(int job=start; job<end; job++){
+		for(int i=hasty->island_jobs[job]; i<hasty->island_jobs[job + 1]; i++){
+			Island *island = hasty->islands + i;
 			
-		for(int j=0; j<constraints->num; j++){
-			cpConstraint *constraint = (cpConstraint *)constraints->arr[j];
-			constraint->klass->applyImpulse(constraint, dt);
+			for(int j=0; j<iterations; j++){
+				SolveArbiters(items, island->start, island->constraints, hasty->simd);
+				SolveConstraints(items, island->constraints, island->end, dt);
+			}
+		}
+	}
+}
+
+//MARK: Parallel Collision Detection
+
+static void
+CollectShape(cpShape *shape, cpArray *shapes)
+{
+	cpArrayPush(shapes, shape);
+}
+
+static void
+UpdateBBs(cpHastySpace *hasty, cpArray *shapes, int start, int end)
+{
+	for(int i=start; i<end; i++) cpShapeCacheBB((cpShape *)shapes->arr[i]);
+}
+
+// Spatial index callback that records the pair instead of colliding it.
+// The index caches the returned value for the pair and passes it back the next step.
+// Return the pair's position (plus one, 0 means nothing cached) so the id found by the narrowphase can be looked up then.
+static cpCollisionID
+RecordCollisionPair(cpShape *a, cpShape *b, cpCollisionID id, cpHastySpace *hasty)
+{
+	if(hasty->pair_count == hasty->pair_capacity){
+		hasty->pair_capacity = (hasty->pair_capacity ? 2*hasty->pair_capacity : 256);
+		hasty->pairs = (CollisionPair *)cprealloc(hasty->pairs, hasty->pair_capacity*sizeof(CollisionPair));
+	}
+	
+	// Other spatial indexes don't cache ids, and a mismatch means the index has reused the value for a different pair.
+	cpCollisionID cached = 0, hint = 0;
+	if(0 < id && id <= (cpCollisionID)hasty->prev_pair_count){
+		CollisionPair *prev = hasty->prev_pairs + (id - 1);
+		if(prev->a == a && prev->b == b){
+			cached = prev->info.id;
+			hint = prev->info.hint;
 		}
 	}
+	
+	CollisionPair *pair = hasty->pairs + hasty->pair_count++;
+	pair->a = a;
+	pair->b = b;
+	pair->id = cached;
+	pair->hint = hint;
+	pair->type = (a->klass->type < b->klass->type ? cpCollisionFuncIndex(a, b) : cpCollisionFuncIndex(b, a));
+	hasty->pair_type_counts[pair->type]++;
+	
+	return (cpCollisionID)hasty->pair_count;
+}
+
+// Sort the pairs into one queue for each type of collision.
+// The queues are stored one after another in hasty->pair_queue, and keep the pairs in the order they were found.
+static void
+QueuePairs(cpHastySpace *hasty)
+{
+	if(hasty->pair_count > hasty->pair_queue_capacity){
+		hasty->pair_queue_capacity = hasty->pair_capacity;
+		hasty->pair_queue = (int *)cprealloc(hasty->pair_queue, hasty->pair_queue_capacity*sizeof(int));
+	}
+	
+	int starts[CP_NUM_SHAPES*CP_NUM_SHAPES];
+	for(int type=0, start=0; type<CP_NUM_SHAPES*CP_NUM_SHAPES; type++){
+		starts[type] = start;
+		start += hasty->pair_type_counts[type];
+		hasty->pair_type_counts[type] = 0;
+	}
+	
+	for(int i=0; i<hasty->pair_count; i++) hasty->pair_queue[starts[hasty->pairs[i].type]++] = i;
+}
+
+// Collide the queued pairs in [start, end).
+// Pairs that pass the rejection tests are collided in batches of the same type.
+static void
+Narrowphase(cpHastySpace *hasty, void *unused, int start, int end)
+{
+	cpSpace *space = (cpSpace *)hasty;
+	struct cpCollisionInfo *batch[PAIR_CHUNK_SIZE];
+	int batch_type = 0, batch_count = 0;
+	
+	for(int i=start; i<end; i++){
+		int index = hasty->pair_queue[i];
+		CollisionPair *pair = hasty->pairs + index;
+		
+		pair->rejected = cpSpaceShapeQueryReject(pair->a, pair->b);
+		pair->info = cpCollisionInfoInit(pair->a, pair->b, pair->id, hasty->contacts + index*CP_MAX_CONTACTS_PER_ARBITER);
+		pair->info.hint = pair->hint;
+		if(pair->rejected) continue;
+		
+		// Reading the cached arbiters is safe since they aren't updated until the results are merged.
+		cpArbiter *arb = (space->contactReuseThreshold > 0.0f ? cpSpaceCachedArbiter(space, &pair->info) : NULL);
+		if(cpSpaceReuseContacts(space, arb, &pair->info)) continue;
+		
+		if(pair->type != batch_type || batch_count == PAIR_CHUNK_SIZE){
+			cpCollideBatch(batch, batch_count);
+			batch_type = pair->type;
+			batch_count = 0;
+		}
+		
+		batch[batch_count++] = &pair->info;
+	}
+	
+	cpCollideBatch(batch, batch_count);
+}
+
+// A job of a parallel cpBBTree rebuild or cpUniformGrid pair search.
+typedef struct IndexJob {
+	void (*func)(void *data, int i);
+	void *data;
+} IndexJob;
+
+static void
+RunIndexJobs(cpHastySpace *hasty, IndexJob *job, int start, int end)
+{
+	for(int i=start; i<end; i++) job->func(job->data, i);
+}
+
+static void
+IndexJobRunner(void (*func)(void *data, int i), void *data, int count, cpHastySpace *hasty)
+{
+	IndexJob job = {func, data};
+	RunJob(hasty, (cpHastySpaceJobFunction)RunIndexJobs, &job, count, 1);
+}
+
+// Update the shape bounding boxes and find the colliding pairs using the worker threads.
+// The narrowphase results are merged in the order the spatial index found the pairs,
+// so arbiters are created and the begin/preSolve callbacks are called in the same order as cpSpaceStep() on the main thread.
+static void
+Collide(cpHastySpace *hasty)
+{
+	cpSpace *space = (cpSpace *)hasty;
+	
+	cpArray *shapes = hasty->collide_shapes;
+	shapes->num = 0;
+	cpSpatialIndexEach(space->dynamicShapes, (cpSpatialIndexIteratorFunc)CollectShape, shapes);
+	
+	RunJob(hasty, (cpHastySpaceJobFunction)UpdateBBs, shapes, shapes->num, SHAPE_CHUNK_SIZE);
+	CP_STEP_STATS_PHASE(space, CP_SPACE_STEP_PHASE_UPDATE_BBS);
+	
+	// Swap the pair buffers so the previous step's collision ids can be looked up.
+	CollisionPair *prev_pairs = hasty->prev_pairs;
+	int prev_pair_capacity = hasty->prev_pair_capacity;
+	hasty->prev_pairs = hasty->pairs;
+	hasty->prev_pair_count = hasty->pair_count;
+	hasty->prev_pair_capacity = hasty->pair_capacity;
+	hasty->pairs = prev_pairs;
+	hasty->pair_count = 0;
+	hasty->pair_capacity = prev_pair_capacity;
+	
+	// A uniform grid can search for the pairs on the worker threads too.
+	if(cpSpatialIndexIsUniformGrid(space->dynamicShapes)){
+		cpUniformGridSetJobRunner(space->dynamicShapes, (cpSpatialIndexJobRunner)IndexJobRunner, hasty);
+	}
+	
+	cpSpatialIndexReindexQuery(space->dynamicShapes, (cpSpatialIndexQueryFunc)RecordCollisionPair, hasty);
+	
+	int contact_count = hasty->pair_count*CP_MAX_CONTACTS_PER_ARBITER;
+	if(contact_count > hasty->contact_capacity){
+		hasty->contact_capacity = (contact_count > 2*hasty->contact_capacity ? contact_count : 2*hasty->contact_capacity);
+		hasty->contacts = (struct cpContact *)cprealloc(hasty->contacts, hasty->contact_capacity*sizeof(struct cpContact));
+	}
+	
+	QueuePairs(hasty);
+	RunJob(hasty, Narrowphase, NULL, hasty->pair_count, PAIR_CHUNK_SIZE);
+	
+	for(int i=0; i<hasty->pair_count; i++){
+		CollisionPair *pair = hasty->pairs + i;
+		CP_STEP_STATS_COUNT(space, pairsTested);
+		
+		if(pair->rejected) continue;
+		if(pair->info.reused){
+			CP_STEP_STATS_COUNT(space, pairsReused);
+		} else {
+			CP_STEP_STATS_NARROWPHASE(space, pair->a, pair->b);
+			CP_STEP_STATS_ITERATIONS(space, &pair->info);
+		}
+		
+		int count = pair->info.count;
+		if(count == 0) continue; // Shapes are not colliding.
+		
+		// Move the contacts into the space's contact buffer so they persist with the arbiter.
+		struct cpCollisionInfo info = pair->info;
+		info.arr = cpContactBufferGetArray(space);
+		memcpy(info.arr, pair->info.arr, count*sizeof(struct cpContact));
+		cpSpacePushContacts(space, count);
+		
+		cpSpaceProcessCollision(space, &info, NULL);
+	}
+	CP_STEP_STATS_PHASE(space, CP_SPACE_STEP_PHASE_COLLIDE);
+}
+
+//MARK: Parallel Step Functions
+
+static void
+IntegratePositions(cpHastySpace *hasty, cpArray *bodies, int start, int end)
+{
+	cpFloat dt = hasty->space.curr_dt;
+	
+	for(int i=start; i<end; i++){
+		cpBody *body = (cpBody *)bodies->arr[i];
+		body->position_func(body, dt);
+	}
+}
+
+static void
+IntegrateVelocities(cpHastySpace *hasty, cpArray *bodies, int start, int end)
+{
+	cpSpace *space = (cpSpace *)hasty;
+	cpFloat dt = space->curr_dt;
+	cpFloat damping = cpfpow(space->damping, dt);
+	cpVect gravity = space->gravity;
+	
+	for(int i=start; i<end; i++){
+		cpBody *body = (cpBody *)bodies->arr[i];
+		body->velocity_func(body, gravity, damping, dt);
+	}
+}
+
+static void
+PreStepArbiters(cpHastySpace *hasty, cpArray *arbiters, int start, int end)
+{
+	cpSpace *space = (cpSpace *)hasty;
+	cpFloat dt = space->curr_dt;
+	cpFloat slop = space->collisionSlop;
+	cpFloat biasCoef = 1.0f - cpfpow(space->collisionBias, dt);
+	
+	for(int i=start; i<end; i++){
+		cpArbiterPreStep((cpArbiter *)arbiters->arr[i], dt, slop, biasCoef);
+	}
 }
 
 //MARK: Thread Management Functions
 
+static unsigned long
+ProcessorCount(void)
+{
+#if defined(__APPLE__)
+	unsigned long count = 1;
+	size_t size = sizeof(count);
+	sysctlbyname("hw.ncpu", &count, &size, NULL, 0);
+	return count;
+#elif defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return (count > 0 ? count : 1);
+#else
+	return 1;
+#endif
+}
+
 static void
 HaltThreads(cpHastySpace *hasty)
 {
+	AtomicStore(&hasty->quit, 1);
+	
 	pthread_mutex_t *mutex = &hasty->mutex;
 	pthread_mutex_lock(mutex); {
-		hasty->work = NULL; // NULL work function means break and exit
 		pthread_cond_broadcast(&hasty->cond_work);
 	} pthread_mutex_unlock(mutex);
 	
 	for(unsigned long i=0; i<(hasty->num_threads-1); i++){
 		pthread_join(hasty->workers[i].thread, NULL);
 	}
+	
+	AtomicStore(&hasty->quit, 0);
+}
+
+static void
+StartThreads(cpHastySpace *hasty)
+{
+	for(unsigned long i=0; i<(hasty->num_threads-1); i++){
+		hasty->workers[i].space = hasty;
+		hasty->workers[i].thread_num = i + 1;
+		
+		pthread_create(&hasty->workers[i].thread, NULL, (void*(*)(void*))WorkerThreadLoop, &hasty->workers[i]);
+	}
 }
 
 void
@@ -517,36 +1696,15 @@ cpHastySpaceSetThreads(cpSpace *space, unsigned long threads)
 	// Individual values appear to be written non-atomically when compiled as debug for the simulator.
 	// No idea why, so threads are disabled.
 	threads = 1;
-#endif	
-	
+#endif
+
 	cpHastySpace *hasty = (cpHastySpace *)space;
 	HaltThreads(hasty);
 	
-#ifdef __APPLE__
-	if(threads == 0){
-		size_t size = sizeof(threads);
-		sysctlbyname("hw.ncpu", &threads, &size, NULL, 0);
-	}
-#else
-	if(threads == 0) threads = 1;
-#endif
-	
+	if(threads == 0) threads = ProcessorCount();
 	hasty->num_threads = (threads < MAX_THREADS ? threads : MAX_THREADS);
-	hasty->num_working = hasty->num_threads - 1;
-	
-	// Create the worker threads and wait for them to signal ready.
-	if(hasty->num_working > 0){
-		pthread_mutex_lock(&hasty->mutex);
-		for(unsigned long i=0; i<(hasty->num_threads-1); i++){
-			hasty->workers[i].space = hasty;
-			hasty->workers[i].thread_num = i + 1;
-			
-			pthread_create(&hasty->workers[i].thread, NULL, (void*(*)(void*))WorkerThreadLoop, &hasty->workers[i]);
-		}
-		
-		pthread_cond_wait(&hasty->cond_resume, &hasty->mutex);
-		pthread_mutex_unlock(&hasty->mutex);
-	}
+	
+	StartThreads(hasty);
 }
 
 unsigned long
@@ -555,6 +1713,98 @@ cpHastySpaceGetThreads(cpSpace *space)
 	return ((cpHastySpace *)space)->num_threads;
 }
 
+void
+cpHastySpaceSetSpinBudget(cpSpace *space, unsigned long spins)
+{
+	// The workers read the spin budget while idle, so restart them instead of changing it underneath them.
+	cpHastySpace *hasty = (cpHastySpace *)space;
+	HaltThreads(hasty);
+	hasty->spin_budget = spins;
+	StartThreads(hasty);
+}
+
+unsigned long
+cpHastySpaceGetSpinBudget(cpSpace *space)
+{
+	return ((cpHastySpace *)space)->spin_budget;
+}
+
+void
+cpHastySpaceSetThreadAffinity(cpSpace *space, cpBool affinity)
+{
+	// Workers pin themselves when they start.
+	cpHastySpace *hasty = (cpHastySpace *)space;
+	HaltThreads(hasty);
+	hasty->affinity = affinity;
+	StartThreads(hasty);
+}
+
+cpBool
+cpHastySpaceGetThreadAffinity(cpSpace *space)
+{
+	return ((cpHastySpace *)space)->affinity;
+}
+
+void
+cpHastySpaceSetSolverMode(cpSpace *space, cpHastySpaceSolverMode mode)
+{
+	((cpHastySpace *)space)->solver_mode = mode;
+}
+
+cpHastySpaceSolverMode
+cpHastySpaceGetSolverMode(cpSpace *space)
+{
+	return ((cpHastySpace *)space)->solver_mode;
+}
+
+static cpHastySpaceSIMD
+DefaultSIMD(void)
+{
+#if __ARM_NEON__
+	return CP_HASTY_SIMD_NEON;
+#elif CP_HASTY_WIDE_SOLVER
+	// SSE2 only holds 2 doubles, which isn't enough to pay for gathering the body velocities.
+	if(CPUSupportsAVX2()) return CP_HASTY_SIMD_AVX2;
+	return (CP_USE_DOUBLES ? CP_HASTY_SIMD_NONE : CP_HASTY_SIMD_SSE2);
+#else
+	return CP_HASTY_SIMD_NONE;
+#endif
+}
+
+static cpBool
+SIMDSupported(cpHastySpaceSIMD simd)
+{
+	switch(simd){
+		case CP_HASTY_SIMD_NONE: return cpTrue;
+#if __ARM_NEON__
+		case CP_HASTY_SIMD_NEON: return cpTrue;
+#endif
+#if CP_HASTY_WIDE_SOLVER
+		case CP_HASTY_SIMD_SSE2: return cpTrue;
+		case CP_HASTY_SIMD_AVX2: return CPUSupportsAVX2();
+#endif
+		default: return cpFalse;
+	}
+}
+
+void
+cpHastySpaceSetSIMD(cpSpace *space, cpHastySpaceSIMD simd)
+{
+	((cpHastySpace *)space)->simd = (SIMDSupported(simd) ? simd : DefaultSIMD());
+}
+
+cpHastySpaceSIMD
+cpHastySpaceGetSIMD(cpSpace *space)
+{
+	return ((cpHastySpace *)space)->simd;
+}
+
+void
+cpHastySpaceOptimizeStaticIndex(cpSpace *space)
+{
+	cpBBTreeOptimizeParallel(space->staticShapes, (cpSpatialIndexJobRunner)IndexJobRunner, space);
+}
+
 //MARK: Overriden cpSpace Functions.
 
 cpSpace *
@@ -565,15 +1815,16 @@ cpHastySpaceNew(void)
 	
 	pthread_mutex_init(&hasty->mutex, NULL);
 	pthread_cond_init(&hasty->cond_work, NULL);
-	pthread_cond_init(&hasty->cond_resume, NULL);
 	
-	// TODO magic number, should test this more thoroughly.
-	hasty->constraint_count_threshold = 50;
+	hasty->spin_budget = DEFAULT_SPIN_BUDGET;
+	hasty->simd = DefaultSIMD();
+	hasty->collide_shapes = cpArrayNew(0);
+	hasty->island_roots = cpArrayNew(0);
 	
 	// Default to 1 thread for determinism.
 	hasty->num_threads = 1;
 	cpHastySpaceSetThreads((cpSpace *)hasty, 1);
-
+	
 	return (cpSpace *)hasty;
 }
 
@@ -586,7 +1837,21 @@ cpHastySpaceFree(cpSpace *space)
 	
 	pthread_mutex_destroy(&hasty->mutex);
 	pthread_cond_destroy(&hasty->cond_work);
-	pthread_cond_destroy(&hasty->cond_resume);
+	
+	cpfree(hasty->solver_items);
+	cpfree(hasty->solver_colors);
+	cpfree(hasty->wide_groups);
+	cpfree(hasty->wide_arbiters);
+	
+	cpArrayFree(hasty->island_roots);
+	cpfree(hasty->islands);
+	cpfree(hasty->island_jobs);
+	
+	cpArrayFree(hasty->collide_shapes);
+	cpfree(hasty->pairs);
+	cpfree(hasty->prev_pairs);
+	cpfree(hasty->pair_queue);
+	cpfree(hasty->contacts);
 	
 	cpSpaceFree(space);
 }
@@ -597,11 +1862,14 @@ cpHastySpaceStep(cpSpace *space, cpFloat dt)
 	// don't step if the timestep is 0!
 	if(dt == 0.0f) return;
 	
+	cpHastySpace *hasty = (cpHastySpace *)space;
+	
 	space->stamp++;
+	CP_STEP_STATS_BEGIN(space);
 	
 	cpFloat prev_dt = space->curr_dt;
 	space->curr_dt = dt;
-		
+	
 	cpArray *bodies = space->dynamicBodies;
 	cpArray *constraints = space->constraints;
 	cpArray *arbiters = space->arbiters;
@@ -620,31 +1888,27 @@ cpHastySpaceStep(cpSpace *space, cpFloat dt)
 	
 	cpSpaceLock(space); {
 		// Integrate positions
-		for(int i=0; i<bodies->num; i++){
-			cpBody *body = (cpBody *)bodies->arr[i];
-			body->position_func(body, dt);
-		}
+		RunJob(hasty, (cpHastySpaceJobFunction)IntegratePositions, bodies, bodies->num, BODY_CHUNK_SIZE);
+		CP_STEP_STATS_PHASE(space, CP_SPACE_STEP_PHASE_INTEGRATE_POSITIONS);
 		
 		// Find colliding pairs.
 		cpSpacePushFreshContactBuffer(space);
-		cpSpatialIndexEach(space->dynamicShapes, (cpSpatialIndexIteratorFunc)cpShapeUpdateFunc, NULL);
-		cpSpatialIndexReindexQuery(space->dynamicShapes, (cpSpatialIndexQueryFunc)cpSpaceCollideShapes, space);
+		Collide(hasty);
 	} cpSpaceUnlock(space, cpFalse);
 	
 	// Rebuild the contact graph (and detect sleeping components if sleeping is enabled)
 	cpSpaceProcessComponents(space, dt);
+	CP_STEP_STATS_PHASE(space, CP_SPACE_STEP_PHASE_COMPONENTS);
 	
 	cpSpaceLock(space); {
 		// Clear out old cached arbiters and call separate callbacks
 		cpHashSetFilter(space->cachedArbiters, (cpHashSetFilterFunc)cpSpaceArbiterSetFilter, space);
-
+		CP_STEP_STATS_PHASE(space, CP_SPACE_STEP_PHASE_ARBITER_FILTER);
+		
 		// Prestep the arbiters and constraints.
-		cpFloat slop = space->collisionSlop;
-		cpFloat biasCoef = 1.0f - cpfpow(space->collisionBias, dt);
-		for(int i=0; i<arbiters->num; i++){
-			cpArbiterPreStep((cpArbiter *)arbiters->arr[i], dt, slop, biasCoef);
-		}
-
+		RunJob(hasty, (cpHastySpaceJobFunction)PreStepArbiters, arbiters, arbiters->num, ARBITER_CHUNK_SIZE);
+		
+		// Constraint pre-solve callbacks can modify the space, so they are run on the main thread.
 		for(int i=0; i<constraints->num; i++){
 			cpConstraint *constraint = (cpConstraint *)constraints->arr[i];
 			
@@ -653,14 +1917,9 @@ cpHastySpaceStep(cpSpace *space, cpFloat dt)
 			
 			constraint->klass->preStep(constraint, dt);
 		}
-	
+		
 		// Integrate velocities.
-		cpFloat damping = cpfpow(space->damping, dt);
-		cpVect gravity = space->gravity;
-		for(int i=0; i<bodies->num; i++){
-			cpBody *body = (cpBody *)bodies->arr[i];
-			body->velocity_func(body, gravity, damping, dt);
-		}
+		RunJob(hasty, (cpHastySpaceJobFunction)IntegrateVelocities, bodies, bodies->num, BODY_CHUNK_SIZE);
 		
 		// Apply cached impulses
 		cpFloat dt_coef = (prev_dt == 0.0f ? 0.0f : dt/prev_dt);
@@ -672,14 +1931,18 @@ cpHastySpaceStep(cpSpace *space, cpFloat dt)
 			cpConstraint *constraint = (cpConstraint *)constraints->arr[i];
 			constraint->klass->applyCachedImpulse(constraint, dt_coef);
 		}
+		CP_STEP_STATS_PHASE(space, CP_SPACE_STEP_PHASE_PRESTEP);
 		
 		// Run the impulse solver.
-		cpHastySpace *hasty = (cpHastySpace *)space;
-		if((unsigned long)(arbiters->num + constraints->num) > hasty->constraint_count_threshold){
-			RunWorkers(hasty, Solver);
+		// Both modes give the same results regardless of the thread count.
+		if(hasty->solver_mode == CP_HASTY_SOLVER_ISLANDS){
+			BuildIslands(hasty);
+			RunJob(hasty, SolveIslands, NULL, hasty->island_job_count, 1);
 		} else {
-			Solver(space, 0, 1);
+			BuildSolverBatches(hasty);
+			Solver(hasty);
 		}
+		CP_STEP_STATS_PHASE(space, CP_SPACE_STEP_PHASE_SOLVE);
 		
 		// Run the constraint post-solve callbacks
 		for(int i=0; i<constraints->num; i++){
@@ -696,5 +1959,8 @@ cpHastySpaceStep(cpSpace *space, cpFloat dt)
 			cpCollisionHandler *handler = arb->handler;
 			handler->postSolveFunc(arb, space, handler->userData);
 		}
+		CP_STEP_STATS_PHASE(space, CP_SPACE_STEP_PHASE_POST_SOLVE);
 	} cpSpaceUnlock(space, cpTrue);
+	
+	CP_STEP_STATS_END(space);
 }
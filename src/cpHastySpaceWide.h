@@ -0,0 +1,100 @@
+// Copyright 2013 Howling Moon Software. All rights reserved.
+// See http://chipmunk2d.net/legal.php for more information.
+
+// Wide contact solver template.
+// cpHastySpace.c includes this once for each instruction set after defining WIDE_FUNC, WIDE_LANES and the vector operations.
+// Solves the groups [start, end) prepared by WidePrepareGroup(). The arbiters in a group must not share any dynamic bodies.
+// The math is done in the same order as cpArbiterApplyImpulse() so the results match the scalar solver when built without -ffast-math.
+
+static void
+WIDE_FUNC(cpFloat *groups, cpArbiter **arbs, int start, int end)
+{
+	cpBody *body_a[WIDE_LANES], *body_b[WIDE_LANES];
+	cpFloat a[WIDE_BODY_FIELDS][WIDE_MAX_LANES], b[WIDE_BODY_FIELDS][WIDE_MAX_LANES];
+	wvec zero = wset1(0.0f);
+
+	for(int g=start; g<end; g++){
+		cpFloat *group = groups + g*WIDE_GROUP_FIELDS*WIDE_LANES;
+		cpArbiter **group_arbs = arbs + g*WIDE_LANES;
+		WideGatherBodies(body_a, body_b, group_arbs, WIDE_LANES);
+
+		wvec a_vx = wgather(body_a, v.x), a_vy = wgather(body_a, v.y), a_w = wgather(body_a, w);
+		wvec a_vbx = wgather(body_a, v_bias.x), a_vby = wgather(body_a, v_bias.y), a_wb = wgather(body_a, w_bias);
+		wvec b_vx = wgather(body_b, v.x), b_vy = wgather(body_b, v.y), b_w = wgather(body_b, w);
+		wvec b_vbx = wgather(body_b, v_bias.x), b_vby = wgather(body_b, v_bias.y), b_wb = wgather(body_b, w_bias);
+
+		wvec a_m = wload(group + WIDE_A_M_INV*WIDE_LANES), a_i = wload(group + WIDE_A_I_INV*WIDE_LANES);
+		wvec b_m = wload(group + WIDE_B_M_INV*WIDE_LANES), b_i = wload(group + WIDE_B_I_INV*WIDE_LANES);
+		wvec nx = wload(group + WIDE_NX*WIDE_LANES), ny = wload(group + WIDE_NY*WIDE_LANES);
+		wvec svx = wload(group + WIDE_SURFACE_VX*WIDE_LANES), svy = wload(group + WIDE_SURFACE_VY*WIDE_LANES);
+		wvec friction = wload(group + WIDE_FRICTION*WIDE_LANES), contacts = wload(group + WIDE_CONTACTS*WIDE_LANES);
+
+		for(int k=0; k<CP_MAX_CONTACTS_PER_ARBITER; k++){
+			cpFloat *con = group + WIDE_CONTACT_FIELD(k, 0)*WIDE_LANES;
+			wvec active = wlt(wset1((cpFloat)k), contacts);
+			if(!wany(active)) break;
+
+			wvec r1x = wload(con + WIDE_R1X*WIDE_LANES), r1y = wload(con + WIDE_R1Y*WIDE_LANES);
+			wvec r2x = wload(con + WIDE_R2X*WIDE_LANES), r2y = wload(con + WIDE_R2Y*WIDE_LANES);
+			wvec nMass = wload(con + WIDE_N_MASS*WIDE_LANES), tMass = wload(con + WIDE_T_MASS*WIDE_LANES);
+			wvec bias = wload(con + WIDE_BIAS*WIDE_LANES), bounce = wload(con + WIDE_BOUNCE*WIDE_LANES);
+			wvec jbnOld = wload(con + WIDE_J_BIAS*WIDE_LANES);
+			wvec jnOld = wload(con + WIDE_JN_ACC*WIDE_LANES);
+			wvec jtOld = wload(con + WIDE_JT_ACC*WIDE_LANES);
+
+			wvec vb1x = wadd(a_vbx, wmul(wneg(r1y), a_wb)), vb1y = wadd(a_vby, wmul(r1x, a_wb));
+			wvec vb2x = wadd(b_vbx, wmul(wneg(r2y), b_wb)), vb2y = wadd(b_vby, wmul(r2x, b_wb));
+
+			wvec v1x = wadd(a_vx, wmul(wneg(r1y), a_w)), v1y = wadd(a_vy, wmul(r1x, a_w));
+			wvec v2x = wadd(b_vx, wmul(wneg(r2y), b_w)), v2y = wadd(b_vy, wmul(r2x, b_w));
+			wvec vrx = wadd(wsub(v2x, v1x), svx), vry = wadd(wsub(v2y, v1y), svy);
+
+			wvec vbn = wadd(wmul(wsub(vb2x, vb1x), nx), wmul(wsub(vb2y, vb1y), ny));
+			wvec vrn = wadd(wmul(vrx, nx), wmul(vry, ny));
+			wvec vrt = wadd(wmul(vrx, wneg(ny)), wmul(vry, nx));
+
+			wvec jBias = wmax(wadd(jbnOld, wmul(wsub(bias, vbn), nMass)), zero);
+			wvec jnAcc = wmax(wadd(jnOld, wmul(wneg(wadd(bounce, vrn)), nMass)), zero);
+
+			wvec jtMax = wmul(friction, jnAcc);
+			wvec jtAcc = wmin(wmax(wadd(jtOld, wmul(wneg(vrt), tMass)), wneg(jtMax)), jtMax);
+
+			wstore(con + WIDE_J_BIAS*WIDE_LANES, jBias);
+			wstore(con + WIDE_JN_ACC*WIDE_LANES, jnAcc);
+			wstore(con + WIDE_JT_ACC*WIDE_LANES, jtAcc);
+
+			// Apply the bias impulse.
+			wvec jbn = wsub(jBias, jbnOld);
+			wvec jbx = wmul(nx, jbn), jby = wmul(ny, jbn);
+			wvec jbx_neg = wneg(jbx), jby_neg = wneg(jby);
+
+			a_vbx = wblend(active, wadd(a_vbx, wmul(jbx_neg, a_m)), a_vbx);
+			a_vby = wblend(active, wadd(a_vby, wmul(jby_neg, a_m)), a_vby);
+			a_wb = wblend(active, wadd(a_wb, wmul(a_i, wsub(wmul(r1x, jby_neg), wmul(r1y, jbx_neg)))), a_wb);
+
+			b_vbx = wblend(active, wadd(b_vbx, wmul(jbx, b_m)), b_vbx);
+			b_vby = wblend(active, wadd(b_vby, wmul(jby, b_m)), b_vby);
+			b_wb = wblend(active, wadd(b_wb, wmul(b_i, wsub(wmul(r2x, jby), wmul(r2y, jbx)))), b_wb);
+
+			// Apply the normal and friction impulse.
+			wvec jn = wsub(jnAcc, jnOld), jt = wsub(jtAcc, jtOld);
+			wvec jx = wsub(wmul(nx, jn), wmul(ny, jt)), jy = wadd(wmul(nx, jt), wmul(ny, jn));
+			wvec jx_neg = wneg(jx), jy_neg = wneg(jy);
+
+			a_vx = wblend(active, wadd(a_vx, wmul(jx_neg, a_m)), a_vx);
+			a_vy = wblend(active, wadd(a_vy, wmul(jy_neg, a_m)), a_vy);
+			a_w = wblend(active, wadd(a_w, wmul(a_i, wsub(wmul(r1x, jy_neg), wmul(r1y, jx_neg)))), a_w);
+
+			b_vx = wblend(active, wadd(b_vx, wmul(jx, b_m)), b_vx);
+			b_vy = wblend(active, wadd(b_vy, wmul(jy, b_m)), b_vy);
+			b_w = wblend(active, wadd(b_w, wmul(b_i, wsub(wmul(r2x, jy), wmul(r2y, jx)))), b_w);
+		}
+
+		wstore(a[WIDE_VX], a_vx); wstore(a[WIDE_VY], a_vy); wstore(a[WIDE_W], a_w);
+		wstore(a[WIDE_VBX], a_vbx); wstore(a[WIDE_VBY], a_vby); wstore(a[WIDE_WB], a_wb);
+		wstore(b[WIDE_VX], b_vx); wstore(b[WIDE_VY], b_vy); wstore(b[WIDE_W], b_w);
+		wstore(b[WIDE_VBX], b_vbx); wstore(b[WIDE_VBY], b_vby); wstore(b[WIDE_WB], b_wb);
+
+		WideScatterBodies(a, b, group_arbs, WIDE_LANES);
+	}
+}
@@ -0,0 +1,765 @@
+/* Copyright (c) 2013 Scott Lembcke and Howling Moon Software
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "chipmunk/chipmunk_private.h"
+
+static inline cpSpatialIndexClass *Klass(void);
+
+// x86-64 always has SSE2. Doubles use AVX when the compiler is allowed to, and pairs of SSE2 vectors otherwise.
+// Other targets test the four lanes in a plain loop.
+#if defined(__x86_64__) || defined(_M_X64)
+	#include <immintrin.h>
+	
+	#if !CP_USE_DOUBLES
+		#define QBVH_SSE 1
+	#elif defined(__AVX__)
+		#define QBVH_AVX 1
+	#else
+		#define QBVH_SSE2 1
+	#endif
+#endif
+
+//MARK: Basic Structures
+
+// A node has up to 4 children, and the children's bounds are stored one per vector lane.
+// The nodes are stored in depth first order, so children always come after their parents, and the root is nodes[0].
+typedef struct QNode {
+	cpFloat l[4], b[4], r[4], t[4];
+	
+	// Index of a child node, or ~i for the leaf cpQBVH.order[i].
+	int children[4];
+	int count;
+	
+	// The leaves under a node are consecutive in cpQBVH.order. This is one past the last one.
+	int leafEnd;
+} QNode;
+
+typedef struct Leaf {
+	void *obj;
+	
+	// Where the leaf's bounds are stored.
+	int node, slot;
+} Leaf;
+
+// How much work is needed before the hierarchy can be queried.
+typedef enum QBVHState {
+	QBVH_CLEAN,
+	// Objects have moved, and the bounds need to be updated.
+	QBVH_REFIT,
+	// Objects have been added or removed, and the hierarchy needs to be rebuilt.
+	QBVH_REBUILD,
+} QBVHState;
+
+// Rebuild instead of refitting once the cost of the hierarchy grows by this much.
+#define QBVH_REBUILD_RATIO 1.5f
+
+struct cpQBVH {
+	cpSpatialIndex spatialIndex;
+	
+	cpHashSet *leaves;
+	
+	QNode *nodes;
+	int nodeCount, nodeCapacity;
+	
+	// Leaves in the order they were built into the hierarchy.
+	Leaf **order;
+	int leafCount, leafCapacity;
+	
+	QBVHState state;
+	// Cost of the hierarchy when it was last rebuilt.
+	cpFloat buildCost;
+	
+	Leaf *pooledLeaves;
+	cpArray *allocatedBuffers;
+	
+	cpCollideStaticBuffer staticBuffer;
+};
+
+static inline cpBB
+QNodeGetBB(QNode *node, int slot)
+{
+	return cpBBNew(node->l[slot], node->b[slot], node->r[slot], node->t[slot]);
+}
+
+static inline void
+QNodeSetBB(QNode *node, int slot, cpBB bb)
+{
+	node->l[slot] = bb.l;
+	node->b[slot] = bb.b;
+	node->r[slot] = bb.r;
+	node->t[slot] = bb.t;
+}
+
+// Bounds of all the children of a node.
+static inline cpBB
+QNodeBounds(QNode *node)
+{
+	cpBB bb = QNodeGetBB(node, 0);
+	for(int i=1; i<node->count; i++) bb = cpBBMerge(bb, QNodeGetBB(node, i));
+	return bb;
+}
+
+static inline cpFloat
+BBPerimeter(cpBB bb)
+{
+	return (bb.r - bb.l) + (bb.t - bb.b);
+}
+
+//MARK: Child Tests
+
+// Each of these return a mask with a bit set for each child of the node that passes the test.
+
+#if QBVH_SSE
+
+static inline int
+QNodeIntersects(QNode *node, cpBB bb)
+{
+	__m128 hit = _mm_and_ps(
+		_mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(node->l), _mm_set1_ps(bb.r)), _mm_cmple_ps(_mm_set1_ps(bb.l), _mm_loadu_ps(node->r))),
+		_mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(node->b), _mm_set1_ps(bb.t)), _mm_cmple_ps(_mm_set1_ps(bb.b), _mm_loadu_ps(node->t)))
+	);
+	
+	return _mm_movemask_ps(hit) & ((1 << node->count) - 1);
+}
+
+// Slab test for one axis. Matches cpBBSegmentQuery().
+static inline __m128
+SegmentSlab(__m128 hit, __m128 *tmin, __m128 *tmax, __m128 min, __m128 max, cpFloat a, cpFloat delta)
+{
+	__m128 va = _mm_set1_ps(a);
+	if(delta == 0.0f){
+		return _mm_and_ps(hit, _mm_and_ps(_mm_cmple_ps(min, va), _mm_cmple_ps(va, max)));
+	} else {
+		__m128 vdelta = _mm_set1_ps(delta);
+		__m128 t1 = _mm_div_ps(_mm_sub_ps(min, va), vdelta);
+		__m128 t2 = _mm_div_ps(_mm_sub_ps(max, va), vdelta);
+		*tmin = _mm_max_ps(*tmin, _mm_min_ps(t1, t2));
+		*tmax = _mm_min_ps(*tmax, _mm_max_ps(t1, t2));
+		return hit;
+	}
+}
+
+static inline int
+QNodeSegmentQuery(QNode *node, cpVect a, cpVect delta, cpFloat *t)
+{
+	__m128 tmin = _mm_set1_ps(-INFINITY), tmax = _mm_set1_ps(INFINITY);
+	__m128 hit = _mm_castsi128_ps(_mm_set1_epi32(-1));
+	hit = SegmentSlab(hit, &tmin, &tmax, _mm_loadu_ps(node->l), _mm_loadu_ps(node->r), a.x, delta.x);
+	hit = SegmentSlab(hit, &tmin, &tmax, _mm_loadu_ps(node->b), _mm_loadu_ps(node->t), a.y, delta.y);
+	
+	__m128 zero = _mm_setzero_ps();
+	hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmple_ps(tmin, tmax), _mm_cmple_ps(zero, tmax)));
+	hit = _mm_and_ps(hit, _mm_cmple_ps(tmin, _mm_set1_ps(1.0f)));
+	
+	_mm_storeu_ps(t, _mm_max_ps(tmin, zero));
+	return _mm_movemask_ps(hit) & ((1 << node->count) - 1);
+}
+
+#elif QBVH_AVX
+
+static inline int
+QNodeIntersects(QNode *node, cpBB bb)
+{
+	__m256d hit = _mm256_and_pd(
+		_mm256_and_pd(_mm256_cmp_pd(_mm256_loadu_pd(node->l), _mm256_set1_pd(bb.r), _CMP_LE_OQ), _mm256_cmp_pd(_mm256_set1_pd(bb.l), _mm256_loadu_pd(node->r), _CMP_LE_OQ)),
+		_mm256_and_pd(_mm256_cmp_pd(_mm256_loadu_pd(node->b), _mm256_set1_pd(bb.t), _CMP_LE_OQ), _mm256_cmp_pd(_mm256_set1_pd(bb.b), _mm256_loadu_pd(node->t), _CMP_LE_OQ))
+	);
+	
+	return _mm256_movemask_pd(hit) & ((1 << node->count) - 1);
+}
+
+// Slab test for one axis. Matches cpBBSegmentQuery().
+static inline __m256d
+SegmentSlab(__m256d hit, __m256d *tmin, __m256d *tmax, __m256d min, __m256d max, cpFloat a, cpFloat delta)
+{
+	__m256d va = _mm256_set1_pd(a);
+	if(delta == 0.0f){
+		return _mm256_and_pd(hit, _mm256_and_pd(_mm256_cmp_pd(min, va, _CMP_LE_OQ), _mm256_cmp_pd(va, max, _CMP_LE_OQ)));
+	} else {
+		__m256d vdelta = _mm256_set1_pd(delta);
+		__m256d t1 = _mm256_div_pd(_mm256_sub_pd(min, va), vdelta);
+		__m256d t2 = _mm256_div_pd(_mm256_sub_pd(max, va), vdelta);
+		*tmin = _mm256_max_pd(*tmin, _mm256_min_pd(t1, t2));
+		*tmax = _mm256_min_pd(*tmax, _mm256_max_pd(t1, t2));
+		return hit;
+	}
+}
+
+static inline int
+QNodeSegmentQuery(QNode *node, cpVect a, cpVect delta, cpFloat *t)
+{
+	__m256d tmin = _mm256_set1_pd(-INFINITY), tmax = _mm256_set1_pd(INFINITY);
+	__m256d hit = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+	hit = SegmentSlab(hit, &tmin, &tmax, _mm256_loadu_pd(node->l), _mm256_loadu_pd(node->r), a.x, delta.x);
+	hit = SegmentSlab(hit, &tmin, &tmax, _mm256_loadu_pd(node->b), _mm256_loadu_pd(node->t), a.y, delta.y);
+	
+	__m256d zero = _mm256_setzero_pd();
+	hit = _mm256_and_pd(hit, _mm256_and_pd(_mm256_cmp_pd(tmin, tmax, _CMP_LE_OQ), _mm256_cmp_pd(zero, tmax, _CMP_LE_OQ)));
+	hit = _mm256_and_pd(hit, _mm256_cmp_pd(tmin, _mm256_set1_pd(1.0), _CMP_LE_OQ));
+	
+	_mm256_storeu_pd(t, _mm256_max_pd(tmin, zero));
+	return _mm256_movemask_pd(hit) & ((1 << node->count) - 1);
+}
+
+#elif QBVH_SSE2
+
+// An SSE2 vector only holds two doubles, so each test is done for lanes 0-1 and then 2-3.
+
+static inline int
+QNodeIntersects(QNode *node, cpBB bb)
+{
+	__m128d l = _mm_set1_pd(bb.l), b = _mm_set1_pd(bb.b), r = _mm_set1_pd(bb.r), t = _mm_set1_pd(bb.t);
+	
+	int mask = 0;
+	for(int i=0; i<4; i+=2){
+		__m128d hit = _mm_and_pd(
+			_mm_and_pd(_mm_cmple_pd(_mm_loadu_pd(node->l + i), r), _mm_cmple_pd(l, _mm_loadu_pd(node->r + i))),
+			_mm_and_pd(_mm_cmple_pd(_mm_loadu_pd(node->b + i), t), _mm_cmple_pd(b, _mm_loadu_pd(node->t + i)))
+		);
+		
+		mask |= _mm_movemask_pd(hit) << i;
+	}
+	
+	return mask & ((1 << node->count) - 1);
+}
+
+// Slab test for one axis. Matches cpBBSegmentQuery().
+static inline __m128d
+SegmentSlab(__m128d hit, __m128d *tmin, __m128d *tmax, __m128d min, __m128d max, cpFloat a, cpFloat delta)
+{
+	__m128d va = _mm_set1_pd(a);
+	if(delta == 0.0f){
+		return _mm_and_pd(hit, _mm_and_pd(_mm_cmple_pd(min, va), _mm_cmple_pd(va, max)));
+	} else {
+		__m128d vdelta = _mm_set1_pd(delta);
+		__m128d t1 = _mm_div_pd(_mm_sub_pd(min, va), vdelta);
+		__m128d t2 = _mm_div_pd(_mm_sub_pd(max, va), vdelta);
+		*tmin = _mm_max_pd(*tmin, _mm_min_pd(t1, t2));
+		*tmax = _mm_min_pd(*tmax, _mm_max_pd(t1, t2));
+		return hit;
+	}
+}
+
+static inline int
+QNodeSegmentQuery(QNode *node, cpVect a, cpVect delta, cpFloat *t)
+{
+	__m128d zero = _mm_setzero_pd(), one = _mm_set1_pd(1.0);
+	
+	int mask = 0;
+	for(int i=0; i<4; i+=2){
+		__m128d tmin = _mm_set1_pd(-INFINITY), tmax = _mm_set1_pd(INFINITY);
+		__m128d hit = _mm_castsi128_pd(_mm_set1_epi32(-1));
+		hit = SegmentSlab(hit, &tmin, &tmax, _mm_loadu_pd(node->l + i), _mm_loadu_pd(node->r + i), a.x, delta.x);
+		hit = SegmentSlab(hit, &tmin, &tmax, _mm_loadu_pd(node->b + i), _mm_loadu_pd(node->t + i), a.y, delta.y);
+		
+		hit = _mm_and_pd(hit, _mm_and_pd(_mm_cmple_pd(tmin, tmax), _mm_cmple_pd(zero, tmax)));
+		hit = _mm_and_pd(hit, _mm_cmple_pd(tmin, one));
+		
+		_mm_storeu_pd(t + i, _mm_max_pd(tmin, zero));
+		mask |= _mm_movemask_pd(hit) << i;
+	}
+	
+	return mask & ((1 << node->count) - 1);
+}
+
+#else
+
+static inline int
+QNodeIntersects(QNode *node, cpBB bb)
+{
+	int mask = 0;
+	for(int i=0; i<node->count; i++){
+		mask |= (node->l[i] <= bb.r && bb.l <= node->r[i] && node->b[i] <= bb.t && bb.b <= node->t[i]) << i;
+	}
+	
+	return mask;
+}
+
+static inline int
+QNodeSegmentQuery(QNode *node, cpVect a, cpVect delta, cpFloat *t)
+{
+	cpVect b = cpvadd(a, delta);
+	
+	int mask = 0;
+	for(int i=0; i<node->count; i++){
+		t[i] = cpBBSegmentQuery(QNodeGetBB(node, i), a, b);
+		mask |= (t[i] != INFINITY) << i;
+	}
+	
+	return mask;
+}
+
+#endif
+
+//MARK: Building
+
+// The hierarchy is built top down with a binned surface area heuristic, like cpBBTreeOptimize().
+// Each node's range of leaves is split in two, and then the larger halves are split again until there are four.
+
+// Build the node for the items in [start, end) and return its index.
+// Nodes are numbered in depth first order, and the leaves keep the order of the items.
+static int
+BuildNode(cpQBVH *bvh, cpBuildItem *items, int start, int end)
+{
+	int index = bvh->nodeCount++;
+	
+	// Split the largest range until there are four. The ranges stay in order.
+	int starts[4] = {start}, ends[4] = {end};
+	int count = 1;
+	while(count < 4){
+		int largest = -1;
+		for(int i=0; i<count; i++){
+			if(ends[i] - starts[i] > 1 && (largest < 0 || ends[i] - starts[i] > ends[largest] - starts[largest])) largest = i;
+		}
+		if(largest < 0) break;
+		
+		for(int i=count; i>largest + 1; i--){
+			starts[i] = starts[i - 1];
+			ends[i] = ends[i - 1];
+		}
+		
+		int split = starts[largest] + cpSpatialIndexPartitionSAH(items + starts[largest], ends[largest] - starts[largest]);
+		starts[largest + 1] = split;
+		ends[largest + 1] = ends[largest];
+		ends[largest] = split;
+		count++;
+	}
+	
+	for(int i=0; i<count; i++){
+		int child;
+		cpBB bb;
+		
+		if(ends[i] - starts[i] == 1){
+			Leaf *leaf = (Leaf *)items[starts[i]].leaf;
+			leaf->node = index;
+			leaf->slot = i;
+			bvh->order[starts[i]] = leaf;
+			
+			child = ~starts[i];
+			bb = items[starts[i]].bb;
+		} else {
+			child = BuildNode(bvh, items, starts[i], ends[i]);
+			bb = QNodeBounds(bvh->nodes + child);
+		}
+		
+		QNode *node = bvh->nodes + index;
+		node->children[i] = child;
+		QNodeSetBB(node, i, bb);
+	}
+	
+	QNode *node = bvh->nodes + index;
+	node->count = count;
+	node->leafEnd = end;
+	
+	// Fill the unused lanes with copies so they don't contain garbage. They are always masked out.
+	for(int i=count; i<4; i++){
+		QNodeSetBB(node, i, QNodeGetBB(node, 0));
+		node->children[i] = node->children[0];
+	}
+	
+	return index;
+}
+
+// Sum of the perimeters of all the children, relative to the bounds of the whole hierarchy.
+// This is proportional to the expected number of children a random query will visit.
+static cpFloat
+QBVHCost(cpQBVH *bvh)
+{
+	if(bvh->nodeCount == 0) return 0.0f;
+	
+	cpFloat sum = 0.0f;
+	for(int i=0; i<bvh->nodeCount; i++){
+		QNode *node = bvh->nodes + i;
+		for(int j=0; j<node->count; j++) sum += BBPerimeter(QNodeGetBB(node, j));
+	}
+	
+	cpFloat perimeter = BBPerimeter(QNodeBounds(bvh->nodes));
+	return (perimeter > 0.0f ? sum/perimeter : 0.0f);
+}
+
+typedef struct FillContext {
+	cpQBVH *bvh;
+	cpBuildItem *cursor;
+} FillContext;
+
+static void
+FillItem(Leaf *leaf, FillContext *context)
+{
+	cpBB bb = context->bvh->spatialIndex.bbfunc(leaf->obj);
+	cpBuildItem item = {bb, cpv((bb.l + bb.r)*0.5f, (bb.b + bb.t)*0.5f), {CP_ALL_CATEGORIES, CP_ALL_CATEGORIES}, leaf};
+	*context->cursor++ = item;
+}
+
+static void
+QBVHRebuild(cpQBVH *bvh)
+{
+	int count = cpHashSetCount(bvh->leaves);
+	
+	if(count > bvh->leafCapacity){
+		bvh->leafCapacity = count;
+		bvh->order = (Leaf **)cprealloc(bvh->order, count*sizeof(Leaf *));
+	}
+	
+	// A hierarchy with n leaves has at most n - 1 nodes, except that a single leaf still needs a root node.
+	if(count > bvh->nodeCapacity){
+		bvh->nodeCapacity = count;
+		bvh->nodes = (QNode *)cprealloc(bvh->nodes, count*sizeof(QNode));
+	}
+	
+	bvh->leafCount = count;
+	bvh->nodeCount = 0;
+	
+	if(count > 0){
+		cpBuildItem *items = (cpBuildItem *)cpcalloc(count, sizeof(cpBuildItem));
+		FillContext context = {bvh, items};
+		cpHashSetEach(bvh->leaves, (cpHashSetIteratorFunc)FillItem, &context);
+		
+		BuildNode(bvh, items, 0, count);
+		cpfree(items);
+	}
+	
+	bvh->buildCost = QBVHCost(bvh);
+	bvh->state = QBVH_CLEAN;
+}
+
+// Update the bounds of the leaves and the nodes above them without changing the hierarchy.
+static void
+QBVHRefit(cpQBVH *bvh)
+{
+	cpSpatialIndexBBFunc bbfunc = bvh->spatialIndex.bbfunc;
+	QNode *nodes = bvh->nodes;
+	
+	for(int i=0; i<bvh->leafCount; i++){
+		Leaf *leaf = bvh->order[i];
+		QNodeSetBB(nodes + leaf->node, leaf->slot, bbfunc(leaf->obj));
+	}
+	
+	// Children come after their parents, so walking backwards refits the children first.
+	for(int i=bvh->nodeCount - 1; i>=0; i--){
+		QNode *node = nodes + i;
+		for(int j=0; j<node->count; j++){
+			int child = node->children[j];
+			if(child >= 0) QNodeSetBB(node, j, QNodeBounds(nodes + child));
+		}
+	}
+}
+
+// Bring the hierarchy up to date before it's queried.
+static void
+QBVHUpdate(cpQBVH *bvh)
+{
+	if(bvh->state == QBVH_REFIT){
+		QBVHRefit(bvh);
+		
+		// Moving objects slowly ruin the quality of the hierarchy.
+		bvh->state = (QBVHCost(bvh) > bvh->buildCost*QBVH_REBUILD_RATIO ? QBVH_REBUILD : QBVH_CLEAN);
+	}
+	
+	if(bvh->state == QBVH_REBUILD) QBVHRebuild(bvh);
+}
+
+static inline void
+QBVHMarkState(cpQBVH *bvh, QBVHState state)
+{
+	if(state > bvh->state) bvh->state = state;
+}
+
+//MARK: Memory Management Functions
+
+static void
+LeafRecycle(cpQBVH *bvh, Leaf *leaf)
+{
+	leaf->obj = bvh->pooledLeaves;
+	bvh->pooledLeaves = leaf;
+}
+
+static Leaf *
+LeafFromPool(cpQBVH *bvh)
+{
+	Leaf *leaf = bvh->pooledLeaves;
+	
+	if(leaf){
+		bvh->pooledLeaves = (Leaf *)leaf->obj;
+		return leaf;
+	} else {
+		// Pool is exhausted, make more
+		int count = CP_BUFFER_BYTES/sizeof(Leaf);
+		cpAssertHard(count, "Internal Error: Buffer size is too small.");
+		
+		Leaf *buffer = (Leaf *)cpcalloc(1, CP_BUFFER_BYTES);
+		cpArrayPush(bvh->allocatedBuffers, buffer);
+		
+		// push all but the first one, return the first instead
+		for(int i=1; i<count; i++) LeafRecycle(bvh, buffer + i);
+		return buffer;
+	}
+}
+
+static int
+leafSetEql(void *obj, Leaf *leaf)
+{
+	return (obj == leaf->obj);
+}
+
+static void *
+leafSetTrans(void *obj, cpQBVH *bvh)
+{
+	Leaf *leaf = LeafFromPool(bvh);
+	leaf->obj = obj;
+	leaf->node = leaf->slot = 0;
+	
+	return leaf;
+}
+
+cpQBVH *
+cpQBVHAlloc(void)
+{
+	return (cpQBVH *)cpcalloc(1, sizeof(cpQBVH));
+}
+
+cpSpatialIndex *
+cpQBVHInit(cpQBVH *bvh, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex)
+{
+	cpSpatialIndexInit((cpSpatialIndex *)bvh, Klass(), bbfunc, staticIndex);
+	
+	bvh->leaves = cpHashSetNew(0, (cpHashSetEqlFunc)leafSetEql);
+	
+	bvh->nodes = NULL;
+	bvh->nodeCount = bvh->nodeCapacity = 0;
+	
+	bvh->order = NULL;
+	bvh->leafCount = bvh->leafCapacity = 0;
+	
+	bvh->state = QBVH_CLEAN;
+	bvh->buildCost = 0.0f;
+	
+	bvh->pooledLeaves = NULL;
+	bvh->allocatedBuffers = cpArrayNew(0);
+	
+	bvh->staticBuffer.objects = NULL;
+	bvh->staticBuffer.capacity = 0;
+	
+	return (cpSpatialIndex *)bvh;
+}
+
+cpSpatialIndex *
+cpQBVHNew(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex)
+{
+	return cpQBVHInit(cpQBVHAlloc(), bbfunc, staticIndex);
+}
+
+static void
+cpQBVHDestroy(cpQBVH *bvh)
+{
+	cpHashSetFree(bvh->leaves);
+	cpfree(bvh->nodes);
+	cpfree(bvh->order);
+	
+	if(bvh->allocatedBuffers) cpArrayFreeEach(bvh->allocatedBuffers, cpfree);
+	cpArrayFree(bvh->allocatedBuffers);
+	cpfree(bvh->staticBuffer.objects);
+}
+
+//MARK: Misc
+
+static int
+cpQBVHCount(cpQBVH *bvh)
+{
+	return cpHashSetCount(bvh->leaves);
+}
+
+typedef struct eachContext {
+	cpSpatialIndexIteratorFunc func;
+	void *data;
+} eachContext;
+
+static void each_helper(Leaf *leaf, eachContext *context){context->func(leaf->obj, context->data);}
+
+static void
+cpQBVHEach(cpQBVH *bvh, cpSpatialIndexIteratorFunc func, void *data)
+{
+	eachContext context = {func, data};
+	cpHashSetEach(bvh->leaves, (cpHashSetIteratorFunc)each_helper, &context);
+}
+
+static cpBool
+cpQBVHContains(cpQBVH *bvh, void *obj, cpHashValue hashid)
+{
+	return (cpHashSetFind(bvh->leaves, hashid, obj) != NULL);
+}
+
+//MARK: Insert/Remove
+
+static void
+cpQBVHInsert(cpQBVH *bvh, void *obj, cpHashValue hashid)
+{
+	cpHashSetInsert(bvh->leaves, hashid, obj, (cpHashSetTransFunc)leafSetTrans, bvh);
+	QBVHMarkState(bvh, QBVH_REBUILD);
+}
+
+static void
+cpQBVHRemove(cpQBVH *bvh, void *obj, cpHashValue hashid)
+{
+	Leaf *leaf = (Leaf *)cpHashSetRemove(bvh->leaves, hashid, obj);
+	if(leaf){
+		LeafRecycle(bvh, leaf);
+		QBVHMarkState(bvh, QBVH_REBUILD);
+	}
+}
+
+//MARK: Query
+
+static void
+SubtreeQuery(cpQBVH *bvh, int index, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data)
+{
+	QNode *node = bvh->nodes + index;
+	
+	for(int mask = QNodeIntersects(node, bb), i = 0; mask; mask >>= 1, i++){
+		if(mask & 1){
+			int child = node->children[i];
+			if(child < 0){
+				func(obj, bvh->order[~child]->obj, 0, data);
+			} else {
+				SubtreeQuery(bvh, child, obj, bb, func, data);
+			}
+		}
+	}
+}
+
+static void
+cpQBVHQuery(cpQBVH *bvh, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data)
+{
+	QBVHUpdate(bvh);
+	if(bvh->nodeCount > 0) SubtreeQuery(bvh, 0, obj, bb, func, data);
+}
+
+static cpFloat
+SubtreeSegmentQuery(cpQBVH *bvh, int index, void *obj, cpVect a, cpVect delta, cpFloat t_exit, cpSpatialIndexSegmentQueryFunc func, void *data)
+{
+	QNode *node = bvh->nodes + index;
+	
+	cpFloat t[4];
+	int mask = QNodeSegmentQuery(node, a, delta, t);
+	
+	// Visit the children nearest first, so t_exit shrinks as quickly as possible.
+	int visit[4], count = 0;
+	for(int i=0; mask; mask >>= 1, i++){
+		if(mask & 1){
+			int j = count++;
+			for(; j > 0 && t[visit[j - 1]] > t[i]; j--) visit[j] = visit[j - 1];
+			visit[j] = i;
+		}
+	}
+	
+	for(int i=0; i<count; i++){
+		int slot = visit[i];
+		if(t[slot] < t_exit){
+			int child = node->children[slot];
+			if(child < 0){
+				t_exit = cpfmin(t_exit, func(obj, bvh->order[~child]->obj, data));
+			} else {
+				t_exit = cpfmin(t_exit, SubtreeSegmentQuery(bvh, child, obj, a, delta, t_exit, func, data));
+			}
+		}
+	}
+	
+	return t_exit;
+}
+
+static void
+cpQBVHSegmentQuery(cpQBVH *bvh, void *obj, cpVect a, cpVect b, cpFloat t_exit, cpSpatialIndexSegmentQueryFunc func, void *data)
+{
+	QBVHUpdate(bvh);
+	if(bvh->nodeCount > 0) SubtreeSegmentQuery(bvh, 0, obj, a, cpvsub(b, a), t_exit, func, data);
+}
+
+//MARK: Reindex
+
+static void
+cpQBVHReindex(cpQBVH *bvh)
+{
+	QBVHMarkState(bvh, QBVH_REFIT);
+	QBVHUpdate(bvh);
+}
+
+static void
+cpQBVHReindexObject(cpQBVH *bvh, void *obj, cpHashValue hashid)
+{
+	if(cpHashSetFind(bvh->leaves, hashid, obj)) QBVHMarkState(bvh, QBVH_REFIT);
+}
+
+// Find the leaves after 'leaf' in the build order that overlap it, so each pair is only reported once.
+static void
+SubtreePairQuery(cpQBVH *bvh, int index, int leaf, cpBB bb, cpSpatialIndexQueryFunc func, void *data)
+{
+	QNode *node = bvh->nodes + index;
+	
+	for(int mask = QNodeIntersects(node, bb), i = 0; mask; mask >>= 1, i++){
+		if(mask & 1){
+			int child = node->children[i];
+			if(child < 0){
+				if(~child > leaf) func(bvh->order[leaf]->obj, bvh->order[~child]->obj, 0, data);
+			} else if(bvh->nodes[child].leafEnd > leaf + 1){
+				SubtreePairQuery(bvh, child, leaf, bb, func, data);
+			}
+		}
+	}
+}
+
+static void
+cpQBVHReindexQuery(cpQBVH *bvh, cpSpatialIndexQueryFunc func, void *data)
+{
+	QBVHMarkState(bvh, QBVH_REFIT);
+	QBVHUpdate(bvh);
+	
+	for(int i=0; i<bvh->leafCount; i++){
+		Leaf *leaf = bvh->order[i];
+		SubtreePairQuery(bvh, 0, i, QNodeGetBB(bvh->nodes + leaf->node, leaf->slot), func, data);
+	}
+	
+	cpSpatialIndexCollideStaticBuffered((cpSpatialIndex *)bvh, bvh->spatialIndex.staticIndex, func, data, &bvh->staticBuffer);
+}
+
+static cpSpatialIndexClass klass = {
+	(cpSpatialIndexDestroyImpl)cpQBVHDestroy,
+	
+	(cpSpatialIndexCountImpl)cpQBVHCount,
+	(cpSpatialIndexEachImpl)cpQBVHEach,
+	
+	(cpSpatialIndexContainsImpl)cpQBVHContains,
+	(cpSpatialIndexInsertImpl)cpQBVHInsert,
+	(cpSpatialIndexRemoveImpl)cpQBVHRemove,
+	
+	(cpSpatialIndexReindexImpl)cpQBVHReindex,
+	(cpSpatialIndexReindexObjectImpl)cpQBVHReindexObject,
+	(cpSpatialIndexReindexQueryImpl)cpQBVHReindexQuery,
+	
+	(cpSpatialIndexQueryImpl)cpQBVHQuery,
+	(cpSpatialIndexSegmentQueryImpl)cpQBVHSegmentQuery,
+};
+
+static inline cpSpatialIndexClass *Klass(){return &klass;}
+
+cpBool
+cpSpatialIndexIsQBVH(cpSpatialIndex *index)
+{
+	return (index && index->klass == Klass());
+}
@@ -205,6 +205,9 @@ cpShapeSetFilter(cpShape *shape, cpShapeFilter filter)
 {
 	cpBodyActivate(shape->body);
 	shape->filter = filter;
+	
+	// The spatial indexes cache filters to prune pairs.
+	if(shape->space) cpSpaceShapeFilterChanged(shape->space, shape);
 }
 
 cpBB
@@ -260,7 +263,7 @@ cpContactPointSet
 cpShapesCollide(const cpShape *a, const cpShape *b)
 {
 	struct cpContact contacts[CP_MAX_CONTACTS_PER_ARBITER];
-	struct cpCollisionInfo info = cpCollide(a, b, 0, contacts);
+	struct cpCollisionInfo info = cpCollide(a, b, 0, 0, contacts);
 	
 	cpContactPointSet set;
 	set.count = info.count;
@@ -38,8 +38,8 @@ applyCachedImpulse(cpSimpleMotor *joint, cpFloat dt_coef)
 	cpBody *b = joint->constraint.b;
 	
 	cpFloat j = joint->jAcc*dt_coef;
-	a->w -= j*a->i_inv;
-	b->w += j*b->i_inv;
+	apply_angular_impulse(a, -j);
+	apply_angular_impulse(b, j);
 }
 
 static void
@@ -60,8 +60,8 @@ applyImpulse(cpSimpleMotor *joint, cpFloat dt)
 	j = joint->jAcc - jOld;
 	
 	// apply impulse
-	a->w -= j*a->i_inv;
-	b->w += j*b->i_inv;
+	apply_angular_impulse(a, -j);
+	apply_angular_impulse(b, j);
 }
 
 static cpFloat
@@ -58,6 +58,60 @@ handlerSetTrans(cpCollisionHandler *handler, void *unused)
 	return copy;
 }
 
+//MARK: No-Collide Pair Set Helper Functions
+
+// Bodies joined by constraints that don't let them collide.
+typedef struct cpNoCollidePair {
+	cpBody *a, *b;
+	// The number of constraints between the bodies with collideBodies == cpFalse.
+	int count;
+} cpNoCollidePair;
+
+// Equals function for noCollidePairs.
+static cpBool
+noCollideSetEql(cpBody **bodies, cpNoCollidePair *pair)
+{
+	cpBody *a = bodies[0];
+	cpBody *b = bodies[1];
+	
+	return ((a == pair->a && b == pair->b) || (b == pair->a && a == pair->b));
+}
+
+// Transformation function for noCollidePairs.
+static void *
+noCollideSetTrans(cpBody **bodies, void *unused)
+{
+	cpNoCollidePair *pair = (cpNoCollidePair *)cpcalloc(1, sizeof(cpNoCollidePair));
+	pair->a = bodies[0];
+	pair->b = bodies[1];
+	pair->count = 0;
+	
+	return pair;
+}
+
+void
+cpSpaceAddNoCollidePair(cpSpace *space, cpBody *a, cpBody *b)
+{
+	cpBody *bodies[] = {a, b};
+	cpHashValue hash = CP_HASH_PAIR((cpHashValue)a, (cpHashValue)b);
+	cpNoCollidePair *pair = (cpNoCollidePair *)cpHashSetInsert(space->noCollidePairs, hash, bodies, (cpHashSetTransFunc)noCollideSetTrans, NULL);
+	pair->count++;
+}
+
+void
+cpSpaceRemoveNoCollidePair(cpSpace *space, cpBody *a, cpBody *b)
+{
+	cpBody *bodies[] = {a, b};
+	cpHashValue hash = CP_HASH_PAIR((cpHashValue)a, (cpHashValue)b);
+	cpNoCollidePair *pair = (cpNoCollidePair *)cpHashSetFind(space->noCollidePairs, hash, bodies);
+	cpAssertHard(pair, "Internal Error: Body pair is missing from the no-collide set.");
+	
+	if(--pair->count == 0){
+		cpHashSetRemove(space->noCollidePairs, hash, bodies);
+		cpfree(pair);
+	}
+}
+
 //MARK: Misc Helper Funcs
 
 // Default collision functions.
@@ -105,6 +159,14 @@ cpCollisionHandler cpCollisionHandlerDoNothing = {
 // function to get the estimated velocity of a shape for the cpBBTree.
 static cpVect ShapeVelocityFunc(cpShape *shape){return shape->body->v;}
 
+// function to get the collision filter of a shape for the spatial indexes.
+static cpSpatialIndexFilter
+ShapeFilterFunc(cpShape *shape)
+{
+	cpSpatialIndexFilter filter = {shape->filter.categories, shape->filter.mask};
+	return filter;
+}
+
 // Used for disposing of collision handlers.
 static void FreeWrap(void *ptr, void *unused){cpfree(ptr);}
 
@@ -129,6 +191,7 @@ cpSpaceInit(cpSpace *space)
 #endif
 
 	space->iterations = 10;
+	space->packedSolver = cpTrue;
 	
 	space->gravity = cpvzero;
 	space->damping = 1.0f;
@@ -136,6 +199,7 @@ cpSpaceInit(cpSpace *space)
 	space->collisionSlop = 0.1f;
 	space->collisionBias = cpfpow(1.0f - 0.1f, 60.0f);
 	space->collisionPersistence = 3;
+	space->contactReuseThreshold = 0.0f;
 	
 	space->locked = 0;
 	space->stamp = 0;
@@ -144,6 +208,8 @@ cpSpaceInit(cpSpace *space)
 	space->staticShapes = cpBBTreeNew((cpSpatialIndexBBFunc)cpShapeGetBB, NULL);
 	space->dynamicShapes = cpBBTreeNew((cpSpatialIndexBBFunc)cpShapeGetBB, space->staticShapes);
 	cpBBTreeSetVelocityFunc(space->dynamicShapes, (cpBBTreeVelocityFunc)ShapeVelocityFunc);
+	cpSpatialIndexSetFilterFunc(space->staticShapes, (cpSpatialIndexFilterFunc)ShapeFilterFunc);
+	cpSpatialIndexSetFilterFunc(space->dynamicShapes, (cpSpatialIndexFilterFunc)ShapeFilterFunc);
 	
 	space->allocatedBuffers = cpArrayNew(0);
 	
@@ -151,6 +217,7 @@ cpSpaceInit(cpSpace *space)
 	space->staticBodies = cpArrayNew(0);
 	space->sleepingComponents = cpArrayNew(0);
 	space->rousedBodies = cpArrayNew(0);
+	space->filterChangedShapes = cpArrayNew(0);
 	
 	space->sleepTimeThreshold = INFINITY;
 	space->idleSpeedThreshold = 0.0f;
@@ -162,6 +229,12 @@ cpSpaceInit(cpSpace *space)
 	space->cachedArbiters = cpHashSetNew(0, (cpHashSetEqlFunc)arbiterSetEql);
 	
 	space->constraints = cpArrayNew(0);
+	space->noCollidePairs = cpHashSetNew(0, (cpHashSetEqlFunc)noCollideSetEql);
+	
+	space->solverBodies = NULL;
+	space->solverBodySources = NULL;
+	space->solverBodyCount = space->solverBodyCapacity = 0;
+	space->solverSyncBodies = cpArrayNew(0);
 	
 	space->usesWildcards = cpFalse;
 	memcpy(&space->defaultHandler, &cpCollisionHandlerDoNothing, sizeof(cpCollisionHandler));
@@ -197,9 +270,17 @@ cpSpaceDestroy(cpSpace *space)
 	cpArrayFree(space->staticBodies);
 	cpArrayFree(space->sleepingComponents);
 	cpArrayFree(space->rousedBodies);
+	cpArrayFree(space->filterChangedShapes);
 	
 	cpArrayFree(space->constraints);
 	
+	if(space->noCollidePairs) cpHashSetEach(space->noCollidePairs, FreeWrap, NULL);
+	cpHashSetFree(space->noCollidePairs);
+	
+	cpfree(space->solverBodies);
+	cpfree(space->solverBodySources);
+	cpArrayFree(space->solverSyncBodies);
+	
 	cpHashSetFree(space->cachedArbiters);
 	
 	cpArrayFree(space->arbiters);
@@ -244,6 +325,18 @@ cpSpaceSetIterations(cpSpace *space, int iterations)
 	space->iterations = iterations;
 }
 
+cpBool
+cpSpaceGetPackedSolver(const cpSpace *space)
+{
+	return space->packedSolver;
+}
+
+void
+cpSpaceSetPackedSolver(cpSpace *space, cpBool packedSolver)
+{
+	space->packedSolver = packedSolver;
+}
+
 cpVect
 cpSpaceGetGravity(const cpSpace *space)
 {
@@ -335,6 +428,18 @@ cpSpaceSetCollisionPersistence(cpSpace *space, cpTimestamp collisionPersistence)
 	space->collisionPersistence = collisionPersistence;
 }
 
+cpFloat
+cpSpaceGetContactReuseThreshold(const cpSpace *space)
+{
+	return space->contactReuseThreshold;
+}
+
+void
+cpSpaceSetContactReuseThreshold(cpSpace *space, cpFloat contactReuseThreshold)
+{
+	space->contactReuseThreshold = contactReuseThreshold;
+}
+
 cpDataPointer
 cpSpaceGetUserData(const cpSpace *space)
 {
@@ -470,6 +575,8 @@ cpSpaceAddConstraint(cpSpace *space, cpConstraint *constraint)
 	constraint->next_b = b->constraintList; b->constraintList = constraint;
 	constraint->space = space;
 	
+	if(!constraint->collideBodies) cpSpaceAddNoCollidePair(space, a, b);
+	
 	return constraint;
 }
 
@@ -536,6 +643,7 @@ cpSpaceRemoveShape(cpSpace *space, cpShape *shape)
 	cpBodyRemoveShape(body, shape);
 	cpSpaceFilterArbiters(space, body, shape);
 	cpSpatialIndexRemove(isStatic ? space->staticShapes : space->dynamicShapes, shape, shape->hashid);
+	cpArrayDeleteObj(space->filterChangedShapes, shape);
 	shape->space = NULL;
 	shape->hashid = 0;
 }
@@ -568,6 +676,8 @@ cpSpaceRemoveConstraint(cpSpace *space, cpConstraint *constraint)
 	cpBodyRemoveConstraint(constraint->a, constraint);
 	cpBodyRemoveConstraint(constraint->b, constraint);
 	constraint->space = NULL;
+	
+	if(!constraint->collideBodies) cpSpaceRemoveNoCollidePair(space, constraint->a, constraint->b);
 }
 
 cpBool cpSpaceContainsShape(cpSpace *space, cpShape *shape)
@@ -671,6 +781,21 @@ cpSpaceReindexShape(cpSpace *space, cpShape *shape)
 	cpSpatialIndexReindexObject(space->staticShapes, shape, shape->hashid);
 }
 
+void
+cpSpaceShapeFilterChanged(cpSpace *space, cpShape *shape)
+{
+	// Dynamic shapes pick up their new filter when the next step updates the index.
+	if(cpBodyGetType(shape->body) != CP_BODY_TYPE_STATIC) return;
+	
+	if(space->locked){
+		// Reindexed by cpSpaceUnlock(). cpSpaceRemoveShape() drops the entry if the shape leaves the space first.
+		cpArray *pending = space->filterChangedShapes;
+		if(!cpArrayContains(pending, shape)) cpArrayPush(pending, shape);
+	} else {
+		cpSpaceReindexShape(space, shape);
+	}
+}
+
 void
 cpSpaceReindexShapesForBody(cpSpace *space, cpBody *body)
 {
@@ -684,11 +809,12 @@ copyShapes(cpShape *shape, cpSpatialIndex *index)
 	cpSpatialIndexInsert(index, shape, shape->hashid);
 }
 
-void
-cpSpaceUseSpatialHash(cpSpace *space, cpFloat dim, int count)
+// Move the shapes into a new pair of indexes and free the old ones.
+static void
+SpaceSwapIndexes(cpSpace *space, cpSpatialIndex *staticShapes, cpSpatialIndex *dynamicShapes)
 {
-	cpSpatialIndex *staticShapes = cpSpaceHashNew(dim, count, (cpSpatialIndexBBFunc)cpShapeGetBB, NULL);
-	cpSpatialIndex *dynamicShapes = cpSpaceHashNew(dim, count, (cpSpatialIndexBBFunc)cpShapeGetBB, staticShapes);
+	cpSpatialIndexSetFilterFunc(staticShapes, (cpSpatialIndexFilterFunc)ShapeFilterFunc);
+	cpSpatialIndexSetFilterFunc(dynamicShapes, (cpSpatialIndexFilterFunc)ShapeFilterFunc);
 	
 	cpSpatialIndexEach(space->staticShapes, (cpSpatialIndexIteratorFunc)copyShapes, staticShapes);
 	cpSpatialIndexEach(space->dynamicShapes, (cpSpatialIndexIteratorFunc)copyShapes, dynamicShapes);
@@ -699,3 +825,45 @@ cpSpaceUseSpatialHash(cpSpace *space, cpFloat dim, int count)
 	space->staticShapes = staticShapes;
 	space->dynamicShapes = dynamicShapes;
 }
+
+void
+cpSpaceUseSpatialHash(cpSpace *space, cpFloat dim, int count)
+{
+	cpSpatialIndex *staticShapes = cpSpaceHashNew(dim, count, (cpSpatialIndexBBFunc)cpShapeGetBB, NULL);
+	cpSpatialIndex *dynamicShapes = cpSpaceHashNew(dim, count, (cpSpatialIndexBBFunc)cpShapeGetBB, staticShapes);
+	
+	SpaceSwapIndexes(space, staticShapes, dynamicShapes);
+}
+
+void
+cpSpaceUseQBVH(cpSpace *space, cpBool staticQBVH, cpBool dynamicQBVH)
+{
+	cpSpatialIndexBBFunc bbfunc = (cpSpatialIndexBBFunc)cpShapeGetBB;
+	cpSpatialIndex *staticShapes = (staticQBVH ? cpQBVHNew(bbfunc, NULL) : cpBBTreeNew(bbfunc, NULL));
+	cpSpatialIndex *dynamicShapes = (dynamicQBVH ? cpQBVHNew(bbfunc, staticShapes) : cpBBTreeNew(bbfunc, staticShapes));
+	if(!dynamicQBVH) cpBBTreeSetVelocityFunc(dynamicShapes, (cpBBTreeVelocityFunc)ShapeVelocityFunc);
+	
+	SpaceSwapIndexes(space, staticShapes, dynamicShapes);
+}
+
+void
+cpSpaceUseUniformGrid(cpSpace *space, cpFloat celldim)
+{
+	// The static shapes get a new tree too, since a cpBBTree can't be detached from the dynamic tree it shares pairs with.
+	cpSpatialIndexBBFunc bbfunc = (cpSpatialIndexBBFunc)cpShapeGetBB;
+	cpSpatialIndex *staticShapes = cpBBTreeNew(bbfunc, NULL);
+	cpSpatialIndex *dynamicShapes = cpUniformGridNew(celldim, bbfunc, staticShapes);
+	
+	SpaceSwapIndexes(space, staticShapes, dynamicShapes);
+}
+
+void
+cpSpaceUseHGrid(cpSpace *space, cpBool staticHGrid, cpBool dynamicHGrid)
+{
+	cpSpatialIndexBBFunc bbfunc = (cpSpatialIndexBBFunc)cpShapeGetBB;
+	cpSpatialIndex *staticShapes = (staticHGrid ? cpHGridNew(0.0f, bbfunc, NULL) : cpBBTreeNew(bbfunc, NULL));
+	cpSpatialIndex *dynamicShapes = (dynamicHGrid ? cpHGridNew(0.0f, bbfunc, staticShapes) : cpBBTreeNew(bbfunc, staticShapes));
+	if(!dynamicHGrid) cpBBTreeSetVelocityFunc(dynamicShapes, (cpBBTreeVelocityFunc)ShapeVelocityFunc);
+	
+	SpaceSwapIndexes(space, staticShapes, dynamicShapes);
+}
@@ -306,6 +306,38 @@ cpSpaceProcessComponents(cpSpace *space, cpFloat dt)
 	}
 }
 
+void
+cpSpaceGatherComponents(cpSpace *space, cpArray *roots)
+{
+	cpArray *bodies = space->dynamicBodies;
+	
+	for(int i=0; i<bodies->num; i++){
+		cpBody *body = (cpBody*)bodies->arr[i];
+		
+		if(cpBodyGetType(body) == CP_BODY_TYPE_DYNAMIC && ComponentRoot(body) == NULL){
+			FloodFillComponent(body, body);
+			cpArrayPush(roots, body);
+		}
+	}
+}
+
+void
+cpSpaceClearComponents(cpArray *roots)
+{
+	for(int i=0; i<roots->num; i++){
+		cpBody *body = (cpBody*)roots->arr[i];
+		
+		while(body){
+			cpBody *next = body->sleeping.next;
+			
+			body->sleeping.root = NULL;
+			body->sleeping.next = NULL;
+			
+			body = next;
+		}
+	}
+}
+
 void
 cpBodySleep(cpBody *body)
 {
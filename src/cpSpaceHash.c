@@ -39,6 +39,15 @@ struct cpSpaceHash {
 	cpArray *allocatedBuffers;
 	
 	cpTimestamp stamp;
+	
+	cpBool autoTune;
+	cpSpaceHashStats stats;
+	
+	// Running totals for the statistics, gathered while reindexing.
+	int statObjects, statEntries, statProbes;
+	cpFloat statExtent;
+	
+	cpCollideStaticBuffer staticBuffer;
 };
 
 
@@ -187,6 +196,13 @@ cpSpaceHashInit(cpSpaceHash *hash, cpFloat celldim, int numcells, cpSpatialIndex
 	
 	hash->stamp = 1;
 	
+	hash->autoTune = cpFalse;
+	hash->stats.celldim = hash->celldim;
+	hash->stats.numcells = hash->numcells;
+	
+	hash->staticBuffer.objects = NULL;
+	hash->staticBuffer.capacity = 0;
+	
 	return (cpSpatialIndex *)hash;
 }
 
@@ -207,6 +223,7 @@ cpSpaceHashDestroy(cpSpaceHash *hash)
 	cpArrayFreeEach(hash->allocatedBuffers, cpfree);
 	cpArrayFree(hash->allocatedBuffers);
 	cpArrayFree(hash->pooledHandles);
+	cpfree(hash->staticBuffer.objects);
 }
 
 //MARK: Helper Functions
@@ -351,13 +368,17 @@ remove_orphaned_handles(cpSpaceHash *hash, cpSpaceHashBin **bin_ptr)
 
 //MARK: Query Functions
 
-static inline void
+// Returns the number of bins in the chain that were visited.
+static inline int
 query_helper(cpSpaceHash *hash, cpSpaceHashBin **bin_ptr, void *obj, cpSpatialIndexQueryFunc func, void *data)
 {
+	int probes = 0;
+	
 	restart:
 	for(cpSpaceHashBin *bin = *bin_ptr; bin; bin = bin->next){
 		cpHandle *hand = bin->handle;
 		void *other = hand->obj;
+		probes++;
 		
 		if(hand->stamp == hash->stamp || obj == other){
 			continue;
@@ -371,6 +392,8 @@ query_helper(cpSpaceHash *hash, cpSpaceHashBin **bin_ptr, void *obj, cpSpatialIn
 			goto restart; // GCC not smart enough/able to tail call an inlined function.
 		}
 	}
+	
+	return probes;
 }
 
 static void
@@ -423,6 +446,9 @@ queryRehash_helper(cpHandle *hand, queryRehashContext *context)
 	int t = floor_int(bb.t/dim);
 	
 	cpSpaceHashBin **table = hash->table;
+	
+	hash->statObjects++;
+	hash->statExtent += 0.5f*((bb.r - bb.l) + (bb.t - bb.b));
 
 	for(int i=l; i<=r; i++){
 		for(int j=b; j<=t; j++){
@@ -432,7 +458,8 @@ queryRehash_helper(cpHandle *hand, queryRehashContext *context)
 			if(containsHandle(bin, hand)) continue;
 			
 			cpHandleRetain(hand); // this MUST be done first in case the object is removed in func()
-			query_helper(hash, &bin, obj, func, data);
+			hash->statProbes += query_helper(hash, &bin, obj, func, data);
+			hash->statEntries++;
 			
 			cpSpaceHashBin *newBin = getEmptyBin(hash);
 			newBin->handle = hand;
@@ -445,15 +472,85 @@ queryRehash_helper(cpHandle *hand, queryRehashContext *context)
 	hash->stamp++;
 }
 
+//MARK: Auto Tuning
+
+// Re-dimension the cells when they are this many times larger or smaller than the average object.
+#define AUTO_TUNE_EXTENT_RATIO 2.0f
+// The table is resized to this many cells per entry when the occupancy leaves the range below.
+#define AUTO_TUNE_CELLS_PER_ENTRY 4
+#define AUTO_TUNE_MIN_CELLS_PER_ENTRY 2
+#define AUTO_TUNE_MAX_CELLS_PER_ENTRY 32
+// Grow the table when the chains that were looked up average more bins than this.
+#define AUTO_TUNE_MAX_CHAIN 4.0f
+
+static void
+updateStats(cpSpaceHash *hash)
+{
+	cpSpaceHashStats *stats = &hash->stats;
+	int objects = hash->statObjects, entries = hash->statEntries;
+	
+	stats->celldim = hash->celldim;
+	stats->numcells = hash->numcells;
+	stats->objects = objects;
+	stats->entries = entries;
+	stats->averageExtent = (objects ? hash->statExtent/objects : 0.0f);
+	stats->averageChain = (entries ? (cpFloat)hash->statProbes/(cpFloat)entries : 0.0f);
+}
+
+// Picks new cell dimensions and table size using the statistics from the last reindex.
+// Must be called while the table is empty.
+static void
+autoTune(cpSpaceHash *hash)
+{
+	cpSpaceHashStats stats = hash->stats;
+	if(stats.objects == 0) return;
+	
+	cpFloat celldim = hash->celldim;
+	int numcells = hash->numcells;
+	int entries = stats.entries;
+	
+	// Cells should be about the size of the average object.
+	cpFloat extent = stats.averageExtent;
+	if(extent > 0.0f && (celldim > extent*AUTO_TUNE_EXTENT_RATIO || celldim*AUTO_TUNE_EXTENT_RATIO < extent)){
+		celldim = extent;
+		
+		// An object the size of a cell overlaps 4 cells on average.
+		entries = 4*stats.objects;
+	}
+	
+	if(numcells < entries*AUTO_TUNE_MIN_CELLS_PER_ENTRY || numcells > entries*AUTO_TUNE_MAX_CELLS_PER_ENTRY){
+		numcells = next_prime(entries*AUTO_TUNE_CELLS_PER_ENTRY);
+	} else if(stats.averageChain > AUTO_TUNE_MAX_CHAIN && 2*numcells <= entries*AUTO_TUNE_MAX_CELLS_PER_ENTRY){
+		// Long chains with a reasonable occupancy means too many cells are hashing to the same bins.
+		numcells = next_prime(2*numcells);
+	}
+	
+	if(celldim != hash->celldim || numcells != hash->numcells){
+		hash->celldim = celldim;
+		if(numcells != hash->numcells) cpSpaceHashAllocTable(hash, numcells);
+		
+		hash->stats.celldim = hash->celldim;
+		hash->stats.numcells = hash->numcells;
+		hash->stats.retunes++;
+	}
+}
+
 static void
 cpSpaceHashReindexQuery(cpSpaceHash *hash, cpSpatialIndexQueryFunc func, void *data)
 {
 	clearTable(hash);
+	// The table is empty now, so this is the cheapest time to resize it.
+	if(hash->autoTune) autoTune(hash);
+	
+	hash->statObjects = hash->statEntries = hash->statProbes = 0;
+	hash->statExtent = 0.0f;
 	
 	queryRehashContext context = {hash, func, data};
 	cpHashSetEach(hash->handleSet, (cpHashSetIteratorFunc)queryRehash_helper, &context);
 	
-	cpSpatialIndexCollideStatic((cpSpatialIndex *)hash, hash->spatialIndex.staticIndex, func, data);
+	updateStats(hash);
+	
+	cpSpatialIndexCollideStaticBuffered((cpSpatialIndex *)hash, hash->spatialIndex.staticIndex, func, data, &hash->staticBuffer);
 }
 
 static inline cpFloat
@@ -556,6 +653,43 @@ cpSpaceHashResize(cpSpaceHash *hash, cpFloat celldim, int numcells)
 	
 	hash->celldim = celldim;
 	cpSpaceHashAllocTable(hash, next_prime(numcells));
+	
+	hash->stats.celldim = hash->celldim;
+	hash->stats.numcells = hash->numcells;
+}
+
+void
+cpSpaceHashSetAutoTune(cpSpaceHash *hash, cpBool autoTune)
+{
+	if(hash->spatialIndex.klass != Klass()){
+		cpAssertWarn(cpFalse, "Ignoring cpSpaceHashSetAutoTune() call to non-cpSpaceHash spatial index.");
+		return;
+	}
+	
+	hash->autoTune = autoTune;
+}
+
+cpBool
+cpSpaceHashGetAutoTune(cpSpaceHash *hash)
+{
+	if(hash->spatialIndex.klass != Klass()){
+		cpAssertWarn(cpFalse, "Ignoring cpSpaceHashGetAutoTune() call to non-cpSpaceHash spatial index.");
+		return cpFalse;
+	}
+	
+	return hash->autoTune;
+}
+
+cpSpaceHashStats
+cpSpaceHashGetStats(cpSpaceHash *hash)
+{
+	if(hash->spatialIndex.klass != Klass()){
+		cpAssertWarn(cpFalse, "Ignoring cpSpaceHashGetStats() call to non-cpSpaceHash spatial index.");
+		cpSpaceHashStats stats = {0};
+		return stats;
+	}
+	
+	return hash->stats;
 }
 
 static int
@@ -590,6 +724,12 @@ static cpSpatialIndexClass klass = {
 
 static inline cpSpatialIndexClass *Klass(){return &klass;}
 
+cpBool
+cpSpatialIndexIsSpaceHash(cpSpatialIndex *index)
+{
+	return (index && index->klass == Klass());
+}
+
 //MARK: Debug Drawing
 
 //#define CP_BBTREE_DEBUG_DRAW
@@ -21,6 +21,52 @@
 
 #include "chipmunk/chipmunk_private.h"
 
+#if CP_ENABLE_STEP_STATS
+	#ifdef _WIN32
+		#ifndef WIN32_LEAN_AND_MEAN
+			#define WIN32_LEAN_AND_MEAN
+		#endif
+		
+		#include <windows.h>
+	#elif defined(__APPLE__)
+		#include <mach/mach_time.h>
+	#else
+		#include <time.h>
+	#endif
+#endif
+
+//MARK: Step Statistics
+
+#if CP_ENABLE_STEP_STATS
+uint64_t
+cpSpaceStepStatsTime(void)
+{
+#if defined(_WIN32)
+	static LARGE_INTEGER freq;
+	if(!freq.QuadPart) QueryPerformanceFrequency(&freq);
+	
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return (uint64_t)((double)now.QuadPart*1e9/(double)freq.QuadPart);
+#elif defined(__APPLE__)
+	static mach_timebase_info_data_t timebase;
+	if(!timebase.denom) mach_timebase_info(&timebase);
+	
+	return mach_absolute_time()*timebase.numer/timebase.denom;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+#endif
+
+cpSpaceStepStats
+cpSpaceGetStepStats(const cpSpace *space)
+{
+	return space->stepStats;
+}
+
 //MARK: Post Step Callback Functions
 
 cpPostStepCallback *
@@ -81,6 +127,9 @@ cpSpaceUnlock(cpSpace *space, cpBool runPostStep)
 		
 		waking->num = 0;
 		
+		cpArray *filtered = space->filterChangedShapes;
+		while(filtered->num > 0) cpSpaceReindexShape(space, (cpShape *)cpArrayPop(filtered));
+		
 		if(space->locked == 0 && runPostStep && !space->skipPostStep){
 			space->skipPostStep = cpTrue;
 			
@@ -123,6 +172,7 @@ cpSpaceAllocContactBuffer(cpSpace *space)
 {
 	cpContactBuffer *buffer = (cpContactBuffer *)cpcalloc(1, sizeof(cpContactBuffer));
 	cpArrayPush(space->allocatedBuffers, buffer);
+	CP_STEP_STATS_COUNT(space, contactBuffersAllocated);
 	return (cpContactBufferHeader *)buffer;
 }
 
@@ -198,58 +248,24 @@ cpSpaceArbiterSetTrans(cpShape **shapes, cpSpace *space)
 		for(int i=0; i<count; i++) cpArrayPush(space->pooledArbiters, buffer + i);
 	}
 	
+	CP_STEP_STATS_COUNT(space, arbitersCreated);
 	return cpArbiterInit((cpArbiter *)cpArrayPop(space->pooledArbiters), shapes[0], shapes[1]);
 }
 
-static inline cpBool
-QueryRejectConstraint(cpBody *a, cpBody *b)
-{
-	CP_BODY_FOREACH_CONSTRAINT(a, constraint){
-		if(
-			!constraint->collideBodies && (
-				(constraint->a == a && constraint->b == b) ||
-				(constraint->a == b && constraint->b == a)
-			)
-		) return cpTrue;
-	}
-	
-	return cpFalse;
-}
-
-static inline cpBool
-QueryReject(cpShape *a, cpShape *b)
-{
-	return (
-		// BBoxes must overlap
-		!cpBBIntersects(a->bb, b->bb)
-		// Don't collide shapes attached to the same body.
-		|| a->body == b->body
-		// Don't collide shapes that are filtered.
-		|| cpShapeFilterReject(a->filter, b->filter)
-		// Don't collide bodies if they have a constraint with collideBodies == cpFalse.
-		|| QueryRejectConstraint(a->body, b->body)
-	);
-}
-
-// Callback from the spatial hash.
-cpCollisionID
-cpSpaceCollideShapes(cpShape *a, cpShape *b, cpCollisionID id, cpSpace *space)
+void
+cpSpaceProcessCollision(cpSpace *space, struct cpCollisionInfo *info, cpArbiter *arb)
 {
-	// Reject any of the simple cases
-	if(QueryReject(a,b)) return id;
-	
-	// Narrow-phase collision detection.
-	struct cpCollisionInfo info = cpCollide(a, b, id, cpContactBufferGetArray(space));
+	const cpShape *a = info->a, *b = info->b;
 	
-	if(info.count == 0) return info.id; // Shapes are not colliding.
-	cpSpacePushContacts(space, info.count);
+	if(arb == NULL){
+		// Get an arbiter from space->arbiterSet for the two shapes.
+		// This is where the persistant contact magic comes from.
+		const cpShape *shape_pair[] = {a, b};
+		cpHashValue arbHashID = CP_HASH_PAIR((cpHashValue)a, (cpHashValue)b);
+		arb = (cpArbiter *)cpHashSetInsert(space->cachedArbiters, arbHashID, shape_pair, (cpHashSetTransFunc)cpSpaceArbiterSetTrans, space);
+	}
 	
-	// Get an arbiter from space->arbiterSet for the two shapes.
-	// This is where the persistant contact magic comes from.
-	const cpShape *shape_pair[] = {info.a, info.b};
-	cpHashValue arbHashID = CP_HASH_PAIR((cpHashValue)info.a, (cpHashValue)info.b);
-	cpArbiter *arb = (cpArbiter *)cpHashSetInsert(space->cachedArbiters, arbHashID, shape_pair, (cpHashSetTransFunc)cpSpaceArbiterSetTrans, space);
-	cpArbiterUpdate(arb, &info, space);
+	cpArbiterUpdate(arb, info, space);
 	
 	cpCollisionHandler *handler = arb->handler;
 	
@@ -273,7 +289,7 @@ cpSpaceCollideShapes(cpShape *a, cpShape *b, cpCollisionID id, cpSpace *space)
 	){
 		cpArrayPush(space->arbiters, arb);
 	} else {
-		cpSpacePopContacts(space, info.count);
+		cpSpacePopContacts(space, info->count);
 		
 		arb->contacts = NULL;
 		arb->count = 0;
@@ -285,6 +301,57 @@ cpSpaceCollideShapes(cpShape *a, cpShape *b, cpCollisionID id, cpSpace *space)
 	
 	// Time stamp the arbiter so we know it was used recently.
 	arb->stamp = space->stamp;
+}
+
+cpArbiter *
+cpSpaceCachedArbiter(cpSpace *space, const struct cpCollisionInfo *info)
+{
+	// Colliding a circle is cheaper than looking up its arbiter. (info->a has the lower shape type)
+	if(info->a->klass->type == CP_CIRCLE_SHAPE) return NULL;
+	
+	const cpShape *shape_pair[] = {info->a, info->b};
+	cpHashValue arbHashID = CP_HASH_PAIR((cpHashValue)info->a, (cpHashValue)info->b);
+	return (cpArbiter *)cpHashSetFind(space->cachedArbiters, arbHashID, shape_pair);
+}
+
+cpBool
+cpSpaceReuseContacts(cpSpace *space, cpArbiter *arb, struct cpCollisionInfo *info)
+{
+	if(space->contactReuseThreshold <= 0.0f || arb == NULL) return cpFalse;
+	
+	// Only contacts from the last step are still valid. (Or this step if the arbiter was woken up)
+	return (space->stamp - arb->stamp <= 1 && cpArbiterReuseContacts(arb, space->contactReuseThreshold, info));
+}
+
+// Callback from the spatial hash.
+cpCollisionID
+cpSpaceCollideShapes(cpShape *a, cpShape *b, cpCollisionID id, cpSpace *space)
+{
+	CP_STEP_STATS_COUNT(space, pairsTested);
+	
+	// Reject any of the simple cases
+	if(cpSpaceShapeQueryReject(a,b)) return id;
+	
+	struct cpCollisionInfo info = cpCollisionInfoInit(a, b, id, cpContactBufferGetArray(space));
+	
+	// The spatial index only caches the id, so the rest of what the narrowphase can start from is kept in the arbiter.
+	cpArbiter *arb = cpSpaceCachedArbiter(space, &info);
+	if(arb && arb->a == info.a) info.hint = arb->hint;
+	
+	if(cpSpaceReuseContacts(space, arb, &info)){
+		CP_STEP_STATS_COUNT(space, pairsReused);
+	} else {
+		CP_STEP_STATS_NARROWPHASE(space, a, b);
+		
+		// Narrow-phase collision detection.
+		info = cpCollide(a, b, id, info.hint, info.arr);
+		CP_STEP_STATS_ITERATIONS(space, &info);
+	}
+	
+	if(info.count == 0) return info.id; // Shapes are not colliding.
+	cpSpacePushContacts(space, info.count);
+	
+	cpSpaceProcessCollision(space, &info, arb);
 	return info.id;
 }
 
@@ -318,12 +385,139 @@ cpSpaceArbiterSetFilter(cpArbiter *arb, cpSpace *space)
 		arb->count = 0;
 		
 		cpArrayPush(space->pooledArbiters, arb);
+		CP_STEP_STATS_COUNT(space, arbitersPooled);
 		return cpFalse;
 	}
 	
 	return cpTrue;
 }
 
+//MARK: Packed Solver Functions
+
+static inline void
+cpSolverBodyLoad(struct cpSolverBody *solverBody, cpBody *body)
+{
+	solverBody->v = body->v;
+	solverBody->v_bias = body->v_bias;
+	solverBody->w = body->w;
+	solverBody->w_bias = body->w_bias;
+	solverBody->m_inv = body->m_inv;
+	solverBody->i_inv = body->i_inv;
+}
+
+static inline void
+cpSolverBodyStore(struct cpSolverBody *solverBody, cpBody *body)
+{
+	body->v = solverBody->v;
+	body->v_bias = solverBody->v_bias;
+	body->w = solverBody->w;
+	body->w_bias = solverBody->w_bias;
+}
+
+static int
+cpSpaceSolverSlot(cpSpace *space, cpBody *body)
+{
+	// Slots are reassigned every step, so the cached slot is only valid if it still points back at the body.
+	int slot = body->solverSlot;
+	if(0 <= slot && slot < space->solverBodyCount && space->solverBodySources[slot] == body) return slot;
+	
+	slot = body->solverSlot = space->solverBodyCount++;
+	space->solverBodySources[slot] = body;
+	cpSolverBodyLoad(space->solverBodies + slot, body);
+	
+	// Constraints still work on the cpBody, so bodies shared with them need to be synced.
+	if(body->constraintList) cpArrayPush(space->solverSyncBodies, body);
+	
+	return slot;
+}
+
+// Copy the state of every body touched by an arbiter into space->solverBodies.
+static void
+cpSpacePackSolverBodies(cpSpace *space)
+{
+	cpArray *arbiters = space->arbiters;
+	
+	// Each arbiter can add at most two bodies.
+	int max = 2*arbiters->num;
+	if(max > space->solverBodyCapacity){
+		// Grow geometrically so scenes with a slowly growing contact count don't reallocate every step.
+		int capacity = space->solverBodyCapacity = (max > 2*space->solverBodyCapacity ? max : 2*space->solverBodyCapacity);
+		space->solverBodies = (struct cpSolverBody *)cprealloc(space->solverBodies, capacity*sizeof(struct cpSolverBody));
+		space->solverBodySources = (cpBody **)cprealloc(space->solverBodySources, capacity*sizeof(cpBody *));
+	}
+	
+	space->solverBodyCount = 0;
+	space->solverSyncBodies->num = 0;
+	
+	for(int i=0; i<arbiters->num; i++){
+		cpArbiter *arb = (cpArbiter *)arbiters->arr[i];
+		arb->slot_a = cpSpaceSolverSlot(space, arb->body_a);
+		arb->slot_b = cpSpaceSolverSlot(space, arb->body_b);
+	}
+}
+
+// Copy the packed state of the bodies shared with constraints back before running the constraints.
+static void
+cpSpaceStoreSyncBodies(cpSpace *space)
+{
+	cpArray *bodies = space->solverSyncBodies;
+	for(int i=0; i<bodies->num; i++){
+		cpBody *body = (cpBody *)bodies->arr[i];
+		if(cpBodyGetType(body) == CP_BODY_TYPE_DYNAMIC) cpSolverBodyStore(space->solverBodies + body->solverSlot, body);
+	}
+}
+
+// Reload the bodies shared with constraints after running the constraints.
+static void
+cpSpaceLoadSyncBodies(cpSpace *space)
+{
+	cpArray *bodies = space->solverSyncBodies;
+	for(int i=0; i<bodies->num; i++){
+		cpBody *body = (cpBody *)bodies->arr[i];
+		cpSolverBodyLoad(space->solverBodies + body->solverSlot, body);
+	}
+}
+
+// Write the packed body state back once the solver is finished.
+// Static and kinematic bodies have infinite mass, so the solver never changes their velocities.
+static void
+cpSpaceUnpackSolverBodies(cpSpace *space)
+{
+	for(int i=0; i<space->solverBodyCount; i++){
+		cpBody *body = space->solverBodySources[i];
+		if(cpBodyGetType(body) == CP_BODY_TYPE_DYNAMIC) cpSolverBodyStore(space->solverBodies + i, body);
+	}
+}
+
+static void
+cpSpaceSolvePacked(cpSpace *space, cpFloat dt)
+{
+	cpArray *constraints = space->constraints;
+	cpArray *arbiters = space->arbiters;
+	
+	cpSpacePackSolverBodies(space);
+	struct cpSolverBody *solverBodies = space->solverBodies;
+	
+	for(int i=0; i<space->iterations; i++){
+		for(int j=0; j<arbiters->num; j++){
+			cpArbiterApplyPackedImpulse((cpArbiter *)arbiters->arr[j], solverBodies);
+		}
+		
+		if(constraints->num){
+			cpSpaceStoreSyncBodies(space);
+			
+			for(int j=0; j<constraints->num; j++){
+				cpConstraint *constraint = (cpConstraint *)constraints->arr[j];
+				constraint->klass->applyImpulse(constraint, dt);
+			}
+			
+			cpSpaceLoadSyncBodies(space);
+		}
+	}
+	
+	cpSpaceUnpackSolverBodies(space);
+}
+
 //MARK: All Important cpSpaceStep() Function
 
  void
@@ -339,6 +533,7 @@ cpSpaceStep(cpSpace *space, cpFloat dt)
 	if(dt == 0.0f) return;
 	
 	space->stamp++;
+	CP_STEP_STATS_BEGIN(space);
 	
 	cpFloat prev_dt = space->curr_dt;
 	space->curr_dt = dt;
@@ -365,19 +560,25 @@ cpSpaceStep(cpSpace *space, cpFloat dt)
 			cpBody *body = (cpBody *)bodies->arr[i];
 			body->position_func(body, dt);
 		}
+		CP_STEP_STATS_PHASE(space, CP_SPACE_STEP_PHASE_INTEGRATE_POSITIONS);
 		
 		// Find colliding pairs.
 		cpSpacePushFreshContactBuffer(space);
 		cpSpatialIndexEach(space->dynamicShapes, (cpSpatialIndexIteratorFunc)cpShapeUpdateFunc, NULL);
+		CP_STEP_STATS_PHASE(space, CP_SPACE_STEP_PHASE_UPDATE_BBS);
+		
 		cpSpatialIndexReindexQuery(space->dynamicShapes, (cpSpatialIndexQueryFunc)cpSpaceCollideShapes, space);
+		CP_STEP_STATS_PHASE(space, CP_SPACE_STEP_PHASE_COLLIDE);
 	} cpSpaceUnlock(space, cpFalse);
 	
 	// Rebuild the contact graph (and detect sleeping components if sleeping is enabled)
 	cpSpaceProcessComponents(space, dt);
+	CP_STEP_STATS_PHASE(space, CP_SPACE_STEP_PHASE_COMPONENTS);
 	
 	cpSpaceLock(space); {
 		// Clear out old cached arbiters and call separate callbacks
 		cpHashSetFilter(space->cachedArbiters, (cpHashSetFilterFunc)cpSpaceArbiterSetFilter, space);
+		CP_STEP_STATS_PHASE(space, CP_SPACE_STEP_PHASE_ARBITER_FILTER);
 
 		// Prestep the arbiters and constraints.
 		cpFloat slop = space->collisionSlop;
@@ -413,18 +614,24 @@ cpSpaceStep(cpSpace *space, cpFloat dt)
 			cpConstraint *constraint = (cpConstraint *)constraints->arr[i];
 			constraint->klass->applyCachedImpulse(constraint, dt_coef);
 		}
+		CP_STEP_STATS_PHASE(space, CP_SPACE_STEP_PHASE_PRESTEP);
 		
 		// Run the impulse solver.
-		for(int i=0; i<space->iterations; i++){
-			for(int j=0; j<arbiters->num; j++){
-				cpArbiterApplyImpulse((cpArbiter *)arbiters->arr[j]);
-			}
-				
-			for(int j=0; j<constraints->num; j++){
-				cpConstraint *constraint = (cpConstraint *)constraints->arr[j];
-				constraint->klass->applyImpulse(constraint, dt);
+		if(space->packedSolver){
+			cpSpaceSolvePacked(space, dt);
+		} else {
+			for(int i=0; i<space->iterations; i++){
+				for(int j=0; j<arbiters->num; j++){
+					cpArbiterApplyImpulse((cpArbiter *)arbiters->arr[j]);
+				}
+					
+				for(int j=0; j<constraints->num; j++){
+					cpConstraint *constraint = (cpConstraint *)constraints->arr[j];
+					constraint->klass->applyImpulse(constraint, dt);
+				}
 			}
 		}
+		CP_STEP_STATS_PHASE(space, CP_SPACE_STEP_PHASE_SOLVE);
 		
 		// Run the constraint post-solve callbacks
 		for(int i=0; i<constraints->num; i++){
@@ -441,5 +648,8 @@ cpSpaceStep(cpSpace *space, cpFloat dt)
 			cpCollisionHandler *handler = arb->handler;
 			handler->postSolveFunc(arb, space, handler->userData);
 		}
+		CP_STEP_STATS_PHASE(space, CP_SPACE_STEP_PHASE_POST_SOLVE);
 	} cpSpaceUnlock(space, cpTrue);
+	
+	CP_STEP_STATS_END(space);
 }
@@ -35,6 +35,7 @@ cpSpatialIndexInit(cpSpatialIndex *index, cpSpatialIndexClass *klass, cpSpatialI
 {
 	index->klass = klass;
 	index->bbfunc = bbfunc;
+	index->filterfunc = NULL;
 	index->staticIndex = staticIndex;
 	
 	if(staticIndex){
@@ -45,25 +46,236 @@ cpSpatialIndexInit(cpSpatialIndex *index, cpSpatialIndexClass *klass, cpSpatialI
 	return index;
 }
 
+void
+cpSpatialIndexSetFilterFunc(cpSpatialIndex *index, cpSpatialIndexFilterFunc func)
+{
+	index->filterfunc = func;
+}
+
+// Dynamic objects are queried against the static index in Morton order of their bounding box centers,
+// so consecutive queries walk the same parts of the static index while they are still in the cache.
+typedef struct dynamicToStaticObject {
+	void *obj;
+	cpBB bb;
+	cpSpatialIndexFilter filter;
+	unsigned int code;
+	int index;
+} dynamicToStaticObject;
+
 typedef struct dynamicToStaticContext {
-	cpSpatialIndexBBFunc bbfunc;
-	cpSpatialIndex *staticIndex;
-	cpSpatialIndexQueryFunc queryFunc;
-	void *data;
+	cpSpatialIndex *dynamicIndex;
+	dynamicToStaticObject *objects;
+	int count;
+	cpBB bounds;
 } dynamicToStaticContext;
 
 static void
 dynamicToStaticIter(void *obj, dynamicToStaticContext *context)
 {
-	cpSpatialIndexQuery(context->staticIndex, obj, context->bbfunc(obj), context->queryFunc, context->data);
+	cpBB bb = context->dynamicIndex->bbfunc(obj);
+	dynamicToStaticObject *object = context->objects + context->count;
+	object->obj = obj;
+	object->bb = bb;
+	object->filter = cpSpatialIndexGetFilter(context->dynamicIndex, obj);
+	object->index = context->count++;
+	
+	// Infinite bounding boxes would stretch the bounds out to nothing, so they are sorted to an end instead.
+	cpVect center = cpBBCenter(bb);
+	if(cpfabs(center.x) < INFINITY && cpfabs(center.y) < INFINITY) context->bounds = cpBBExpand(context->bounds, center);
+}
+
+// Spread the low 16 bits of x out to the even bits.
+static inline unsigned int
+MortonSpread(unsigned int x)
+{
+	x = (x | (x << 8)) & 0x00FF00FF;
+	x = (x | (x << 4)) & 0x0F0F0F0F;
+	x = (x | (x << 2)) & 0x33333333;
+	x = (x | (x << 1)) & 0x55555555;
+	return x;
+}
+
+// Map t to [0, 0xFFFF], clamping to the ends. NaN maps to 0.
+static inline unsigned int
+MortonQuantize(cpFloat t)
+{
+	return (t > 0.0f ? (t < 1.0f ? (unsigned int)(t*65535.0f) : 0xFFFF) : 0);
+}
+
+typedef struct dynamicToStaticFilterContext {
+	cpSpatialIndexFilterFunc filterfunc;
+	cpSpatialIndexFilter filter;
+	cpSpatialIndexQueryFunc func;
+	void *data;
+} dynamicToStaticFilterContext;
+
+// Drops the pairs whose filters don't match before they reach the query callback.
+static cpCollisionID
+dynamicToStaticFilterQuery(void *obj, void *staticObj, cpCollisionID id, dynamicToStaticFilterContext *context)
+{
+	if(cpSpatialIndexFilterReject(context->filter, context->filterfunc(staticObj))) return id;
+	return context->func(obj, staticObj, id, context->data);
+}
+
+static int
+dynamicToStaticCompare(const void *a, const void *b)
+{
+	const dynamicToStaticObject *oa = (const dynamicToStaticObject *)a, *ob = (const dynamicToStaticObject *)b;
+	if(oa->code != ob->code) return (oa->code < ob->code ? -1 : 1);
+	
+	// Keep the order stable so the query order is deterministic.
+	return oa->index - ob->index;
 }
 
 void
-cpSpatialIndexCollideStatic(cpSpatialIndex *dynamicIndex, cpSpatialIndex *staticIndex, cpSpatialIndexQueryFunc func, void *data)
+cpSpatialIndexCollideStaticBuffered(cpSpatialIndex *dynamicIndex, cpSpatialIndex *staticIndex, cpSpatialIndexQueryFunc func, void *data, cpCollideStaticBuffer *buffer)
 {
-	if(staticIndex && cpSpatialIndexCount(staticIndex) > 0){
-		dynamicToStaticContext context = {dynamicIndex->bbfunc, staticIndex, func, data};
-		cpSpatialIndexEach(dynamicIndex, (cpSpatialIndexIteratorFunc)dynamicToStaticIter, &context);
+	if(!staticIndex || cpSpatialIndexCount(staticIndex) == 0) return;
+	if(cpBBTreeCollideTrees(dynamicIndex, staticIndex, func, data)) return;
+	
+	int count = cpSpatialIndexCount(dynamicIndex);
+	if(count == 0) return;
+	
+	if(count > buffer->capacity){
+		buffer->capacity = (count > 2*buffer->capacity ? count : 2*buffer->capacity);
+		buffer->objects = cprealloc(buffer->objects, buffer->capacity*sizeof(dynamicToStaticObject));
+	}
+	
+	dynamicToStaticContext context = {dynamicIndex, (dynamicToStaticObject *)buffer->objects, 0, {INFINITY, INFINITY, -INFINITY, -INFINITY}};
+	cpSpatialIndexEach(dynamicIndex, (cpSpatialIndexIteratorFunc)dynamicToStaticIter, &context);
+	
+	cpBB bounds = context.bounds;
+	cpFloat sx = (bounds.r > bounds.l ? 1.0f/(bounds.r - bounds.l) : 0.0f);
+	cpFloat sy = (bounds.t > bounds.b ? 1.0f/(bounds.t - bounds.b) : 0.0f);
+	for(int i=0; i<context.count; i++){
+		dynamicToStaticObject *object = context.objects + i;
+		cpVect center = cpBBCenter(object->bb);
+		unsigned int x = MortonQuantize((center.x - bounds.l)*sx);
+		unsigned int y = MortonQuantize((center.y - bounds.b)*sy);
+		object->code = MortonSpread(x) | (MortonSpread(y) << 1);
 	}
+	
+	qsort(context.objects, context.count, sizeof(dynamicToStaticObject), dynamicToStaticCompare);
+	
+	dynamicToStaticFilterContext filterContext = {staticIndex->filterfunc, {CP_ALL_CATEGORIES, CP_ALL_CATEGORIES}, func, data};
+	for(int i=0; i<context.count; i++){
+		dynamicToStaticObject *object = context.objects + i;
+		if(filterContext.filterfunc){
+			filterContext.filter = object->filter;
+			cpSpatialIndexQuery(staticIndex, object->obj, object->bb, (cpSpatialIndexQueryFunc)dynamicToStaticFilterQuery, &filterContext);
+		} else {
+			cpSpatialIndexQuery(staticIndex, object->obj, object->bb, func, data);
+		}
+	}
+}
+
+void
+cpSpatialIndexCollideStatic(cpSpatialIndex *dynamicIndex, cpSpatialIndex *staticIndex, cpSpatialIndexQueryFunc func, void *data)
+{
+	cpCollideStaticBuffer buffer = {NULL, 0};
+	cpSpatialIndexCollideStaticBuffered(dynamicIndex, staticIndex, func, data, &buffer);
+	cpfree(buffer.objects);
+}
+
+//MARK: Hierarchy Building
+
+// Used by cpBBTreeOptimize() and cpQBVH to split each range of leaves while building top down.
+// The centroids are sorted into bins along each axis, and the items are split between
+// the two bins that minimize the sum of each side's perimeter times its item count.
+
+#define SAH_BINS 16
+
+static inline cpFloat
+BBPerimeter(cpBB bb)
+{
+	return (bb.r - bb.l) + (bb.t - bb.b);
 }
 
+// Clamped so that a centroid the axis scale doesn't cover (or a NaN) can't index outside the bins.
+static inline int
+SAHBin(cpFloat value, cpFloat min, cpFloat scale)
+{
+	cpFloat bin = (value - min)*scale;
+	return (bin > 0.0f ? (bin < SAH_BINS - 1 ? (int)bin : SAH_BINS - 1) : 0);
+}
+
+int
+cpSpatialIndexPartitionSAH(cpBuildItem *items, int count)
+{
+	if(count == 2) return 1;
+	
+	cpVect c = items[0].centroid;
+	cpBB centroids = {c.x, c.y, c.x, c.y};
+	for(int i=1; i<count; i++) centroids = cpBBExpand(centroids, items[i].centroid);
+	
+	cpFloat best_cost = INFINITY;
+	int best_axis = -1, best_bin = 0;
+	cpFloat mins[2] = {centroids.l, centroids.b};
+	cpFloat scales[2] = {0.0f, 0.0f};
+	
+	for(int axis=0; axis<2; axis++){
+		cpFloat extent = (axis == 0 ? centroids.r - centroids.l : centroids.t - centroids.b);
+		// Also skips infinite or NaN extents, which can't be scaled into bins.
+		if(!(extent > 0.0f && extent < INFINITY)) continue;
+		
+		// Scale so the largest centroid still lands in the last bin.
+		cpFloat scale = scales[axis] = SAH_BINS*(1.0f - 1e-4f)/extent;
+		
+		// Empty bounds that any other bounds can be merged into.
+		cpBB empty = {INFINITY, INFINITY, -INFINITY, -INFINITY};
+		
+		int counts[SAH_BINS] = {0};
+		cpBB bbs[SAH_BINS];
+		for(int bin=0; bin<SAH_BINS; bin++) bbs[bin] = empty;
+		
+		for(int i=0; i<count; i++){
+			int bin = SAHBin((axis == 0 ? items[i].centroid.x : items[i].centroid.y), mins[axis], scale);
+			bbs[bin] = cpBBMerge(bbs[bin], items[i].bb);
+			counts[bin]++;
+		}
+		
+		// Sweep from the right to find the cost of everything after each split, then from the left to find the total.
+		cpFloat right_costs[SAH_BINS];
+		cpBB right_bb = empty;
+		int right_count = 0;
+		for(int bin=SAH_BINS - 1; bin>0; bin--){
+			right_bb = cpBBMerge(right_bb, bbs[bin]);
+			right_count += counts[bin];
+			right_costs[bin] = BBPerimeter(right_bb)*right_count;
+		}
+		
+		cpBB left_bb = empty;
+		int left_count = 0;
+		for(int bin=1; bin<SAH_BINS; bin++){
+			left_bb = cpBBMerge(left_bb, bbs[bin - 1]);
+			left_count += counts[bin - 1];
+			if(left_count == 0 || left_count == count) continue;
+			
+			cpFloat cost = BBPerimeter(left_bb)*left_count + right_costs[bin];
+			if(cost < best_cost){
+				best_cost = cost;
+				best_axis = axis;
+				best_bin = bin;
+			}
+		}
+	}
+	
+	// All of the centroids are in the same place, or too far apart to bin. Split by count.
+	if(best_axis < 0) return count/2;
+	
+	int right = count;
+	for(int left=0; left < right;){
+		cpBuildItem item = items[left];
+		cpFloat value = (best_axis == 0 ? item.centroid.x : item.centroid.y);
+		
+		if(SAHBin(value, mins[best_axis], scales[best_axis]) >= best_bin){
+			right--;
+			items[left] = items[right];
+			items[right] = item;
+		} else {
+			left++;
+		}
+	}
+	
+	return right;
+}
@@ -19,48 +19,98 @@
  * SOFTWARE.
  */
 
+#include <string.h>
+
 #include "chipmunk/chipmunk_private.h"
 
 static inline cpSpatialIndexClass *Klass(void);
 
 //MARK: Basic Structures
 
-typedef struct Bounds {
-	cpFloat min, max;
-} Bounds;
-
-typedef struct TableCell {
-	void *obj;
-	Bounds bounds;
-} TableCell;
-
+// The table is stored as parallel arrays sorted by the min of each object's bounds along the sweep axis.
+// Keeping the endpoints in their own arrays lets the overlap loops read only the floats they compare.
 struct cpSweep1D
 {
 	cpSpatialIndex spatialIndex;
 	
 	int num;
 	int max;
-	TableCell *table;
+	
+	void **objs;
+	// Bounds along the sweep axis.
+	cpFloat *mins, *maxs;
+	// Bounds along the other axis.
+	cpFloat *omins, *omaxs;
+	
+	// Scratch space for the overlapping indexes found by cpSweep1DReindexQuery().
+	int *hits;
+	
+	// The sweep axis, 0 for x and 1 for y.
+	int axis;
+	// The number of objects at the start of the table that are sorted.
+	// Objects inserted since the last reindex are appended after them.
+	int sorted;
+	
+	cpCollideStaticBuffer staticBuffer;
 };
 
-static inline cpBool
-BoundsOverlap(Bounds a, Bounds b)
-{
-	return (a.min <= b.max && b.min <= a.max);
-}
+// The other axis needs to spread the objects out this much more before the sweep switches to it.
+// Keeps the table from being re-sorted over and over when the variances are close.
+#define SWEEP_AXIS_HYSTERESIS 1.25f
+
+// Re-sort the table from scratch instead of using insertion sort when more than 1/n of it was appended.
+#define SWEEP_RESORT_FRACTION 8
+
+typedef struct Bounds {
+	cpFloat min, max;
+	cpFloat omin, omax;
+} Bounds;
 
 static inline Bounds
 BBToBounds(cpSweep1D *sweep, cpBB bb)
 {
-	Bounds bounds = {bb.l, bb.r};
-	return bounds;
+	if(sweep->axis == 0){
+		Bounds bounds = {bb.l, bb.r, bb.b, bb.t};
+		return bounds;
+	} else {
+		Bounds bounds = {bb.b, bb.t, bb.l, bb.r};
+		return bounds;
+	}
+}
+
+static inline void
+SetBounds(cpSweep1D *sweep, int i, cpBB bb)
+{
+	Bounds bounds = BBToBounds(sweep, bb);
+	sweep->mins[i] = bounds.min;
+	sweep->maxs[i] = bounds.max;
+	sweep->omins[i] = bounds.omin;
+	sweep->omaxs[i] = bounds.omax;
+}
+
+static inline cpBool
+BoundsOverlap(cpSweep1D *sweep, int i, Bounds bounds)
+{
+	return (
+		bounds.min <= sweep->maxs[i] && sweep->mins[i] <= bounds.max &&
+		bounds.omin <= sweep->omaxs[i] && sweep->omins[i] <= bounds.omax
+	);
 }
 
-static inline TableCell
-MakeTableCell(cpSweep1D *sweep, void *obj)
+// Returns the index of the first object in [start, end) with a min greater than 'max'.
+static inline int
+UpperBound(cpFloat *mins, int start, int end, cpFloat max)
 {
-	TableCell cell = {obj, BBToBounds(sweep, sweep->spatialIndex.bbfunc(obj))};
-	return cell;
+	while(start < end){
+		int mid = start + (end - start)/2;
+		if(mins[mid] <= max){
+			start = mid + 1;
+		} else {
+			end = mid;
+		}
+	}
+	
+	return start;
 }
 
 //MARK: Memory Management Functions
@@ -75,7 +125,12 @@ static void
 ResizeTable(cpSweep1D *sweep, int size)
 {
 	sweep->max = size;
-	sweep->table = (TableCell *)cprealloc(sweep->table, size*sizeof(TableCell));
+	sweep->objs = (void **)cprealloc(sweep->objs, size*sizeof(void *));
+	sweep->mins = (cpFloat *)cprealloc(sweep->mins, size*sizeof(cpFloat));
+	sweep->maxs = (cpFloat *)cprealloc(sweep->maxs, size*sizeof(cpFloat));
+	sweep->omins = (cpFloat *)cprealloc(sweep->omins, size*sizeof(cpFloat));
+	sweep->omaxs = (cpFloat *)cprealloc(sweep->omaxs, size*sizeof(cpFloat));
+	sweep->hits = (int *)cprealloc(sweep->hits, size*sizeof(int));
 }
 
 cpSpatialIndex *
@@ -84,8 +139,13 @@ cpSweep1DInit(cpSweep1D *sweep, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *sta
 	cpSpatialIndexInit((cpSpatialIndex *)sweep, Klass(), bbfunc, staticIndex);
 	
 	sweep->num = 0;
+	sweep->axis = 0;
+	sweep->sorted = 0;
 	ResizeTable(sweep, 32);
 	
+	sweep->staticBuffer.objects = NULL;
+	sweep->staticBuffer.capacity = 0;
+	
 	return (cpSpatialIndex *)sweep;
 }
 
@@ -98,8 +158,13 @@ cpSweep1DNew(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex)
 static void
 cpSweep1DDestroy(cpSweep1D *sweep)
 {
-	cpfree(sweep->table);
-	sweep->table = NULL;
+	cpfree(sweep->objs); sweep->objs = NULL;
+	cpfree(sweep->mins); sweep->mins = NULL;
+	cpfree(sweep->maxs); sweep->maxs = NULL;
+	cpfree(sweep->omins); sweep->omins = NULL;
+	cpfree(sweep->omaxs); sweep->omaxs = NULL;
+	cpfree(sweep->hits); sweep->hits = NULL;
+	cpfree(sweep->staticBuffer.objects); sweep->staticBuffer.objects = NULL;
 }
 
 //MARK: Misc
@@ -113,16 +178,16 @@ cpSweep1DCount(cpSweep1D *sweep)
 static void
 cpSweep1DEach(cpSweep1D *sweep, cpSpatialIndexIteratorFunc func, void *data)
 {
-	TableCell *table = sweep->table;
-	for(int i=0, count=sweep->num; i<count; i++) func(table[i].obj, data);
+	void **objs = sweep->objs;
+	for(int i=0, count=sweep->num; i<count; i++) func(objs[i], data);
 }
 
 static int
 cpSweep1DContains(cpSweep1D *sweep, void *obj, cpHashValue hashid)
 {
-	TableCell *table = sweep->table;
+	void **objs = sweep->objs;
 	for(int i=0, count=sweep->num; i<count; i++){
-		if(table[i].obj == obj) return cpTrue;
+		if(objs[i] == obj) return cpTrue;
 	}
 	
 	return cpFalse;
@@ -135,26 +200,165 @@ cpSweep1DInsert(cpSweep1D *sweep, void *obj, cpHashValue hashid)
 {
 	if(sweep->num == sweep->max) ResizeTable(sweep, sweep->max*2);
 	
-	sweep->table[sweep->num] = MakeTableCell(sweep, obj);
-	sweep->num++;
+	// Append the object. It's moved into sorted order the next time the table is reindexed.
+	int i = sweep->num++;
+	sweep->objs[i] = obj;
+	SetBounds(sweep, i, sweep->spatialIndex.bbfunc(obj));
 }
 
 static void
 cpSweep1DRemove(cpSweep1D *sweep, void *obj, cpHashValue hashid)
 {
-	TableCell *table = sweep->table;
+	void **objs = sweep->objs;
 	for(int i=0, count=sweep->num; i<count; i++){
-		if(table[i].obj == obj){
-			int num = --sweep->num;
+		if(objs[i] == obj){
+			// Shift the rest of the table down to keep it sorted.
+			int tail = count - i - 1;
+			memmove(sweep->objs + i, sweep->objs + i + 1, tail*sizeof(void *));
+			memmove(sweep->mins + i, sweep->mins + i + 1, tail*sizeof(cpFloat));
+			memmove(sweep->maxs + i, sweep->maxs + i + 1, tail*sizeof(cpFloat));
+			memmove(sweep->omins + i, sweep->omins + i + 1, tail*sizeof(cpFloat));
+			memmove(sweep->omaxs + i, sweep->omaxs + i + 1, tail*sizeof(cpFloat));
 			
-			table[i] = table[num];
-			table[num].obj = NULL;
+			sweep->num--;
+			if(i < sweep->sorted) sweep->sorted--;
 			
 			return;
 		}
 	}
 }
 
+//MARK: Sorting
+
+typedef struct SortKey {
+	cpFloat min;
+	int index;
+} SortKey;
+
+static int
+SortKeyCompare(const SortKey *a, const SortKey *b)
+{
+	// Break ties by index so the order doesn't depend on the qsort() implementation.
+	if(a->min != b->min) return (a->min < b->min ? -1 : 1);
+	return a->index - b->index;
+}
+
+static void
+Gather(cpFloat *values, cpFloat *scratch, SortKey *keys, int count)
+{
+	for(int i=0; i<count; i++) scratch[i] = values[keys[i].index];
+	memcpy(values, scratch, count*sizeof(cpFloat));
+}
+
+// Sorts the whole table from scratch.
+static void
+FullSort(cpSweep1D *sweep)
+{
+	int count = sweep->num;
+	SortKey *keys = (SortKey *)cpcalloc(count, sizeof(SortKey));
+	for(int i=0; i<count; i++){
+		keys[i].min = sweep->mins[i];
+		keys[i].index = i;
+	}
+	
+	qsort(keys, count, sizeof(SortKey), (int (*)(const void *, const void *))SortKeyCompare);
+	
+	void **objs = (void **)cpcalloc(count, sizeof(void *));
+	for(int i=0; i<count; i++) objs[i] = sweep->objs[keys[i].index];
+	memcpy(sweep->objs, objs, count*sizeof(void *));
+	cpfree(objs);
+	
+	cpFloat *scratch = (cpFloat *)cpcalloc(count, sizeof(cpFloat));
+	Gather(sweep->mins, scratch, keys, count);
+	Gather(sweep->maxs, scratch, keys, count);
+	Gather(sweep->omins, scratch, keys, count);
+	Gather(sweep->omaxs, scratch, keys, count);
+	cpfree(scratch);
+	
+	cpfree(keys);
+}
+
+// Objects only move a little each step, so the table from the previous step is almost sorted.
+// Insertion sort fixes it up in close to linear time.
+static void
+InsertionSort(cpSweep1D *sweep)
+{
+	void **objs = sweep->objs;
+	cpFloat *mins = sweep->mins, *maxs = sweep->maxs;
+	cpFloat *omins = sweep->omins, *omaxs = sweep->omaxs;
+	
+	for(int i=1, count=sweep->num; i<count; i++){
+		cpFloat min = mins[i];
+		if(mins[i - 1] <= min) continue;
+		
+		void *obj = objs[i];
+		cpFloat max = maxs[i], omin = omins[i], omax = omaxs[i];
+		
+		int j = i;
+		for(; j > 0 && mins[j - 1] > min; j--){
+			objs[j] = objs[j - 1];
+			mins[j] = mins[j - 1];
+			maxs[j] = maxs[j - 1];
+			omins[j] = omins[j - 1];
+			omaxs[j] = omaxs[j - 1];
+		}
+		
+		objs[j] = obj;
+		mins[j] = min;
+		maxs[j] = max;
+		omins[j] = omin;
+		omaxs[j] = omax;
+	}
+}
+
+// Refreshes the bounds of every object, picks the sweep axis and sorts the table along it.
+static void
+UpdateTable(cpSweep1D *sweep)
+{
+	int count = sweep->num;
+	if(count == 0){
+		sweep->sorted = 0;
+		return;
+	}
+	
+	cpSpatialIndexBBFunc bbfunc = sweep->spatialIndex.bbfunc;
+	
+	// The axis the AABB centers are spread out along the most separates the most pairs.
+	// Accumulate the variance of the centers relative to the first one to avoid cancellation far from the origin.
+	cpBB first = bbfunc(sweep->objs[0]);
+	cpFloat x0 = first.l + first.r, y0 = first.b + first.t;
+	cpFloat sx = 0.0f, sy = 0.0f, sxx = 0.0f, syy = 0.0f;
+	
+	for(int i=0; i<count; i++){
+		cpBB bb = bbfunc(sweep->objs[i]);
+		SetBounds(sweep, i, bb);
+		
+		cpFloat x = (bb.l + bb.r) - x0, y = (bb.b + bb.t) - y0;
+		sx += x; sxx += x*x;
+		sy += y; syy += y*y;
+	}
+	
+	cpFloat varX = sxx - sx*sx/count;
+	cpFloat varY = syy - sy*sy/count;
+	cpFloat varSweep = (sweep->axis == 0 ? varX : varY);
+	cpFloat varOther = (sweep->axis == 0 ? varY : varX);
+	
+	if(varOther > varSweep*SWEEP_AXIS_HYSTERESIS){
+		// Swap the roles of the bound arrays instead of recalculating them.
+		sweep->axis ^= 1;
+		cpFloat *mins = sweep->mins; sweep->mins = sweep->omins; sweep->omins = mins;
+		cpFloat *maxs = sweep->maxs; sweep->maxs = sweep->omaxs; sweep->omaxs = maxs;
+		
+		FullSort(sweep);
+	} else if((count - sweep->sorted)*SWEEP_RESORT_FRACTION > count){
+		FullSort(sweep);
+	} else {
+		InsertionSort(sweep);
+	}
+	
+	sweep->sorted = count;
+}
+
 //MARK: Reindexing Functions
 
 static void
@@ -166,8 +370,8 @@ cpSweep1DReindexObject(cpSweep1D *sweep, void *obj, cpHashValue hashid)
 static void
 cpSweep1DReindex(cpSweep1D *sweep)
 {
-	// Nothing to do here
-	// Could perform a sort, but queries are not accelerated anyway.
+	// Queries can skip the end of the sorted table, so it's worth keeping up to date.
+	UpdateTable(sweep);
 }
 
 //MARK: Query Functions
@@ -175,15 +379,17 @@ cpSweep1DReindex(cpSweep1D *sweep)
 static void
 cpSweep1DQuery(cpSweep1D *sweep, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data)
 {
-	// Implementing binary search here would allow you to find an upper limit
-	// but not a lower limit. Probably not worth the hassle.
-	
+	// Binary search finds where the mins pass the end of the query, but there's no lower limit
+	// since the maxes aren't sorted. Objects appended since the last reindex are checked separately.
 	Bounds bounds = BBToBounds(sweep, bb);
 	
-	TableCell *table = sweep->table;
-	for(int i=0, count=sweep->num; i<count; i++){
-		TableCell cell = table[i];
-		if(BoundsOverlap(bounds, cell.bounds) && obj != cell.obj) func(obj, cell.obj, 0, data);
+	void **objs = sweep->objs;
+	for(int i=0, end=UpperBound(sweep->mins, 0, sweep->sorted, bounds.max); i<end; i++){
+		if(BoundsOverlap(sweep, i, bounds) && obj != objs[i]) func(obj, objs[i], 0, data);
+	}
+	
+	for(int i=sweep->sorted, count=sweep->num; i<count; i++){
+		if(BoundsOverlap(sweep, i, bounds) && obj != objs[i]) func(obj, objs[i], 0, data);
 	}
 }
 
@@ -193,43 +399,47 @@ cpSweep1DSegmentQuery(cpSweep1D *sweep, void *obj, cpVect a, cpVect b, cpFloat t
 	cpBB bb = cpBBExpand(cpBBNew(a.x, a.y, a.x, a.y), b);
 	Bounds bounds = BBToBounds(sweep, bb);
 	
-	TableCell *table = sweep->table;
-	for(int i=0, count=sweep->num; i<count; i++){
-		TableCell cell = table[i];
-		if(BoundsOverlap(bounds, cell.bounds)) func(obj, cell.obj, data);
+	void **objs = sweep->objs;
+	for(int i=0, end=UpperBound(sweep->mins, 0, sweep->sorted, bounds.max); i<end; i++){
+		if(BoundsOverlap(sweep, i, bounds)) func(obj, objs[i], data);
+	}
+	
+	for(int i=sweep->sorted, count=sweep->num; i<count; i++){
+		if(BoundsOverlap(sweep, i, bounds)) func(obj, objs[i], data);
 	}
 }
 
 //MARK: Reindex/Query
 
-static int
-TableSort(TableCell *a, TableCell *b)
-{
-	return (a->bounds.min < b->bounds.min ? -1 : (a->bounds.min > b->bounds.min ? 1 : 0));
-}
-
 static void
 cpSweep1DReindexQuery(cpSweep1D *sweep, cpSpatialIndexQueryFunc func, void *data)
 {
-	TableCell *table = sweep->table;
-	int count = sweep->num;
-	
 	// Update bounds and sort
-	for(int i=0; i<count; i++) table[i] = MakeTableCell(sweep, table[i].obj);
-	qsort(table, count, sizeof(TableCell), (int (*)(const void *, const void *))TableSort); // TODO: use insertion sort instead
+	UpdateTable(sweep);
 	
-	for(int i=0; i<count; i++){
-		TableCell cell = table[i];
-		cpFloat max = cell.bounds.max;
+	void **objs = sweep->objs;
+	cpFloat *mins = sweep->mins, *maxs = sweep->maxs;
+	cpFloat *omins = sweep->omins, *omaxs = sweep->omaxs;
+	int *hits = sweep->hits;
+	
+	for(int i=0, count=sweep->num; i<count; i++){
+		// Everything from i + 1 up to the first min past this object's max overlaps it along the sweep axis.
+		// Finding the end first keeps the loop below a counted, branch free pass over the other axis.
+		int end = UpperBound(mins, i + 1, count, maxs[i]);
+		cpFloat omin = omins[i], omax = omaxs[i];
 		
-		for(int j=i+1; table[j].bounds.min < max && j<count; j++){
-			func(cell.obj, table[j].obj, 0, data);
+		int n = 0;
+		for(int j=i+1; j<end; j++){
+			hits[n] = j;
+			n += (omins[j] <= omax) & (omin <= omaxs[j]);
 		}
+		
+		for(int k=0; k<n; k++) func(objs[i], objs[hits[k]], 0, data);
 	}
 	
 	// Reindex query is also responsible for colliding against the static index.
 	// Fortunately there is a helper function for that.
-	cpSpatialIndexCollideStatic((cpSpatialIndex *)sweep, sweep->spatialIndex.staticIndex, func, data);
+	cpSpatialIndexCollideStaticBuffered((cpSpatialIndex *)sweep, sweep->spatialIndex.staticIndex, func, data, &sweep->staticBuffer);
 }
 
 static cpSpatialIndexClass klass = {
@@ -252,3 +462,9 @@ static cpSpatialIndexClass klass = {
 
 static inline cpSpatialIndexClass *Klass(){return &klass;}
 
+cpBool
+cpSpatialIndexIsSweep1D(cpSpatialIndex *index)
+{
+	return (index && index->klass == Klass());
+}
+
@@ -0,0 +1,568 @@
+/* Copyright (c) 2013 Scott Lembcke and Howling Moon Software
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include "chipmunk/chipmunk_private.h"
+
+static inline cpSpatialIndexClass *Klass(void);
+
+//MARK: Basic Structures
+
+// Each object is put in the cell that contains the center of its bounding box.
+// The cells are never smaller than the largest object, so overlapping objects are always in the same or adjacent cells.
+
+// Keep the grid from having more than this many cells per object when the objects are spread out.
+#define GRID_CELLS_PER_OBJECT 4
+// Rows of cells searched for pairs by each job when a job runner is set.
+#define GRID_ROWS_PER_BAND 8
+
+typedef struct GridPair {
+	void *a, *b;
+} GridPair;
+
+// Pairs found by a job, reported after all the jobs have finished.
+// Jobs never allocate. Pairs past the capacity are only counted, and the band is searched again on the calling thread.
+typedef struct GridBand {
+	GridPair *pairs;
+	int count, capacity;
+} GridBand;
+
+struct cpUniformGrid {
+	cpSpatialIndex spatialIndex;
+	
+	// The objects themselves are the elements of the set.
+	cpHashSet *objects;
+	
+	// The smallest cell size allowed.
+	cpFloat celldim;
+	
+	// The grid built by the last update.
+	cpBB bounds;
+	cpFloat cellSize, maxExtent;
+	int cols, rows;
+	
+	// The objects in cell i are objs[cellStart[i]] to objs[cellStart[i + 1] - 1].
+	int *cellStart;
+	int cellCapacity;
+	
+	void **objs;
+	cpBB *bbs;
+	cpSpatialIndexFilter *filters;
+	int count, capacity;
+	
+	// Objects in the order they were gathered, and the cells they belong to.
+	void **gatherObjs;
+	cpBB *gatherBBs;
+	cpSpatialIndexFilter *gatherFilters;
+	int *gatherCells;
+	
+	// Objects were added, removed or reindexed since the grid was built.
+	cpBool dirty;
+	
+	cpSpatialIndexJobRunner runner;
+	void *runnerData;
+	
+	GridBand *bands;
+	int bandCapacity;
+	
+	cpCollideStaticBuffer staticBuffer;
+};
+
+static inline int
+CellCoord(cpFloat x, cpFloat min, cpFloat size, int count)
+{
+	int i = (int)((x - min)/size);
+	return (i < 0 ? 0 : (i < count ? i : count - 1));
+}
+
+//MARK: Building
+
+static void
+GatherObject(void *obj, cpUniformGrid *grid)
+{
+	int i = grid->count++;
+	grid->gatherObjs[i] = obj;
+	grid->gatherBBs[i] = grid->spatialIndex.bbfunc(obj);
+	grid->gatherFilters[i] = cpSpatialIndexGetFilter((cpSpatialIndex *)grid, obj);
+}
+
+static void
+ReserveObjects(cpUniformGrid *grid, int count)
+{
+	if(count <= grid->capacity) return;
+	
+	int capacity = (count > 2*grid->capacity ? count : 2*grid->capacity);
+	grid->capacity = capacity;
+	grid->objs = (void **)cprealloc(grid->objs, capacity*sizeof(void *));
+	grid->bbs = (cpBB *)cprealloc(grid->bbs, capacity*sizeof(cpBB));
+	grid->filters = (cpSpatialIndexFilter *)cprealloc(grid->filters, capacity*sizeof(cpSpatialIndexFilter));
+	grid->gatherObjs = (void **)cprealloc(grid->gatherObjs, capacity*sizeof(void *));
+	grid->gatherBBs = (cpBB *)cprealloc(grid->gatherBBs, capacity*sizeof(cpBB));
+	grid->gatherFilters = (cpSpatialIndexFilter *)cprealloc(grid->gatherFilters, capacity*sizeof(cpSpatialIndexFilter));
+	grid->gatherCells = (int *)cprealloc(grid->gatherCells, capacity*sizeof(int));
+}
+
+static void
+ReserveCells(cpUniformGrid *grid, int cells)
+{
+	if(cells + 1 <= grid->cellCapacity) return;
+	
+	grid->cellCapacity = (cells + 1 > 2*grid->cellCapacity ? cells + 1 : 2*grid->cellCapacity);
+	grid->cellStart = (int *)cprealloc(grid->cellStart, grid->cellCapacity*sizeof(int));
+}
+
+// Picks the cell size and grid dimensions for the gathered objects.
+static void
+SizeGrid(cpUniformGrid *grid)
+{
+	int count = grid->count;
+	
+	cpBB bounds = grid->gatherBBs[0];
+	cpFloat maxExtent = 0.0f;
+	for(int i=0; i<count; i++){
+		cpBB bb = grid->gatherBBs[i];
+		bounds = cpBBMerge(bounds, bb);
+		maxExtent = cpfmax(maxExtent, cpfmax(bb.r - bb.l, bb.t - bb.b));
+	}
+	
+	cpFloat width = bounds.r - bounds.l, height = bounds.t - bounds.b;
+	cpFloat size = cpfmax(grid->celldim, maxExtent);
+	// Objects with no size, spread out evenly.
+	if(size <= 0.0f) size = cpfmax(width, height)/cpfsqrt((cpFloat)count);
+	if(size <= 0.0f) size = 1.0f;
+	
+	// Don't make more cells than are useful when the objects are spread out.
+	cpFloat limit = (cpFloat)(GRID_CELLS_PER_OBJECT*count + 16);
+	cpFloat cells = (cpffloor(width/size) + 1.0f)*(cpffloor(height/size) + 1.0f);
+	if(cells > limit) size *= cpfsqrt(cells/limit)*1.01f;
+	
+	grid->bounds = bounds;
+	grid->cellSize = size;
+	grid->maxExtent = maxExtent;
+	grid->cols = (int)(width/size) + 1;
+	grid->rows = (int)(height/size) + 1;
+}
+
+// Rebuilds the grid from scratch with a counting sort of the objects by cell.
+static void
+GridBuild(cpUniformGrid *grid)
+{
+	ReserveObjects(grid, cpHashSetCount(grid->objects));
+	
+	grid->count = 0;
+	cpHashSetEach(grid->objects, (cpHashSetIteratorFunc)GatherObject, grid);
+	grid->dirty = cpFalse;
+	
+	int count = grid->count;
+	if(count == 0){
+		grid->cols = grid->rows = 0;
+		return;
+	}
+	
+	SizeGrid(grid);
+	
+	int cols = grid->cols, cells = cols*grid->rows;
+	ReserveCells(grid, cells);
+	
+	cpBB bounds = grid->bounds;
+	cpFloat size = grid->cellSize;
+	int *cellStart = grid->cellStart;
+	memset(cellStart, 0, (cells + 1)*sizeof(int));
+	
+	// First pass, count the objects in each cell.
+	for(int i=0; i<count; i++){
+		cpBB bb = grid->gatherBBs[i];
+		int x = CellCoord(0.5f*(bb.l + bb.r), bounds.l, size, cols);
+		int y = CellCoord(0.5f*(bb.b + bb.t), bounds.b, size, grid->rows);
+		
+		int cell = x + y*cols;
+		grid->gatherCells[i] = cell;
+		cellStart[cell]++;
+	}
+	
+	// Turn the counts into the end of each cell's range.
+	for(int i=1; i<=cells; i++) cellStart[i] += cellStart[i - 1];
+	
+	// Second pass, place the objects. Going backwards leaves cellStart at the start of each range and keeps the gathered order within a cell.
+	for(int i=count-1; i>=0; i--){
+		int j = --cellStart[grid->gatherCells[i]];
+		grid->objs[j] = grid->gatherObjs[i];
+		grid->bbs[j] = grid->gatherBBs[i];
+		grid->filters[j] = grid->gatherFilters[i];
+	}
+}
+
+static inline void
+GridUpdate(cpUniformGrid *grid)
+{
+	if(grid->dirty) GridBuild(grid);
+}
+
+//MARK: Memory Management Functions
+
+static int objectSetEql(void *obj, void *elt){return (obj == elt);}
+static void *objectSetTrans(void *obj, void *unused){return obj;}
+
+cpUniformGrid *
+cpUniformGridAlloc(void)
+{
+	return (cpUniformGrid *)cpcalloc(1, sizeof(cpUniformGrid));
+}
+
+cpSpatialIndex *
+cpUniformGridInit(cpUniformGrid *grid, cpFloat celldim, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex)
+{
+	cpSpatialIndexInit((cpSpatialIndex *)grid, Klass(), bbfunc, staticIndex);
+	
+	grid->objects = cpHashSetNew(0, (cpHashSetEqlFunc)objectSetEql);
+	grid->celldim = celldim;
+	
+	grid->cols = grid->rows = 0;
+	grid->cellStart = NULL;
+	grid->cellCapacity = 0;
+	
+	grid->objs = grid->gatherObjs = NULL;
+	grid->bbs = grid->gatherBBs = NULL;
+	grid->filters = grid->gatherFilters = NULL;
+	grid->gatherCells = NULL;
+	grid->count = grid->capacity = 0;
+	
+	grid->dirty = cpFalse;
+	
+	grid->runner = NULL;
+	grid->runnerData = NULL;
+	grid->bands = NULL;
+	grid->bandCapacity = 0;
+	
+	grid->staticBuffer.objects = NULL;
+	grid->staticBuffer.capacity = 0;
+	
+	return (cpSpatialIndex *)grid;
+}
+
+cpSpatialIndex *
+cpUniformGridNew(cpFloat celldim, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex)
+{
+	return cpUniformGridInit(cpUniformGridAlloc(), celldim, bbfunc, staticIndex);
+}
+
+static void
+cpUniformGridDestroy(cpUniformGrid *grid)
+{
+	cpHashSetFree(grid->objects);
+	
+	cpfree(grid->cellStart);
+	cpfree(grid->objs);
+	cpfree(grid->bbs);
+	cpfree(grid->filters);
+	cpfree(grid->gatherObjs);
+	cpfree(grid->gatherBBs);
+	cpfree(grid->gatherFilters);
+	cpfree(grid->gatherCells);
+	
+	for(int i=0; i<grid->bandCapacity; i++) cpfree(grid->bands[i].pairs);
+	cpfree(grid->bands);
+	cpfree(grid->staticBuffer.objects);
+}
+
+//MARK: Misc
+
+static int
+cpUniformGridCount(cpUniformGrid *grid)
+{
+	return cpHashSetCount(grid->objects);
+}
+
+typedef struct eachContext {
+	cpSpatialIndexIteratorFunc func;
+	void *data;
+} eachContext;
+
+static void each_helper(void *obj, eachContext *context){context->func(obj, context->data);}
+
+static void
+cpUniformGridEach(cpUniformGrid *grid, cpSpatialIndexIteratorFunc func, void *data)
+{
+	eachContext context = {func, data};
+	cpHashSetEach(grid->objects, (cpHashSetIteratorFunc)each_helper, &context);
+}
+
+static cpBool
+cpUniformGridContains(cpUniformGrid *grid, void *obj, cpHashValue hashid)
+{
+	return (cpHashSetFind(grid->objects, hashid, obj) != NULL);
+}
+
+void
+cpUniformGridSetJobRunner(cpSpatialIndex *index, cpSpatialIndexJobRunner runner, void *data)
+{
+	if(index->klass != Klass()){
+		cpAssertWarn(cpFalse, "Ignoring cpUniformGridSetJobRunner() call to non-grid spatial index.");
+		return;
+	}
+	
+	cpUniformGrid *grid = (cpUniformGrid *)index;
+	grid->runner = runner;
+	grid->runnerData = data;
+}
+
+cpBool
+cpSpatialIndexIsUniformGrid(cpSpatialIndex *index)
+{
+	return (index && index->klass == Klass());
+}
+
+//MARK: Insert/Remove
+
+static void
+cpUniformGridInsert(cpUniformGrid *grid, void *obj, cpHashValue hashid)
+{
+	cpHashSetInsert(grid->objects, hashid, obj, (cpHashSetTransFunc)objectSetTrans, NULL);
+	grid->dirty = cpTrue;
+}
+
+static void
+cpUniformGridRemove(cpUniformGrid *grid, void *obj, cpHashValue hashid)
+{
+	if(cpHashSetRemove(grid->objects, hashid, obj)) grid->dirty = cpTrue;
+}
+
+//MARK: Query
+
+typedef struct CellRange {
+	int x0, y0, x1, y1;
+} CellRange;
+
+// The cells that can contain an object overlapping 'bb'.
+// An object's center is never more than half the largest extent outside of it.
+static inline CellRange
+GridCellRange(cpUniformGrid *grid, cpBB bb)
+{
+	cpFloat half = 0.5f*grid->maxExtent, size = grid->cellSize;
+	CellRange range = {
+		CellCoord(bb.l - half, grid->bounds.l, size, grid->cols),
+		CellCoord(bb.b - half, grid->bounds.b, size, grid->rows),
+		CellCoord(bb.r + half, grid->bounds.l, size, grid->cols),
+		CellCoord(bb.t + half, grid->bounds.b, size, grid->rows),
+	};
+	
+	return range;
+}
+
+static void
+cpUniformGridQuery(cpUniformGrid *grid, void *obj, cpBB bb, cpSpatialIndexQueryFunc func, void *data)
+{
+	GridUpdate(grid);
+	if(grid->count == 0 || !cpBBIntersects(bb, grid->bounds)) return;
+	
+	CellRange range = GridCellRange(grid, bb);
+	for(int y=range.y0; y<=range.y1; y++){
+		for(int cell=range.x0 + y*grid->cols, end=range.x1 + y*grid->cols; cell<=end; cell++){
+			for(int i=grid->cellStart[cell], i_end=grid->cellStart[cell + 1]; i<i_end; i++){
+				void *other = grid->objs[i];
+				if(obj != other && cpBBIntersects(bb, grid->bbs[i])) func(obj, other, 0, data);
+			}
+		}
+	}
+}
+
+static void
+cpUniformGridSegmentQuery(cpUniformGrid *grid, void *obj, cpVect a, cpVect b, cpFloat t_exit, cpSpatialIndexSegmentQueryFunc func, void *data)
+{
+	GridUpdate(grid);
+	if(grid->count == 0) return;
+	
+	// The cells aren't visited in order along the segment, but t_exit still skips objects past the closest hit so far.
+	cpBB bb = cpBBExpand(cpBBNew(a.x, a.y, a.x, a.y), cpvlerp(a, b, cpfmin(t_exit, 1.0f)));
+	if(!cpBBIntersects(bb, grid->bounds)) return;
+	
+	CellRange range = GridCellRange(grid, bb);
+	for(int y=range.y0; y<=range.y1; y++){
+		for(int cell=range.x0 + y*grid->cols, end=range.x1 + y*grid->cols; cell<=end; cell++){
+			for(int i=grid->cellStart[cell], i_end=grid->cellStart[cell + 1]; i<i_end; i++){
+				if(cpBBSegmentQuery(grid->bbs[i], a, b) < t_exit) t_exit = cpfmin(t_exit, func(obj, grid->objs[i], data));
+			}
+		}
+	}
+}
+
+//MARK: Reindex
+
+static void
+cpUniformGridReindex(cpUniformGrid *grid)
+{
+	GridBuild(grid);
+}
+
+static void
+cpUniformGridReindexObject(cpUniformGrid *grid, void *obj, cpHashValue hashid)
+{
+	grid->dirty = cpTrue;
+}
+
+// Returns true if object j overlaps the bounds and passes the filter of another object.
+static inline cpBool
+GridPairTest(cpUniformGrid *grid, cpBB bb, cpSpatialIndexFilter filter, int j)
+{
+	return (cpBBIntersects(bb, grid->bbs[j]) && !cpSpatialIndexFilterReject(filter, grid->filters[j]));
+}
+
+// Checks the objects in cell 'a' against the ones in cell 'b'.
+static inline void
+CollideCells(cpUniformGrid *grid, int a, int b, cpSpatialIndexQueryFunc func, void *data)
+{
+	int *cellStart = grid->cellStart;
+	void **objs = grid->objs;
+	
+	for(int i=cellStart[a], i_end=cellStart[a + 1]; i<i_end; i++){
+		cpBB bb = grid->bbs[i];
+		cpSpatialIndexFilter filter = grid->filters[i];
+		for(int j=cellStart[b], j_end=cellStart[b + 1]; j<j_end; j++){
+			if(GridPairTest(grid, bb, filter, j)) func(objs[i], objs[j], 0, data);
+		}
+	}
+}
+
+// Finds the pairs with an object in the rows [start, end).
+// Each cell is checked against itself and the neighbors to its right and above, so every pair of cells is only checked once.
+static void
+CollideRows(cpUniformGrid *grid, int start, int end, cpSpatialIndexQueryFunc func, void *data)
+{
+	int cols = grid->cols, rows = grid->rows;
+	int *cellStart = grid->cellStart;
+	void **objs = grid->objs;
+	
+	for(int y=start; y<end; y++){
+		for(int x=0; x<cols; x++){
+			int cell = x + y*cols;
+			int i_end = cellStart[cell + 1];
+			if(cellStart[cell] == i_end) continue;
+			
+			for(int i=cellStart[cell]; i<i_end; i++){
+				cpBB bb = grid->bbs[i];
+				cpSpatialIndexFilter filter = grid->filters[i];
+				for(int j=i+1; j<i_end; j++){
+					if(GridPairTest(grid, bb, filter, j)) func(objs[i], objs[j], 0, data);
+				}
+			}
+			
+			if(x + 1 < cols) CollideCells(grid, cell, cell + 1, func, data);
+			if(y + 1 < rows){
+				int above = cell + cols;
+				if(x > 0) CollideCells(grid, cell, above - 1, func, data);
+				CollideCells(grid, cell, above, func, data);
+				if(x + 1 < cols) CollideCells(grid, cell, above + 1, func, data);
+			}
+		}
+	}
+}
+
+static void
+GridBandReserve(GridBand *band, int count)
+{
+	if(count <= band->capacity) return;
+	
+	band->capacity = count;
+	band->pairs = (GridPair *)cprealloc(band->pairs, count*sizeof(GridPair));
+}
+
+static cpCollisionID
+PushPair(void *a, void *b, cpCollisionID id, GridBand *band)
+{
+	if(band->count < band->capacity){
+		GridPair pair = {a, b};
+		band->pairs[band->count] = pair;
+	}
+	
+	band->count++;
+	return id;
+}
+
+static void
+CollideBandJob(cpUniformGrid *grid, int i)
+{
+	GridBand *band = grid->bands + i;
+	band->count = 0;
+	
+	int start = i*GRID_ROWS_PER_BAND, end = start + GRID_ROWS_PER_BAND;
+	CollideRows(grid, start, (end < grid->rows ? end : grid->rows), (cpSpatialIndexQueryFunc)PushPair, band);
+}
+
+static void
+cpUniformGridReindexQuery(cpUniformGrid *grid, cpSpatialIndexQueryFunc func, void *data)
+{
+	GridBuild(grid);
+	
+	int bandCount = (grid->rows + GRID_ROWS_PER_BAND - 1)/GRID_ROWS_PER_BAND;
+	if(grid->runner && bandCount > 1){
+		if(bandCount > grid->bandCapacity){
+			int capacity = (bandCount > 2*grid->bandCapacity ? bandCount : 2*grid->bandCapacity);
+			grid->bands = (GridBand *)cprealloc(grid->bands, capacity*sizeof(GridBand));
+			memset(grid->bands + grid->bandCapacity, 0, (capacity - grid->bandCapacity)*sizeof(GridBand));
+			grid->bandCapacity = capacity;
+		}
+		
+		// Leave each band room for twice as many pairs as it found last step.
+		for(int i=0; i<bandCount; i++){
+			GridBand *band = grid->bands + i;
+			GridBandReserve(band, (band->count > 32 ? 2*band->count : 64));
+		}
+		
+		// Find the pairs of each band of rows in parallel, then report them in the same order as the serial loop.
+		grid->runner((void (*)(void *, int))CollideBandJob, grid, bandCount, grid->runnerData);
+		
+		for(int i=0; i<bandCount; i++){
+			GridBand *band = grid->bands + i;
+			if(band->count > band->capacity){
+				GridBandReserve(band, band->count);
+				CollideBandJob(grid, i);
+			}
+			
+			for(int j=0; j<band->count; j++) func(band->pairs[j].a, band->pairs[j].b, 0, data);
+		}
+	} else {
+		CollideRows(grid, 0, grid->rows, func, data);
+	}
+	
+	cpSpatialIndexCollideStaticBuffered((cpSpatialIndex *)grid, grid->spatialIndex.staticIndex, func, data, &grid->staticBuffer);
+}
+
+static cpSpatialIndexClass klass = {
+	(cpSpatialIndexDestroyImpl)cpUniformGridDestroy,
+	
+	(cpSpatialIndexCountImpl)cpUniformGridCount,
+	(cpSpatialIndexEachImpl)cpUniformGridEach,
+	(cpSpatialIndexContainsImpl)cpUniformGridContains,
+	
+	(cpSpatialIndexInsertImpl)cpUniformGridInsert,
+	(cpSpatialIndexRemoveImpl)cpUniformGridRemove,
+	
+	(cpSpatialIndexReindexImpl)cpUniformGridReindex,
+	(cpSpatialIndexReindexObjectImpl)cpUniformGridReindexObject,
+	(cpSpatialIndexReindexQueryImpl)cpUniformGridReindexQuery,
+	
+	(cpSpatialIndexQueryImpl)cpUniformGridQuery,
+	(cpSpatialIndexSegmentQueryImpl)cpUniformGridSegmentQuery,
+};
+
+static inline cpSpatialIndexClass *Klass(){return &klass;}